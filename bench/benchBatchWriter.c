@@ -0,0 +1,201 @@
+/*
+ * Stage burst benchmark of the batch writer. A fake sysfs tree stands in for
+ * the three servo duty cycles and the four LED brightnesses, and every burst
+ * writes all seven attributes as one batch, as a stage transition does. The
+ * time the submitting thread spends in every submission is recorded for
+ * plain pwrite() and for io_uring, along with the time it takes for all the
+ * writes to land.
+ *
+ * Run with '-h' for the options.
+ */
+
+#include "../include/batchWriter.h"
+#include "../include/file.h"
+#include "../include/timing.h"
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MAX_PATH_LEN 128
+#define NUM_ATTRIBUTES 7
+
+// Benchmark definitions
+// ----------------------------------------------------------------------------
+static const char *ATTRIBUTE_NAMES[NUM_ATTRIBUTES] = {
+    "pwm0_duty_cycle", "pwm1_duty_cycle", "pwm2_duty_cycle", "led0_brightness",
+    "led1_brightness", "led2_brightness", "led3_brightness"};
+
+// Values every attribute alternates between, duty cycles first
+static const char *SERVO_VALUES[] = {"1000000", "2000000"};
+static const char *LED_VALUES[] = {"0", "255"};
+#define NUM_SERVO_ATTRIBUTES 3
+
+// Options
+// ----------------------------------------------------------------------------
+static size_t m_numBursts = 10000;
+static char m_treePath[MAX_PATH_LEN] = "/tmp/benchBatchWriter";
+// Time between bursts. Back to back bursts make every write wait for the
+// previous write to the same attribute, which stage transitions never do.
+static int64_t m_burstGapUs = 0;
+
+// Function prototype declarations
+// ----------------------------------------------------------------------------
+static void Bench_getOpts(int argc, char **argv);
+static void Bench_createTree(void);
+static void Bench_removeTree(void);
+static void Bench_run(bool _isRingEnabled);
+static int Bench_compareInt64(const void *_pA, const void *_pB);
+
+// Main
+// ----------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+  Bench_getOpts(argc, argv);
+  Bench_createTree();
+
+  printf("Batches of %d writes to %s, %zu bursts per run, %lld us apart. "
+         "Times in nanoseconds.\n",
+         NUM_ATTRIBUTES, m_treePath, m_numBursts, (long long)m_burstGapUs);
+  Bench_run(false);
+  Bench_run(true);
+
+  Bench_removeTree();
+  return EXIT_SUCCESS;
+}
+
+static void Bench_getOpts(int argc, char **argv)
+{
+  int opt;
+  while ((opt = getopt(argc, argv, "n:d:g:h")) != -1) {
+    switch (opt) {
+    case 'n':
+      m_numBursts = (size_t)atoll(optarg);
+      break;
+    case 'd':
+      snprintf(m_treePath, MAX_PATH_LEN, "%s", optarg);
+      break;
+    case 'g':
+      m_burstGapUs = atoll(optarg);
+      break;
+    case 'h':
+    default:
+      printf("Usage: bench_batch_writer [-n bursts] [-d directory] [-g us]\n"
+             "  -n  bursts per run (default 10000)\n"
+             "  -g  gap between bursts in microseconds (default 0)\n"
+             "  -d  directory the fake sysfs tree is created in (default "
+             "/tmp/benchBatchWriter)\n");
+      exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+  }
+
+  if (m_numBursts == 0) {
+    fprintf(stderr, "At least one burst is needed.\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+// Fake sysfs tree functions
+// ----------------------------------------------------------------------------
+static void Bench_createTree(void)
+{
+  mkdir(m_treePath, 0755);
+
+  char path[MAX_PATH_LEN * 2];
+  for (int i = 0; i < NUM_ATTRIBUTES; i++) {
+    snprintf(path, sizeof(path), "%s/%s", m_treePath, ATTRIBUTE_NAMES[i]);
+    File_writeToFile(path, "0");
+  }
+}
+
+static void Bench_removeTree(void)
+{
+  char path[MAX_PATH_LEN * 2];
+  for (int i = 0; i < NUM_ATTRIBUTES; i++) {
+    snprintf(path, sizeof(path), "%s/%s", m_treePath, ATTRIBUTE_NAMES[i]);
+    remove(path);
+  }
+  rmdir(m_treePath);
+}
+
+// Benchmark functions
+// ----------------------------------------------------------------------------
+static void Bench_run(bool _isRingEnabled)
+{
+  BatchWriter_init(_isRingEnabled);
+
+  int fds[NUM_ATTRIBUTES];
+  int slots[NUM_ATTRIBUTES];
+  char path[MAX_PATH_LEN * 2];
+  for (int i = 0; i < NUM_ATTRIBUTES; i++) {
+    snprintf(path, sizeof(path), "%s/%s", m_treePath, ATTRIBUTE_NAMES[i]);
+    fds[i] = File_openAttribute(path, FILE_ATTRIBUTE_WRITE);
+    if (fds[i] < 0) {
+      fprintf(stderr, "Could not open %s: %s\n", path, strerror(-fds[i]));
+      exit(EXIT_FAILURE);
+    }
+    slots[i] = BatchWriter_registerFd(fds[i]);
+  }
+
+  int64_t *submitTimesNs = malloc(m_numBursts * sizeof(int64_t));
+  int64_t startNs = Timing_getMonotonicTimeNs();
+  for (size_t b = 0; b < m_numBursts; b++) {
+    sBatchWriterBatch batch;
+    BatchWriter_initBatch(&batch);
+    for (int i = 0; i < NUM_ATTRIBUTES; i++) {
+      const char **values = i < NUM_SERVO_ATTRIBUTES ? SERVO_VALUES : LED_VALUES;
+      BatchWriter_add(&batch, slots[i], values[b % 2]);
+    }
+
+    int64_t submitStartNs = Timing_getMonotonicTimeNs();
+    BatchWriter_submit(&batch);
+    submitTimesNs[b] = Timing_getMonotonicTimeNs() - submitStartNs;
+
+    if (m_burstGapUs > 0) {
+      Timing_nanoSleep(0, m_burstGapUs * 1000);
+    }
+  }
+
+  // Unregistering waits for the writes in flight
+  for (int i = 0; i < NUM_ATTRIBUTES; i++) {
+    BatchWriter_unregisterFd(slots[i]);
+  }
+  int64_t totalNs = Timing_getMonotonicTimeNs() - startNs;
+  sBatchWriterStats stats = BatchWriter_getStats();
+  BatchWriter_cleanup();
+  for (int i = 0; i < NUM_ATTRIBUTES; i++) {
+    File_closeAttribute(fds[i]);
+  }
+
+  int64_t totalSubmitNs = 0;
+  for (size_t b = 0; b < m_numBursts; b++) {
+    totalSubmitNs += submitTimesNs[b];
+  }
+  qsort(submitTimesNs, m_numBursts, sizeof(int64_t), &Bench_compareInt64);
+
+  printf("%-9s submit min %6lld  avg %6lld  p99 %6lld  max %7lld  "
+         "elapsed %6lld per burst\n",
+         _isRingEnabled && stats.numRingWrites > 0 ? "io_uring" : "pwrite",
+         (long long)submitTimesNs[0],
+         (long long)(totalSubmitNs / (int64_t)m_numBursts),
+         (long long)submitTimesNs[m_numBursts * 99 / 100],
+         (long long)submitTimesNs[m_numBursts - 1],
+         (long long)(totalNs / (int64_t)m_numBursts));
+  printf("          %llu writes, %llu through io_uring, %llu failed\n",
+         (unsigned long long)stats.numWrites,
+         (unsigned long long)stats.numRingWrites,
+         (unsigned long long)stats.numFailedWrites);
+  free(submitTimesNs);
+}
+
+static int Bench_compareInt64(const void *_pA, const void *_pB)
+{
+  int64_t a = *(const int64_t *)_pA;
+  int64_t b = *(const int64_t *)_pB;
+  return (a > b) - (a < b);
+}
@@ -0,0 +1,169 @@
+/*
+ * Per-access cost benchmark of the two ways the File module reaches sysfs
+ * attributes: the path functions, which open and close a stdio stream on
+ * every access, and attribute handles, which are opened once and accessed
+ * with pwrite()/pread() at offset 0. Both alternate the values an LED
+ * brightness takes, and the time of every access is recorded.
+ *
+ * Run with '-h' for the options.
+ */
+
+#include "../include/file.h"
+#include "../include/timing.h"
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_PATH_LEN 128
+#define VALUE_BUFFER_LEN 16
+
+// Benchmark definitions
+// ----------------------------------------------------------------------------
+typedef enum {
+  METHOD_PATH_WRITE,      // File_writeToFile()
+  METHOD_ATTRIBUTE_WRITE, // File_writeAttribute()
+  METHOD_PATH_READ,       // File_readFromFile()
+  METHOD_ATTRIBUTE_READ,  // File_readAttribute()
+  NUM_METHODS,
+} eMethod;
+
+static const char *METHOD_NAMES[NUM_METHODS] = {
+    "path write", "attribute write", "path read", "attribute read"};
+
+static const char *VALUES[] = {"0", "1"};
+
+// Options
+// ----------------------------------------------------------------------------
+static size_t m_numAccesses = 10000;
+static char m_filePath[MAX_PATH_LEN] = "/tmp/benchFileAttribute";
+static bool m_isFileCreated = false;
+
+// Function prototype declarations
+// ----------------------------------------------------------------------------
+static void Bench_getOpts(int argc, char **argv);
+static void Bench_run(eMethod _method);
+static void Bench_printResults(int64_t *_pTimesNs, eMethod _method);
+static int Bench_compareInt64(const void *_pA, const void *_pB);
+
+// Main
+// ----------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+  Bench_getOpts(argc, argv);
+
+  // The default file stands in for an attribute when there is no sysfs
+  if (access(m_filePath, F_OK) != 0) {
+    File_writeToFile(m_filePath, VALUES[0]);
+    m_isFileCreated = true;
+  }
+
+  printf("Time per access of %s in nanoseconds, %zu accesses per method.\n",
+         m_filePath, m_numAccesses);
+  for (int m = 0; m < NUM_METHODS; m++) {
+    Bench_run(m);
+  }
+
+  if (m_isFileCreated) {
+    remove(m_filePath);
+  }
+  return EXIT_SUCCESS;
+}
+
+static void Bench_getOpts(int argc, char **argv)
+{
+  int opt;
+  while ((opt = getopt(argc, argv, "n:f:h")) != -1) {
+    switch (opt) {
+    case 'n':
+      m_numAccesses = (size_t)atoll(optarg);
+      break;
+    case 'f':
+      snprintf(m_filePath, MAX_PATH_LEN, "%s", optarg);
+      break;
+    case 'h':
+    default:
+      printf("Usage: bench_file [-n accesses] [-f path]\n"
+             "  -n  accesses per method (default 10000)\n"
+             "  -f  attribute to access, e.g. an LED brightness (default a "
+             "file in /tmp)\n");
+      exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+  }
+
+  if (m_numAccesses == 0) {
+    fprintf(stderr, "At least one access is needed.\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+// Benchmark functions
+// ----------------------------------------------------------------------------
+static void Bench_run(eMethod _method)
+{
+  int64_t *timesNs = malloc(m_numAccesses * sizeof(int64_t));
+  char buffer[VALUE_BUFFER_LEN];
+
+  int attributeFd = -1;
+  if (_method == METHOD_ATTRIBUTE_WRITE || _method == METHOD_ATTRIBUTE_READ) {
+    attributeFd = File_openAttribute(m_filePath, FILE_ATTRIBUTE_READ |
+                                                     FILE_ATTRIBUTE_WRITE);
+    if (attributeFd < 0) {
+      fprintf(stderr, "Could not open %s: %s\n", m_filePath,
+              strerror(-attributeFd));
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  for (size_t i = 0; i < m_numAccesses; i++) {
+    const char *value = VALUES[i % 2];
+    int64_t startNs = Timing_getMonotonicTimeNs();
+    switch (_method) {
+    case METHOD_PATH_WRITE:
+      File_writeToFile(m_filePath, value);
+      break;
+    case METHOD_ATTRIBUTE_WRITE:
+      File_writeAttribute(attributeFd, value);
+      break;
+    case METHOD_PATH_READ:
+      File_readFromFile(m_filePath, buffer, VALUE_BUFFER_LEN);
+      break;
+    case METHOD_ATTRIBUTE_READ:
+      File_readAttribute(attributeFd, buffer, VALUE_BUFFER_LEN);
+      break;
+    default:
+      break;
+    }
+    timesNs[i] = Timing_getMonotonicTimeNs() - startNs;
+  }
+
+  File_closeAttribute(attributeFd);
+  Bench_printResults(timesNs, _method);
+  free(timesNs);
+}
+
+static void Bench_printResults(int64_t *_pTimesNs, eMethod _method)
+{
+  int64_t totalNs = 0;
+  for (size_t i = 0; i < m_numAccesses; i++) {
+    totalNs += _pTimesNs[i];
+  }
+
+  qsort(_pTimesNs, m_numAccesses, sizeof(int64_t), &Bench_compareInt64);
+  printf("%-16s min %7lld  avg %7lld  p99 %7lld  max %8lld\n",
+         METHOD_NAMES[_method], (long long)_pTimesNs[0],
+         (long long)(totalNs / (int64_t)m_numAccesses),
+         (long long)_pTimesNs[m_numAccesses * 99 / 100],
+         (long long)_pTimesNs[m_numAccesses - 1]);
+}
+
+static int Bench_compareInt64(const void *_pA, const void *_pB)
+{
+  int64_t a = *(const int64_t *)_pA;
+  int64_t b = *(const int64_t *)_pB;
+  return (a > b) - (a < b);
+}
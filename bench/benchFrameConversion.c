@@ -0,0 +1,242 @@
+/*
+ * Bulk frame conversion benchmark. A buffer of raw color sensor frames, with
+ * random counts along with dark, saturated and clear-less frames, is converted
+ * by the portable scalar reference and by ColorSensor_convertFrames(), which
+ * runs the NEON kernel on NEON targets. Every output of both is compared bit
+ * for bit, and the frames converted per second are reported for each.
+ *
+ * Run with '-h' for the options.
+ */
+
+#include "../include/colorSensor.h"
+#include "../include/timing.h"
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_CHANNELS 4
+
+// Options
+// ----------------------------------------------------------------------------
+static size_t m_numFrames = 100000;
+static size_t m_numRuns = 20;
+static eColorSensorIntegration m_integration = COLOR_SENSOR_INTEGRATION_FULL;
+
+// Function prototype declarations
+// ----------------------------------------------------------------------------
+static void Bench_getOpts(int argc, char **argv);
+static uint32_t Bench_getRandom(uint32_t *_pState);
+static void Bench_fillFrames(uint8_t *_pFrames);
+static void Bench_allocateArrays(sColorSensorFrameArrays *_pArrays);
+static void Bench_freeArrays(sColorSensorFrameArrays *_pArrays);
+static size_t Bench_countMismatches(const sColorSensorFrameArrays *_pExpected,
+                                    const sColorSensorFrameArrays *_pActual);
+static int64_t Bench_run(const char *_pName, const uint8_t *_pFrames,
+                         bool _isReference,
+                         const sColorSensorFrameArrays *_pArrays);
+
+// Main
+// ----------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+  Bench_getOpts(argc, argv);
+
+  uint8_t *frames = malloc(m_numFrames * COLOR_SENSOR_FRAME_NUM_BYTES);
+  if (frames == NULL) {
+    perror("Could not allocate the frames");
+    exit(EXIT_FAILURE);
+  }
+  Bench_fillFrames(frames);
+
+  sColorSensorFrameArrays reference;
+  sColorSensorFrameArrays converted;
+  Bench_allocateArrays(&reference);
+  Bench_allocateArrays(&converted);
+
+#ifdef __ARM_NEON
+  const char *kernelName = "NEON";
+#else
+  const char *kernelName = "default";
+#endif
+  printf("%zu frames per run, %zu runs, %s integration.\n", m_numFrames,
+         m_numRuns,
+         m_integration == COLOR_SENSOR_INTEGRATION_SHORT ? "short" : "full");
+  int64_t referenceNs = Bench_run("scalar", frames, true, &reference);
+  int64_t convertedNs = Bench_run(kernelName, frames, false, &converted);
+  printf("Speedup: %.2fx\n", (double)referenceNs / convertedNs);
+
+  size_t numMismatches = Bench_countMismatches(&reference, &converted);
+  printf("%zu frames differ from the scalar reference.\n", numMismatches);
+
+  Bench_freeArrays(&reference);
+  Bench_freeArrays(&converted);
+  free(frames);
+  return numMismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static void Bench_getOpts(int argc, char **argv)
+{
+  int opt;
+  while ((opt = getopt(argc, argv, "n:r:sh")) != -1) {
+    switch (opt) {
+    case 'n':
+      m_numFrames = (size_t)atoll(optarg);
+      break;
+    case 'r':
+      m_numRuns = (size_t)atoll(optarg);
+      break;
+    case 's':
+      m_integration = COLOR_SENSOR_INTEGRATION_SHORT;
+      break;
+    case 'h':
+    default:
+      printf("Usage: bench_frame_conversion [-n frames] [-r runs] [-s]\n"
+             "  -n  frames per run (default 100000)\n"
+             "  -r  runs per conversion (default 20)\n"
+             "  -s  convert the frames as short-integration frames\n");
+      exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+  }
+
+  if (m_numFrames == 0 || m_numRuns == 0) {
+    fprintf(stderr, "At least one frame and one run are needed.\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+// Frame functions
+// ----------------------------------------------------------------------------
+// xorshift32, so that every run converts the same frames
+static uint32_t Bench_getRandom(uint32_t *_pState)
+{
+  uint32_t x = *_pState;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *_pState = x;
+  return x;
+}
+
+// Mostly random counts, with the edge cases of the conversion mixed in
+static void Bench_fillFrames(uint8_t *_pFrames)
+{
+  uint32_t state = 0x433;
+  for (size_t i = 0; i < m_numFrames; i++) {
+    uint8_t *frame = _pFrames + i * COLOR_SENSOR_FRAME_NUM_BYTES;
+    for (int j = 0; j < NUM_CHANNELS; j++) {
+      uint32_t random = Bench_getRandom(&state);
+      uint16_t count;
+      switch (random % 8) {
+      case 0:
+        count = 0;
+        break;
+      case 1:
+        count = UINT16_MAX;
+        break;
+      case 2:
+        count = (random >> 8) % 64;
+        break;
+      default:
+        count = random >> 16;
+        break;
+      }
+      frame[j * 2] = count & 0xFF;
+      frame[j * 2 + 1] = count >> 8;
+    }
+  }
+}
+
+static void Bench_allocateArrays(sColorSensorFrameArrays *_pArrays)
+{
+  _pArrays->pRed = malloc(m_numFrames * sizeof(uint16_t));
+  _pArrays->pGreen = malloc(m_numFrames * sizeof(uint16_t));
+  _pArrays->pBlue = malloc(m_numFrames * sizeof(uint16_t));
+  _pArrays->pClear = malloc(m_numFrames * sizeof(uint16_t));
+  _pArrays->pMilliLux = malloc(m_numFrames * sizeof(int32_t));
+  _pArrays->pRedChromaticity = malloc(m_numFrames * sizeof(uint32_t));
+  _pArrays->pGreenChromaticity = malloc(m_numFrames * sizeof(uint32_t));
+  _pArrays->pBlueChromaticity = malloc(m_numFrames * sizeof(uint32_t));
+  if (_pArrays->pRed == NULL || _pArrays->pGreen == NULL ||
+      _pArrays->pBlue == NULL || _pArrays->pClear == NULL ||
+      _pArrays->pMilliLux == NULL || _pArrays->pRedChromaticity == NULL ||
+      _pArrays->pGreenChromaticity == NULL ||
+      _pArrays->pBlueChromaticity == NULL) {
+    perror("Could not allocate the converted frames");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void Bench_freeArrays(sColorSensorFrameArrays *_pArrays)
+{
+  free(_pArrays->pRed);
+  free(_pArrays->pGreen);
+  free(_pArrays->pBlue);
+  free(_pArrays->pClear);
+  free(_pArrays->pMilliLux);
+  free(_pArrays->pRedChromaticity);
+  free(_pArrays->pGreenChromaticity);
+  free(_pArrays->pBlueChromaticity);
+}
+
+static size_t Bench_countMismatches(const sColorSensorFrameArrays *_pExpected,
+                                    const sColorSensorFrameArrays *_pActual)
+{
+  size_t numMismatches = 0;
+  for (size_t i = 0; i < m_numFrames; i++) {
+    if (_pExpected->pRed[i] != _pActual->pRed[i] ||
+        _pExpected->pGreen[i] != _pActual->pGreen[i] ||
+        _pExpected->pBlue[i] != _pActual->pBlue[i] ||
+        _pExpected->pClear[i] != _pActual->pClear[i] ||
+        _pExpected->pMilliLux[i] != _pActual->pMilliLux[i] ||
+        _pExpected->pRedChromaticity[i] != _pActual->pRedChromaticity[i] ||
+        _pExpected->pGreenChromaticity[i] !=
+            _pActual->pGreenChromaticity[i] ||
+        _pExpected->pBlueChromaticity[i] != _pActual->pBlueChromaticity[i]) {
+      if (numMismatches == 0) {
+        printf("First mismatch at frame %zu: %d mlux, expected %d mlux\n", i,
+               _pActual->pMilliLux[i], _pExpected->pMilliLux[i]);
+      }
+      numMismatches++;
+    }
+  }
+
+  return numMismatches;
+}
+
+// Benchmark functions
+// ----------------------------------------------------------------------------
+// Returns the fastest run, which is the least disturbed by the rest of the
+// system
+static int64_t Bench_run(const char *_pName, const uint8_t *_pFrames,
+                         bool _isReference,
+                         const sColorSensorFrameArrays *_pArrays)
+{
+  int64_t minNs = INT64_MAX;
+  int64_t totalNs = 0;
+  for (size_t r = 0; r < m_numRuns; r++) {
+    int64_t startNs = Timing_getMonotonicTimeNs();
+    if (_isReference) {
+      ColorSensor_convertFramesScalar(_pFrames, m_numFrames, m_integration,
+                                      _pArrays);
+    }
+    else {
+      ColorSensor_convertFrames(_pFrames, m_numFrames, m_integration,
+                                _pArrays);
+    }
+    int64_t elapsedNs = Timing_getMonotonicTimeNs() - startNs;
+
+    totalNs += elapsedNs;
+    if (elapsedNs < minNs) {
+      minNs = elapsedNs;
+    }
+  }
+
+  printf("%-8s min %9lld ns  avg %9lld ns  %12.0f frames/s\n", _pName,
+         (long long)minNs, (long long)(totalNs / (int64_t)m_numRuns),
+         (double)m_numFrames * 1e9 / minNs);
+  return minNs;
+}
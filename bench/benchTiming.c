@@ -0,0 +1,374 @@
+/*
+ * Wakeup latency benchmark for the timing backends the recycler may use, in
+ * the spirit of cyclictest. A thread wakes up periodically at the intervals
+ * the recycler uses (lights at 125/250/500 ms, detection polls at 150 ms), and
+ * the difference between when it asked to wake up and when it did is recorded
+ * for every combination of sleep mechanism and clock, optionally while other
+ * threads load the I2C bus and sysfs like the recycler does.
+ *
+ * Run with '-h' for the options.
+ */
+
+// CLOCK_BOOTTIME is a Linux extension
+#define _GNU_SOURCE
+
+#include "../include/file.h"
+#include "../include/i2cBus.h"
+#include "../include/realtime.h"
+#include "../include/timing.h"
+
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NUM_HISTOGRAM_BUCKETS 18
+#define MAX_PATH_LEN 128
+
+// Benchmark definitions
+// ----------------------------------------------------------------------------
+static const int64_t PERIODS_MS[] = {125, 150, 250, 500};
+#define NUM_PERIODS (sizeof(PERIODS_MS) / sizeof(PERIODS_MS[0]))
+
+typedef enum {
+  MECHANISM_RELATIVE_SLEEP, // Timing_nanoSleep() from the end of each cycle
+  MECHANISM_ABSOLUTE_SLEEP, // clock_nanosleep() to absolute deadlines
+  MECHANISM_TIMERFD,        // Periodic timerfd
+  MECHANISM_POLL,           // poll() timeout, as the actuator waits
+  NUM_MECHANISMS,
+} eMechanism;
+
+static const char *MECHANISM_NAMES[NUM_MECHANISMS] = {"relative", "absolute",
+                                                      "timerfd", "poll"};
+
+typedef struct {
+  const char *name;
+  clockid_t id;
+} sClock;
+
+static const sClock CLOCKS[] = {{"monotonic", CLOCK_MONOTONIC},
+                                {"realtime", CLOCK_REALTIME},
+                                {"boottime", CLOCK_BOOTTIME}};
+#define NUM_CLOCKS (sizeof(CLOCKS) / sizeof(CLOCKS[0]))
+
+// Options
+// ----------------------------------------------------------------------------
+static int64_t m_runDurationMs = 10000;
+static int64_t m_onlyPeriodMs = -1;
+static int m_onlyMechanism = -1;
+static bool m_isLoadEnabled = false;
+static int32_t m_loadI2cBusNumber = -1;
+static char m_loadSysfsPath[MAX_PATH_LEN] =
+    FILE_LED_PATH "0" FILE_LED_BRIGHTNESS;
+static bool m_isRealtimeEnabled = false;
+
+// Synthetic load
+// ----------------------------------------------------------------------------
+// Color sensor address and the register block the recycler reads every frame
+static const int32_t LOAD_I2C_DEVICE_ADDRESS = 0x29;
+static const uint8_t LOAD_I2C_REGISTER_ADDRESS = 0x94;
+static const size_t LOAD_I2C_NUM_BYTES = 8;
+
+static bool m_isLoadRunning;
+static pthread_t m_i2cLoadThread;
+static pthread_t m_sysfsLoadThread;
+
+// Function prototype declarations
+// ----------------------------------------------------------------------------
+static void Bench_getOpts(int argc, char **argv);
+static void Bench_runAll(bool _isLoaded);
+static void Bench_run(int64_t _periodMs, eMechanism _mechanism,
+                      const sClock *_pClock, bool _isLoaded);
+static int64_t Bench_getTimeNs(clockid_t _clock);
+static void Bench_printResults(int64_t *_pLatenciesNs, size_t _numSamples,
+                               int64_t _driftNs, int64_t _periodMs,
+                               eMechanism _mechanism, const sClock *_pClock,
+                               bool _isLoaded);
+static int Bench_compareInt64(const void *_pA, const void *_pB);
+static void Bench_startLoad(void);
+static void Bench_stopLoad(void);
+static void *Bench_i2cLoadThreadFunction(void *_args);
+static void *Bench_sysfsLoadThreadFunction(void *_args);
+
+// Main
+// ----------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+  Bench_getOpts(argc, argv);
+  Realtime_init(m_isRealtimeEnabled);
+
+  printf("Wakeup latency in microseconds, %lld ms per run, %s scheduling.\n",
+         (long long)m_runDurationMs,
+         m_isRealtimeEnabled ? "real-time" : "default");
+  printf("Histogram buckets are [2^(n-1), 2^n) us, bucket 0 is < 1 us.\n");
+
+  Bench_runAll(false);
+  if (m_isLoadEnabled) {
+    Bench_startLoad();
+    Bench_runAll(true);
+    Bench_stopLoad();
+  }
+
+  Realtime_cleanup();
+  return EXIT_SUCCESS;
+}
+
+static void Bench_getOpts(int argc, char **argv)
+{
+  int opt;
+  while ((opt = getopt(argc, argv, "d:p:m:li:f:rh")) != -1) {
+    switch (opt) {
+    case 'd':
+      m_runDurationMs = atoll(optarg) * 1000;
+      break;
+    case 'p':
+      m_onlyPeriodMs = atoll(optarg);
+      break;
+    case 'm':
+      for (int i = 0; i < NUM_MECHANISMS; i++) {
+        if (strcmp(optarg, MECHANISM_NAMES[i]) == 0) {
+          m_onlyMechanism = i;
+        }
+      }
+      if (m_onlyMechanism < 0) {
+        fprintf(stderr, "Unknown mechanism %s.\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'l':
+      m_isLoadEnabled = true;
+      break;
+    case 'i':
+      m_loadI2cBusNumber = atoi(optarg);
+      break;
+    case 'f':
+      snprintf(m_loadSysfsPath, MAX_PATH_LEN, "%s", optarg);
+      break;
+    case 'r':
+      m_isRealtimeEnabled = true;
+      break;
+    case 'h':
+    default:
+      printf("Usage: bench_timing [-d seconds] [-p period_ms] [-m mechanism] "
+             "[-l] [-i bus] [-f path] [-r]\n"
+             "  -d  duration of every run (default 10 s)\n"
+             "  -p  only run this period (default 125, 150, 250 and 500 ms)\n"
+             "  -m  only run this mechanism: relative, absolute, timerfd or "
+             "poll\n"
+             "  -l  repeat every run under synthetic load\n"
+             "  -i  load the color sensor on this I2C bus\n"
+             "  -f  load this sysfs file with writes (default LED 0 "
+             "brightness)\n"
+             "  -r  use the real-time scheduling profile (needs root)\n");
+      exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+  }
+}
+
+// Benchmark functions
+// ----------------------------------------------------------------------------
+static void Bench_runAll(bool _isLoaded)
+{
+  for (size_t p = 0; p < NUM_PERIODS; p++) {
+    if (m_onlyPeriodMs >= 0 && PERIODS_MS[p] != m_onlyPeriodMs) {
+      continue;
+    }
+
+    for (int m = 0; m < NUM_MECHANISMS; m++) {
+      if (m_onlyMechanism >= 0 && m != m_onlyMechanism) {
+        continue;
+      }
+
+      // Relative sleeps and poll timeouts always run on the monotonic clock
+      size_t numClocks =
+          m == MECHANISM_RELATIVE_SLEEP || m == MECHANISM_POLL ? 1 : NUM_CLOCKS;
+      for (size_t c = 0; c < numClocks; c++) {
+        Bench_run(PERIODS_MS[p], m, &CLOCKS[c], _isLoaded);
+      }
+    }
+  }
+}
+
+static void Bench_run(int64_t _periodMs, eMechanism _mechanism,
+                      const sClock *_pClock, bool _isLoaded)
+{
+  int64_t periodNs = _periodMs * 1000000;
+  size_t maxSamples = m_runDurationMs / _periodMs + 1;
+  int64_t *latenciesNs = malloc(maxSamples * sizeof(int64_t));
+  if (latenciesNs == NULL) {
+    perror("Bench: Unable to allocate samples");
+    exit(EXIT_FAILURE);
+  }
+
+  int timerFd = -1;
+  int64_t startNs = Bench_getTimeNs(_pClock->id);
+  if (_mechanism == MECHANISM_TIMERFD) {
+    timerFd = timerfd_create(_pClock->id, 0);
+    if (timerFd < 0) {
+      perror("Bench: Unable to create timerfd");
+      exit(EXIT_FAILURE);
+    }
+
+    struct itimerspec spec;
+    spec.it_interval.tv_sec = periodNs / 1000000000;
+    spec.it_interval.tv_nsec = periodNs % 1000000000;
+    spec.it_value.tv_sec = (startNs + periodNs) / 1000000000;
+    spec.it_value.tv_nsec = (startNs + periodNs) % 1000000000;
+    timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &spec, NULL);
+  }
+
+  size_t numSamples = 0;
+  int64_t expectedNs = startNs;
+  while (numSamples < maxSamples - 1) {
+    switch (_mechanism) {
+    case MECHANISM_RELATIVE_SLEEP:
+      expectedNs = Bench_getTimeNs(_pClock->id) + periodNs;
+      Timing_nanoSleep(0, periodNs);
+      break;
+    case MECHANISM_ABSOLUTE_SLEEP: {
+      expectedNs += periodNs;
+      struct timespec deadline = {expectedNs / 1000000000,
+                                  expectedNs % 1000000000};
+      clock_nanosleep(_pClock->id, TIMER_ABSTIME, &deadline, NULL);
+      break;
+    }
+    case MECHANISM_TIMERFD: {
+      // Overruns are charged to the wakeup that was late
+      uint64_t expirations;
+      read(timerFd, &expirations, sizeof(expirations));
+      expectedNs += periodNs;
+      break;
+    }
+    case MECHANISM_POLL:
+      expectedNs = Bench_getTimeNs(_pClock->id) + periodNs;
+      poll(NULL, 0, (int)_periodMs);
+      break;
+    default:
+      break;
+    }
+
+    latenciesNs[numSamples++] = Bench_getTimeNs(_pClock->id) - expectedNs;
+  }
+
+  // How far behind the ideal schedule the last wakeup was. Relative sleeps and
+  // poll timeouts accumulate every latency; absolute deadlines do not.
+  int64_t driftNs =
+      Bench_getTimeNs(_pClock->id) - startNs - (int64_t)numSamples * periodNs;
+
+  if (timerFd >= 0) {
+    close(timerFd);
+  }
+
+  Bench_printResults(latenciesNs, numSamples, driftNs, _periodMs, _mechanism,
+                     _pClock, _isLoaded);
+  free(latenciesNs);
+}
+
+static int64_t Bench_getTimeNs(clockid_t _clock)
+{
+  struct timespec now;
+  clock_gettime(_clock, &now);
+  return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void Bench_printResults(int64_t *_pLatenciesNs, size_t _numSamples,
+                               int64_t _driftNs, int64_t _periodMs,
+                               eMechanism _mechanism, const sClock *_pClock,
+                               bool _isLoaded)
+{
+  qsort(_pLatenciesNs, _numSamples, sizeof(int64_t), &Bench_compareInt64);
+
+  int64_t totalNs = 0;
+  uint32_t histogram[NUM_HISTOGRAM_BUCKETS] = {0};
+  for (size_t i = 0; i < _numSamples; i++) {
+    totalNs += _pLatenciesNs[i];
+
+    int64_t latencyUs = _pLatenciesNs[i] / 1000;
+    int bucket = 0;
+    while (bucket < NUM_HISTOGRAM_BUCKETS - 1 && latencyUs >= (1LL << bucket)) {
+      bucket++;
+    }
+    histogram[bucket]++;
+  }
+
+  printf("\n%3lld ms %-8s %-9s %-7s n=%-4zu min %lld avg %lld p99 %lld max "
+         "%lld drift %lld\n  ",
+         (long long)_periodMs, MECHANISM_NAMES[_mechanism], _pClock->name,
+         _isLoaded ? "loaded" : "idle", _numSamples,
+         (long long)(_pLatenciesNs[0] / 1000),
+         (long long)(totalNs / (int64_t)_numSamples / 1000),
+         (long long)(_pLatenciesNs[_numSamples * 99 / 100] / 1000),
+         (long long)(_pLatenciesNs[_numSamples - 1] / 1000),
+         (long long)(_driftNs / 1000));
+  for (int i = 0; i < NUM_HISTOGRAM_BUCKETS; i++) {
+    printf("%u ", histogram[i]);
+  }
+  printf("\n");
+}
+
+static int Bench_compareInt64(const void *_pA, const void *_pB)
+{
+  int64_t a = *(const int64_t *)_pA;
+  int64_t b = *(const int64_t *)_pB;
+  return (a > b) - (a < b);
+}
+
+// Load functions
+// ----------------------------------------------------------------------------
+static void Bench_startLoad(void)
+{
+  __atomic_store_n(&m_isLoadRunning, true, __ATOMIC_RELEASE);
+  if (m_loadI2cBusNumber >= 0) {
+    pthread_create(&m_i2cLoadThread, NULL, &Bench_i2cLoadThreadFunction, NULL);
+  }
+  pthread_create(&m_sysfsLoadThread, NULL, &Bench_sysfsLoadThreadFunction,
+                 NULL);
+}
+
+static void Bench_stopLoad(void)
+{
+  __atomic_store_n(&m_isLoadRunning, false, __ATOMIC_RELEASE);
+  if (m_loadI2cBusNumber >= 0) {
+    pthread_join(m_i2cLoadThread, NULL);
+  }
+  pthread_join(m_sysfsLoadThread, NULL);
+}
+
+// Reads the color sensor data registers back to back, at the priority of
+// diagnostics
+static void *Bench_i2cLoadThreadFunction(void *_args)
+{
+  sI2cBusDevice device;
+  I2cBus_openDevice(&device, m_loadI2cBusNumber, LOAD_I2C_DEVICE_ADDRESS,
+                    I2C_BUS_NO_MUX, 0);
+  uint8_t buffer[LOAD_I2C_NUM_BYTES];
+  sI2cBusTransaction transaction;
+  I2cBus_initTransaction(&transaction);
+  I2cBus_addReadReg(&transaction, LOAD_I2C_REGISTER_ADDRESS, buffer,
+                    LOAD_I2C_NUM_BYTES);
+  while (__atomic_load_n(&m_isLoadRunning, __ATOMIC_ACQUIRE)) {
+    I2cBus_execute(&device, I2C_BUS_PRIORITY_DIAGNOSTICS, &transaction);
+  }
+
+  I2cBus_closeDevice(&device);
+  return NULL;
+}
+
+// Writes the sysfs file back to back, the way the LED module does
+static void *Bench_sysfsLoadThreadFunction(void *_args)
+{
+  bool isOn = false;
+  while (__atomic_load_n(&m_isLoadRunning, __ATOMIC_ACQUIRE)) {
+    File_writeToFile(m_loadSysfsPath, isOn ? "1" : "0");
+    isOn = !isOn;
+  }
+
+  return NULL;
+}
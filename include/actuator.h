@@ -0,0 +1,134 @@
+/*
+ * The actuator module moves the servos from a dedicated service thread, so
+ * that the stage logic does not block on servo travel. Commands are handed to
+ * the service thread through a lock-free single-producer single-consumer
+ * queue. Commands to different servos travel in parallel, while commands to the
+ * same servo are carried out in the order they were submitted.
+ *
+ * Every command returns a completion token that may be polled, waited on, or
+ * combined with other tokens. NOTE: commands to an actuator must all be
+ * submitted from the same thread.
+ *
+ * Every actuator drives its own servo bank, so each station has one.
+ */
+
+#ifndef _ACTUATOR_H_
+#define _ACTUATOR_H_
+
+#include "servo.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define ACTUATOR_QUEUE_SIZE 16 // Must be a power of two
+
+// Type definitions
+// ----------------------------------------------------------------------------
+
+// Completion token. Holds, for every servo, the sequence number of the command
+// that must be completed on that servo (0 if none). A zeroed token is always
+// complete.
+typedef struct {
+  uint64_t sequences[SERVO_NUM_SERVOS];
+} sActuatorToken;
+
+typedef struct {
+  int servoIndex;
+  char dutyCycle[SERVO_DUTY_CYCLE_LEN];
+  int64_t travelTimeMs;
+  uint64_t sequence;
+} sActuatorCommand;
+
+// Commands of a single servo, within the service thread
+typedef struct {
+  sActuatorCommand pending[ACTUATOR_QUEUE_SIZE];
+  uint32_t pendingHead;
+  uint32_t pendingTail;
+  bool isMoving;
+  uint64_t movingSequence;
+  int64_t doneTimeMs;
+} sActuatorChannel;
+
+// The fields are private to the module
+typedef struct {
+  sServoBank *pServoBank;
+  // Offset added to the CPU of the service thread
+  int cpuOffset;
+
+  // Lock-free SPSC queue. The head is only written by the submitting thread and
+  // the tail only by the service thread.
+  sActuatorCommand commandQueue[ACTUATOR_QUEUE_SIZE];
+  uint32_t queueHead;
+  uint32_t queueTail;
+
+  // Submitting thread state
+  char submittedDutyCycles[SERVO_NUM_SERVOS][SERVO_DUTY_CYCLE_LEN];
+  bool hasSubmitted[SERVO_NUM_SERVOS];
+  uint64_t lastSubmittedSequences[SERVO_NUM_SERVOS];
+
+  // Completion state. Commands to a servo complete in order, so the sequence
+  // number of the last completed command is enough to tell whether any
+  // command has completed.
+  uint64_t completedSequences[SERVO_NUM_SERVOS];
+  pthread_mutex_t completionMutex;
+  pthread_cond_t completionCond;
+  // Signalled on every completion, for threads that wait in an event loop
+  int completionFd;
+
+  // Service thread state
+  sActuatorChannel channels[SERVO_NUM_SERVOS];
+  pthread_t serviceThread;
+  int wakeupFd;
+  bool isRunning;
+} sActuator;
+
+// Token that is always complete.
+extern const sActuatorToken ACTUATOR_TOKEN_COMPLETE;
+
+// Initialization/Termination functions
+// ----------------------------------------------------------------------------
+/* Starts the service thread of an actuator that drives _pServoBank, on the CPU
+ * of its realtime role plus _cpuOffset. Servo_init() must be called on the bank
+ * before. */
+void Actuator_init(sActuator *_pActuator, sServoBank *_pServoBank,
+                   int _cpuOffset);
+
+// Waits for every submitted command to complete, then stops the service thread.
+void Actuator_cleanup(sActuator *_pActuator);
+
+// Command functions
+// ----------------------------------------------------------------------------
+/* Submits a command to move the servo at _servoIndex to _dutyCycle and give it
+ * _travelTimeMs to get there. If the last command submitted to the servo was
+ * already to _dutyCycle, nothing is queued and the token of that command is
+ * returned instead. Blocks only if the command queue is full. */
+sActuatorToken Actuator_submit(sActuator *_pActuator, int _servoIndex,
+                               const char *_dutyCycle, int64_t _travelTimeMs);
+
+// Returns true if the last command submitted to the servo at _servoIndex was
+// to _dutyCycle. The command may still be in progress.
+bool Actuator_isSubmittedTo(const sActuator *_pActuator, int _servoIndex,
+                            const char *_dutyCycle);
+
+// Returns the servo bank the actuator drives.
+sServoBank *Actuator_getServoBank(sActuator *_pActuator);
+
+// Token functions
+// ----------------------------------------------------------------------------
+// Returns a token that is complete once both _token1 and _token2 are.
+sActuatorToken Actuator_combineTokens(sActuatorToken _token1,
+                                      sActuatorToken _token2);
+
+bool Actuator_isComplete(sActuator *_pActuator, sActuatorToken _token);
+
+// Blocks until the commands referred to by _token have completed.
+void Actuator_wait(sActuator *_pActuator, sActuatorToken _token);
+
+/* Returns a non-blocking eventfd that becomes readable whenever a command
+ * completes, so that event loops can wait for tokens alongside other events.
+ * The reader must read the eventfd to reset it, then check its tokens with
+ * Actuator_isComplete(). */
+int Actuator_getCompletionFd(const sActuator *_pActuator);
+
+#endif
@@ -0,0 +1,88 @@
+/*
+ * The ambient monitor module watches the luminance of the frames read while
+ * the ramp is empty, to tell when the ambient light has moved away from the
+ * baseline that object detection was calibrated against. Detection can then
+ * be recalibrated from frames already read, between items, without stopping
+ * to take calibration readings.
+ *
+ * A sustained shift is flagged once an exponentially weighted moving average
+ * of the empty-ramp luminance has stayed away from the baseline for a few
+ * seconds. Brief disturbances, such as an item rolling past, do not last that
+ * long. A burst of false triggers, threshold crossings that turned out not to
+ * be an item, is flagged as well, as it means the baseline sits too close to
+ * the threshold for the current lighting.
+ */
+
+#ifndef _AMBIENT_MONITOR_H_
+#define _AMBIENT_MONITOR_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define AMBIENT_MONITOR_BURST_LEN 3
+
+typedef struct {
+  uint64_t numEmptyFrames;
+  // Threshold crossings that were not confirmed as an item, each a phantom
+  // sorting cycle prevented
+  uint32_t numFalseTriggers;
+  // Recalibrations for a sustained shift, and for a burst of false triggers
+  uint32_t numShiftRecalibrations;
+  uint32_t numBurstRecalibrations;
+} sAmbientMonitorStats;
+
+// The fields are private to the module
+typedef struct {
+  int32_t baselineLuminance;
+  int32_t shiftLuminance;
+  sAmbientMonitorStats stats;
+
+  // Moving average of the empty-ramp luminance, in Q8, and the time since
+  // which it has been a shift away from the baseline
+  int64_t averageLuminanceQ8;
+  bool isShifted;
+  int64_t shiftStartTimeMs;
+
+  // Times of the latest false triggers, oldest first
+  int64_t falseTriggerTimesMs[AMBIENT_MONITOR_BURST_LEN];
+  uint32_t numRecentFalseTriggers;
+} sAmbientMonitor;
+
+// Initialization/Termination functions
+// ----------------------------------------------------------------------------
+// Monitors the ambient light against _baselineLuminance. Departures of the
+// average of at least _shiftLuminance are sustained shifts.
+void AmbientMonitor_init(sAmbientMonitor *_pMonitor,
+                         int32_t _baselineLuminance, int32_t _shiftLuminance);
+void AmbientMonitor_cleanup(sAmbientMonitor *_pMonitor);
+
+// Monitoring functions
+// ----------------------------------------------------------------------------
+// Restarts monitoring against a new baseline, e.g. after a recalibration
+void AmbientMonitor_setBaseline(sAmbientMonitor *_pMonitor,
+                                int32_t _baselineLuminance);
+
+/* Records the luminance of a frame of the empty ramp, read at monotonic time
+ * _timeMs. Returns true if the ambient light has shifted for long enough that
+ * the baseline should be moved to AmbientMonitor_getAmbientLuminance(). */
+bool AmbientMonitor_recordEmptyFrame(sAmbientMonitor *_pMonitor,
+                                     int32_t _luminance, int64_t _timeMs);
+
+// Records that an item has arrived, so that the frames of its approach do not
+// count toward a shift
+void AmbientMonitor_recordItem(sAmbientMonitor *_pMonitor);
+
+/* Records a threshold crossing that was not confirmed as an item, at
+ * monotonic time _timeMs. Returns true if it completes a burst of false
+ * triggers, after which the baseline should be moved to
+ * AmbientMonitor_getAmbientLuminance(). */
+bool AmbientMonitor_recordFalseTrigger(sAmbientMonitor *_pMonitor,
+                                       int64_t _timeMs);
+
+// Returns the average luminance of the latest empty-ramp frames
+int32_t AmbientMonitor_getAmbientLuminance(const sAmbientMonitor *_pMonitor);
+
+sAmbientMonitorStats AmbientMonitor_getStats(const sAmbientMonitor *_pMonitor);
+void AmbientMonitor_printStats(const sAmbientMonitor *_pMonitor);
+
+#endif
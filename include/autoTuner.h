@@ -0,0 +1,65 @@
+/*
+ * The auto tuner module learns the delays of the sorting cycle from how long
+ * the mechanics actually take on this unit. Each delay starts at its
+ * conservative default and shrinks towards a high percentile of the observed
+ * completion times plus a safety margin. A failure attributed to a delay
+ * backs it off towards its default. Learned delays are persisted to a profile
+ * file so they survive restarts. Every station has its own auto tuner and
+ * profile, as the mechanics of each station differ.
+ */
+
+#ifndef _AUTO_TUNER_H_
+#define _AUTO_TUNER_H_
+
+#include <stdint.h>
+
+#define AUTO_TUNER_MAX_OBSERVATIONS 32
+#define AUTO_TUNER_PATH_LEN 128
+
+typedef enum {
+  // Time for an arrived item to come to rest in front of the sensor
+  AUTO_TUNER_ARRIVAL_SETTLE,
+  // Time for a dropped item to leave the pipe before it is considered jammed
+  AUTO_TUNER_DEPARTURE_TIMEOUT,
+  AUTO_TUNER_NUM_DELAYS,
+} eAutoTunerDelay;
+
+// The fields are private to the module
+typedef struct {
+  int64_t currentMs;
+  int64_t observations[AUTO_TUNER_MAX_OBSERVATIONS];
+  uint32_t numObservations;
+  uint32_t nextObservation;
+  uint32_t numFailures;
+} sAutoTunerDelay;
+
+typedef struct {
+  sAutoTunerDelay delays[AUTO_TUNER_NUM_DELAYS];
+  char profilePath[AUTO_TUNER_PATH_LEN];
+} sAutoTuner;
+
+// Initialization/Termination functions
+// ----------------------------------------------------------------------------
+// Loads the learned delays from the profile at _pProfilePath, if it exists.
+// Otherwise, every delay starts at its default.
+void AutoTuner_init(sAutoTuner *_pTuner, const char *_pProfilePath);
+
+// Saves the learned delays to the profile.
+void AutoTuner_cleanup(sAutoTuner *_pTuner);
+
+// Tuning functions
+// ----------------------------------------------------------------------------
+int64_t AutoTuner_getDelayMs(const sAutoTuner *_pTuner, eAutoTunerDelay _delay);
+
+// Records that the event the delay waits for was observed to complete
+// _observedMs after it started.
+void AutoTuner_recordObservation(sAutoTuner *_pTuner, eAutoTunerDelay _delay,
+                                 int64_t _observedMs);
+
+// Records that the delay was too short, e.g. an item was not at rest by the
+// end of it. Backs the delay off and discards its observations.
+void AutoTuner_recordFailure(sAutoTuner *_pTuner, eAutoTunerDelay _delay);
+
+void AutoTuner_printStats(const sAutoTuner *_pTuner);
+
+#endif
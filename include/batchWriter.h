@@ -0,0 +1,79 @@
+/*
+ * The batch writer module writes short values to sysfs attributes in
+ * batches. With io_uring enabled, the writes of a batch are submitted in a
+ * single system call against pre-registered file descriptors, and complete
+ * asynchronously while the submitting thread carries on. Without it, or when
+ * the kernel does not offer io_uring, every write of a batch is a plain
+ * pwrite() at offset 0.
+ *
+ * Writes to the same attribute are applied in the order they are submitted.
+ * Submission is thread-safe.
+ */
+
+#ifndef _BATCH_WRITER_H_
+#define _BATCH_WRITER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define BATCH_WRITER_MAX_FDS 16
+#define BATCH_WRITER_MAX_WRITES 16
+#define BATCH_WRITER_VALUE_LEN 16
+
+// Type definitions
+// ----------------------------------------------------------------------------
+typedef struct {
+  int numWrites;
+  int slots[BATCH_WRITER_MAX_WRITES];
+  char values[BATCH_WRITER_MAX_WRITES][BATCH_WRITER_VALUE_LEN];
+} sBatchWriterBatch;
+
+typedef struct {
+  uint64_t numBatches;
+  uint64_t numWrites;
+  // Writes issued through io_uring rather than pwrite()
+  uint64_t numRingWrites;
+  uint64_t numFailedWrites;
+} sBatchWriterStats;
+
+// Initialization/Termination functions
+// ----------------------------------------------------------------------------
+// Sets up the io_uring instance if _isRingEnabled. Must be called before any
+// file descriptor is registered.
+void BatchWriter_init(bool _isRingEnabled);
+
+// Waits for the writes in flight to complete.
+void BatchWriter_cleanup(void);
+
+// Registration functions
+// ----------------------------------------------------------------------------
+// Registers the attribute open at _fd for batched writes. Returns the slot to
+// add writes to it with, or -1 if every slot is taken.
+int BatchWriter_registerFd(int _fd);
+
+// Waits for the writes to the slot in flight, and frees it. The file
+// descriptor may be closed afterwards.
+void BatchWriter_unregisterFd(int _slot);
+
+// Waits for the writes to the slot in flight, e.g. before the attribute is
+// changed through another path.
+void BatchWriter_waitForSlot(int _slot);
+
+// Batch functions
+// ----------------------------------------------------------------------------
+void BatchWriter_initBatch(sBatchWriterBatch *_pBatch);
+
+// Adds the write of _pValue to the attribute of _slot to the batch. A later
+// write to the same slot in the same batch replaces the earlier one. Returns
+// false if the batch is full or the value too long.
+bool BatchWriter_add(sBatchWriterBatch *_pBatch, int _slot,
+                     const char *_pValue);
+
+// Submits the writes of the batch and empties it. Returns once the writes are
+// submitted, which with io_uring is before they complete.
+void BatchWriter_submit(sBatchWriterBatch *_pBatch);
+
+sBatchWriterStats BatchWriter_getStats(void);
+void BatchWriter_printStats(void);
+
+#endif
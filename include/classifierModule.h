@@ -1,7 +1,12 @@
 /* The classifier module is responsible for classifying the type of refuse
  * that is currently waiting on the ramp, so that the item can subsequently be
- * placed within the correct bin. */
+ * placed within the correct bin. Every station classifies with its own color
+ * sensor. */
 
+#include "ambientMonitor.h"
+#include "colorSensor.h"
+
+#include <stdbool.h>
 #include <stdint.h>
 
 #ifndef _CLASSIFIER_MODULE_GUARD_H_
@@ -13,15 +18,135 @@ typedef enum {
   CLASSIFIER_MODULE_RECYCLING,
 } eClassifierModule_RefuseItemType;
 
-void ClassifierModule_init(uint32_t _colorSensorI2cBusNumber,
-  uint32_t _objectSensingThreshold);
-void ClassifierModule_cleanup(void);
+// The fields are private to the module
+typedef struct {
+  sColorSensor colorSensor;
+  sAmbientMonitor ambientMonitor;
+} sClassifierModule;
+
+// Initializes the classifier around the color sensor described by _pConfig.
+void ClassifierModule_init(sClassifierModule *_pClassifier,
+                           const sColorSensorConfig *_pConfig);
+void ClassifierModule_cleanup(sClassifierModule *_pClassifier);
+
+/* Blocking function that returns once the refuse item is in front of the
+ * sensor on the ramp. Reads one full-integration frame at a time while the
+ * ramp is quiet, and every short frame once the luminance starts to move, as
+ * a sorter does with an arrival tracker. */
+void ClassifierModule_waitUntilRefuseItemAppears(
+    sClassifierModule *_pClassifier);
+
+/* Blocking function that returns once the sensor readings have been back at
+ * the calibrated baseline for several consecutive frames, meaning the refuse
+ * item has left, or once _timeoutMs have passed (never if negative). Returns
+ * true if the refuse item has left. */
+bool ClassifierModule_waitUntilRefuseItemLeaves(
+    sClassifierModule *_pClassifier, int64_t _timeoutMs);
+
+// Returns the refuse type of the next refuse item waiting on the ramp, from a
+// full-integration frame. Blocks until such a frame is available.
+eClassifierModule_RefuseItemType
+ClassifierModule_getRefuseItemType(sClassifierModule *_pClassifier);
+
+/* Recalibrates object detection for the current lighting. Blocks temporarily.
+ * ClassifierModule_trackArrival() also recalibrates, without blocking, when
+ * the empty ramp shows that the lighting has changed. */
+void ClassifierModule_recalibrate(sClassifierModule *_pClassifier);
+
+// Calibrates the white balance against a white reference held in front of the
+// sensor. Returns false if the reference is too dark. Blocks temporarily.
+bool ClassifierModule_calibrateWhiteBalance(sClassifierModule *_pClassifier);
+
+// Non-blocking functions
+// ----------------------------------------------------------------------------
+// For callers that wait for frames in an event loop. Frames are integrated
+// continuously; these functions read the latest available frame.
+
+typedef enum {
+  CLASSIFIER_MODULE_FRAMES_FULL,  // Accurate, for classification
+  CLASSIFIER_MODULE_FRAMES_SHORT, // Fast, for watching the item move
+} eClassifierModule_FrameMode;
+
+// Consecutive frames of the refuse item coming to rest
+typedef struct {
+  bool hasFrame;
+  int32_t lastClear;
+} sClassifierModule_RestTracker;
+
+// Consecutive frames without the refuse item in front of the sensor
+typedef struct {
+  uint32_t numEmptyFrames;
+} sClassifierModule_DepartureTracker;
+
+typedef enum {
+  // The sensor reads its calibrated baseline
+  CLASSIFIER_MODULE_RAMP_QUIET,
+  // The luminance is moving toward the object sensing threshold, or is past it
+  // but not for long enough to confirm an arrival
+  CLASSIFIER_MODULE_RAMP_ACTIVE,
+  CLASSIFIER_MODULE_RAMP_ARRIVED,
+} eClassifierModule_RampActivity;
+
+// Frames of the refuse item arriving in front of the sensor
+typedef struct {
+  bool isActive;
+  bool hasCrossedThreshold;
+  uint32_t numPresentFrames;
+  uint32_t numQuietFrames;
+  // Activities that crossed the threshold but ended quiet, without an arrival
+  uint32_t numFalseTriggers;
+} sClassifierModule_ArrivalTracker;
+
+// Restarts integration with the given frame mode. The sensor starts with full
+// frames.
+void ClassifierModule_setFrameMode(sClassifierModule *_pClassifier,
+                                   eClassifierModule_FrameMode _frameMode);
+
+// Time left until the first frame of the current frame mode is available (0 if
+// it already is), and until the frame currently being integrated is.
+int64_t ClassifierModule_getMsUntilFrame(sClassifierModule *_pClassifier);
+int64_t ClassifierModule_getMsUntilNextFrame(sClassifierModule *_pClassifier);
+
+bool ClassifierModule_isRefuseItemPresent(sClassifierModule *_pClassifier);
+
+// Returns the refuse type from the latest frame, and sets
+// _pConfidencePercentOut to the confidence of the guess [0, 100].
+eClassifierModule_RefuseItemType
+ClassifierModule_getCurrentRefuseItemType(sClassifierModule *_pClassifier,
+                                          uint32_t *_pConfidencePercentOut);
+
+// Returns true if the refuse item has not moved since the last frame read with
+// _pTracker. Zero the tracker before the first frame.
+bool ClassifierModule_isRefuseItemAtRest(
+    sClassifierModule *_pClassifier, sClassifierModule_RestTracker *_pTracker);
+
+// Returns true once enough consecutive frames read with _pTracker are back at
+// the calibrated baseline to confirm that the refuse item has left. Zero the
+// tracker before the first frame.
+bool ClassifierModule_hasRefuseItemLeft(
+    sClassifierModule *_pClassifier,
+    sClassifierModule_DepartureTracker *_pTracker);
+
+/* Reads the latest frame into _pTracker and returns the activity on the ramp.
+ * Frames are best read slowly while the ramp is quiet, and as fast as they are
+ * integrated while it is active. Zero the tracker before the first frame.
+ * Frames without an arrival are watched for a change in the ambient light,
+ * after which object detection is recalibrated from them and the ramp is
+ * quiet. */
+eClassifierModule_RampActivity
+ClassifierModule_trackArrival(sClassifierModule *_pClassifier,
+                              sClassifierModule_ArrivalTracker *_pTracker);
 
-// Blocking function that returns once the refuse item is
-// in front of the sensor on the ramp.
-void ClassifierModule_waitUntilRefuseItemAppears(void);
+// Records a frame of the given object sensing level into _pTracker and returns
+// the activity on the ramp. See ColorSensor_getObjectSensingLevelPercent().
+eClassifierModule_RampActivity
+ClassifierModule_recordArrivalLevel(sClassifierModule_ArrivalTracker *_pTracker,
+                                    uint32_t _levelPercent);
 
-// Returns the refuse type of the next refuse item waiting on the ramp.
-eClassifierModule_RefuseItemType ClassifierModule_getRefuseItemType(void);
+// Counters of the ambient light monitoring done by
+// ClassifierModule_trackArrival()
+sAmbientMonitorStats
+ClassifierModule_getAmbientStats(const sClassifierModule *_pClassifier);
+void ClassifierModule_printStats(const sClassifierModule *_pClassifier);
 
 #endif
@@ -2,9 +2,24 @@
  * red, blue, and green color values from the TCS34725 color sensor.
  * I2c is used to communicate with the device. The I2c bus number
  * is provided by the client code, and the address of the
- * color sensor is hard-coded by the manufacturer. */
+ * color sensor is hard-coded by the manufacturer.
+ *
+ * Every sensor is an sColorSensor owned by the client code, with its own
+ * calibration and integration state, so several sensors can be used at once.
+ * As the address is fixed, sensors sharing a bus sit behind a multiplexer.
+ * Frame reads and integration switches are queued on the bus at detection
+ * priority, and calibration at control priority.
+ * Different sensors may be used from different threads; a single sensor must
+ * only be used by one thread at a time.
+ *
+ * Frames read elsewhere, e.g. captured at a high rate or replayed from a file,
+ * are converted in bulk with ColorSensor_convertFrames(), which runs a NEON
+ * kernel when built for a NEON target. */
+
+#include "i2cBus.h"
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #ifndef _COLORSENSOR_GUARD_H_
@@ -15,34 +30,235 @@ typedef enum {
   COLOR_SENSOR_BLUE,
 } eColorSensorColor;
 
-// i2cBusNum is the i2c bus number that the color sensor is attached to.
-// _objectSensingThreshold determines how sensitive the color sensor is at
-// detecting objects in front of it (lower = more sensitive).
-// function blocks temporarily due to initial calibration
-void ColorSensor_init(uint32_t _i2cBusNum, uint32_t _objectSensingThreshold);
-void ColorSensor_cleanup(void);
+// Integration times the sensor can be switched between. Short frames are ready
+// sooner but are noisier.
+typedef enum {
+  COLOR_SENSOR_INTEGRATION_SHORT, // ~104 ms
+  COLOR_SENSOR_INTEGRATION_FULL,  // ~615 ms
+} eColorSensorIntegration;
+
+#define COLOR_SENSOR_NO_MUX I2C_BUS_NO_MUX
+
+// Object sensing level from which an object is in front of the sensor
+#define COLOR_SENSOR_OBJECT_LEVEL_PERCENT 100
+#define COLOR_SENSOR_NUM_COLORS 3
+
+// One in the Q16 fixed point of the chromaticities and white balance gains
+#define COLOR_SENSOR_Q16_ONE 65536
+
+// Features of one frame, in integer fixed point. Counts are scaled to what a
+// full-integration frame would read.
+typedef struct {
+  int32_t red;
+  int32_t green;
+  int32_t blue;
+  int32_t clear;
+  // Infrared estimate (R + G + B - C) / 2, and the color channels without it
+  int32_t infrared;
+  int32_t irFreeRed;
+  int32_t irFreeGreen;
+  int32_t irFreeBlue;
+  // Infrared-free channels corrected by the white balance gains
+  int32_t balancedRed;
+  int32_t balancedGreen;
+  int32_t balancedBlue;
+  // Color channels over the clear channel, in Q16, up to one
+  uint32_t redChromaticity;
+  uint32_t greenChromaticity;
+  uint32_t blueChromaticity;
+  // Correlated color temperature, or 0 if the frame has no red
+  int32_t cctKelvin;
+  int32_t milliLux;
+} sColorSensorFeatures;
+
+typedef struct {
+  // i2c bus number that the color sensor is attached to
+  int32_t i2cBusNum;
+  // Address of the TCA9548A-style multiplexer the sensor is behind, or
+  // COLOR_SENSOR_NO_MUX, and the multiplexer channel it is on
+  int32_t muxAddress;
+  uint8_t muxChannel;
+  // Determines how sensitive the color sensor is at detecting objects in front
+  // of it (lower = more sensitive)
+  uint32_t objectSensingThreshold;
+  // File the white balance gains are kept in, or NULL to keep them in memory
+  const char *pCalibrationProfilePath;
+} sColorSensorConfig;
+
+// Bytes of a raw frame: the clear, red, green and blue data registers, each
+// 16 bits little endian, in the order they are read from CDATAL onwards
+#define COLOR_SENSOR_FRAME_NUM_BYTES 8
+
+// Arrays that bulk-converted frames are written to, one element per frame
+typedef struct {
+  uint16_t *pRed;
+  uint16_t *pGreen;
+  uint16_t *pBlue;
+  uint16_t *pClear;
+  int32_t *pMilliLux;
+  // Color channels over the clear channel, in Q16
+  uint32_t *pRedChromaticity;
+  uint32_t *pGreenChromaticity;
+  uint32_t *pBlueChromaticity;
+} sColorSensorFrameArrays;
+
+// The fields are private to the module
+typedef struct {
+  sColorSensorConfig config;
+  sI2cBusDevice device;
+
+  // Baseline for detecting if no object is in front of the sensor
+  int32_t baselineLuminance;
+
+  // Q16 gains of the infrared-free channels, indexed by eColorSensorColor
+  uint32_t whiteBalanceGains[COLOR_SENSOR_NUM_COLORS];
+
+  // Integration time of the frames currently being integrated, and the time at
+  // which the integration was (re)started
+  int64_t integrationTimeMs;
+  int64_t integrationStartTimeMs;
+
+  // Integration cycles of the frames currently being integrated, and of the
+  // frames integrated before the last restart. The data registers keep the
+  // last frame integrated before a restart until the first new frame is ready.
+  int32_t integrationCycles;
+  int32_t previousIntegrationCycles;
+} sColorSensor;
+
+/* Function blocks temporarily due to initial calibration. Loads the white
+ * balance gains from the calibration profile if there is one, or starts with
+ * unity gains. */
+void ColorSensor_init(sColorSensor *_pSensor,
+                      const sColorSensorConfig *_pConfig);
+void ColorSensor_cleanup(sColorSensor *_pSensor);
 
 /* Output buffer must be 5 int32_t's in size. The first element will contain
- * the red luminance, second green, third blue, fourth is luminance, and the
- * fifth element will be the ambient light luminance in Lux units */
-void ColorSensor_getLuminanceValuesInLux(int32_t *_pLuminanceValsOut);
+ * the red luminance, second green, third blue, fourth the clear channel, and
+ * the fifth element will be the ambient light luminance in Lux units. Values
+ * are scaled to what a full-integration frame would read. */
+void ColorSensor_getLuminanceValuesInLux(sColorSensor *_pSensor,
+                                         int32_t *_pLuminanceValsOut);
 
 /* Output buffer must be 3 int32_t's in size. The first element will contain
  * the red value, second green, third blue. Values are in the range [0,255]. */
-void ColorSensor_getRgbValues(int32_t *_pRgbValuesOut);
+void ColorSensor_getRgbValues(sColorSensor *_pSensor, int32_t *_pRgbValuesOut);
 
 /* Recalibrate the color sensor for object detection in the current lighting
  * This should be called before using isObjectInFrontOfSensor for the
  * first time, and everytime the light changes in the surrounding environment.
- * Blocks temporarily */
-void ColorSensor_recalibrate(void);
+ * Blocks temporarily. See ColorSensor_setBaselineLuminance() to recalibrate
+ * from frames already read instead. */
+void ColorSensor_recalibrate(sColorSensor *_pSensor);
+
+// The ambient light luminance of the empty ramp that objects are detected
+// against. Setting it recalibrates object detection without blocking.
+int32_t ColorSensor_getBaselineLuminance(const sColorSensor *_pSensor);
+void ColorSensor_setBaselineLuminance(sColorSensor *_pSensor,
+                                      int32_t _luminance);
+
+/* Calibrates the white balance against a white reference held in front of the
+ * sensor, and saves the gains to the calibration profile. Returns false, and
+ * keeps the gains, if the reference is too dark to calibrate against. Blocks
+ * temporarily. */
+bool ColorSensor_calibrateWhiteBalance(sColorSensor *_pSensor);
 
 /* Returns true if an object is right in front of the sensor. Otherwise,
  * returns false if no object is in front of the color sensor. The object
  * should be right in front of the light. NOTE: ColorSensor_recalibrate()
  * should be called at least once before calling this function */
-bool ColorSensor_isObjectInFrontOfSensor(void);
+bool ColorSensor_isObjectInFrontOfSensor(sColorSensor *_pSensor);
+
+/* Returns how far the ambient light luminance of the latest frame is from the
+ * calibrated baseline, as a percentage of the object sensing threshold. An
+ * object is in front of the sensor from COLOR_SENSOR_OBJECT_LEVEL_PERCENT on.
+ * NOTE: ColorSensor_recalibrate() should be called at least once before. */
+uint32_t ColorSensor_getObjectSensingLevelPercent(sColorSensor *_pSensor);
+
+// Returns the ambient light luminance of the latest frame, in Lux, scaled to
+// what a full-integration frame would read
+int32_t ColorSensor_getAmbientLuminance(sColorSensor *_pSensor);
+
+// Returns the object sensing level of an ambient light luminance read earlier.
+// See ColorSensor_getObjectSensingLevelPercent().
+uint32_t ColorSensor_getLuminanceLevelPercent(const sColorSensor *_pSensor,
+                                              int32_t _luminance);
 
 // return the color that the sensor is picking up
-eColorSensorColor ColorSensor_getColor(void);
+eColorSensorColor ColorSensor_getColor(sColorSensor *_pSensor);
+
+/* Returns the color that the sensor is picking up, and sets
+ * _pConfidencePercentOut to how far ahead the leading channel is from the
+ * runner-up. See ColorSensor_getFeaturesColor(). */
+eColorSensorColor
+ColorSensor_getColorWithConfidence(sColorSensor *_pSensor,
+                                   uint32_t *_pConfidencePercentOut);
+
+// Reads a frame and computes its features, white balanced with the gains of
+// the sensor.
+void ColorSensor_getFeatures(sColorSensor *_pSensor,
+                             sColorSensorFeatures *_pFeaturesOut);
+
+/* Computes the features of a frame from its channel counts: the infrared
+ * estimate and infrared-free channels, the chromaticities, and the CCT and
+ * illuminance with the coefficients of the datasheet and DN40. The balanced
+ * channels are those of unity gains. */
+void ColorSensor_computeFeatures(int32_t _red, int32_t _green, int32_t _blue,
+                                 int32_t _clear,
+                                 sColorSensorFeatures *_pFeaturesOut);
+
+// Sets the balanced channels of _pFeaturesInOut to its infrared-free channels
+// multiplied by the Q16 _pGains, indexed by eColorSensorColor.
+void ColorSensor_applyWhiteBalance(const uint32_t *_pGains,
+                                   sColorSensorFeatures *_pFeaturesInOut);
+
+/* Sets _pGainsOut to the Q16 gains that bring the infrared-free channels of
+ * the white reference _pWhite to its green channel. Returns false if a
+ * channel is too dark to calibrate against. */
+bool ColorSensor_computeWhiteBalanceGains(const sColorSensorFeatures *_pWhite,
+                                          uint32_t *_pGainsOut);
+
+/* Returns the color of the leading balanced channel, and sets
+ * _pConfidencePercentOut to its lead over the runner-up, as a percentage of
+ * the leading channel [0, 100]. Removing the infrared, which every channel
+ * sees alike, keeps similar hues apart, and the white balance keeps them
+ * apart under every illuminant. */
+eColorSensorColor
+ColorSensor_getFeaturesColor(const sColorSensorFeatures *_pFeatures,
+                             uint32_t *_pConfidencePercentOut);
+
+/* Converts _numFrames raw frames, laid out back to back, that were integrated
+ * with _integration. Writes the channel counts, illuminance and chromaticities
+ * of frame i to element i of every array of _pFramesOut. The illuminance and
+ * chromaticities are those ColorSensor_computeFeatures() computes for the
+ * counts of a full-integration frame. Runs a NEON kernel when built for a
+ * NEON target, and ColorSensor_convertFramesScalar() otherwise. */
+void ColorSensor_convertFrames(const uint8_t *_pFrames, size_t _numFrames,
+                               eColorSensorIntegration _integration,
+                               const sColorSensorFrameArrays *_pFramesOut);
+
+// Portable reference of ColorSensor_convertFrames(), which agrees with it bit
+// for bit.
+void ColorSensor_convertFramesScalar(
+    const uint8_t *_pFrames, size_t _numFrames,
+    eColorSensorIntegration _integration,
+    const sColorSensorFrameArrays *_pFramesOut);
+
+/* Restarts integration with the given integration time. Returns immediately;
+ * use ColorSensor_waitForFrame() to wait for the first frame integrated with
+ * the new time. The sensor starts with full integration. */
+void ColorSensor_setIntegration(sColorSensor *_pSensor,
+                                eColorSensorIntegration _integration);
+
+// Blocks until a frame integrated entirely with the current integration time
+// is available. Returns immediately if one already is.
+void ColorSensor_waitForFrame(const sColorSensor *_pSensor);
+
+// Blocks until the frame currently being integrated is available.
+void ColorSensor_waitForNextFrame(const sColorSensor *_pSensor);
+
+// Non-blocking counterparts of the functions above, for callers that wait in
+// an event loop. Return the time left until the frame is available (0 if a
+// frame integrated with the current integration time already is).
+int64_t ColorSensor_getMsUntilFrame(const sColorSensor *_pSensor);
+int64_t ColorSensor_getMsUntilNextFrame(const sColorSensor *_pSensor);
 #endif
@@ -23,6 +23,12 @@
 #define FILE_LED_TRIGGER "/trigger"
 #define FILE_LED_BRIGHTNESS "/brightness"
 #define FILE_LED_MAX_BRIGHTNESS "/max_brightness"
+#define FILE_LED_DELAY_ON "/delay_on"
+#define FILE_LED_DELAY_OFF "/delay_off"
+
+// Pin multiplexing files, e.g. FILE_PINMUX_PATH "P9_18" FILE_PINMUX_STATE
+#define FILE_PINMUX_PATH "/sys/devices/platform/ocp/ocp:"
+#define FILE_PINMUX_STATE "_pinmux/state"
 
 // Concatenates a two files paths together and stores the result in the in-out
 // parameter _pConcatFilePath. Returns a 1 if successful.
@@ -38,4 +44,29 @@ int File_readFromFile(const char *_pFilePath, char *_readBuffer,
 // Returns 1 if successful.
 int File_writeToFile(const char *_pFilePath, const char *_pValue);
 
+// Attribute handle functions
+// ----------------------------------------------------------------------------
+// Sysfs attributes that are accessed repeatedly are opened once, and then read
+// or written whole at offset 0 without stdio buffering. Unlike the functions
+// above, these return a negative errno value on failure instead of exiting.
+#define FILE_ATTRIBUTE_READ 0x1
+#define FILE_ATTRIBUTE_WRITE 0x2
+// Fails with -EAGAIN instead of blocking, for attributes that may block
+#define FILE_ATTRIBUTE_NONBLOCK 0x4
+
+// Opens the attribute at _pFilePath with the FILE_ATTRIBUTE flags in _flags.
+// Returns its file descriptor, or a negative errno value.
+int File_openAttribute(const char *_pFilePath, int _flags);
+
+void File_closeAttribute(int _attributeFd);
+
+// Replaces the contents of the attribute with _pValue. Returns 0 if all of it
+// was written, or a negative errno value.
+int File_writeAttribute(int _attributeFd, const char *_pValue);
+
+// Reads the attribute into _readBuffer as a string, without its trailing
+// newline. Returns the length of the string, or a negative errno value.
+int File_readAttribute(int _attributeFd, char *_readBuffer,
+                       const int _readBufferSize);
+
 #endif
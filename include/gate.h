@@ -6,24 +6,92 @@
 #ifndef _GATE_HEADER_H_
 #define _GATE_HEADER_H_
 
+#include "actuator.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
 // Gate enumerator to specify between gates 1 and gate 2.
 typedef enum { gate1 = 1, gate2 = 2 } eGateNum;
 
+// Last commanded position of a gate. A gate is in an unknown position until it
+// is commanded for the first time.
+typedef enum { GATE_UNKNOWN, GATE_RAISED, GATE_LOWERED } eGatePosition;
+
+// Positions of both gates that route a ball to each of the bins.
+typedef enum {
+  GATE_CONFIG_GARBAGE,   // Gates 1 and 2 raised
+  GATE_CONFIG_COMPOST,   // Gate 1 lowered, gate 2 raised
+  GATE_CONFIG_RECYCLING, // Gates 1 and 2 lowered
+} eGateConfig;
+
+// The gates of a station. The fields are private to the module
+typedef struct {
+  sActuator *pActuator;
+  // Token of the last command submitted to each of the gates
+  sActuatorToken gatesToken;
+} sGates;
+
 // Initialization/Termination functions
 // ----------------------------------------------------------------------------
 // Initializes the gates 1 and 2 by setting the position of the arms on the
 // Micro Servo 98 SG90's to their initial positions where the gates are up.
-void Gate_init(void);
+// The gates are driven by _pActuator, on which Actuator_init() must be called
+// before.
+void Gate_init(sGates *_pGates, sActuator *_pActuator);
 
 // Sets gate 1 and 2's arms to their resting position where the gates are down.
-void Gate_cleanup(void);
+void Gate_cleanup(sGates *_pGates);
 
 // Behaviour functions
 // ----------------------------------------------------------------------------
-// Raises the gate respective of the gate number.
-void Gate_raisesGate(eGateNum _gateToRaise);
+// Gate commands are carried out by the actuator service thread and return
+// without waiting for the gates to move. The returned token completes once the
+// gates have had enough time to get to their new positions.
+
+// Raises the gate respective of the gate number. Does not move the gate if it
+// was already commanded to be raised.
+sActuatorToken Gate_raisesGate(sGates *_pGates, eGateNum _gateToRaise);
+
+// Lowers the gate respective of the gate number. Does not move the gate if it
+// was already commanded to be lowered.
+sActuatorToken Gate_lowersGate(sGates *_pGates, eGateNum _gateToLower);
+
+// Commands both gates to the given configuration in parallel, only moving the
+// gates that are not already in place.
+sActuatorToken Gate_setConfiguration(sGates *_pGates, eGateConfig _config);
+
+// State functions
+// ----------------------------------------------------------------------------
+eGatePosition Gate_getPosition(const sGates *_pGates, eGateNum _gate);
+
+// Sets _pConfigOut to the configuration both gates were last commanded to.
+// Returns false if the gates are not in any of the configurations.
+bool Gate_getConfiguration(const sGates *_pGates, eGateConfig *_pConfigOut);
+
+// Returns true if both gates were commanded to the given configuration and
+// have had enough time to travel there.
+bool Gate_isConfigurationReached(const sGates *_pGates, eGateConfig _config);
+
+// Returns true if both gates were commanded to the given configuration. They
+// may still be travelling.
+bool Gate_isConfigurationCommanded(const sGates *_pGates,
+                                   eGateConfig _config);
+
+// Returns the number of gates that must move to go from configuration _from to
+// configuration _to.
+int Gate_getNumGatesToMove(eGateConfig _from, eGateConfig _to);
+
+// Returns the time a gate is given to travel between its two positions.
+int64_t Gate_getTravelTimeMs(void);
+
+// Returns the time the gates take to go from configuration _from to
+// configuration _to. Both gates travel in parallel, so it is one travel time
+// if any gate moves, and 0 otherwise.
+int64_t Gate_getTransitionTimeMs(eGateConfig _from, eGateConfig _to);
 
-// Lowers the gate respective of the gate number.
-void Gate_lowersGate(eGateNum _gateToLower);
+// Blocks until the gates have finished every move commanded so far. Returns
+// immediately if both gates have already settled.
+void Gate_waitUntilSettled(const sGates *_pGates);
 
 #endif
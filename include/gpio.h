@@ -0,0 +1,93 @@
+/*
+ * The gpio module requests GPIO lines through the Linux GPIO character device
+ * (v2 uAPI), instead of the slower sysfs interface. Lines are requested
+ * together from a chip (e.g. "/dev/gpiochip0"), and can then be read or written
+ * with a single ioctl, or watched for debounced edge events timestamped by the
+ * kernel.
+ */
+
+// Not _GPIO_H_, which is the guard of the kernel's <linux/gpio.h>
+#ifndef _GPIO_MODULE_H_
+#define _GPIO_MODULE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define GPIO_MAX_LINES 64
+
+// Type definitions
+// ----------------------------------------------------------------------------
+typedef enum { GPIO_DIRECTION_INPUT, GPIO_DIRECTION_OUTPUT } eGpioDirection;
+
+typedef enum {
+  GPIO_EDGE_NONE,
+  GPIO_EDGE_RISING,
+  GPIO_EDGE_FALLING,
+  GPIO_EDGE_BOTH,
+} eGpioEdge;
+
+typedef struct {
+  eGpioDirection direction;
+  // Edges reported as events. Inputs only.
+  eGpioEdge edge;
+  // Time a line must be stable before a change is reported, 0 to disable.
+  // Inputs only.
+  uint32_t debounceUs;
+  // Values are logical: active low lines read 1 when the pin is low
+  bool isActiveLow;
+  // Bit i is the initial value of the ith requested line. Outputs only.
+  uint64_t initialValues;
+} sGpioConfig;
+
+// A set of lines requested together. The ith line is offsets[i] on its chip,
+// and is bit i in the masks and values of the functions below.
+typedef struct {
+  int fd;
+  uint32_t numLines;
+  uint32_t offsets[GPIO_MAX_LINES];
+} sGpioLines;
+
+typedef struct {
+  // Offset of the line on its chip
+  uint32_t offset;
+  bool isRising;
+  // Kernel timestamp, comparable with Timing_getMonotonicTimeNs()
+  int64_t timestampNs;
+  // Sequence number of the event among those of the request. A gap means
+  // events were lost.
+  uint32_t sequence;
+} sGpioEvent;
+
+// Request functions
+// ----------------------------------------------------------------------------
+/* Requests _numLines lines at _pOffsets of the chip at _pChipPath, all with
+ * _pConfig, under the name _pConsumer. Returns false, printing why, if the
+ * lines could not be requested. */
+bool Gpio_requestLines(const char *_pChipPath, const uint32_t *_pOffsets,
+                       uint32_t _numLines, const sGpioConfig *_pConfig,
+                       const char *_pConsumer, sGpioLines *_pLinesOut);
+
+void Gpio_releaseLines(sGpioLines *_pLines);
+
+// Value functions
+// ----------------------------------------------------------------------------
+// Reads the lines selected by _mask in one ioctl. Returns false on error.
+bool Gpio_getValues(const sGpioLines *_pLines, uint64_t _mask,
+                    uint64_t *_pValuesOut);
+
+// Sets the output lines selected by _mask to the matching bits of _values in
+// one ioctl. Returns false on error.
+bool Gpio_setValues(const sGpioLines *_pLines, uint64_t _mask,
+                    uint64_t _values);
+
+// Event functions
+// ----------------------------------------------------------------------------
+/* Waits up to _timeoutMs (-1 waits forever) for edge events, and reads up to
+ * _maxEvents of those that are pending. Returns the number of events read, 0
+ * on timeout or -1 on error. The descriptor in _pLines may also be added to
+ * an event loop, which calls this function with a timeout of 0 when it is
+ * readable. */
+int Gpio_readEvents(const sGpioLines *_pLines, int _timeoutMs,
+                    sGpioEvent *_pEventsOut, int _maxEvents);
+
+#endif
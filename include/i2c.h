@@ -30,4 +30,23 @@ void I2c_writeI2cReg(int32_t _i2cFileDesc, uint8_t _regAddr, uint8_t _value);
 void I2c_readI2cReg(int32_t _i2cFileDesc, uint8_t _regAddr,
                     uint8_t *_pBufferOut, size_t _numBytesToRead);
 
+// Writes a single byte to the I2C device, for devices without registers such
+// as bus multiplexers.
+void I2c_writeI2cByte(int32_t _i2cFileDesc, uint8_t _value);
+
+// Bus functions
+// ----------------------------------------------------------------------------
+// Devices can also be reached through a single file descriptor for the whole
+// bus, switching its slave address between accesses. See i2cBus.h, which
+// arbitrates buses this way.
+
+#define I2C_NUM_BUSES 3
+
+// Returns the file descriptor of i2c bus _busNum, with no slave address set.
+// Must be closed with I2c_closeI2cDevice().
+int32_t I2c_openI2cBus(int32_t _busNum);
+
+// Sets the slave address the accesses through _i2cFileDesc are sent to
+void I2c_setSlaveAddress(int32_t _i2cFileDesc, int32_t _deviceAddress);
+
 #endif
@@ -0,0 +1,123 @@
+/*
+ * The I2C bus module arbitrates the I2C buses between the devices and threads
+ * that share them. Every bus is opened once, and the devices on it are reached
+ * by switching the slave address of that single file descriptor. A
+ * transaction is a short sequence of register accesses to one device, and
+ * runs without other transactions interleaving with it.
+ *
+ * Transactions that find the bus busy wait in its queue, and are granted the
+ * bus by priority first, then favouring transactions to the device the bus is
+ * already addressing, so that address switches and multiplexer channel
+ * selections are batched. A waiter that has been passed over
+ * I2C_BUS_MAX_BYPASSES times is granted the bus next, so that no priority or
+ * device starves.
+ *
+ * All functions are thread-safe.
+ */
+
+#ifndef _I2C_BUS_H_
+#define _I2C_BUS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define I2C_BUS_NO_MUX -1
+#define I2C_BUS_MAX_OPS 8
+#define I2C_BUS_MAX_BYPASSES 4
+
+// Type definitions
+// ----------------------------------------------------------------------------
+// From highest to lowest
+typedef enum {
+  // Accesses the sorting cycle waits on, e.g. detection and color frames
+  I2C_BUS_PRIORITY_DETECTION,
+  // Configuration and calibration of devices
+  I2C_BUS_PRIORITY_CONTROL,
+  // Accesses nothing waits on, e.g. diagnostics and benchmark load
+  I2C_BUS_PRIORITY_DIAGNOSTICS,
+  I2C_BUS_NUM_PRIORITIES,
+} eI2cBusPriority;
+
+// The fields are private to the module
+typedef struct {
+  int32_t busNum;
+  int32_t address;
+  // Address of the TCA9548A-style multiplexer the device is behind, or
+  // I2C_BUS_NO_MUX, and the multiplexer channel it is on
+  int32_t muxAddress;
+  uint8_t muxChannel;
+} sI2cBusDevice;
+
+typedef enum {
+  I2C_BUS_OP_WRITE_REG,
+  I2C_BUS_OP_READ_REG,
+} eI2cBusOpType;
+
+typedef struct {
+  eI2cBusOpType type;
+  uint8_t regAddr;
+  // Value written by I2C_BUS_OP_WRITE_REG
+  uint8_t value;
+  // Buffer read into by I2C_BUS_OP_READ_REG
+  uint8_t *pBufferOut;
+  size_t numBytes;
+} sI2cBusOp;
+
+typedef struct {
+  int numOps;
+  sI2cBusOp ops[I2C_BUS_MAX_OPS];
+} sI2cBusTransaction;
+
+typedef struct {
+  uint64_t numTransactions[I2C_BUS_NUM_PRIORITIES];
+  // Time from the request of a transaction to the grant of the bus
+  int64_t totalWaitNs[I2C_BUS_NUM_PRIORITIES];
+  int64_t maxWaitNs[I2C_BUS_NUM_PRIORITIES];
+  // Time transactions held the bus, and time the bus was open
+  int64_t busyNs;
+  int64_t openNs;
+  // I2C_SLAVE ioctls and multiplexer channel selections issued
+  uint64_t numAddressSwitches;
+  uint64_t numMuxSelections;
+  // Grants made ahead of an older waiter of the same priority, because the
+  // bus was already addressing the device
+  uint64_t numBatchedGrants;
+} sI2cBusStats;
+
+// Device functions
+// ----------------------------------------------------------------------------
+/* Sets up _pDeviceOut to reach the device at _address on bus _busNum, behind
+ * channel _muxChannel of the multiplexer at _muxAddress unless it is
+ * I2C_BUS_NO_MUX. Opens the bus if no other device has it open. */
+void I2cBus_openDevice(sI2cBusDevice *_pDeviceOut, int32_t _busNum,
+                       int32_t _address, int32_t _muxAddress,
+                       uint8_t _muxChannel);
+
+// Closes the bus once no device has it open. The statistics of the bus are
+// kept.
+void I2cBus_closeDevice(sI2cBusDevice *_pDevice);
+
+// Transaction functions
+// ----------------------------------------------------------------------------
+void I2cBus_initTransaction(sI2cBusTransaction *_pTransaction);
+
+// Add an access to the transaction. Return false if the transaction is full.
+bool I2cBus_addWriteReg(sI2cBusTransaction *_pTransaction, uint8_t _regAddr,
+                        uint8_t _value);
+bool I2cBus_addReadReg(sI2cBusTransaction *_pTransaction, uint8_t _regAddr,
+                       uint8_t *_pBufferOut, size_t _numBytes);
+
+// Waits for the bus of _pDevice to be granted at _priority, then runs the
+// accesses of the transaction in order. Returns once they are all done.
+void I2cBus_execute(const sI2cBusDevice *_pDevice, eI2cBusPriority _priority,
+                    const sI2cBusTransaction *_pTransaction);
+
+// Statistics functions
+// ----------------------------------------------------------------------------
+sI2cBusStats I2cBus_getStats(int32_t _busNum);
+
+// Prints the utilization and queue wait times of every bus used
+void I2cBus_printStats(void);
+
+#endif
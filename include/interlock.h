@@ -0,0 +1,59 @@
+/*
+ * The interlock module models the mechanical constraints between the pipe and
+ * the gates, so that the stages of consecutive items may overlap safely. The
+ * next item may be detected and classified as soon as the previous item has
+ * been released from the pipe. Its gates may only move once the previous item
+ * has fallen past them, and it may only be dropped once the pipe is back at
+ * rest and the gates have settled in the item's configuration.
+ */
+
+#ifndef _INTERLOCK_H_
+#define _INTERLOCK_H_
+
+#include "gate.h"
+#include "pipe.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// The interlock of a station. The fields are private to the module
+typedef struct {
+  const sGates *pGates;
+  const sPipe *pPipe;
+  // Monotonic time at which the last item left the pipe
+  int64_t itemReleasedTimeMs;
+} sInterlock;
+
+// Initialization/Termination functions
+// ----------------------------------------------------------------------------
+// Couples the gates and the pipe of a station.
+void Interlock_init(sInterlock *_pInterlock, const sGates *_pGates,
+                    const sPipe *_pPipe);
+void Interlock_cleanup(sInterlock *_pInterlock);
+
+// Event functions
+// ----------------------------------------------------------------------------
+// Records that the pipe has finished rotating and the item has left it.
+void Interlock_recordItemReleased(sInterlock *_pInterlock);
+
+// Interlock functions
+// ----------------------------------------------------------------------------
+// Returns true if the last released item has fallen past the gates.
+bool Interlock_canMoveGates(const sInterlock *_pInterlock);
+
+// Returns the time left until the last released item has fallen past the
+// gates (0 if it already has).
+int64_t Interlock_getMsUntilGatesMayMove(const sInterlock *_pInterlock);
+
+// Blocks until the last released item has fallen past the gates.
+void Interlock_waitUntilGatesMayMove(const sInterlock *_pInterlock);
+
+// Returns true if the pipe is at rest and the gates have settled in _config.
+bool Interlock_canDrop(const sInterlock *_pInterlock, eGateConfig _config);
+
+// Blocks until the pipe is at rest and the gates have settled. The gates must
+// have been commanded to _config beforehand.
+void Interlock_waitUntilDropMayBegin(const sInterlock *_pInterlock,
+                                     eGateConfig _config);
+
+#endif
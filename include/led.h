@@ -4,7 +4,10 @@
 #ifndef _LED_H_
 #define _LED_H_
 
+#include "batchWriter.h"
+
 #include <stdbool.h>
+#include <stdint.h>
 
 // Type definitions
 // ----------------------------------------------------------------------------
@@ -30,10 +33,24 @@ void Led_termLed(eLedNum _ledNum);
 // Light functions
 // ----------------------------------------------------------------------------
 // Sets/get the led on (true) or off (false). Led must be initialized before
-// calling Led_set() on it.
+// calling Led_set() on it. Only changes are written to the led, and the state
+// returned is the last one set rather than one read back from the led.
 void Led_setLight(eLedNum _ledNum, bool _value);
 bool Led_getLight(eLedNum _ledNum);
 
+// Same as Led_setLight(), but the write is added to _pBatch, to be issued when
+// the batch is submitted.
+void Led_queueLight(eLedNum _ledNum, bool _value, sBatchWriterBatch *_pBatch);
+
+/* Blinks the led _onMs on and _offMs off through the kernel "timer" trigger,
+   so that no userspace thread has to wake up to toggle it. Calling it again
+   with the same delays leaves the running blink untouched, and Led_setLight()
+   stops it. Returns false, leaving the led as it was, if the kernel does not
+   offer the timer trigger for this led.
+ */
+bool Led_setBlink(eLedNum _ledNum, uint32_t _onMs, uint32_t _offMs);
+bool Led_isBlinking(eLedNum _ledNum);
+
 bool Led_isInitialized(eLedNum _ledNum);
 
 #endif
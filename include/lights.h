@@ -15,4 +15,7 @@ void Lights_setRecycling(void);
 void Lights_setRecycled(void);
 void Lights_setReturning(void);
 
+// Fast blinking that calls for the operator, e.g. when an item is jammed.
+void Lights_setAlarm(void);
+
 #endif
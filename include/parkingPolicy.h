@@ -0,0 +1,60 @@
+/*
+ * The parking policy module decides which configuration the gates wait in
+ * between items. It keeps a rolling histogram of the configurations recent
+ * items needed and picks the one that minimizes the expected number of gate
+ * transitions for the next item. Both gates move in parallel, so a transition
+ * costs the same however many gates it moves. It also keeps track of the gate
+ * actuation time the policy saved compared to always returning the gates to
+ * the raised (garbage) configuration.
+ */
+
+#ifndef _PARKING_POLICY_H_
+#define _PARKING_POLICY_H_
+
+#include "gate.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PARKING_POLICY_HISTORY_SIZE 32
+#define PARKING_POLICY_NUM_GATE_CONFIGS 3
+
+// The fields are private to the module
+typedef struct {
+  // Rolling histogram
+  eGateConfig history[PARKING_POLICY_HISTORY_SIZE];
+  uint32_t historyLength;
+  uint32_t historyNext;
+  uint32_t configCounts[PARKING_POLICY_NUM_GATE_CONFIGS];
+
+  // Savings accounting
+  bool hasPreviousItem;
+  eGateConfig previousItemConfig;
+  eGateConfig parkingConfig;
+  int64_t savedActuationMs;
+} sParkingPolicy;
+
+// Initialization/Termination functions
+// ----------------------------------------------------------------------------
+void ParkingPolicy_init(sParkingPolicy *_pPolicy);
+void ParkingPolicy_cleanup(sParkingPolicy *_pPolicy);
+
+// Policy functions
+// ----------------------------------------------------------------------------
+// Records the configuration an item needed, and the actuation time saved on it
+// by the configuration the gates were last parked in.
+void ParkingPolicy_recordItem(sParkingPolicy *_pPolicy,
+                              eGateConfig _itemConfig);
+
+// Returns the configuration the gates should be parked in until the next item.
+// Keeps _currentConfig on ties so that the gates do not move needlessly.
+eGateConfig ParkingPolicy_getParkingConfig(sParkingPolicy *_pPolicy,
+                                           eGateConfig _currentConfig);
+
+// Gate actuation time saved so far compared to parking the gates raised. May
+// be negative if the item stream changes faster than the histogram.
+int64_t ParkingPolicy_getSavedActuationMs(const sParkingPolicy *_pPolicy);
+
+void ParkingPolicy_printStats(const sParkingPolicy *_pPolicy);
+
+#endif
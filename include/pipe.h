@@ -6,24 +6,59 @@
 #ifndef _PIPE_HEADER_H_
 #define _PIPE_HEADER_H_
 
+#include "actuator.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Last commanded position of the pipe. The pipe is in an unknown position until
+// it is commanded for the first time.
+typedef enum { PIPE_UNKNOWN, PIPE_AT_REST, PIPE_DROPPING } ePipePosition;
+
+// The pipe of a station. The fields are private to the module
+typedef struct {
+  sActuator *pActuator;
+  // Token of the last command submitted to the pipe
+  sActuatorToken pipeToken;
+} sPipe;
+
 // Initialization/Termination functions
 // ----------------------------------------------------------------------------
 // Initializes the pipe by setting the position of the arm on the TowerPro
-// SG-5010 to it's initial position.
-void Pipe_init(void);
+// SG-5010 to it's initial position. The pipe is driven by _pActuator, on which
+// Actuator_init() must be called before.
+void Pipe_init(sPipe *_pPipe, sActuator *_pActuator);
 
 // Sets pipe motor arm back to it's initial position and disables the 
 // associated pwm.
-void Pipe_cleanup(void);
+void Pipe_cleanup(sPipe *_pPipe);
 
 // Behaviour functions
 // ----------------------------------------------------------------------------
+// Pipe commands are carried out by the actuator service thread and return
+// without waiting for the pipe to move. The returned token completes once the
+// pipe has had enough time to get to its new position.
+
 // Resets the pipe position by turning the arm attachment on the TowerPro
-// SG-5010 clockwise until the arm reaches it's initial position.
-void Pipe_resetPipePosition(void);
+// SG-5010 clockwise until the arm reaches it's initial position. Does not move
+// the pipe if it was already commanded to its initial position.
+sActuatorToken Pipe_resetPipePosition(sPipe *_pPipe);
 
 // Rotates the pipe position by turning the arm attachment on the TowerPro
-// SG-5010 counterclockwise to it's most left position.
-void Pipe_rotatePipeToDropBall(void);
+// SG-5010 counterclockwise to it's most left position. Does not move the pipe
+// if it was already commanded to that position.
+sActuatorToken Pipe_rotatePipeToDropBall(sPipe *_pPipe);
+
+// State functions
+// ----------------------------------------------------------------------------
+ePipePosition Pipe_getPosition(const sPipe *_pPipe);
+
+// Returns true if the pipe was commanded to _position and has had enough time
+// to travel there.
+bool Pipe_isPositionReached(const sPipe *_pPipe, ePipePosition _position);
+
+// Blocks until the pipe has finished every move commanded so far. Returns
+// immediately if the pipe has already settled.
+void Pipe_waitUntilSettled(const sPipe *_pPipe);
 
 #endif
@@ -0,0 +1,69 @@
+/*
+ * The realtime module applies a real-time scheduling profile to the recycler:
+ * every thread gets a SCHED_FIFO priority and a CPU according to its role, and
+ * the process memory is locked and prefaulted so that page faults do not
+ * delay the control path. The profile is optional, as it needs root.
+ *
+ * Whether or not the profile is applied, threads record how late they wake up
+ * compared to when they asked to, so that the control path can be shown to
+ * meet its deadlines.
+ */
+
+#ifndef _REALTIME_H_
+#define _REALTIME_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+  REALTIME_THREAD_SORTER,   // Main thread running the sorter event loop
+  REALTIME_THREAD_ACTUATOR, // Actuator service thread
+  REALTIME_THREAD_LIGHTS,   // Light animation thread
+  REALTIME_NUM_THREADS,
+} eRealtimeThread;
+
+#define REALTIME_NUM_LATENCY_BUCKETS 8
+
+typedef struct {
+  uint64_t numWakeups;
+  uint64_t numDeadlineMisses;
+  int64_t totalLatencyNs;
+  int64_t maxLatencyNs;
+  // Wakeups per latency bucket, see Realtime_printStats()
+  uint64_t buckets[REALTIME_NUM_LATENCY_BUCKETS];
+} sRealtimeLatencyStats;
+
+// Initialization/Termination functions
+// ----------------------------------------------------------------------------
+/* If _isEnabled, locks the current and future memory of the process and
+ * prefaults the stack of the calling thread, then configures it as the sorter
+ * thread. Should be called before any other thread is started. Otherwise, only
+ * latency statistics are kept. */
+void Realtime_init(bool _isEnabled);
+
+void Realtime_cleanup(void);
+
+// Profile functions
+// ----------------------------------------------------------------------------
+// Sets the scheduling policy, priority and CPU of _thread for its _role. Does
+// nothing unless the profile is enabled. Failures are reported, not fatal.
+void Realtime_configureThread(pthread_t _thread, eRealtimeThread _role);
+
+// As Realtime_configureThread(), with the thread moved _cpuOffset CPUs past
+// the CPU of its role, wrapping around. Lets the threads of several stations
+// spread over the CPUs.
+void Realtime_configureThreadOnCpu(pthread_t _thread, eRealtimeThread _role,
+                                   int _cpuOffset);
+
+// Statistics functions
+// ----------------------------------------------------------------------------
+// Records that a thread with _role woke up for something it expected at
+// _expectedTimeNs on the monotonic clock (see Timing_getMonotonicTimeNs()).
+void Realtime_recordWakeup(eRealtimeThread _role, int64_t _expectedTimeNs);
+
+sRealtimeLatencyStats Realtime_getStats(eRealtimeThread _role);
+
+void Realtime_printStats(void);
+
+#endif
@@ -0,0 +1,72 @@
+/*
+ * The scheduler module runs several sorting stations from one process, each
+ * on its own thread, spread over the CPUs. Termination signals are received
+ * by the scheduler alone and stop every station. A station that receives a
+ * quit command stops on its own; the scheduler returns once all have.
+ *
+ * Stations are described in a configuration file. A "station <name>" line
+ * starts a station, and the "<key> <value>" lines that follow describe it.
+ * Blank lines and lines starting with '#' are ignored.
+ *   sensorBus           i2c bus number of the color sensor (required)
+ *   muxAddress          address of the multiplexer of the sensor, if any
+ *   muxChannel          multiplexer channel of the sensor [0, 7]
+ *   threshold           object sensing threshold of the sensor
+ *   pipeServo           EHRPWM pin of the pipe servo, e.g. P8_13
+ *   gate1Servo          EHRPWM pin of the gate 1 servo
+ *   gate2Servo          EHRPWM pin of the gate 2 servo
+ *   delayProfile        file the learned delays of the station are kept in
+ *   calibrationProfile  file the white balance of the sensor is kept in
+ *   controlFifo         FIFO the station reads control commands from
+ *   lights              "on" to show the stages on the onboard LEDs
+ *   speculation         confidence percentage to pre-position the gates from
+ */
+
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+
+#include "station.h"
+
+#include <stdbool.h>
+
+#define SCHEDULER_MAX_STATIONS 4
+
+// Type definitions
+// ----------------------------------------------------------------------------
+typedef struct {
+  sStationConfig stations[SCHEDULER_MAX_STATIONS];
+  int numStations;
+} sSchedulerConfig;
+
+// Configuration functions
+// ----------------------------------------------------------------------------
+// Parses the station configuration file at _pPath into _pConfigOut. Returns
+// false, after reporting the offending line, if it cannot.
+bool Scheduler_loadConfig(const char *_pPath, sSchedulerConfig *_pConfigOut);
+
+/* Returns true if the stations can run together: every station has a sensor
+ * bus and PWM servo pins, and no two stations share a servo pin, a sensor,
+ * a profile, a control FIFO or a name. Sensors on the same bus must sit
+ * behind the same multiplexer, on different channels. At most one station may
+ * have the lights. Reports every problem found. */
+bool Scheduler_validateConfig(const sSchedulerConfig *_pConfig);
+
+// Initialization/Termination functions
+// ----------------------------------------------------------------------------
+/* Blocks SIGINT and SIGTERM so that they are received by the scheduler only,
+ * then initializes the lights if a station has them, and every station.
+ * Must be called before any other thread is started, so that every thread
+ * inherits the signal mask. Realtime_init() and BatchWriter_init() must be
+ * called before. The configuration must be valid. */
+void Scheduler_init(const sSchedulerConfig *_pConfig);
+
+void Scheduler_cleanup(void);
+
+// Behaviour functions
+// ----------------------------------------------------------------------------
+// Starts every station, and returns once a termination signal has stopped
+// them or they have all stopped on their own.
+void Scheduler_run(void);
+
+void Scheduler_printStats(void);
+
+#endif
@@ -3,14 +3,28 @@
  * reads and writes to the linux pwmchips enabled by the PWM overlays. The
  * period and duty cycle files for the servos may be written to for PWM control
  * of the motors and the servos may be enabled/unenabled and 
- * exported/unexported. */
+ * exported/unexported.
+ *
+ * The three servos of a station form a servo bank, driven from the PWM pins
+ * the station is wired to. Each station owns its bank. */
 
 #ifndef _SERVO_GAURD_H_
 #define _SERVO_GAURD_H_
 
+#include "batchWriter.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
 // Declaration of max buffer length for servo module
 #define MAX_BUFFER_LEN 1024
 
+// Number of servos in a bank (1 TowerPro SG-5010, 2 Micro Servo 98's)
+#define SERVO_NUM_SERVOS 3
+
+#define SERVO_DUTY_CYCLE_LEN 16
+
 // Structure to hold servo information
 typedef struct Servo {
 	int pin;
@@ -19,23 +33,72 @@ typedef struct Servo {
 	char *pwmchip;
 	char *pwmPath;
 	char *type;
+	int dutyCycleFd;	// Duty cycle attribute, open between init and cleanup
 } Servo;
 
+// Last commanded duty cycle of a servo, so that redundant writes (and the
+// settle time that comes with them) can be skipped
+typedef struct {
+	char dutyCycle[SERVO_DUTY_CYCLE_LEN];
+	bool isCommanded;
+	int64_t lastCommandTimeMs;
+} sServoState;
+
+// The fields are private to the module. The actuator service thread writes the
+// shadow states while stage logic reads them, hence the lock.
+typedef struct {
+	Servo servos[SERVO_NUM_SERVOS];
+	sServoState states[SERVO_NUM_SERVOS];
+	// Batch writer slots of the duty cycle attributes, -1 if not registered
+	int dutyCycleSlots[SERVO_NUM_SERVOS];
+	pthread_mutex_t statesMutex;
+} sServoBank;
+
+// PWM pins of the pipe servo and gates 1 and 2 on the original station
+extern const char *const SERVO_DEFAULT_PINS[SERVO_NUM_SERVOS];
+
 // Intializes the 1 TowerPro SG-5010 and 2 Micro Servo 98 SG90 servos by
 // finding the pwmchip path, exporting the pwm for the pwmchip, and setting the 
-// period.
-void Servo_init(void);
+// period. _pPins names the PWM pin of every servo of the bank, e.g. "P9_21",
+// the pipe servo first.
+void Servo_init(sServoBank *_pBank, const char *const _pPins[SERVO_NUM_SERVOS]);
 
 // Cleans up the pwms by unenabling, resting the duty cycle and period, and
 // unexporting the pwm form the pwmchip.
-void Servo_cleanup(void);
+void Servo_cleanup(sServoBank *_pBank);
+
+// Returns true if _pPin is a PWM pin a servo can be driven from.
+bool Servo_isPwmPin(const char *_pPin);
 
 // Can be used to move the servos in clockwise or counterclockwise direction by
 // changing the duty cycle.
 void Servo_changeDutyCycle(Servo _servo, const char *_newDutyCycle);
 
-// Get servo in the servo list via index.
-Servo Servo_getServo(int servoIndex);
+// Shadow state functions. These are thread-safe.
+// ----------------------------------------------------------------------------
+// Commands the servo at _servoIndex to _newDutyCycle through the servo's
+// shadow state. The sysfs write is skipped if the servo was already commanded
+// to that duty cycle. Returns true if a write was issued, false otherwise.
+bool Servo_commandDutyCycle(sServoBank *_pBank, int _servoIndex,
+							const char *_newDutyCycle);
+
+// Same as Servo_commandDutyCycle(), but the write is added to _pBatch, to be
+// issued when the batch is submitted.
+bool Servo_queueDutyCycle(sServoBank *_pBank, int _servoIndex,
+						  const char *_newDutyCycle,
+						  sBatchWriterBatch *_pBatch);
+
+// Returns true if the last duty cycle commanded to the servo at _servoIndex
+// through Servo_commandDutyCycle() is _dutyCycle.
+bool Servo_isCommandedTo(sServoBank *_pBank, int _servoIndex,
+						 const char *_dutyCycle);
+
+// Returns the milliseconds elapsed since the servo at _servoIndex was last
+// commanded through Servo_commandDutyCycle(), or INT64_MAX if it never was.
+int64_t Servo_getMsSinceLastCommand(sServoBank *_pBank, int _servoIndex);
+
+// Get servo in the bank via index.
+Servo Servo_getServo(const sServoBank *_pBank, int servoIndex);
 
 // Sends a signal to the pwm 'enable' file to enable or disable access to the 
 // pwm. 
@@ -5,14 +5,38 @@
  * Provides error messages for failures.
  */
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #ifndef SHELL_GAURD
 #define SHELL_GAURD
 
-// blocks and returns NULL if successful, a string pointer with an error message
+// Results of Shell_runCommand() other than an exit status
+#define SHELL_ERROR_SPAWN -1   // The command could not be started
+#define SHELL_ERROR_TIMEOUT -2 // The command was killed after the timeout
+#define SHELL_ERROR_SIGNAL -3  // The command was terminated by a signal
+
+// Pin and the mode to set it to, as given to config-pin (e.g. "P9_18", "i2c")
+typedef struct {
+  const char *pPin;
+  const char *pMode;
+} sShellPinMode;
+
+// Blocks and returns NULL if successful, a string pointer with an error message
 // if not.
 const char *Shell_execCommand(const char *_pCommandNameIn,
                               const char *_pArgsIn[], size_t _numArgs);
 
+/* Runs the executable at _pCommandPath with _numArgs arguments, and waits up
+ * to _timeoutMs (-1 waits forever) for it to exit. Returns its exit status,
+ * or one of the SHELL_ERROR values. */
+int Shell_runCommand(const char *_pCommandPath, const char *_pArgsIn[],
+                     size_t _numArgs, int64_t _timeoutMs);
+
+/* Sets every pin to its mode, skipping pins that are already in it. Modes are
+ * written to the pinmux state of the pins, and pins without one are set by a
+ * single config-pin invocation. Returns true if every pin was set. */
+bool Shell_setPinModes(const sShellPinMode *_pPinModes, size_t _numPins);
+
 #endif
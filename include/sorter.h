@@ -0,0 +1,172 @@
+/*
+ * The sorter module runs the sorting cycle as an event-driven state machine.
+ * A single epoll loop waits on sensor frames and stage timers (timerfd),
+ * actuator completions and stop requests (eventfd) and commands written to a
+ * control FIFO, so that any of them can be reacted to in the middle of a
+ * stage.
+ *
+ * Every state has a deadline after which it times out into another state. The
+ * states run as a pipeline: the next item is detected and classified while the
+ * pipe is still returning from the previous one, and the interlock module
+ * holds back the gates and the next drop until the mechanics allow them.
+ *
+ * While idle, the sorter reads one full-integration frame at a time, and
+ * bursts to reading every short frame once the luminance starts to move, until
+ * an arrival is confirmed or the ramp is quiet again. Object detection is
+ * recalibrated in passing when the idle frames show that the lighting has
+ * changed.
+ *
+ * Every station runs its own sorter, each on its own thread, with its own
+ * classifier, actuator, gates, pipe and control FIFO.
+ *
+ * The control FIFO accepts one command per line:
+ *   quit         stops the sorter
+ *   recalibrate  recalibrates object detection once the ramp is idle
+ *   whitebalance calibrates the white balance against a white reference held
+ *                in front of the sensor of an idle sorter
+ *   clear        declares a jammed item cleared by hand
+ *   status       prints the current state and statistics
+ */
+
+#ifndef _SORTER_H_
+#define _SORTER_H_
+
+#include "actuator.h"
+#include "autoTuner.h"
+#include "classifierModule.h"
+#include "gate.h"
+#include "interlock.h"
+#include "parkingPolicy.h"
+#include "pipe.h"
+#include "speculator.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SORTER_NAME_LEN 32
+#define SORTER_PATH_LEN 128
+
+// Type definitions
+// ----------------------------------------------------------------------------
+typedef enum {
+  SORTER_STATE_DETECTING,
+  SORTER_STATE_SPECULATING,
+  SORTER_STATE_SETTLING,
+  SORTER_STATE_CATEGORIZING,
+  SORTER_STATE_SORTING,
+  SORTER_STATE_DISPOSING,
+  SORTER_STATE_DEPARTING,
+  SORTER_STATE_JAMMED,
+  SORTER_STATE_RETURNING,
+  SORTER_NUM_STATES,
+} eSorterState;
+
+// The modules of the station the sorter runs, all initialized beforehand
+typedef struct {
+  sClassifierModule *pClassifier;
+  sActuator *pActuator;
+  sGates *pGates;
+  sPipe *pPipe;
+  sInterlock *pInterlock;
+  sSpeculator *pSpeculator;
+  sParkingPolicy *pParkingPolicy;
+  sAutoTuner *pAutoTuner;
+} sSorterModules;
+
+typedef struct {
+  // Prefixed to every message of the sorter, unless empty
+  const char *pName;
+  sSorterModules modules;
+  const char *pControlFifoPath;
+  // Whether the gates are pre-positioned from early color readings
+  bool isSpeculationEnabled;
+  // Whether the sorter shows its stages on the lights module, which must then
+  // be initialized beforehand. Only one sorter may.
+  bool hasLights;
+} sSorterConfig;
+
+// The fields are private to the module
+typedef struct {
+  char name[SORTER_NAME_LEN];
+  sClassifierModule *pClassifier;
+  sActuator *pActuator;
+  sGates *pGates;
+  sPipe *pPipe;
+  sInterlock *pInterlock;
+  sSpeculator *pSpeculator;
+  sParkingPolicy *pParkingPolicy;
+  sAutoTuner *pAutoTuner;
+  bool isSpeculationEnabled;
+  bool hasLights;
+
+  // Event loop state
+  int epollFd;
+  int wakeTimerFd;
+  int deadlineTimerFd;
+  int stopFd;
+  int controlFd;
+  // Monotonic times at which the timers were armed to expire
+  int64_t wakeExpiryTimeNs;
+  int64_t deadlineExpiryTimeNs;
+  char controlFifoPath[SORTER_PATH_LEN];
+
+  bool isRunning;
+  eSorterState state;
+  bool isTransitionPending;
+  eSorterState nextState;
+  eClassifierModule_FrameMode frameMode;
+  void (*pSetLights)(void);
+
+  // Sorting cycle state
+  bool isRecalibrationRequested;
+
+  int64_t detectedTimeMs;
+  int64_t settledAfterMs;
+  sClassifierModule_RestTracker restTracker;
+  sClassifierModule_DepartureTracker departureTracker;
+  sClassifierModule_ArrivalTracker arrivalTracker;
+  int64_t detectingStartTimeMs;
+  int64_t burstStartTimeMs;
+
+  bool hasPreliminaryReading;
+  eGateConfig preliminaryConfig;
+  uint32_t preliminaryConfidencePercent;
+
+  eClassifierModule_RefuseItemType itemType;
+  eGateConfig gateConfig;
+  eGateConfig parkingConfig;
+  int64_t dropTimeMs;
+
+  uint32_t numItemsSorted;
+  uint32_t numJams;
+
+  // Detection statistics: frames read and time spent idle, bursts of short
+  // frames, those that ended without an item, and their total time to arrival
+  uint64_t numDetectionReads;
+  int64_t detectingMs;
+  uint32_t numDetectionBursts;
+  uint32_t numQuietBursts;
+  int64_t burstToArrivalMs;
+} sSorter;
+
+// Initialization/Termination functions
+// ----------------------------------------------------------------------------
+// Creates the event file descriptors of the sorter and the control FIFO at
+// _pConfig->pControlFifoPath.
+void Sorter_init(sSorter *_pSorter, const sSorterConfig *_pConfig);
+
+void Sorter_cleanup(sSorter *_pSorter);
+
+// Behaviour functions
+// ----------------------------------------------------------------------------
+// Runs the sorting cycle until Sorter_stop() is called or a quit command is
+// received.
+void Sorter_run(sSorter *_pSorter);
+
+// Makes Sorter_run() return once the current event is handled. May be called
+// from any thread, including signal handlers.
+void Sorter_stop(sSorter *_pSorter);
+
+void Sorter_printStats(const sSorter *_pSorter);
+
+#endif
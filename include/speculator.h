@@ -0,0 +1,71 @@
+/*
+ * The speculator module pre-positions the gates from a preliminary
+ * classification, so that most of the gate travel happens while the sensor is
+ * still integrating the frame used for the final classification. The
+ * speculation is resolved against the final classification, and hits, misses,
+ * and the cost of rolling back misses are counted.
+ */
+
+#ifndef _SPECULATOR_H_
+#define _SPECULATOR_H_
+
+#include "gate.h"
+#include "interlock.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+  uint32_t numHits;
+  uint32_t numMisses;
+  // Preliminary classifications not confident enough to speculate on
+  uint32_t numSkipped;
+  // Gate moves made by misses that would not have been made otherwise
+  uint32_t numRollbackMoves;
+  // Gate actuation time spent on those moves, one travel time per transition
+  // however many gates it moved
+  int64_t rollbackCostMs;
+} sSpeculatorStats;
+
+// The speculator of a station. The fields are private to the module
+typedef struct {
+  sGates *pGates;
+  const sInterlock *pInterlock;
+  uint32_t confidenceThresholdPercent;
+  sSpeculatorStats stats;
+
+  // Pending speculation
+  bool isSpeculating;
+  eGateConfig speculatedConfig;
+  eGateConfig configBeforeSpeculation;
+  bool wasConfigKnown;
+} sSpeculator;
+
+// Initialization/Termination functions
+// ----------------------------------------------------------------------------
+// Speculates with _pGates, as far as _pInterlock allows. Preliminary
+// classifications with a confidence below _confidenceThresholdPercent are not
+// speculated on.
+void Speculator_init(sSpeculator *_pSpeculator, sGates *_pGates,
+                     const sInterlock *_pInterlock,
+                     uint32_t _confidenceThresholdPercent);
+void Speculator_cleanup(sSpeculator *_pSpeculator);
+
+// Speculation functions
+// ----------------------------------------------------------------------------
+/* Commands the gates to _config if _confidencePercent reaches the confidence
+ * threshold. Returns true if the gates were commanded. Does not block: returns
+ * false, without speculating, if the gates must move but the interlock does
+ * not allow it yet. See Interlock_getMsUntilGatesMayMove(). */
+bool Speculator_speculate(sSpeculator *_pSpeculator, eGateConfig _config,
+                          uint32_t _confidencePercent);
+
+// Resolves the pending speculation, if any, against the configuration of the
+// final classification. Does not move the gates; the caller must still command
+// _finalConfig.
+void Speculator_resolve(sSpeculator *_pSpeculator, eGateConfig _finalConfig);
+
+sSpeculatorStats Speculator_getStats(const sSpeculator *_pSpeculator);
+void Speculator_printStats(const sSpeculator *_pSpeculator);
+
+#endif
@@ -0,0 +1,108 @@
+/*
+ * The station module bundles everything one sorting station is made of: a
+ * color sensor behind its classifier, a bank of three servos driven by an
+ * actuator, the gates and pipe on top of it, and the interlock, speculator,
+ * parking policy, auto tuner and sorter that run the cycle. Stations share
+ * nothing but the I2C buses and the batch writer, so several of them can sort
+ * in parallel, each on its own thread.
+ */
+
+#ifndef _STATION_H_
+#define _STATION_H_
+
+#include "actuator.h"
+#include "autoTuner.h"
+#include "classifierModule.h"
+#include "colorSensor.h"
+#include "gate.h"
+#include "interlock.h"
+#include "parkingPolicy.h"
+#include "pipe.h"
+#include "servo.h"
+#include "sorter.h"
+#include "speculator.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define STATION_NAME_LEN SORTER_NAME_LEN
+#define STATION_PATH_LEN SORTER_PATH_LEN
+#define STATION_PIN_LEN 8
+
+// Type definitions
+// ----------------------------------------------------------------------------
+typedef struct {
+  // Prefixed to the messages of the station, unless empty
+  char name[STATION_NAME_LEN];
+  // The bus number is negative until one is set
+  sColorSensorConfig sensorConfig;
+  // EHRPWM pins of the pipe, gate 1 and gate 2 servos, e.g. "P9_21"
+  char servoPins[SERVO_NUM_SERVOS][STATION_PIN_LEN];
+  char delayProfilePath[STATION_PATH_LEN];
+  // File the white balance of the sensor is kept in
+  char calibrationProfilePath[STATION_PATH_LEN];
+  char controlFifoPath[STATION_PATH_LEN];
+  // Whether the station shows its stages on the onboard LEDs. Only one
+  // station may, and Lights_init() must be called before it is initialized.
+  bool hasLights;
+  bool isSpeculationEnabled;
+  uint32_t speculationConfidenceThreshold;
+} sStationConfig;
+
+// The fields are private to the module
+typedef struct {
+  sStationConfig config;
+  sServoBank servoBank;
+  sActuator actuator;
+  sGates gates;
+  sPipe pipe;
+  sInterlock interlock;
+  sSpeculator speculator;
+  sParkingPolicy parkingPolicy;
+  sAutoTuner autoTuner;
+  sClassifierModule classifier;
+  sSorter sorter;
+
+  int cpuOffset;
+  pthread_t thread;
+  bool isStarted;
+  // Written to once the sorter of the station has stopped, or -1
+  int stoppedFd;
+} sStation;
+
+// Configuration functions
+// ----------------------------------------------------------------------------
+/* Sets _pConfigOut to the defaults of a station named _pName: no sensor bus,
+ * no multiplexer, the default servo pins, no lights and no speculation. The
+ * delay profile, calibration profile and control FIFO paths are those of the
+ * single-station recycler, suffixed with the name unless it is empty. */
+void Station_initConfig(sStationConfig *_pConfigOut, const char *_pName);
+
+// Initialization/Termination functions
+// ----------------------------------------------------------------------------
+/* Initializes the hardware and modules of the station described by _pConfig.
+ * The threads of the station run on the CPUs of their realtime roles plus
+ * _cpuOffset. Realtime_init() and BatchWriter_init() must be called before.
+ * Blocks while the servos are homed and the sensor calibrated. */
+void Station_init(sStation *_pStation, const sStationConfig *_pConfig,
+                  int _cpuOffset);
+
+// Joins the station thread if it was started, then homes the servos and
+// releases the hardware. Saves the learned delays.
+void Station_cleanup(sStation *_pStation);
+
+// Behaviour functions
+// ----------------------------------------------------------------------------
+// Starts the sorting cycle of the station on a thread of its own. Once the
+// cycle stops, 1 is written to the eventfd _stoppedFd, unless it is -1.
+void Station_start(sStation *_pStation, int _stoppedFd);
+
+// Asks the sorting cycle to stop. Does not wait for it; see Station_cleanup().
+void Station_stop(sStation *_pStation);
+
+const char *Station_getName(const sStation *_pStation);
+
+void Station_printStats(const sStation *_pStation);
+
+#endif
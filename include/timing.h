@@ -13,4 +13,16 @@ void Timing_nanoSleep(int64_t _seconds, int64_t _nanoseconds);
 
 void Timing_milliSleep(int64_t _seconds, int64_t _milliseconds);
 
+// Pause the thread execution until the monotonic clock reaches _deadlineNs
+// (see Timing_getMonotonicTimeNs()). Periodic loops that sleep until
+// absolute deadlines do not accumulate the drift of relative sleeps.
+void Timing_sleepUntilNs(int64_t _deadlineNs);
+
+// Returns the time elapsed on the monotonic clock, in milliseconds. Only
+// meaningful when compared against another reading of the same clock.
+int64_t Timing_getMonotonicTimeMs(void);
+
+// Same as Timing_getMonotonicTimeMs(), in nanoseconds.
+int64_t Timing_getMonotonicTimeNs(void);
+
 #endif
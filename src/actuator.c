@@ -0,0 +1,322 @@
+/*
+ * Every actuator runs a service thread that consumes servo commands from a
+ * lock-free single-producer single-consumer queue. Each servo has its own
+ * channel within the service thread, so a servo that is still travelling only
+ * holds back the commands that were submitted to that same servo.
+ */
+
+#include "../include/actuator.h"
+#include "../include/batchWriter.h"
+#include "../include/realtime.h"
+#include "../include/timing.h"
+
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+const sActuatorToken ACTUATOR_TOKEN_COMPLETE = {{0}};
+
+// Function prototype declarations
+// ----------------------------------------------------------------------------
+static void Actuator_pushCommand(sActuator *_pActuator,
+                                 const sActuatorCommand *_pCommand);
+static void Actuator_drainQueue(sActuator *_pActuator);
+static void Actuator_completeSequence(sActuator *_pActuator, int _servoIndex,
+                                      uint64_t _sequence);
+static void Actuator_startNextCommand(sActuator *_pActuator,
+                                      sActuatorChannel *_pChannel,
+                                      int64_t _nowMs,
+                                      sBatchWriterBatch *_pBatch);
+static bool Actuator_serviceChannels(sActuator *_pActuator,
+                                     int *_pTimeoutMsOut);
+static void *Actuator_serviceThreadFunction(void *_args);
+
+// Initialization/Termination functions
+// ----------------------------------------------------------------------------
+void Actuator_init(sActuator *_pActuator, sServoBank *_pServoBank,
+                   int _cpuOffset)
+{
+  memset(_pActuator, 0, sizeof(*_pActuator));
+  _pActuator->pServoBank = _pServoBank;
+  _pActuator->cpuOffset = _cpuOffset;
+  pthread_mutex_init(&_pActuator->completionMutex, NULL);
+  pthread_cond_init(&_pActuator->completionCond, NULL);
+
+  _pActuator->wakeupFd = eventfd(0, 0);
+  if (_pActuator->wakeupFd < 0) {
+    perror("Actuator: Unable to create wakeup eventfd");
+    exit(EXIT_FAILURE);
+  }
+
+  _pActuator->completionFd = eventfd(0, EFD_NONBLOCK);
+  if (_pActuator->completionFd < 0) {
+    perror("Actuator: Unable to create completion eventfd");
+    exit(EXIT_FAILURE);
+  }
+
+  __atomic_store_n(&_pActuator->isRunning, true, __ATOMIC_RELEASE);
+  pthread_create(&_pActuator->serviceThread, NULL,
+                 &Actuator_serviceThreadFunction, _pActuator);
+  Realtime_configureThreadOnCpu(_pActuator->serviceThread,
+                                REALTIME_THREAD_ACTUATOR, _cpuOffset);
+}
+
+void Actuator_cleanup(sActuator *_pActuator)
+{
+  __atomic_store_n(&_pActuator->isRunning, false, __ATOMIC_RELEASE);
+  uint64_t wakeup = 1;
+  write(_pActuator->wakeupFd, &wakeup, sizeof(wakeup));
+  pthread_join(_pActuator->serviceThread, NULL);
+
+  close(_pActuator->wakeupFd);
+  _pActuator->wakeupFd = -1;
+  close(_pActuator->completionFd);
+  _pActuator->completionFd = -1;
+  pthread_cond_destroy(&_pActuator->completionCond);
+  pthread_mutex_destroy(&_pActuator->completionMutex);
+}
+
+// Command functions
+// ----------------------------------------------------------------------------
+sActuatorToken Actuator_submit(sActuator *_pActuator, int _servoIndex,
+                               const char *_dutyCycle, int64_t _travelTimeMs)
+{
+  sActuatorToken token = ACTUATOR_TOKEN_COMPLETE;
+  if (Actuator_isSubmittedTo(_pActuator, _servoIndex, _dutyCycle)) {
+    token.sequences[_servoIndex] =
+        _pActuator->lastSubmittedSequences[_servoIndex];
+    return token;
+  }
+
+  sActuatorCommand command;
+  command.servoIndex = _servoIndex;
+  snprintf(command.dutyCycle, SERVO_DUTY_CYCLE_LEN, "%s", _dutyCycle);
+  command.travelTimeMs = _travelTimeMs;
+  command.sequence = ++_pActuator->lastSubmittedSequences[_servoIndex];
+  Actuator_pushCommand(_pActuator, &command);
+
+  snprintf(_pActuator->submittedDutyCycles[_servoIndex], SERVO_DUTY_CYCLE_LEN,
+           "%s", _dutyCycle);
+  _pActuator->hasSubmitted[_servoIndex] = true;
+
+  token.sequences[_servoIndex] = command.sequence;
+  return token;
+}
+
+bool Actuator_isSubmittedTo(const sActuator *_pActuator, int _servoIndex,
+                            const char *_dutyCycle)
+{
+  return _pActuator->hasSubmitted[_servoIndex] &&
+         strcmp(_pActuator->submittedDutyCycles[_servoIndex], _dutyCycle) == 0;
+}
+
+sServoBank *Actuator_getServoBank(sActuator *_pActuator)
+{
+  return _pActuator->pServoBank;
+}
+
+// Token functions
+// ----------------------------------------------------------------------------
+sActuatorToken Actuator_combineTokens(sActuatorToken _token1,
+                                      sActuatorToken _token2)
+{
+  sActuatorToken combined;
+  for (int i = 0; i < SERVO_NUM_SERVOS; i++) {
+    combined.sequences[i] = _token1.sequences[i] > _token2.sequences[i]
+                                ? _token1.sequences[i]
+                                : _token2.sequences[i];
+  }
+
+  return combined;
+}
+
+bool Actuator_isComplete(sActuator *_pActuator, sActuatorToken _token)
+{
+  for (int i = 0; i < SERVO_NUM_SERVOS; i++) {
+    uint64_t completed =
+        __atomic_load_n(&_pActuator->completedSequences[i], __ATOMIC_ACQUIRE);
+    if (completed < _token.sequences[i]) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void Actuator_wait(sActuator *_pActuator, sActuatorToken _token)
+{
+  if (Actuator_isComplete(_pActuator, _token)) {
+    return;
+  }
+
+  pthread_mutex_lock(&_pActuator->completionMutex);
+  while (!Actuator_isComplete(_pActuator, _token)) {
+    pthread_cond_wait(&_pActuator->completionCond,
+                      &_pActuator->completionMutex);
+  }
+  pthread_mutex_unlock(&_pActuator->completionMutex);
+}
+
+int Actuator_getCompletionFd(const sActuator *_pActuator)
+{
+  return _pActuator->completionFd;
+}
+
+// Queue functions
+// ----------------------------------------------------------------------------
+static void Actuator_pushCommand(sActuator *_pActuator,
+                                 const sActuatorCommand *_pCommand)
+{
+  uint32_t head = __atomic_load_n(&_pActuator->queueHead, __ATOMIC_RELAXED);
+
+  // Queue full; the service thread drains it as soon as a channel frees up
+  while (head - __atomic_load_n(&_pActuator->queueTail, __ATOMIC_ACQUIRE) ==
+         ACTUATOR_QUEUE_SIZE) {
+    Timing_milliSleep(0, 1);
+  }
+
+  _pActuator->commandQueue[head % ACTUATOR_QUEUE_SIZE] = *_pCommand;
+  __atomic_store_n(&_pActuator->queueHead, head + 1, __ATOMIC_RELEASE);
+
+  uint64_t wakeup = 1;
+  write(_pActuator->wakeupFd, &wakeup, sizeof(wakeup));
+}
+
+// Moves commands from the queue to the channel of their servo, stopping at the
+// first command whose channel is full.
+static void Actuator_drainQueue(sActuator *_pActuator)
+{
+  uint32_t tail = __atomic_load_n(&_pActuator->queueTail, __ATOMIC_RELAXED);
+  uint32_t head = __atomic_load_n(&_pActuator->queueHead, __ATOMIC_ACQUIRE);
+
+  while (tail != head) {
+    sActuatorCommand *command =
+        &_pActuator->commandQueue[tail % ACTUATOR_QUEUE_SIZE];
+    sActuatorChannel *channel = &_pActuator->channels[command->servoIndex];
+    if (channel->pendingHead - channel->pendingTail == ACTUATOR_QUEUE_SIZE) {
+      break;
+    }
+
+    channel->pending[channel->pendingHead++ % ACTUATOR_QUEUE_SIZE] = *command;
+    tail++;
+  }
+
+  __atomic_store_n(&_pActuator->queueTail, tail, __ATOMIC_RELEASE);
+}
+
+// Service thread functions
+// ----------------------------------------------------------------------------
+static void Actuator_completeSequence(sActuator *_pActuator, int _servoIndex,
+                                      uint64_t _sequence)
+{
+  __atomic_store_n(&_pActuator->completedSequences[_servoIndex], _sequence,
+                   __ATOMIC_RELEASE);
+
+  pthread_mutex_lock(&_pActuator->completionMutex);
+  pthread_cond_broadcast(&_pActuator->completionCond);
+  pthread_mutex_unlock(&_pActuator->completionMutex);
+
+  uint64_t completion = 1;
+  write(_pActuator->completionFd, &completion, sizeof(completion));
+}
+
+static void Actuator_startNextCommand(sActuator *_pActuator,
+                                      sActuatorChannel *_pChannel,
+                                      int64_t _nowMs,
+                                      sBatchWriterBatch *_pBatch)
+{
+  sActuatorCommand *command =
+      &_pChannel->pending[_pChannel->pendingTail++ % ACTUATOR_QUEUE_SIZE];
+
+  // If the servo was already commanded there, only the travel time left from
+  // that earlier command needs to pass.
+  Servo_queueDutyCycle(_pActuator->pServoBank, command->servoIndex,
+                       command->dutyCycle, _pBatch);
+  int64_t elapsedMs = Servo_getMsSinceLastCommand(_pActuator->pServoBank,
+                                                  command->servoIndex);
+  int64_t remainingMs = command->travelTimeMs - elapsedMs;
+
+  _pChannel->isMoving = true;
+  _pChannel->movingSequence = command->sequence;
+  _pChannel->doneTimeMs = _nowMs + (remainingMs > 0 ? remainingMs : 0);
+}
+
+// Completes the commands whose travel time is over and starts the next ones,
+// writing the duty cycles of every servo started as one batch. Sets the time
+// until the next command completes (-1 if none is moving), and returns true if
+// every channel is idle.
+static bool Actuator_serviceChannels(sActuator *_pActuator,
+                                     int *_pTimeoutMsOut)
+{
+  int64_t nowMs = Timing_getMonotonicTimeMs();
+  bool isIdle = true;
+  *_pTimeoutMsOut = -1;
+
+  sBatchWriterBatch batch;
+  BatchWriter_initBatch(&batch);
+
+  for (int i = 0; i < SERVO_NUM_SERVOS; i++) {
+    sActuatorChannel *channel = &_pActuator->channels[i];
+
+    while (true) {
+      if (channel->isMoving && nowMs >= channel->doneTimeMs) {
+        channel->isMoving = false;
+        Actuator_completeSequence(_pActuator, i, channel->movingSequence);
+      }
+
+      if (channel->isMoving || channel->pendingTail == channel->pendingHead) {
+        break;
+      }
+
+      Actuator_startNextCommand(_pActuator, channel, nowMs, &batch);
+    }
+
+    if (channel->isMoving) {
+      isIdle = false;
+      int timeoutMs = (int)(channel->doneTimeMs - nowMs);
+      if (*_pTimeoutMsOut < 0 || timeoutMs < *_pTimeoutMsOut) {
+        *_pTimeoutMsOut = timeoutMs;
+      }
+    }
+  }
+
+  BatchWriter_submit(&batch);
+  return isIdle;
+}
+
+static void *Actuator_serviceThreadFunction(void *_args)
+{
+  sActuator *actuator = _args;
+  while (true) {
+    Actuator_drainQueue(actuator);
+
+    int timeoutMs;
+    bool isIdle = Actuator_serviceChannels(actuator, &timeoutMs);
+    bool isQueueEmpty =
+        __atomic_load_n(&actuator->queueTail, __ATOMIC_RELAXED) ==
+        __atomic_load_n(&actuator->queueHead, __ATOMIC_ACQUIRE);
+    if (isIdle && isQueueEmpty &&
+        !__atomic_load_n(&actuator->isRunning, __ATOMIC_ACQUIRE)) {
+      break;
+    }
+
+    struct pollfd wakeupPollFd = {actuator->wakeupFd, POLLIN, 0};
+    int64_t expectedTimeNs =
+        Timing_getMonotonicTimeNs() + (int64_t)timeoutMs * 1000000;
+    int numReady = poll(&wakeupPollFd, 1, timeoutMs);
+    if (numReady > 0) {
+      uint64_t wakeups;
+      read(actuator->wakeupFd, &wakeups, sizeof(wakeups));
+    }
+    else if (numReady == 0) {
+      // Timed out for a servo to finish travelling
+      Realtime_recordWakeup(REALTIME_THREAD_ACTUATOR, expectedTimeNs);
+    }
+  }
+
+  return NULL;
+}
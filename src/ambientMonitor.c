@@ -0,0 +1,133 @@
+/*
+ * The ambient monitor module keeps the moving average in Q8, so that frames
+ * that differ from it by less than the weight divisor still move it.
+ */
+
+#include "../include/ambientMonitor.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Every frame moves the average by 1/AVERAGE_WEIGHT_DIVISOR of its difference
+static const int64_t AVERAGE_WEIGHT_DIVISOR = 8;
+
+// Time the average must stay a shift away from the baseline. Longer than an
+// item takes to roll past the sensor, at any frame rate.
+static const int64_t SHIFT_CONFIRMATION_MS = 5000;
+
+// Time within which AMBIENT_MONITOR_BURST_LEN false triggers make a burst
+static const int64_t FALSE_TRIGGER_BURST_WINDOW_MS = 60000;
+
+static void AmbientMonitor_restart(sAmbientMonitor *_pMonitor,
+                                   int32_t _baselineLuminance);
+
+// Initialization/Termination functions
+// ----------------------------------------------------------------------------
+void AmbientMonitor_init(sAmbientMonitor *_pMonitor,
+                         int32_t _baselineLuminance, int32_t _shiftLuminance)
+{
+  _pMonitor->shiftLuminance = _shiftLuminance > 0 ? _shiftLuminance : 1;
+  _pMonitor->stats = (sAmbientMonitorStats){0};
+  AmbientMonitor_restart(_pMonitor, _baselineLuminance);
+}
+
+void AmbientMonitor_cleanup(sAmbientMonitor *_pMonitor)
+{
+  _pMonitor->numRecentFalseTriggers = 0;
+}
+
+// Monitoring functions
+// ----------------------------------------------------------------------------
+void AmbientMonitor_setBaseline(sAmbientMonitor *_pMonitor,
+                                int32_t _baselineLuminance)
+{
+  AmbientMonitor_restart(_pMonitor, _baselineLuminance);
+}
+
+static void AmbientMonitor_restart(sAmbientMonitor *_pMonitor,
+                                   int32_t _baselineLuminance)
+{
+  _pMonitor->baselineLuminance = _baselineLuminance;
+  _pMonitor->averageLuminanceQ8 = (int64_t)_baselineLuminance * 256;
+  _pMonitor->isShifted = false;
+  _pMonitor->numRecentFalseTriggers = 0;
+}
+
+bool AmbientMonitor_recordEmptyFrame(sAmbientMonitor *_pMonitor,
+                                     int32_t _luminance, int64_t _timeMs)
+{
+  _pMonitor->stats.numEmptyFrames++;
+  _pMonitor->averageLuminanceQ8 +=
+      ((int64_t)_luminance * 256 - _pMonitor->averageLuminanceQ8) /
+      AVERAGE_WEIGHT_DIVISOR;
+
+  int32_t shift = AmbientMonitor_getAmbientLuminance(_pMonitor) -
+                  _pMonitor->baselineLuminance;
+  if (abs(shift) < _pMonitor->shiftLuminance) {
+    _pMonitor->isShifted = false;
+    return false;
+  }
+
+  if (!_pMonitor->isShifted) {
+    _pMonitor->isShifted = true;
+    _pMonitor->shiftStartTimeMs = _timeMs;
+  }
+  if (_timeMs - _pMonitor->shiftStartTimeMs < SHIFT_CONFIRMATION_MS) {
+    return false;
+  }
+
+  _pMonitor->stats.numShiftRecalibrations++;
+  return true;
+}
+
+void AmbientMonitor_recordItem(sAmbientMonitor *_pMonitor)
+{
+  _pMonitor->averageLuminanceQ8 = (int64_t)_pMonitor->baselineLuminance * 256;
+  _pMonitor->isShifted = false;
+}
+
+bool AmbientMonitor_recordFalseTrigger(sAmbientMonitor *_pMonitor,
+                                       int64_t _timeMs)
+{
+  _pMonitor->stats.numFalseTriggers++;
+
+  // Keep the latest triggers, oldest first
+  if (_pMonitor->numRecentFalseTriggers == AMBIENT_MONITOR_BURST_LEN) {
+    for (int i = 1; i < AMBIENT_MONITOR_BURST_LEN; i++) {
+      _pMonitor->falseTriggerTimesMs[i - 1] =
+          _pMonitor->falseTriggerTimesMs[i];
+    }
+    _pMonitor->numRecentFalseTriggers--;
+  }
+  _pMonitor->falseTriggerTimesMs[_pMonitor->numRecentFalseTriggers++] =
+      _timeMs;
+
+  if (_pMonitor->numRecentFalseTriggers < AMBIENT_MONITOR_BURST_LEN ||
+      _timeMs - _pMonitor->falseTriggerTimesMs[0] >
+          FALSE_TRIGGER_BURST_WINDOW_MS) {
+    return false;
+  }
+
+  _pMonitor->stats.numBurstRecalibrations++;
+  return true;
+}
+
+int32_t AmbientMonitor_getAmbientLuminance(const sAmbientMonitor *_pMonitor)
+{
+  return (int32_t)(_pMonitor->averageLuminanceQ8 / 256);
+}
+
+sAmbientMonitorStats AmbientMonitor_getStats(const sAmbientMonitor *_pMonitor)
+{
+  return _pMonitor->stats;
+}
+
+void AmbientMonitor_printStats(const sAmbientMonitor *_pMonitor)
+{
+  const sAmbientMonitorStats *stats = &_pMonitor->stats;
+  printf("Ambient light: %llu empty-ramp frames, %u false triggers (phantom "
+         "cycles prevented), %u recalibrations for a shift and %u for false "
+         "triggers.\n",
+         (unsigned long long)stats->numEmptyFrames, stats->numFalseTriggers,
+         stats->numShiftRecalibrations, stats->numBurstRecalibrations);
+}
@@ -0,0 +1,223 @@
+/*
+ * The auto tuner module keeps the last observations of every delay in a ring
+ * buffer. Once enough observations are available, the delay moves a fraction
+ * of the way towards the 95th percentile plus a margin when shrinking, and
+ * straight to it when growing.
+ */
+
+#include "../include/autoTuner.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PROFILE_LINE_LEN 128
+
+// Observations needed before a delay is tuned
+static const uint32_t MIN_OBSERVATIONS = 8;
+
+// Percentile of the observations the delay is tuned to
+static const uint32_t TARGET_PERCENTILE = 95;
+
+// Safety margin added to the percentile: a percentage of it, but no less than
+// a minimum
+static const int64_t MARGIN_PERCENT = 25;
+static const int64_t MIN_MARGIN_MS = 50;
+
+// Percentage of the distance to the target covered by every shrinking step
+static const int64_t SHRINK_STEP_PERCENT = 25;
+
+// Delay definitions
+// ----------------------------------------------------------------------------
+typedef struct {
+  const char *name;
+  int64_t defaultMs;
+  int64_t floorMs;
+} sTunedDelayDefinition;
+
+static const sTunedDelayDefinition m_definitions[AUTO_TUNER_NUM_DELAYS] = {
+    [AUTO_TUNER_ARRIVAL_SETTLE] = {"arrivalSettle", 700, 250},
+    [AUTO_TUNER_DEPARTURE_TIMEOUT] = {"departureTimeout", 4000, 1000},
+};
+
+static void AutoTuner_loadProfile(sAutoTuner *_pTuner);
+static void AutoTuner_saveProfile(const sAutoTuner *_pTuner);
+static int64_t AutoTuner_getPercentile(const sAutoTunerDelay *_pDelay,
+                                       uint32_t _percentile);
+static int64_t AutoTuner_clamp(eAutoTunerDelay _delay, int64_t _delayMs);
+static int AutoTuner_compareInt64(const void *_pA, const void *_pB);
+
+// Initialization/Termination functions
+// ----------------------------------------------------------------------------
+void AutoTuner_init(sAutoTuner *_pTuner, const char *_pProfilePath)
+{
+  snprintf(_pTuner->profilePath, AUTO_TUNER_PATH_LEN, "%s", _pProfilePath);
+
+  for (int i = 0; i < AUTO_TUNER_NUM_DELAYS; i++) {
+    _pTuner->delays[i].currentMs = m_definitions[i].defaultMs;
+    _pTuner->delays[i].numObservations = 0;
+    _pTuner->delays[i].nextObservation = 0;
+    _pTuner->delays[i].numFailures = 0;
+  }
+
+  AutoTuner_loadProfile(_pTuner);
+}
+
+void AutoTuner_cleanup(sAutoTuner *_pTuner)
+{
+  AutoTuner_saveProfile(_pTuner);
+}
+
+// Tuning functions
+// ----------------------------------------------------------------------------
+int64_t AutoTuner_getDelayMs(const sAutoTuner *_pTuner, eAutoTunerDelay _delay)
+{
+  return _pTuner->delays[_delay].currentMs;
+}
+
+void AutoTuner_recordObservation(sAutoTuner *_pTuner, eAutoTunerDelay _delay,
+                                 int64_t _observedMs)
+{
+  sAutoTunerDelay *delay = &_pTuner->delays[_delay];
+  delay->observations[delay->nextObservation] = _observedMs;
+  delay->nextObservation =
+      (delay->nextObservation + 1) % AUTO_TUNER_MAX_OBSERVATIONS;
+  if (delay->numObservations < AUTO_TUNER_MAX_OBSERVATIONS) {
+    delay->numObservations++;
+  }
+
+  if (delay->numObservations < MIN_OBSERVATIONS) {
+    return;
+  }
+
+  int64_t percentileMs = AutoTuner_getPercentile(delay, TARGET_PERCENTILE);
+  int64_t marginMs = percentileMs * MARGIN_PERCENT / 100;
+  if (marginMs < MIN_MARGIN_MS) {
+    marginMs = MIN_MARGIN_MS;
+  }
+  int64_t targetMs = AutoTuner_clamp(_delay, percentileMs + marginMs);
+
+  // Growing is a safety matter, shrinking is not. Steps are rounded up so the
+  // delay does reach its target.
+  int64_t newDelayMs = targetMs;
+  if (targetMs < delay->currentMs) {
+    int64_t stepMs =
+        ((delay->currentMs - targetMs) * SHRINK_STEP_PERCENT + 99) / 100;
+    newDelayMs = delay->currentMs - stepMs;
+  }
+
+  if (newDelayMs != delay->currentMs) {
+    delay->currentMs = newDelayMs;
+    AutoTuner_saveProfile(_pTuner);
+  }
+}
+
+void AutoTuner_recordFailure(sAutoTuner *_pTuner, eAutoTunerDelay _delay)
+{
+  sAutoTunerDelay *delay = &_pTuner->delays[_delay];
+  int64_t defaultMs = m_definitions[_delay].defaultMs;
+  delay->numFailures++;
+  delay->numObservations = 0;
+  delay->nextObservation = 0;
+
+  // Double the delay, up to its default
+  delay->currentMs =
+      delay->currentMs * 2 < defaultMs ? delay->currentMs * 2 : defaultMs;
+  AutoTuner_saveProfile(_pTuner);
+}
+
+void AutoTuner_printStats(const sAutoTuner *_pTuner)
+{
+  for (int i = 0; i < AUTO_TUNER_NUM_DELAYS; i++) {
+    const sAutoTunerDelay *delay = &_pTuner->delays[i];
+    printf("Delay %s: %lld ms (default %lld ms), %u observations, %u "
+           "failures.\n",
+           m_definitions[i].name, (long long)delay->currentMs,
+           (long long)m_definitions[i].defaultMs, delay->numObservations,
+           delay->numFailures);
+  }
+}
+
+// Profile functions
+// ----------------------------------------------------------------------------
+// The profile holds one "name value" line per delay.
+static void AutoTuner_loadProfile(sAutoTuner *_pTuner)
+{
+  FILE *pFile = fopen(_pTuner->profilePath, "r");
+  if (pFile == NULL) {
+    printf("No delay profile at %s, using default delays.\n",
+           _pTuner->profilePath);
+    return;
+  }
+
+  char line[PROFILE_LINE_LEN];
+  while (fgets(line, PROFILE_LINE_LEN, pFile) != NULL) {
+    char name[PROFILE_LINE_LEN];
+    long long valueMs;
+    if (sscanf(line, "%127s %lld", name, &valueMs) != 2) {
+      continue;
+    }
+
+    for (int i = 0; i < AUTO_TUNER_NUM_DELAYS; i++) {
+      if (strcmp(name, m_definitions[i].name) == 0) {
+        _pTuner->delays[i].currentMs = AutoTuner_clamp(i, valueMs);
+      }
+    }
+  }
+
+  fclose(pFile);
+}
+
+static void AutoTuner_saveProfile(const sAutoTuner *_pTuner)
+{
+  FILE *pFile = fopen(_pTuner->profilePath, "w");
+  if (pFile == NULL) {
+    fprintf(stderr, "Unable to save delay profile to %s.\n",
+            _pTuner->profilePath);
+    return;
+  }
+
+  for (int i = 0; i < AUTO_TUNER_NUM_DELAYS; i++) {
+    fprintf(pFile, "%s %lld\n", m_definitions[i].name,
+            (long long)_pTuner->delays[i].currentMs);
+  }
+
+  fclose(pFile);
+}
+
+// Helper functions
+// ----------------------------------------------------------------------------
+static int64_t AutoTuner_getPercentile(const sAutoTunerDelay *_pDelay,
+                                       uint32_t _percentile)
+{
+  int64_t sorted[AUTO_TUNER_MAX_OBSERVATIONS];
+  memcpy(sorted, _pDelay->observations,
+         _pDelay->numObservations * sizeof(sorted[0]));
+  qsort(sorted, _pDelay->numObservations, sizeof(sorted[0]),
+        &AutoTuner_compareInt64);
+
+  // Nearest-rank percentile
+  uint32_t rank = (_percentile * _pDelay->numObservations + 99) / 100;
+  return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static int64_t AutoTuner_clamp(eAutoTunerDelay _delay, int64_t _delayMs)
+{
+  const sTunedDelayDefinition *definition = &m_definitions[_delay];
+  if (_delayMs < definition->floorMs) {
+    return definition->floorMs;
+  }
+  else if (_delayMs > definition->defaultMs) {
+    return definition->defaultMs;
+  }
+
+  return _delayMs;
+}
+
+static int AutoTuner_compareInt64(const void *_pA, const void *_pB)
+{
+  int64_t a = *(const int64_t *)_pA;
+  int64_t b = *(const int64_t *)_pB;
+  return (a > b) - (a < b);
+}
@@ -0,0 +1,481 @@
+/*
+ * The batch writer module talks to io_uring through its raw system calls, so
+ * that it needs no library. Every write in flight owns an entry of a fixed
+ * pool, which holds a copy of its value until the kernel completes it, and
+ * completions are reaped on the next submission. A write to an attribute that
+ * still has one in flight waits for it first, which keeps writes to the same
+ * attribute in order.
+ */
+
+// syscall() is a GNU extension
+#define _GNU_SOURCE
+
+#include "../include/batchWriter.h"
+#include "../include/file.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// Toolchains with older kernel headers only get the pwrite() path
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define BATCH_WRITER_HAS_RING
+#endif
+#endif
+
+#define RING_ENTRIES 32
+
+// Registration state
+// ----------------------------------------------------------------------------
+static pthread_mutex_t m_mutex = PTHREAD_MUTEX_INITIALIZER;
+static bool m_isSlotUsed[BATCH_WRITER_MAX_FDS];
+static int m_fds[BATCH_WRITER_MAX_FDS];
+static uint32_t m_numSlotWritesInFlight[BATCH_WRITER_MAX_FDS];
+static sBatchWriterStats m_stats;
+
+static void BatchWriter_writeDirectly(int _slot, const char *_pValue);
+
+#ifdef BATCH_WRITER_HAS_RING
+// Ring state
+// ----------------------------------------------------------------------------
+typedef struct {
+  bool isInUse;
+  int slot;
+  char value[BATCH_WRITER_VALUE_LEN];
+  struct iovec iov;
+} sRingWrite;
+
+static bool m_isRingEnabled;
+static int m_ringFd = -1;
+static bool m_areFilesRegistered;
+static bool m_isSlotFixed[BATCH_WRITER_MAX_FDS];
+
+static void *m_sqRing = MAP_FAILED;
+static size_t m_sqRingSize;
+static void *m_cqRing = MAP_FAILED;
+static size_t m_cqRingSize;
+static struct io_uring_sqe *m_sqes = MAP_FAILED;
+static size_t m_sqesSize;
+
+static uint32_t *m_sqTail;
+static uint32_t *m_sqMask;
+static uint32_t *m_sqArray;
+static uint32_t *m_cqHead;
+static uint32_t *m_cqTail;
+static uint32_t *m_cqMask;
+static struct io_uring_cqe *m_cqes;
+
+static sRingWrite m_ringWrites[RING_ENTRIES];
+static uint32_t m_numRingWritesInFlight;
+// Entries added to the submission queue, but not submitted yet
+static uint32_t m_numQueued;
+
+static bool BatchWriter_setUpRing(void);
+static void BatchWriter_tearDownRing(void);
+static void BatchWriter_registerFiles(void);
+static void BatchWriter_updateFile(int _slot, int _fd);
+static void BatchWriter_queueRingWrite(int _slot, const char *_pValue);
+static bool BatchWriter_enterRing(uint32_t _minComplete);
+static void BatchWriter_waitForSlotLocked(int _slot);
+static void BatchWriter_reapCompletions(void);
+#endif
+
+// Initialization/Termination functions
+// ----------------------------------------------------------------------------
+void BatchWriter_init(bool _isRingEnabled)
+{
+  pthread_mutex_lock(&m_mutex);
+  memset(m_isSlotUsed, 0, sizeof(m_isSlotUsed));
+  memset(m_numSlotWritesInFlight, 0, sizeof(m_numSlotWritesInFlight));
+  memset(&m_stats, 0, sizeof(m_stats));
+
+  if (_isRingEnabled) {
+#ifdef BATCH_WRITER_HAS_RING
+    m_isRingEnabled = BatchWriter_setUpRing();
+    if (m_isRingEnabled) {
+      BatchWriter_registerFiles();
+    }
+#else
+    printf("BatchWriter: Built without io_uring, falling back to pwrite.\n");
+#endif
+  }
+  pthread_mutex_unlock(&m_mutex);
+}
+
+void BatchWriter_cleanup(void)
+{
+  pthread_mutex_lock(&m_mutex);
+#ifdef BATCH_WRITER_HAS_RING
+  if (m_isRingEnabled) {
+    bool isEntered = true;
+    while (m_numRingWritesInFlight > 0 && isEntered) {
+      isEntered = BatchWriter_enterRing(1);
+    }
+    BatchWriter_tearDownRing();
+    m_isRingEnabled = false;
+  }
+#endif
+  memset(m_isSlotUsed, 0, sizeof(m_isSlotUsed));
+  pthread_mutex_unlock(&m_mutex);
+}
+
+// Registration functions
+// ----------------------------------------------------------------------------
+int BatchWriter_registerFd(int _fd)
+{
+  pthread_mutex_lock(&m_mutex);
+  int slot = -1;
+  for (int i = 0; i < BATCH_WRITER_MAX_FDS && slot < 0; i++) {
+    if (!m_isSlotUsed[i]) {
+      slot = i;
+    }
+  }
+
+  if (slot >= 0) {
+    m_isSlotUsed[slot] = true;
+    m_fds[slot] = _fd;
+    m_numSlotWritesInFlight[slot] = 0;
+#ifdef BATCH_WRITER_HAS_RING
+    BatchWriter_updateFile(slot, _fd);
+#endif
+  }
+  pthread_mutex_unlock(&m_mutex);
+  return slot;
+}
+
+void BatchWriter_unregisterFd(int _slot)
+{
+  if (_slot < 0) {
+    return;
+  }
+
+  pthread_mutex_lock(&m_mutex);
+#ifdef BATCH_WRITER_HAS_RING
+  BatchWriter_waitForSlotLocked(_slot);
+  BatchWriter_updateFile(_slot, -1);
+#endif
+  m_isSlotUsed[_slot] = false;
+  m_fds[_slot] = -1;
+  pthread_mutex_unlock(&m_mutex);
+}
+
+void BatchWriter_waitForSlot(int _slot)
+{
+  if (_slot < 0) {
+    return;
+  }
+
+#ifdef BATCH_WRITER_HAS_RING
+  pthread_mutex_lock(&m_mutex);
+  BatchWriter_waitForSlotLocked(_slot);
+  pthread_mutex_unlock(&m_mutex);
+#endif
+}
+
+// Batch functions
+// ----------------------------------------------------------------------------
+void BatchWriter_initBatch(sBatchWriterBatch *_pBatch)
+{
+  _pBatch->numWrites = 0;
+}
+
+bool BatchWriter_add(sBatchWriterBatch *_pBatch, int _slot,
+                     const char *_pValue)
+{
+  if (strlen(_pValue) >= BATCH_WRITER_VALUE_LEN) {
+    return false;
+  }
+
+  int index = 0;
+  while (index < _pBatch->numWrites && _pBatch->slots[index] != _slot) {
+    index++;
+  }
+  if (index == BATCH_WRITER_MAX_WRITES) {
+    return false;
+  }
+  if (index == _pBatch->numWrites) {
+    _pBatch->numWrites++;
+  }
+
+  _pBatch->slots[index] = _slot;
+  snprintf(_pBatch->values[index], BATCH_WRITER_VALUE_LEN, "%s", _pValue);
+  return true;
+}
+
+void BatchWriter_submit(sBatchWriterBatch *_pBatch)
+{
+  if (_pBatch->numWrites == 0) {
+    return;
+  }
+
+  pthread_mutex_lock(&m_mutex);
+  m_stats.numBatches++;
+  for (int i = 0; i < _pBatch->numWrites; i++) {
+    int slot = _pBatch->slots[i];
+    if (slot < 0 || slot >= BATCH_WRITER_MAX_FDS || !m_isSlotUsed[slot]) {
+      m_stats.numFailedWrites++;
+      continue;
+    }
+
+    m_stats.numWrites++;
+#ifdef BATCH_WRITER_HAS_RING
+    if (m_isRingEnabled) {
+      BatchWriter_queueRingWrite(slot, _pBatch->values[i]);
+      continue;
+    }
+#endif
+    BatchWriter_writeDirectly(slot, _pBatch->values[i]);
+  }
+
+#ifdef BATCH_WRITER_HAS_RING
+  if (m_isRingEnabled) {
+    BatchWriter_enterRing(0);
+  }
+#endif
+  pthread_mutex_unlock(&m_mutex);
+
+  _pBatch->numWrites = 0;
+}
+
+static void BatchWriter_writeDirectly(int _slot, const char *_pValue)
+{
+  if (File_writeAttribute(m_fds[_slot], _pValue) < 0) {
+    m_stats.numFailedWrites++;
+  }
+}
+
+// Statistics functions
+// ----------------------------------------------------------------------------
+sBatchWriterStats BatchWriter_getStats(void)
+{
+  pthread_mutex_lock(&m_mutex);
+  sBatchWriterStats stats = m_stats;
+  pthread_mutex_unlock(&m_mutex);
+  return stats;
+}
+
+void BatchWriter_printStats(void)
+{
+  sBatchWriterStats stats = BatchWriter_getStats();
+  printf("Sysfs writes: %llu in %llu batches, %llu through io_uring, %llu "
+         "failed\n",
+         (unsigned long long)stats.numWrites,
+         (unsigned long long)stats.numBatches,
+         (unsigned long long)stats.numRingWrites,
+         (unsigned long long)stats.numFailedWrites);
+}
+
+#ifdef BATCH_WRITER_HAS_RING
+// Ring set up functions
+// ----------------------------------------------------------------------------
+static bool BatchWriter_setUpRing(void)
+{
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  m_ringFd = (int)syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+  if (m_ringFd < 0) {
+    printf("BatchWriter: io_uring unavailable (%s), falling back to pwrite.\n",
+           strerror(errno));
+    return false;
+  }
+
+  m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+  m_cqRingSize =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  bool isSingleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (isSingleMmap && m_cqRingSize > m_sqRingSize) {
+    m_sqRingSize = m_cqRingSize;
+  }
+
+  m_sqRing = mmap(NULL, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                  m_ringFd, IORING_OFF_SQ_RING);
+  if (!isSingleMmap && m_sqRing != MAP_FAILED) {
+    m_cqRing = mmap(NULL, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    m_ringFd, IORING_OFF_CQ_RING);
+  }
+  m_sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+  m_sqes = mmap(NULL, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_ringFd,
+                IORING_OFF_SQES);
+
+  void *cqRing = isSingleMmap ? m_sqRing : m_cqRing;
+  if (m_sqRing == MAP_FAILED || cqRing == MAP_FAILED || m_sqes == MAP_FAILED) {
+    perror("BatchWriter: Unable to map io_uring, falling back to pwrite");
+    BatchWriter_tearDownRing();
+    return false;
+  }
+
+  unsigned char *sq = m_sqRing;
+  m_sqTail = (uint32_t *)(sq + params.sq_off.tail);
+  m_sqMask = (uint32_t *)(sq + params.sq_off.ring_mask);
+  m_sqArray = (uint32_t *)(sq + params.sq_off.array);
+
+  unsigned char *cq = cqRing;
+  m_cqHead = (uint32_t *)(cq + params.cq_off.head);
+  m_cqTail = (uint32_t *)(cq + params.cq_off.tail);
+  m_cqMask = (uint32_t *)(cq + params.cq_off.ring_mask);
+  m_cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+  memset(m_ringWrites, 0, sizeof(m_ringWrites));
+  m_numRingWritesInFlight = 0;
+  m_numQueued = 0;
+  return true;
+}
+
+static void BatchWriter_tearDownRing(void)
+{
+  if (m_sqes != MAP_FAILED) {
+    munmap(m_sqes, m_sqesSize);
+  }
+  if (m_cqRing != MAP_FAILED) {
+    munmap(m_cqRing, m_cqRingSize);
+  }
+  if (m_sqRing != MAP_FAILED) {
+    munmap(m_sqRing, m_sqRingSize);
+  }
+  m_sqes = MAP_FAILED;
+  m_cqRing = MAP_FAILED;
+  m_sqRing = MAP_FAILED;
+
+  // Closing the ring also drops its registered files
+  close(m_ringFd);
+  m_ringFd = -1;
+  m_areFilesRegistered = false;
+}
+
+// Registers a table of empty slots, so that attributes can be registered into
+// it as modules open them. Kernels without sparse tables keep to plain fds.
+static void BatchWriter_registerFiles(void)
+{
+  int fds[BATCH_WRITER_MAX_FDS];
+  for (int i = 0; i < BATCH_WRITER_MAX_FDS; i++) {
+    fds[i] = -1;
+    m_isSlotFixed[i] = false;
+  }
+
+  m_areFilesRegistered =
+      syscall(__NR_io_uring_register, m_ringFd, IORING_REGISTER_FILES, fds,
+              BATCH_WRITER_MAX_FDS) == 0;
+}
+
+static void BatchWriter_updateFile(int _slot, int _fd)
+{
+  m_isSlotFixed[_slot] = false;
+  if (!m_isRingEnabled || !m_areFilesRegistered) {
+    return;
+  }
+
+  struct io_uring_files_update update;
+  memset(&update, 0, sizeof(update));
+  update.offset = (uint32_t)_slot;
+  update.fds = (uint64_t)(uintptr_t)&_fd;
+  int numUpdated = (int)syscall(__NR_io_uring_register, m_ringFd,
+                                IORING_REGISTER_FILES_UPDATE, &update, 1);
+  m_isSlotFixed[_slot] = _fd >= 0 && numUpdated == 1;
+}
+
+// Ring submission functions
+// ----------------------------------------------------------------------------
+static void BatchWriter_queueRingWrite(int _slot, const char *_pValue)
+{
+  while (m_numSlotWritesInFlight[_slot] > 0 ||
+         m_numRingWritesInFlight == RING_ENTRIES) {
+    if (!BatchWriter_enterRing(1)) {
+      BatchWriter_writeDirectly(_slot, _pValue);
+      return;
+    }
+  }
+
+  int index = 0;
+  while (m_ringWrites[index].isInUse) {
+    index++;
+  }
+
+  sRingWrite *write = &m_ringWrites[index];
+  write->isInUse = true;
+  write->slot = _slot;
+  snprintf(write->value, BATCH_WRITER_VALUE_LEN, "%s", _pValue);
+  write->iov.iov_base = write->value;
+  write->iov.iov_len = strlen(write->value);
+
+  // Only this module produces entries, so the tail is not read back
+  uint32_t tail = *m_sqTail;
+  uint32_t sqIndex = tail & *m_sqMask;
+  struct io_uring_sqe *sqe = &m_sqes[sqIndex];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_WRITEV;
+  if (m_isSlotFixed[_slot]) {
+    sqe->fd = _slot;
+    sqe->flags = IOSQE_FIXED_FILE;
+  }
+  else {
+    sqe->fd = m_fds[_slot];
+  }
+  sqe->addr = (uint64_t)(uintptr_t)&write->iov;
+  sqe->len = 1;
+  sqe->off = 0;
+  sqe->user_data = (uint64_t)index;
+  m_sqArray[sqIndex] = sqIndex;
+  __atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+
+  m_numQueued++;
+  m_numSlotWritesInFlight[_slot]++;
+  m_numRingWritesInFlight++;
+  m_stats.numRingWrites++;
+}
+
+// Submits the queued entries, waits for _minComplete completions, and reaps
+// every completion available. Returns false if the ring could not be entered.
+static bool BatchWriter_enterRing(uint32_t _minComplete)
+{
+  unsigned flags = _minComplete > 0 ? IORING_ENTER_GETEVENTS : 0;
+  int numSubmitted;
+  do {
+    numSubmitted = (int)syscall(__NR_io_uring_enter, m_ringFd, m_numQueued,
+                                _minComplete, flags, NULL, 0);
+  } while (numSubmitted < 0 && errno == EINTR);
+
+  if (numSubmitted < 0) {
+    perror("BatchWriter: Unable to submit writes");
+    return false;
+  }
+
+  m_numQueued -= (uint32_t)numSubmitted;
+  BatchWriter_reapCompletions();
+  return true;
+}
+
+static void BatchWriter_waitForSlotLocked(int _slot)
+{
+  bool isEntered = true;
+  while (m_isRingEnabled && m_numSlotWritesInFlight[_slot] > 0 && isEntered) {
+    isEntered = BatchWriter_enterRing(1);
+  }
+}
+
+static void BatchWriter_reapCompletions(void)
+{
+  uint32_t head = *m_cqHead;
+  uint32_t tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+  while (head != tail) {
+    struct io_uring_cqe *cqe = &m_cqes[head & *m_cqMask];
+    sRingWrite *write = &m_ringWrites[cqe->user_data];
+    if (cqe->res != (int32_t)write->iov.iov_len) {
+      m_stats.numFailedWrites++;
+    }
+
+    m_numSlotWritesInFlight[write->slot]--;
+    m_numRingWritesInFlight--;
+    write->isInUse = false;
+    head++;
+  }
+
+  __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+}
+#endif
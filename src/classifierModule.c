@@ -3,41 +3,295 @@
  * placed within the correct bin. */
 
 #include "../include/classifierModule.h"
+#include "../include/ambientMonitor.h"
 #include "../include/colorSensor.h"
 #include "../include/timing.h"
 #include <stdint.h>
 
-static const uint32_t WAIT_UNTIL_REFUSE_ITEM_APPEARS_SLEEP_INTERVAL_MS =
-    150; // 0.15 sec
+// Object sensing level, as a percentage of the threshold, from which the
+// luminance is taken to be moving toward it
+static const uint32_t ARRIVAL_ACTIVITY_LEVEL_PERCENT = 25;
 
-void ClassifierModule_init(uint32_t _colorSensorI2cBusNumber,
-  uint32_t _objectSensingThreshold)
+// Consecutive frames past the threshold that confirm an arrival, and
+// consecutive frames under the activity level that end the activity
+static const uint32_t ARRIVAL_CONFIRMATION_FRAMES = 2;
+static const uint32_t ARRIVAL_QUIET_FRAMES = 3;
+
+// Consecutive empty frames needed to confirm that the refuse item has left
+static const uint32_t REFUSE_ITEM_LEFT_CONFIRMATION_FRAMES = 2;
+
+// Largest change in clear luminance between consecutive frames of an item at
+// rest, as a percentage of the previous frame, and as an absolute floor for
+// dark items
+static const int32_t REFUSE_ITEM_SETTLED_TOLERANCE_PERCENT = 5;
+static const int32_t REFUSE_ITEM_SETTLED_TOLERANCE_MIN = 20;
+
+static eClassifierModule_RefuseItemType
+ClassifierModule_colorToRefuseItemType(eColorSensorColor _color);
+static void ClassifierModule_setBaseline(sClassifierModule *_pClassifier,
+                                         int32_t _baselineLuminance);
+
+void ClassifierModule_init(sClassifierModule *_pClassifier,
+                           const sColorSensorConfig *_pConfig)
 {
-  ColorSensor_init(_colorSensorI2cBusNumber, _objectSensingThreshold);
+  ColorSensor_init(&_pClassifier->colorSensor, _pConfig);
+
+  // The ambient light has shifted once the empty ramp reads as active
+  int32_t shiftLuminance = (int64_t)_pConfig->objectSensingThreshold *
+                           ARRIVAL_ACTIVITY_LEVEL_PERCENT /
+                           COLOR_SENSOR_OBJECT_LEVEL_PERCENT;
+  AmbientMonitor_init(
+      &_pClassifier->ambientMonitor,
+      ColorSensor_getBaselineLuminance(&_pClassifier->colorSensor),
+      shiftLuminance);
 }
 
-void ClassifierModule_cleanup(void)
+void ClassifierModule_cleanup(sClassifierModule *_pClassifier)
 {
-  ColorSensor_cleanup();
+  AmbientMonitor_cleanup(&_pClassifier->ambientMonitor);
+  ColorSensor_cleanup(&_pClassifier->colorSensor);
 }
 
 // Blocking function that returns once the refuse is in front of the sensor
 // on the ramp.
-void ClassifierModule_waitUntilRefuseItemAppears(void)
+void ClassifierModule_waitUntilRefuseItemAppears(
+    sClassifierModule *_pClassifier)
 {
-  bool hasRefuseAppeared;
-  do {
-    hasRefuseAppeared = ColorSensor_isObjectInFrontOfSensor();
-    Timing_milliSleep(0, WAIT_UNTIL_REFUSE_ITEM_APPEARS_SLEEP_INTERVAL_MS);
-  } while (!hasRefuseAppeared);
+  ClassifierModule_setFrameMode(_pClassifier, CLASSIFIER_MODULE_FRAMES_FULL);
+
+  sClassifierModule_ArrivalTracker tracker = {0};
+  eClassifierModule_FrameMode frameMode = CLASSIFIER_MODULE_FRAMES_FULL;
+  while (true) {
+    ColorSensor_waitForNextFrame(&_pClassifier->colorSensor);
+    eClassifierModule_RampActivity activity =
+        ClassifierModule_trackArrival(_pClassifier, &tracker);
+    if (activity == CLASSIFIER_MODULE_RAMP_ARRIVED) {
+      break;
+    }
+
+    eClassifierModule_FrameMode nextFrameMode =
+        activity == CLASSIFIER_MODULE_RAMP_ACTIVE
+            ? CLASSIFIER_MODULE_FRAMES_SHORT
+            : CLASSIFIER_MODULE_FRAMES_FULL;
+    if (nextFrameMode != frameMode) {
+      frameMode = nextFrameMode;
+      ClassifierModule_setFrameMode(_pClassifier, frameMode);
+    }
+  }
+
+  ClassifierModule_setFrameMode(_pClassifier, CLASSIFIER_MODULE_FRAMES_FULL);
+}
+
+bool ClassifierModule_waitUntilRefuseItemLeaves(
+    sClassifierModule *_pClassifier, int64_t _timeoutMs)
+{
+  // Short frames confirm departure sooner
+  ClassifierModule_setFrameMode(_pClassifier, CLASSIFIER_MODULE_FRAMES_SHORT);
+
+  int64_t startTimeMs = Timing_getMonotonicTimeMs();
+  sClassifierModule_DepartureTracker tracker = {0};
+  bool hasRefuseLeft = false;
+  while (true) {
+    ColorSensor_waitForNextFrame(&_pClassifier->colorSensor);
+    if (ClassifierModule_hasRefuseItemLeft(_pClassifier, &tracker)) {
+      hasRefuseLeft = true;
+      break;
+    }
+
+    if (_timeoutMs >= 0 &&
+        Timing_getMonotonicTimeMs() - startTimeMs >= _timeoutMs) {
+      break;
+    }
+  }
+
+  ClassifierModule_setFrameMode(_pClassifier, CLASSIFIER_MODULE_FRAMES_FULL);
+  return hasRefuseLeft;
 }
 
 // Returns the current color of the next refuse item waiting on the ramp.
-eClassifierModule_RefuseItemType ClassifierModule_getRefuseItemType(void)
+eClassifierModule_RefuseItemType
+ClassifierModule_getRefuseItemType(sClassifierModule *_pClassifier)
+{
+  ColorSensor_waitForFrame(&_pClassifier->colorSensor);
+  eColorSensorColor refuseColor =
+      ColorSensor_getColor(&_pClassifier->colorSensor);
+
+  return ClassifierModule_colorToRefuseItemType(refuseColor);
+}
+
+void ClassifierModule_recalibrate(sClassifierModule *_pClassifier)
+{
+  ColorSensor_recalibrate(&_pClassifier->colorSensor);
+  AmbientMonitor_setBaseline(
+      &_pClassifier->ambientMonitor,
+      ColorSensor_getBaselineLuminance(&_pClassifier->colorSensor));
+}
+
+static void ClassifierModule_setBaseline(sClassifierModule *_pClassifier,
+                                         int32_t _baselineLuminance)
+{
+  ColorSensor_setBaselineLuminance(&_pClassifier->colorSensor,
+                                   _baselineLuminance);
+  AmbientMonitor_setBaseline(&_pClassifier->ambientMonitor,
+                             _baselineLuminance);
+}
+
+bool ClassifierModule_calibrateWhiteBalance(sClassifierModule *_pClassifier)
+{
+  return ColorSensor_calibrateWhiteBalance(&_pClassifier->colorSensor);
+}
+
+// Non-blocking functions
+// ----------------------------------------------------------------------------
+void ClassifierModule_setFrameMode(sClassifierModule *_pClassifier,
+                                   eClassifierModule_FrameMode _frameMode)
+{
+  ColorSensor_setIntegration(&_pClassifier->colorSensor,
+                             _frameMode == CLASSIFIER_MODULE_FRAMES_SHORT
+                                 ? COLOR_SENSOR_INTEGRATION_SHORT
+                                 : COLOR_SENSOR_INTEGRATION_FULL);
+}
+
+int64_t ClassifierModule_getMsUntilFrame(sClassifierModule *_pClassifier)
+{
+  return ColorSensor_getMsUntilFrame(&_pClassifier->colorSensor);
+}
+
+int64_t ClassifierModule_getMsUntilNextFrame(sClassifierModule *_pClassifier)
+{
+  return ColorSensor_getMsUntilNextFrame(&_pClassifier->colorSensor);
+}
+
+bool ClassifierModule_isRefuseItemPresent(sClassifierModule *_pClassifier)
 {
-  eColorSensorColor refuseColor = ColorSensor_getColor();
+  return ColorSensor_isObjectInFrontOfSensor(&_pClassifier->colorSensor);
+}
+
+eClassifierModule_RefuseItemType
+ClassifierModule_getCurrentRefuseItemType(sClassifierModule *_pClassifier,
+                                          uint32_t *_pConfidencePercentOut)
+{
+  eColorSensorColor refuseColor = ColorSensor_getColorWithConfidence(
+      &_pClassifier->colorSensor, _pConfidencePercentOut);
+
+  return ClassifierModule_colorToRefuseItemType(refuseColor);
+}
+
+bool ClassifierModule_isRefuseItemAtRest(
+    sClassifierModule *_pClassifier, sClassifierModule_RestTracker *_pTracker)
+{
+  sColorSensorFeatures features;
+  ColorSensor_getFeatures(&_pClassifier->colorSensor, &features);
+  int32_t clear = features.clear;
+
+  int32_t tolerance =
+      _pTracker->lastClear * REFUSE_ITEM_SETTLED_TOLERANCE_PERCENT / 100;
+  if (tolerance < REFUSE_ITEM_SETTLED_TOLERANCE_MIN) {
+    tolerance = REFUSE_ITEM_SETTLED_TOLERANCE_MIN;
+  }
+
+  bool isAtRest = _pTracker->hasFrame &&
+                  clear - _pTracker->lastClear <= tolerance &&
+                  _pTracker->lastClear - clear <= tolerance;
+  _pTracker->lastClear = clear;
+  _pTracker->hasFrame = true;
+  return isAtRest;
+}
+
+bool ClassifierModule_hasRefuseItemLeft(
+    sClassifierModule *_pClassifier,
+    sClassifierModule_DepartureTracker *_pTracker)
+{
+  if (ColorSensor_isObjectInFrontOfSensor(&_pClassifier->colorSensor)) {
+    _pTracker->numEmptyFrames = 0;
+    return false;
+  }
+
+  return ++_pTracker->numEmptyFrames >= REFUSE_ITEM_LEFT_CONFIRMATION_FRAMES;
+}
+
+eClassifierModule_RampActivity
+ClassifierModule_trackArrival(sClassifierModule *_pClassifier,
+                              sClassifierModule_ArrivalTracker *_pTracker)
+{
+  sColorSensor *sensor = &_pClassifier->colorSensor;
+  sAmbientMonitor *monitor = &_pClassifier->ambientMonitor;
+  int32_t luminance = ColorSensor_getAmbientLuminance(sensor);
+  uint32_t numFalseTriggers = _pTracker->numFalseTriggers;
+  eClassifierModule_RampActivity activity = ClassifierModule_recordArrivalLevel(
+      _pTracker, ColorSensor_getLuminanceLevelPercent(sensor, luminance));
+  if (activity == CLASSIFIER_MODULE_RAMP_ARRIVED) {
+    AmbientMonitor_recordItem(monitor);
+    return activity;
+  }
 
-  switch (refuseColor) {
+  int64_t timeMs = Timing_getMonotonicTimeMs();
+  bool hasShifted = AmbientMonitor_recordEmptyFrame(monitor, luminance, timeMs);
+  bool hasFalseTriggerBurst =
+      _pTracker->numFalseTriggers != numFalseTriggers &&
+      AmbientMonitor_recordFalseTrigger(monitor, timeMs);
+  if (!hasShifted && !hasFalseTriggerBurst) {
+    return activity;
+  }
+
+  // Recalibrate from the frames already read, rather than stalling the caller
+  // for fresh calibration readings. Any activity was the lighting changing.
+  ClassifierModule_setBaseline(_pClassifier,
+                               AmbientMonitor_getAmbientLuminance(monitor));
+  _pTracker->isActive = false;
+  _pTracker->hasCrossedThreshold = false;
+  _pTracker->numPresentFrames = 0;
+  _pTracker->numQuietFrames = 0;
+  return CLASSIFIER_MODULE_RAMP_QUIET;
+}
+
+eClassifierModule_RampActivity
+ClassifierModule_recordArrivalLevel(sClassifierModule_ArrivalTracker *_pTracker,
+                                    uint32_t _levelPercent)
+{
+  if (_levelPercent >= COLOR_SENSOR_OBJECT_LEVEL_PERCENT) {
+    _pTracker->isActive = true;
+    _pTracker->hasCrossedThreshold = true;
+    _pTracker->numQuietFrames = 0;
+    return ++_pTracker->numPresentFrames >= ARRIVAL_CONFIRMATION_FRAMES
+               ? CLASSIFIER_MODULE_RAMP_ARRIVED
+               : CLASSIFIER_MODULE_RAMP_ACTIVE;
+  }
+
+  // A single frame past the threshold may be noise, or an item passing by
+  _pTracker->numPresentFrames = 0;
+  if (_levelPercent >= ARRIVAL_ACTIVITY_LEVEL_PERCENT) {
+    _pTracker->isActive = true;
+    _pTracker->numQuietFrames = 0;
+  }
+  else if (_pTracker->isActive &&
+           ++_pTracker->numQuietFrames >= ARRIVAL_QUIET_FRAMES) {
+    _pTracker->isActive = false;
+    if (_pTracker->hasCrossedThreshold) {
+      _pTracker->hasCrossedThreshold = false;
+      _pTracker->numFalseTriggers++;
+    }
+  }
+
+  return _pTracker->isActive ? CLASSIFIER_MODULE_RAMP_ACTIVE
+                             : CLASSIFIER_MODULE_RAMP_QUIET;
+}
+
+sAmbientMonitorStats
+ClassifierModule_getAmbientStats(const sClassifierModule *_pClassifier)
+{
+  return AmbientMonitor_getStats(&_pClassifier->ambientMonitor);
+}
+
+void ClassifierModule_printStats(const sClassifierModule *_pClassifier)
+{
+  AmbientMonitor_printStats(&_pClassifier->ambientMonitor);
+}
+
+static eClassifierModule_RefuseItemType
+ClassifierModule_colorToRefuseItemType(eColorSensorColor _color)
+{
+  switch (_color) {
   case COLOR_SENSOR_RED:
     return CLASSIFIER_MODULE_GARBAGE;
   case COLOR_SENSOR_GREEN:
@@ -1,8 +1,16 @@
 #include "../include/colorSensor.h"
-#include "../include/i2c.h"
+#include "../include/i2cBus.h"
 #include "../include/timing.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+// The NEON kernel loads the 16-bit data registers of a frame as they lie in
+// memory, so it needs a little endian target
+#if defined(__ARM_NEON) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define COLOR_SENSOR_NEON
+#include <arm_neon.h>
+#endif
 
 // Adapted from
 // http://www.beaglebone.net/code/c/beaglebone-and-tcs34725-color-sensor-example-in-c.php
@@ -13,9 +21,21 @@ static const int32_t COLOR_SENSOR_DEVICE_ADDRESS = 0x29;
 
 static const int32_t SELECT_ENABLE_REGISTER_ADDRESS = 0x80;
 static const int32_t POWER_ON_RGBC_ENABLE_WAIT_TIME_DISABLE = 0x03;
+static const int32_t POWER_ON_RGBC_DISABLE = 0x01;
 
 static const int32_t SELECT_ALS_TIME_REGISTER_ADDRESS = 0x81;
 static const int32_t ATIME_700MS = 0x00;
+static const int32_t ATIME_101MS = 0xD5;
+
+// Integration time for each ATIME value, rounded up, plus the 2.4 ms RGBC
+// initialization that precedes every integration cycle
+static const int64_t ATIME_700MS_INTEGRATION_TIME_MS = 618;
+static const int64_t ATIME_101MS_INTEGRATION_TIME_MS = 107;
+
+// Integration cycles for each ATIME value (256 - ATIME). Channel counts are
+// proportional to the number of cycles.
+static const int32_t ATIME_700MS_INTEGRATION_CYCLES = 256;
+static const int32_t ATIME_101MS_INTEGRATION_CYCLES = 43;
 
 static const int32_t SELECT_WAIT_TIME_REGISTER_ADDRESS = 0x83;
 static const int32_t WAIT_TIME_2POINT4_MS = 0xFF;
@@ -29,12 +49,45 @@ static const int32_t NUM_BYTES_TO_READ_FROM_CDATA_REGISTER = 8;
 // Value indices into luminance output buffer from getLuminanceValuesInLux
 // ----------------------------------------------------------------------------
 static const int32_t RED_LUMINANCE_OUT_INDEX = 0;
-static const int32_t BLUE_LUMINANCE_OUT_INDEX = 1;
-static const int32_t GREEN_LUMINANCE_OUT_INDEX = 2;
-static const int32_t IR_LUMINANCE_OUT_INDEX = 3;
+static const int32_t GREEN_LUMINANCE_OUT_INDEX = 1;
+static const int32_t BLUE_LUMINANCE_OUT_INDEX = 2;
+static const int32_t CLEAR_LUMINANCE_OUT_INDEX = 3;
 static const int32_t AMBIENT_LIGHT_LUMINANCE_OUT_INDEX = 4;
 static const size_t LUMINANCE_OUTPUT_ARRAY_SIZE = 5;
 
+// Feature coefficients from the TCS34725 datasheet and DN40
+// ----------------------------------------------------------------------------
+// Weights of the infrared-free channels in the illuminance, in Q12
+static const int32_t FEATURE_COEFFICIENT_SHIFT = 12;
+static const int64_t LUX_RED_COEFFICIENT = 557;    // 0.136
+static const int64_t LUX_GREEN_COEFFICIENT = 4096; // 1.0
+static const int64_t LUX_BLUE_COEFFICIENT = -1819; // -0.444
+
+// Device and glass attenuation factor, for a sensor in open air
+static const int64_t LUX_DEVICE_GAIN_FACTOR = 310;
+
+// Illuminance is computed for the integration time of the counts, in tenths
+// of ms (2.4 ms per cycle), at the analog gain the sensor runs with
+static const int64_t INTEGRATION_CYCLE_TIME_TENTHS_MS = 24;
+static const int64_t AGAIN_1_TIME_GAIN = 1;
+
+// The illuminance is the weighted green times a multiplier in Q32, which holds
+// the Q12 of the coefficients, the DGF and the counts per lux of the frame
+static const int32_t MILLI_LUX_MULTIPLIER_SHIFT = 32;
+
+static const int64_t CCT_COEFFICIENT = 3810;
+static const int64_t CCT_OFFSET = 1391;
+
+// White balance calibration
+// ----------------------------------------------------------------------------
+// Least infrared-free count of every channel of a white reference
+static const int32_t WHITE_REFERENCE_MIN_COUNT = 100;
+
+// The calibration profile holds one "name value" line per gain
+#define CALIBRATION_PROFILE_LINE_LEN 128
+static const char *WHITE_BALANCE_GAIN_NAMES[COLOR_SENSOR_NUM_COLORS] = {
+    "redGain", "greenGain", "blueGain"};
+
 // Function Prototype declarations
 // ----------------------------------------------------------------------------
 static double ColorSensor_getMaxValue(double _val1, double _val2);
@@ -43,73 +96,153 @@ static void
 ColorSensor_regValsToRgbLuminanceValues(uint8_t *_pRegisterBytesIn,
                                         int32_t *_pLuminanceValuesOut);
 static void
-ColorSensor_regValsToIrLuminanceValue(uint8_t *_pRegisterBytesIn,
-                                      int32_t *_pLuminanceValuesOut);
+ColorSensor_regValsToClearLuminanceValue(uint8_t *_pRegisterBytesIn,
+                                         int32_t *_pLuminanceValuesOut);
 static void ColorSensor_RGBValsToAmbientLightLuminanceValue(
     int32_t _red, int32_t _green, int32_t _blue, int32_t *_pLuminanceValuesOut);
+static void
+ColorSensor_normalizeToFullIntegration(const sColorSensor *_pSensor,
+                                       int32_t *_pLuminanceValuesInOut);
+static void ColorSensor_readLuminanceValues(sColorSensor *_pSensor,
+                                            eI2cBusPriority _priority,
+                                            int32_t *_pLuminanceValsOut);
+static void ColorSensor_readFeatures(sColorSensor *_pSensor,
+                                     eI2cBusPriority _priority,
+                                     sColorSensorFeatures *_pFeaturesOut);
+static int32_t ColorSensor_multiplyQ16(int32_t _value, uint32_t _q16Factor);
+static int32_t ColorSensor_computeInfrared(int32_t _red, int32_t _green,
+                                           int32_t _blue, int32_t _clear);
+static int32_t ColorSensor_removeInfrared(int32_t _channel, int32_t _infrared);
+static uint32_t ColorSensor_computeChromaticity(int32_t _channel,
+                                                int32_t _clear);
+static uint32_t ColorSensor_getMilliLuxMultiplier(int32_t _integrationCycles);
+static int32_t ColorSensor_computeMilliLux(int32_t _irFreeRed,
+                                          int32_t _irFreeGreen,
+                                          int32_t _irFreeBlue,
+                                          uint32_t _multiplier);
+static void ColorSensor_convertFrame(const uint8_t *_pFrame, size_t _index,
+                                     uint32_t _milliLuxMultiplier,
+                                     const sColorSensorFrameArrays *_pOut);
+#ifdef COLOR_SENSOR_NEON
+static void ColorSensor_convertFramesNeon(uint32x4_t _red, uint32x4_t _green,
+                                          uint32x4_t _blue, uint32x4_t _clear,
+                                          size_t _index,
+                                          uint32_t _milliLuxMultiplier,
+                                          const sColorSensorFrameArrays *_pOut);
+static uint32x4_t ColorSensor_computeChromaticitiesNeon(uint32x4_t _channel,
+                                                        uint32x4_t _clear);
+#endif
+static void ColorSensor_loadCalibrationProfile(sColorSensor *_pSensor);
+static void ColorSensor_saveCalibrationProfile(const sColorSensor *_pSensor);
 
 // Static Variables
 // ----------------------------------------------------------------------------
 
-// File descriptor to use color sensor I2C device
-static int32_t m_i2cFileBusDescriptor;
-
-// Baseline for detecting if no object is in front of the sensor
-static int32_t m_baselineLuminance;
-
-// Distance away from baseline to detect if object is in front
-static uint32_t m_objectSensingThreshold;
-
 // Number of readings to take for calibration
 const size_t MAX_CALIBRATION_READINGS = 10;
 
 // Interval between calibration reads
 const uint64_t CALIBRATION_READ_INTERVAL_NS = 250000000; // 0.25 seconds
 
-void ColorSensor_init(uint32_t _i2cBusNum, uint32_t _objectSensingThreshold)
+void ColorSensor_init(sColorSensor *_pSensor,
+                      const sColorSensorConfig *_pConfig)
 {
-  m_objectSensingThreshold = _objectSensingThreshold;
-  m_i2cFileBusDescriptor =
-      I2c_initI2cDevice(_i2cBusNum, COLOR_SENSOR_DEVICE_ADDRESS);
-  I2c_writeI2cReg(m_i2cFileBusDescriptor, SELECT_ENABLE_REGISTER_ADDRESS,
-                  POWER_ON_RGBC_ENABLE_WAIT_TIME_DISABLE);
-  I2c_writeI2cReg(m_i2cFileBusDescriptor, SELECT_ALS_TIME_REGISTER_ADDRESS,
-                  ATIME_700MS);
-  I2c_writeI2cReg(m_i2cFileBusDescriptor, SELECT_WAIT_TIME_REGISTER_ADDRESS,
-                  WAIT_TIME_2POINT4_MS);
-  I2c_writeI2cReg(m_i2cFileBusDescriptor, SELECT_CONTROL_REGISTER_ADDRESS,
-                  AGAIN_1_TIME);
+  _pSensor->config = *_pConfig;
+  for (int i = 0; i < COLOR_SENSOR_NUM_COLORS; i++) {
+    _pSensor->whiteBalanceGains[i] = COLOR_SENSOR_Q16_ONE;
+  }
+  ColorSensor_loadCalibrationProfile(_pSensor);
+
+  I2cBus_openDevice(&_pSensor->device, _pConfig->i2cBusNum,
+                    COLOR_SENSOR_DEVICE_ADDRESS, _pConfig->muxAddress,
+                    _pConfig->muxChannel);
+
+  sI2cBusTransaction transaction;
+  I2cBus_initTransaction(&transaction);
+  I2cBus_addWriteReg(&transaction, SELECT_ENABLE_REGISTER_ADDRESS,
+                     POWER_ON_RGBC_ENABLE_WAIT_TIME_DISABLE);
+  I2cBus_addWriteReg(&transaction, SELECT_ALS_TIME_REGISTER_ADDRESS,
+                     ATIME_700MS);
+  I2cBus_addWriteReg(&transaction, SELECT_WAIT_TIME_REGISTER_ADDRESS,
+                     WAIT_TIME_2POINT4_MS);
+  I2cBus_addWriteReg(&transaction, SELECT_CONTROL_REGISTER_ADDRESS,
+                     AGAIN_1_TIME);
+  I2cBus_execute(&_pSensor->device, I2C_BUS_PRIORITY_CONTROL, &transaction);
+  _pSensor->integrationTimeMs = ATIME_700MS_INTEGRATION_TIME_MS;
+  _pSensor->integrationStartTimeMs = Timing_getMonotonicTimeMs();
+  _pSensor->integrationCycles = ATIME_700MS_INTEGRATION_CYCLES;
+  _pSensor->previousIntegrationCycles = ATIME_700MS_INTEGRATION_CYCLES;
 
   // Calibrate the color sensor based on its current environment
-  ColorSensor_recalibrate();
+  ColorSensor_recalibrate(_pSensor);
 
   Timing_nanoSleep(1, 0);
 }
 
-void ColorSensor_recalibrate(void)
+void ColorSensor_recalibrate(sColorSensor *_pSensor)
 {
   int32_t readingsSum = 0;
   for (int i = 0; i < MAX_CALIBRATION_READINGS; ++i) {
     int32_t luminanceValuesOut[LUMINANCE_OUTPUT_ARRAY_SIZE];
-    ColorSensor_getLuminanceValuesInLux(luminanceValuesOut);
+    ColorSensor_readLuminanceValues(_pSensor, I2C_BUS_PRIORITY_CONTROL,
+                                    luminanceValuesOut);
 
     readingsSum += luminanceValuesOut[AMBIENT_LIGHT_LUMINANCE_OUT_INDEX];
 
     Timing_nanoSleep(0, CALIBRATION_READ_INTERVAL_NS);
   }
 
-  m_baselineLuminance = readingsSum / MAX_CALIBRATION_READINGS;
+  _pSensor->baselineLuminance = readingsSum / MAX_CALIBRATION_READINGS;
+}
+
+int32_t ColorSensor_getBaselineLuminance(const sColorSensor *_pSensor)
+{
+  return _pSensor->baselineLuminance;
+}
+
+void ColorSensor_setBaselineLuminance(sColorSensor *_pSensor,
+                                      int32_t _luminance)
+{
+  _pSensor->baselineLuminance = _luminance;
+}
+
+bool ColorSensor_calibrateWhiteBalance(sColorSensor *_pSensor)
+{
+  int64_t sums[COLOR_SENSOR_NUM_COLORS] = {0};
+  for (int i = 0; i < MAX_CALIBRATION_READINGS; ++i) {
+    sColorSensorFeatures features;
+    ColorSensor_readFeatures(_pSensor, I2C_BUS_PRIORITY_CONTROL, &features);
+    sums[COLOR_SENSOR_RED] += features.irFreeRed;
+    sums[COLOR_SENSOR_GREEN] += features.irFreeGreen;
+    sums[COLOR_SENSOR_BLUE] += features.irFreeBlue;
+
+    Timing_nanoSleep(0, CALIBRATION_READ_INTERVAL_NS);
+  }
+
+  sColorSensorFeatures white = {
+      .irFreeRed = sums[COLOR_SENSOR_RED] / MAX_CALIBRATION_READINGS,
+      .irFreeGreen = sums[COLOR_SENSOR_GREEN] / MAX_CALIBRATION_READINGS,
+      .irFreeBlue = sums[COLOR_SENSOR_BLUE] / MAX_CALIBRATION_READINGS,
+  };
+  uint32_t gains[COLOR_SENSOR_NUM_COLORS];
+  if (!ColorSensor_computeWhiteBalanceGains(&white, gains)) {
+    return false;
+  }
+
+  memcpy(_pSensor->whiteBalanceGains, gains, sizeof(gains));
+  ColorSensor_saveCalibrationProfile(_pSensor);
+  return true;
 }
 
-void ColorSensor_cleanup(void)
+void ColorSensor_cleanup(sColorSensor *_pSensor)
 {
-  I2c_closeI2cDevice(m_i2cFileBusDescriptor);
+  I2cBus_closeDevice(&_pSensor->device);
 }
 
-void ColorSensor_getRgbValues(int32_t *_pRgbValuesOut)
+void ColorSensor_getRgbValues(sColorSensor *_pSensor, int32_t *_pRgbValuesOut)
 {
   int32_t luminanceValuesOut[LUMINANCE_OUTPUT_ARRAY_SIZE];
-  ColorSensor_getLuminanceValuesInLux(luminanceValuesOut);
+  ColorSensor_getLuminanceValuesInLux(_pSensor, luminanceValuesOut);
 
   int32_t redLuminance = luminanceValuesOut[RED_LUMINANCE_OUT_INDEX];
   int32_t greenLuminance = luminanceValuesOut[GREEN_LUMINANCE_OUT_INDEX];
@@ -124,17 +257,30 @@ void ColorSensor_getRgbValues(int32_t *_pRgbValuesOut)
   _pRgbValuesOut[2] = ((double)blueLuminance / maxRgbVal) * 255;
 }
 
-void ColorSensor_getLuminanceValuesInLux(int32_t *_pLuminanceValsOut)
+void ColorSensor_getLuminanceValuesInLux(sColorSensor *_pSensor,
+                                         int32_t *_pLuminanceValsOut)
+{
+  ColorSensor_readLuminanceValues(_pSensor, I2C_BUS_PRIORITY_DETECTION,
+                                  _pLuminanceValsOut);
+}
+
+static void ColorSensor_readLuminanceValues(sColorSensor *_pSensor,
+                                            eI2cBusPriority _priority,
+                                            int32_t *_pLuminanceValsOut)
 {
   uint8_t regOutBuf[NUM_BYTES_TO_READ_FROM_CDATA_REGISTER];
-  I2c_readI2cReg(m_i2cFileBusDescriptor, CDATA_LSB_REGISTER_ADDRESS, regOutBuf,
-                 NUM_BYTES_TO_READ_FROM_CDATA_REGISTER);
+  sI2cBusTransaction transaction;
+  I2cBus_initTransaction(&transaction);
+  I2cBus_addReadReg(&transaction, CDATA_LSB_REGISTER_ADDRESS, regOutBuf,
+                    NUM_BYTES_TO_READ_FROM_CDATA_REGISTER);
+  I2cBus_execute(&_pSensor->device, _priority, &transaction);
   ColorSensor_regValsToRgbLuminanceValues(regOutBuf, _pLuminanceValsOut);
-  ColorSensor_regValsToIrLuminanceValue(regOutBuf, _pLuminanceValsOut);
+  ColorSensor_regValsToClearLuminanceValue(regOutBuf, _pLuminanceValsOut);
   ColorSensor_RGBValsToAmbientLightLuminanceValue(
       _pLuminanceValsOut[RED_LUMINANCE_OUT_INDEX],
       _pLuminanceValsOut[GREEN_LUMINANCE_OUT_INDEX],
       _pLuminanceValsOut[BLUE_LUMINANCE_OUT_INDEX], _pLuminanceValsOut);
+  ColorSensor_normalizeToFullIntegration(_pSensor, _pLuminanceValsOut);
 }
 
 static double ColorSensor_getMaxValue(double _val1, double _val2)
@@ -142,36 +288,522 @@ static double ColorSensor_getMaxValue(double _val1, double _val2)
   return _val1 > _val2 ? _val1 : _val2;
 }
 
-bool ColorSensor_isObjectInFrontOfSensor(void)
+bool ColorSensor_isObjectInFrontOfSensor(sColorSensor *_pSensor)
+{
+  return ColorSensor_getObjectSensingLevelPercent(_pSensor) >=
+         COLOR_SENSOR_OBJECT_LEVEL_PERCENT;
+}
+
+uint32_t ColorSensor_getObjectSensingLevelPercent(sColorSensor *_pSensor)
+{
+  return ColorSensor_getLuminanceLevelPercent(
+      _pSensor, ColorSensor_getAmbientLuminance(_pSensor));
+}
+
+int32_t ColorSensor_getAmbientLuminance(sColorSensor *_pSensor)
 {
   int32_t luminanceValuesOut[LUMINANCE_OUTPUT_ARRAY_SIZE];
-  ColorSensor_getLuminanceValuesInLux(luminanceValuesOut);
+  ColorSensor_getLuminanceValuesInLux(_pSensor, luminanceValuesOut);
+  return luminanceValuesOut[AMBIENT_LIGHT_LUMINANCE_OUT_INDEX];
+}
+
+uint32_t ColorSensor_getLuminanceLevelPercent(const sColorSensor *_pSensor,
+                                              int32_t _luminance)
+{
+  if (_pSensor->config.objectSensingThreshold == 0) {
+    return COLOR_SENSOR_OBJECT_LEVEL_PERCENT;
+  }
+
+  int64_t deviation =
+      llabs((int64_t)_pSensor->baselineLuminance - _luminance);
 
-  return abs(m_baselineLuminance -
-             luminanceValuesOut[AMBIENT_LIGHT_LUMINANCE_OUT_INDEX]) >=
-         m_objectSensingThreshold;
+  int64_t levelPercent = deviation * COLOR_SENSOR_OBJECT_LEVEL_PERCENT /
+                         _pSensor->config.objectSensingThreshold;
+  return levelPercent < UINT32_MAX ? (uint32_t)levelPercent : UINT32_MAX;
 }
 
-eColorSensorColor ColorSensor_getColor(void)
+eColorSensorColor ColorSensor_getColor(sColorSensor *_pSensor)
+{
+  uint32_t confidencePercent;
+  return ColorSensor_getColorWithConfidence(_pSensor, &confidencePercent);
+}
+
+eColorSensorColor
+ColorSensor_getColorWithConfidence(sColorSensor *_pSensor,
+                                   uint32_t *_pConfidencePercentOut)
+{
+  sColorSensorFeatures features;
+  ColorSensor_getFeatures(_pSensor, &features);
+
+  return ColorSensor_getFeaturesColor(&features, _pConfidencePercentOut);
+}
+
+// Feature functions
+// ----------------------------------------------------------------------------
+void ColorSensor_getFeatures(sColorSensor *_pSensor,
+                             sColorSensorFeatures *_pFeaturesOut)
+{
+  ColorSensor_readFeatures(_pSensor, I2C_BUS_PRIORITY_DETECTION,
+                           _pFeaturesOut);
+}
+
+static void ColorSensor_readFeatures(sColorSensor *_pSensor,
+                                     eI2cBusPriority _priority,
+                                     sColorSensorFeatures *_pFeaturesOut)
 {
   int32_t luminanceValuesOut[LUMINANCE_OUTPUT_ARRAY_SIZE];
-  ColorSensor_getLuminanceValuesInLux(luminanceValuesOut);
+  ColorSensor_readLuminanceValues(_pSensor, _priority, luminanceValuesOut);
+
+  ColorSensor_computeFeatures(luminanceValuesOut[RED_LUMINANCE_OUT_INDEX],
+                              luminanceValuesOut[GREEN_LUMINANCE_OUT_INDEX],
+                              luminanceValuesOut[BLUE_LUMINANCE_OUT_INDEX],
+                              luminanceValuesOut[CLEAR_LUMINANCE_OUT_INDEX],
+                              _pFeaturesOut);
+  ColorSensor_applyWhiteBalance(_pSensor->whiteBalanceGains, _pFeaturesOut);
+}
 
-  int32_t redLuminance = luminanceValuesOut[RED_LUMINANCE_OUT_INDEX];
-  int32_t greenLuminance = luminanceValuesOut[GREEN_LUMINANCE_OUT_INDEX];
-  int32_t blueLuminance = luminanceValuesOut[BLUE_LUMINANCE_OUT_INDEX];
+void ColorSensor_computeFeatures(int32_t _red, int32_t _green, int32_t _blue,
+                                 int32_t _clear,
+                                 sColorSensorFeatures *_pFeaturesOut)
+{
+  _pFeaturesOut->red = _red;
+  _pFeaturesOut->green = _green;
+  _pFeaturesOut->blue = _blue;
+  _pFeaturesOut->clear = _clear;
+
+  int32_t infrared = ColorSensor_computeInfrared(_red, _green, _blue, _clear);
+  _pFeaturesOut->infrared = infrared;
+  _pFeaturesOut->irFreeRed = ColorSensor_removeInfrared(_red, infrared);
+  _pFeaturesOut->irFreeGreen = ColorSensor_removeInfrared(_green, infrared);
+  _pFeaturesOut->irFreeBlue = ColorSensor_removeInfrared(_blue, infrared);
+  _pFeaturesOut->balancedRed = _pFeaturesOut->irFreeRed;
+  _pFeaturesOut->balancedGreen = _pFeaturesOut->irFreeGreen;
+  _pFeaturesOut->balancedBlue = _pFeaturesOut->irFreeBlue;
+
+  _pFeaturesOut->redChromaticity =
+      ColorSensor_computeChromaticity(_red, _clear);
+  _pFeaturesOut->greenChromaticity =
+      ColorSensor_computeChromaticity(_green, _clear);
+  _pFeaturesOut->blueChromaticity =
+      ColorSensor_computeChromaticity(_blue, _clear);
+
+  _pFeaturesOut->milliLux = ColorSensor_computeMilliLux(
+      _pFeaturesOut->irFreeRed, _pFeaturesOut->irFreeGreen,
+      _pFeaturesOut->irFreeBlue,
+      ColorSensor_getMilliLuxMultiplier(ATIME_700MS_INTEGRATION_CYCLES));
+
+  _pFeaturesOut->cctKelvin =
+      _pFeaturesOut->irFreeRed > 0
+          ? (int32_t)(CCT_COEFFICIENT * _pFeaturesOut->irFreeBlue /
+                          _pFeaturesOut->irFreeRed +
+                      CCT_OFFSET)
+          : 0;
+}
+
+void ColorSensor_applyWhiteBalance(const uint32_t *_pGains,
+                                   sColorSensorFeatures *_pFeaturesInOut)
+{
+  _pFeaturesInOut->balancedRed = ColorSensor_multiplyQ16(
+      _pFeaturesInOut->irFreeRed, _pGains[COLOR_SENSOR_RED]);
+  _pFeaturesInOut->balancedGreen = ColorSensor_multiplyQ16(
+      _pFeaturesInOut->irFreeGreen, _pGains[COLOR_SENSOR_GREEN]);
+  _pFeaturesInOut->balancedBlue = ColorSensor_multiplyQ16(
+      _pFeaturesInOut->irFreeBlue, _pGains[COLOR_SENSOR_BLUE]);
+}
+
+static int32_t ColorSensor_multiplyQ16(int32_t _value, uint32_t _q16Factor)
+{
+  return (int32_t)(((int64_t)_value * _q16Factor) >> 16);
+}
+
+// The color channels see infrared that the clear channel does not
+static int32_t ColorSensor_computeInfrared(int32_t _red, int32_t _green,
+                                           int32_t _blue, int32_t _clear)
+{
+  int32_t infrared = (_red + _green + _blue - _clear) / 2;
+  return infrared > 0 ? infrared : 0;
+}
 
-  if (redLuminance > greenLuminance && redLuminance > blueLuminance) {
-    return COLOR_SENSOR_RED;
+static int32_t ColorSensor_removeInfrared(int32_t _channel, int32_t _infrared)
+{
+  return _channel > _infrared ? _channel - _infrared : 0;
+}
+
+// A channel above the clear channel only reads so from noise or saturation,
+// so the chromaticity is capped at one
+static uint32_t ColorSensor_computeChromaticity(int32_t _channel,
+                                                int32_t _clear)
+{
+  if (_clear <= 0) {
+    return 0;
   }
-  else if (greenLuminance > redLuminance && greenLuminance > blueLuminance) {
-    return COLOR_SENSOR_GREEN;
+
+  int32_t channel = _channel < _clear ? _channel : _clear;
+  return (uint32_t)(((int64_t)channel * COLOR_SENSOR_Q16_ONE) / _clear);
+}
+
+// lux = G'' / CPL, with CPL = ATIME_ms * AGAIN / DGF
+static uint32_t ColorSensor_getMilliLuxMultiplier(int32_t _integrationCycles)
+{
+  int64_t countsPerLuxDivisor =
+      _integrationCycles * INTEGRATION_CYCLE_TIME_TENTHS_MS * AGAIN_1_TIME_GAIN;
+  int64_t scaledDeviceFactor =
+      (LUX_DEVICE_GAIN_FACTOR * 1000 * 10)
+      << (MILLI_LUX_MULTIPLIER_SHIFT - FEATURE_COEFFICIENT_SHIFT);
+  return (uint32_t)((scaledDeviceFactor + countsPerLuxDivisor / 2) /
+                    countsPerLuxDivisor);
+}
+
+static int32_t ColorSensor_computeMilliLux(int32_t _irFreeRed,
+                                          int32_t _irFreeGreen,
+                                          int32_t _irFreeBlue,
+                                          uint32_t _multiplier)
+{
+  int64_t weightedGreen = LUX_RED_COEFFICIENT * _irFreeRed +
+                          LUX_GREEN_COEFFICIENT * _irFreeGreen +
+                          LUX_BLUE_COEFFICIENT * _irFreeBlue;
+  if (weightedGreen < 0) {
+    return 0;
+  }
+
+  return (int32_t)(((uint64_t)weightedGreen * _multiplier) >>
+                   MILLI_LUX_MULTIPLIER_SHIFT);
+}
+
+bool ColorSensor_computeWhiteBalanceGains(const sColorSensorFeatures *_pWhite,
+                                          uint32_t *_pGainsOut)
+{
+  const int32_t channels[COLOR_SENSOR_NUM_COLORS] = {
+      [COLOR_SENSOR_RED] = _pWhite->irFreeRed,
+      [COLOR_SENSOR_GREEN] = _pWhite->irFreeGreen,
+      [COLOR_SENSOR_BLUE] = _pWhite->irFreeBlue,
+  };
+  for (int i = 0; i < COLOR_SENSOR_NUM_COLORS; i++) {
+    if (channels[i] < WHITE_REFERENCE_MIN_COUNT) {
+      return false;
+    }
+  }
+
+  // Green carries most of the illuminance, so it is the one left alone
+  for (int i = 0; i < COLOR_SENSOR_NUM_COLORS; i++) {
+    _pGainsOut[i] = (uint32_t)((int64_t)channels[COLOR_SENSOR_GREEN] *
+                               COLOR_SENSOR_Q16_ONE / channels[i]);
+  }
+  return true;
+}
+
+eColorSensorColor
+ColorSensor_getFeaturesColor(const sColorSensorFeatures *_pFeatures,
+                             uint32_t *_pConfidencePercentOut)
+{
+  int32_t red = _pFeatures->balancedRed;
+  int32_t green = _pFeatures->balancedGreen;
+  int32_t blue = _pFeatures->balancedBlue;
+
+  // The leading channel wins, and its lead over the runner-up is the
+  // confidence
+  eColorSensorColor color;
+  int32_t leading;
+  int32_t runnerUp;
+  if (red > green && red > blue) {
+    color = COLOR_SENSOR_RED;
+    leading = red;
+    runnerUp = ColorSensor_getMaxValue(green, blue);
+  }
+  else if (green > red && green > blue) {
+    color = COLOR_SENSOR_GREEN;
+    leading = green;
+    runnerUp = ColorSensor_getMaxValue(red, blue);
   }
   else {
-    return COLOR_SENSOR_BLUE;
+    color = COLOR_SENSOR_BLUE;
+    leading = blue;
+    runnerUp = ColorSensor_getMaxValue(red, green);
+  }
+
+  *_pConfidencePercentOut =
+      leading > 0 && leading > runnerUp
+          ? (uint32_t)((int64_t)(leading - runnerUp) * 100 / leading)
+          : 0;
+  return color;
+}
+
+void ColorSensor_setIntegration(sColorSensor *_pSensor,
+                                eColorSensorIntegration _integration)
+{
+  // Frames from before the restart remain readable until the first new one
+  int64_t elapsedMs =
+      Timing_getMonotonicTimeMs() - _pSensor->integrationStartTimeMs;
+  if (elapsedMs >= _pSensor->integrationTimeMs) {
+    _pSensor->previousIntegrationCycles = _pSensor->integrationCycles;
+  }
+
+  int32_t atime = ATIME_700MS;
+  _pSensor->integrationTimeMs = ATIME_700MS_INTEGRATION_TIME_MS;
+  _pSensor->integrationCycles = ATIME_700MS_INTEGRATION_CYCLES;
+  if (_integration == COLOR_SENSOR_INTEGRATION_SHORT) {
+    atime = ATIME_101MS;
+    _pSensor->integrationTimeMs = ATIME_101MS_INTEGRATION_TIME_MS;
+    _pSensor->integrationCycles = ATIME_101MS_INTEGRATION_CYCLES;
+  }
+
+  // Disabling and re-enabling the RGBC ADC restarts the integration cycle, so
+  // the new ATIME applies from now rather than from the next cycle
+  sI2cBusTransaction transaction;
+  I2cBus_initTransaction(&transaction);
+  I2cBus_addWriteReg(&transaction, SELECT_ENABLE_REGISTER_ADDRESS,
+                     POWER_ON_RGBC_DISABLE);
+  I2cBus_addWriteReg(&transaction, SELECT_ALS_TIME_REGISTER_ADDRESS, atime);
+  I2cBus_addWriteReg(&transaction, SELECT_ENABLE_REGISTER_ADDRESS,
+                     POWER_ON_RGBC_ENABLE_WAIT_TIME_DISABLE);
+  I2cBus_execute(&_pSensor->device, I2C_BUS_PRIORITY_DETECTION, &transaction);
+  _pSensor->integrationStartTimeMs = Timing_getMonotonicTimeMs();
+}
+
+void ColorSensor_waitForFrame(const sColorSensor *_pSensor)
+{
+  Timing_milliSleep(0, ColorSensor_getMsUntilFrame(_pSensor));
+}
+
+void ColorSensor_waitForNextFrame(const sColorSensor *_pSensor)
+{
+  Timing_milliSleep(0, ColorSensor_getMsUntilNextFrame(_pSensor));
+}
+
+int64_t ColorSensor_getMsUntilFrame(const sColorSensor *_pSensor)
+{
+  int64_t elapsedMs =
+      Timing_getMonotonicTimeMs() - _pSensor->integrationStartTimeMs;
+  if (elapsedMs >= _pSensor->integrationTimeMs) {
+    return 0;
+  }
+
+  return _pSensor->integrationTimeMs - elapsedMs;
+}
+
+int64_t ColorSensor_getMsUntilNextFrame(const sColorSensor *_pSensor)
+{
+  int64_t elapsedMs =
+      Timing_getMonotonicTimeMs() - _pSensor->integrationStartTimeMs;
+  int64_t framesDone = elapsedMs / _pSensor->integrationTimeMs;
+  int64_t nextFrameMs = (framesDone + 1) * _pSensor->integrationTimeMs;
+  return nextFrameMs - elapsedMs;
+}
+
+// Bulk conversion functions
+// ----------------------------------------------------------------------------
+void ColorSensor_convertFrames(const uint8_t *_pFrames, size_t _numFrames,
+                               eColorSensorIntegration _integration,
+                               const sColorSensorFrameArrays *_pFramesOut)
+{
+#ifdef COLOR_SENSOR_NEON
+  uint32_t milliLuxMultiplier = ColorSensor_getMilliLuxMultiplier(
+      _integration == COLOR_SENSOR_INTEGRATION_SHORT
+          ? ATIME_101MS_INTEGRATION_CYCLES
+          : ATIME_700MS_INTEGRATION_CYCLES);
+
+  // Eight frames at a time, deinterleaved into one vector per channel
+  size_t i = 0;
+  for (; i + 8 <= _numFrames; i += 8) {
+    uint16x8x4_t frames = vld4q_u16(
+        (const uint16_t *)(_pFrames + i * COLOR_SENSOR_FRAME_NUM_BYTES));
+    uint16x8_t clear = frames.val[0];
+    uint16x8_t red = frames.val[1];
+    uint16x8_t green = frames.val[2];
+    uint16x8_t blue = frames.val[3];
+    vst1q_u16(&_pFramesOut->pRed[i], red);
+    vst1q_u16(&_pFramesOut->pGreen[i], green);
+    vst1q_u16(&_pFramesOut->pBlue[i], blue);
+    vst1q_u16(&_pFramesOut->pClear[i], clear);
+
+    ColorSensor_convertFramesNeon(
+        vmovl_u16(vget_low_u16(red)), vmovl_u16(vget_low_u16(green)),
+        vmovl_u16(vget_low_u16(blue)), vmovl_u16(vget_low_u16(clear)), i,
+        milliLuxMultiplier, _pFramesOut);
+    ColorSensor_convertFramesNeon(
+        vmovl_u16(vget_high_u16(red)), vmovl_u16(vget_high_u16(green)),
+        vmovl_u16(vget_high_u16(blue)), vmovl_u16(vget_high_u16(clear)),
+        i + 4, milliLuxMultiplier, _pFramesOut);
+  }
+
+  for (; i < _numFrames; i++) {
+    ColorSensor_convertFrame(_pFrames + i * COLOR_SENSOR_FRAME_NUM_BYTES, i,
+                             milliLuxMultiplier, _pFramesOut);
+  }
+#else
+  ColorSensor_convertFramesScalar(_pFrames, _numFrames, _integration,
+                                  _pFramesOut);
+#endif
+}
+
+void ColorSensor_convertFramesScalar(const uint8_t *_pFrames,
+                                     size_t _numFrames,
+                                     eColorSensorIntegration _integration,
+                                     const sColorSensorFrameArrays *_pFramesOut)
+{
+  uint32_t milliLuxMultiplier = ColorSensor_getMilliLuxMultiplier(
+      _integration == COLOR_SENSOR_INTEGRATION_SHORT
+          ? ATIME_101MS_INTEGRATION_CYCLES
+          : ATIME_700MS_INTEGRATION_CYCLES);
+
+  for (size_t i = 0; i < _numFrames; i++) {
+    ColorSensor_convertFrame(_pFrames + i * COLOR_SENSOR_FRAME_NUM_BYTES, i,
+                             milliLuxMultiplier, _pFramesOut);
   }
 }
 
+static void ColorSensor_convertFrame(const uint8_t *_pFrame, size_t _index,
+                                     uint32_t _milliLuxMultiplier,
+                                     const sColorSensorFrameArrays *_pOut)
+{
+  int32_t clear = _pFrame[1] * 256 + _pFrame[0];
+  int32_t red = _pFrame[3] * 256 + _pFrame[2];
+  int32_t green = _pFrame[5] * 256 + _pFrame[4];
+  int32_t blue = _pFrame[7] * 256 + _pFrame[6];
+  _pOut->pRed[_index] = red;
+  _pOut->pGreen[_index] = green;
+  _pOut->pBlue[_index] = blue;
+  _pOut->pClear[_index] = clear;
+
+  int32_t infrared = ColorSensor_computeInfrared(red, green, blue, clear);
+  _pOut->pMilliLux[_index] = ColorSensor_computeMilliLux(
+      ColorSensor_removeInfrared(red, infrared),
+      ColorSensor_removeInfrared(green, infrared),
+      ColorSensor_removeInfrared(blue, infrared), _milliLuxMultiplier);
+
+  _pOut->pRedChromaticity[_index] =
+      ColorSensor_computeChromaticity(red, clear);
+  _pOut->pGreenChromaticity[_index] =
+      ColorSensor_computeChromaticity(green, clear);
+  _pOut->pBlueChromaticity[_index] =
+      ColorSensor_computeChromaticity(blue, clear);
+}
+
+#ifdef COLOR_SENSOR_NEON
+// Converts the four frames from _index on. Counts are at most 16 bits, so the
+// weighted green and the chromaticity numerators fit in 32-bit lanes.
+static void ColorSensor_convertFramesNeon(uint32x4_t _red, uint32x4_t _green,
+                                          uint32x4_t _blue, uint32x4_t _clear,
+                                          size_t _index,
+                                          uint32_t _milliLuxMultiplier,
+                                          const sColorSensorFrameArrays *_pOut)
+{
+  // An arithmetic shift rounds down where the division truncates, which only
+  // differs for a negative infrared, clamped to zero anyway
+  int32x4_t colorSum = vreinterpretq_s32_u32(
+      vsubq_u32(vaddq_u32(vaddq_u32(_red, _green), _blue), _clear));
+  uint32x4_t infrared = vreinterpretq_u32_s32(
+      vmaxq_s32(vshrq_n_s32(colorSum, 1), vdupq_n_s32(0)));
+  int32x4_t irFreeRed = vreinterpretq_s32_u32(vqsubq_u32(_red, infrared));
+  int32x4_t irFreeGreen = vreinterpretq_s32_u32(vqsubq_u32(_green, infrared));
+  int32x4_t irFreeBlue = vreinterpretq_s32_u32(vqsubq_u32(_blue, infrared));
+
+  int32x4_t weightedGreen = vmulq_n_s32(irFreeRed, LUX_RED_COEFFICIENT);
+  weightedGreen =
+      vmlaq_n_s32(weightedGreen, irFreeGreen, LUX_GREEN_COEFFICIENT);
+  weightedGreen =
+      vmlaq_n_s32(weightedGreen, irFreeBlue, LUX_BLUE_COEFFICIENT);
+  uint32x4_t positiveGreen =
+      vreinterpretq_u32_s32(vmaxq_s32(weightedGreen, vdupq_n_s32(0)));
+  uint64x2_t lowProducts =
+      vmull_n_u32(vget_low_u32(positiveGreen), _milliLuxMultiplier);
+  uint64x2_t highProducts =
+      vmull_n_u32(vget_high_u32(positiveGreen), _milliLuxMultiplier);
+  uint32x4_t milliLux = vcombine_u32(vshrn_n_u64(lowProducts, 32),
+                                     vshrn_n_u64(highProducts, 32));
+  vst1q_s32(&_pOut->pMilliLux[_index], vreinterpretq_s32_u32(milliLux));
+
+  vst1q_u32(&_pOut->pRedChromaticity[_index],
+            ColorSensor_computeChromaticitiesNeon(_red, _clear));
+  vst1q_u32(&_pOut->pGreenChromaticity[_index],
+            ColorSensor_computeChromaticitiesNeon(_green, _clear));
+  vst1q_u32(&_pOut->pBlueChromaticity[_index],
+            ColorSensor_computeChromaticitiesNeon(_blue, _clear));
+}
+
+// NEON has no integer division. The quotient is estimated from a refined
+// reciprocal of the clear channel, which lands within one of it, and the
+// remainder then settles it exactly.
+static uint32x4_t ColorSensor_computeChromaticitiesNeon(uint32x4_t _channel,
+                                                        uint32x4_t _clear)
+{
+  uint32x4_t channel = vminq_u32(_channel, _clear);
+
+  float32x4_t clear = vcvtq_f32_u32(_clear);
+  float32x4_t reciprocal = vrecpeq_f32(clear);
+  reciprocal = vmulq_f32(reciprocal, vrecpsq_f32(clear, reciprocal));
+  reciprocal = vmulq_f32(reciprocal, vrecpsq_f32(clear, reciprocal));
+  float32x4_t estimate = vmulq_f32(
+      vmulq_n_f32(vcvtq_f32_u32(channel), COLOR_SENSOR_Q16_ONE), reciprocal);
+  uint32x4_t quotient = vminq_u32(vcvtq_u32_f32(estimate),
+                                  vdupq_n_u32(COLOR_SENSOR_Q16_ONE));
+
+  // Comparison masks are all ones, so adding one subtracts one
+  uint32x4_t numerator = vshlq_n_u32(channel, 16);
+  uint32x4_t isOver = vcgtq_u32(vmulq_u32(quotient, _clear), numerator);
+  quotient = vaddq_u32(quotient, isOver);
+  uint32x4_t remainder = vsubq_u32(numerator, vmulq_u32(quotient, _clear));
+  quotient = vsubq_u32(quotient, vcgeq_u32(remainder, _clear));
+
+  return vbicq_u32(quotient, vceqq_u32(_clear, vdupq_n_u32(0)));
+}
+#endif
+
+// Calibration profile functions
+// ----------------------------------------------------------------------------
+static void ColorSensor_loadCalibrationProfile(sColorSensor *_pSensor)
+{
+  const char *path = _pSensor->config.pCalibrationProfilePath;
+  if (path == NULL) {
+    return;
+  }
+
+  FILE *pFile = fopen(path, "r");
+  if (pFile == NULL) {
+    printf("No calibration profile at %s, using unity white balance.\n",
+           path);
+    return;
+  }
+
+  char line[CALIBRATION_PROFILE_LINE_LEN];
+  while (fgets(line, CALIBRATION_PROFILE_LINE_LEN, pFile) != NULL) {
+    char name[CALIBRATION_PROFILE_LINE_LEN];
+    unsigned long gain;
+    if (sscanf(line, "%127s %lu", name, &gain) != 2 || gain == 0) {
+      continue;
+    }
+
+    for (int i = 0; i < COLOR_SENSOR_NUM_COLORS; i++) {
+      if (strcmp(name, WHITE_BALANCE_GAIN_NAMES[i]) == 0) {
+        _pSensor->whiteBalanceGains[i] = (uint32_t)gain;
+      }
+    }
+  }
+
+  fclose(pFile);
+}
+
+static void ColorSensor_saveCalibrationProfile(const sColorSensor *_pSensor)
+{
+  const char *path = _pSensor->config.pCalibrationProfilePath;
+  if (path == NULL) {
+    return;
+  }
+
+  FILE *pFile = fopen(path, "w");
+  if (pFile == NULL) {
+    fprintf(stderr, "Unable to save calibration profile to %s.\n", path);
+    return;
+  }
+
+  for (int i = 0; i < COLOR_SENSOR_NUM_COLORS; i++) {
+    fprintf(pFile, "%s %lu\n", WHITE_BALANCE_GAIN_NAMES[i],
+            (unsigned long)_pSensor->whiteBalanceGains[i]);
+  }
+
+  fclose(pFile);
+}
+
 static void
 ColorSensor_regValsToRgbLuminanceValues(uint8_t *_pRegisterBytesIn,
                                         int32_t *_pLuminanceValuesOut)
@@ -186,12 +818,13 @@ ColorSensor_regValsToRgbLuminanceValues(uint8_t *_pRegisterBytesIn,
   _pLuminanceValuesOut[BLUE_LUMINANCE_OUT_INDEX] = blue;
 }
 
-static void ColorSensor_regValsToIrLuminanceValue(uint8_t *_pRegisterBytesIn,
-                                                  int32_t *_pLuminanceValuesOut)
+static void
+ColorSensor_regValsToClearLuminanceValue(uint8_t *_pRegisterBytesIn,
+                                         int32_t *_pLuminanceValuesOut)
 {
   int32_t cData = (_pRegisterBytesIn[1] * 256 + _pRegisterBytesIn[0]);
 
-  _pLuminanceValuesOut[IR_LUMINANCE_OUT_INDEX] = cData;
+  _pLuminanceValuesOut[CLEAR_LUMINANCE_OUT_INDEX] = cData;
 }
 
 static void ColorSensor_RGBValsToAmbientLightLuminanceValue(
@@ -206,3 +839,24 @@ static void ColorSensor_RGBValsToAmbientLightLuminanceValue(
 
   _pLuminanceValuesOut[AMBIENT_LIGHT_LUMINANCE_OUT_INDEX] = (int32_t)luminance;
 }
+
+// Scales values from a frame integrated with fewer cycles up to what a
+// full-integration frame would read, so that they compare against the baseline.
+static void
+ColorSensor_normalizeToFullIntegration(const sColorSensor *_pSensor,
+                                       int32_t *_pLuminanceValuesInOut)
+{
+  int64_t elapsedMs =
+      Timing_getMonotonicTimeMs() - _pSensor->integrationStartTimeMs;
+  int32_t frameCycles = elapsedMs >= _pSensor->integrationTimeMs
+                            ? _pSensor->integrationCycles
+                            : _pSensor->previousIntegrationCycles;
+  if (frameCycles == ATIME_700MS_INTEGRATION_CYCLES) {
+    return;
+  }
+
+  for (size_t i = 0; i < LUMINANCE_OUTPUT_ARRAY_SIZE; i++) {
+    _pLuminanceValuesInOut[i] = (int64_t)_pLuminanceValuesInOut[i] *
+                                ATIME_700MS_INTEGRATION_CYCLES / frameCycles;
+  }
+}
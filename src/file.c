@@ -4,8 +4,12 @@
  */
 
 #include "../include/file.h"
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 int File_concatFilePath(const char *_pFilePathBegin, const char *_pFilePathEnd,
                         char *_pConcatFilePath, const int concatFilePathSize)
@@ -56,3 +60,58 @@ int File_writeToFile(const char *_pFilePath, const char *_pValue)
 
   return 1;
 }
+
+int File_openAttribute(const char *_pFilePath, int _flags)
+{
+  int openFlags = O_CLOEXEC;
+  if ((_flags & FILE_ATTRIBUTE_READ) && (_flags & FILE_ATTRIBUTE_WRITE)) {
+    openFlags |= O_RDWR;
+  }
+  else if (_flags & FILE_ATTRIBUTE_WRITE) {
+    openFlags |= O_WRONLY;
+  }
+  else {
+    openFlags |= O_RDONLY;
+  }
+  if (_flags & FILE_ATTRIBUTE_NONBLOCK) {
+    openFlags |= O_NONBLOCK;
+  }
+
+  int attributeFd = open(_pFilePath, openFlags);
+  return attributeFd < 0 ? -errno : attributeFd;
+}
+
+void File_closeAttribute(int _attributeFd)
+{
+  if (_attributeFd >= 0) {
+    close(_attributeFd);
+  }
+}
+
+int File_writeAttribute(int _attributeFd, const char *_pValue)
+{
+  // Sysfs takes the whole value in a single write
+  ssize_t length = (ssize_t)strlen(_pValue);
+  ssize_t charsWritten = pwrite(_attributeFd, _pValue, length, 0);
+  if (charsWritten < 0) {
+    return -errno;
+  }
+
+  return charsWritten == length ? 0 : -EIO;
+}
+
+int File_readAttribute(int _attributeFd, char *_readBuffer,
+                       const int _readBufferSize)
+{
+  ssize_t charsRead = pread(_attributeFd, _readBuffer, _readBufferSize - 1, 0);
+  if (charsRead < 0) {
+    return -errno;
+  }
+
+  _readBuffer[charsRead] = '\0';
+  if (charsRead > 0 && _readBuffer[charsRead - 1] == '\n') {
+    _readBuffer[--charsRead] = '\0';
+  }
+
+  return (int)charsRead;
+}
@@ -1,7 +1,9 @@
 #include "../include/gate.h"
+#include "../include/actuator.h"
 #include "../include/servo.h"
 #include "../include/timing.h"
 
+#include <stdint.h>
 #include <stdlib.h>
 
 // Servo max and min duty cycles
@@ -9,75 +11,215 @@
 static const char *MAX_MICRO_SERVO = "1000000";		// clockwise
 static const char *MIN_MICRO_SERVO = "2000000";		// counterclockwise
 
+// Time given to a gate to travel between the raised and lowered positions
+// ----------------------------------------------------------------------------
+static const int64_t GATE_TRAVEL_TIME_MS = 3000;
+
 // Function prototype declarations
 // ----------------------------------------------------------------------------
-static void enableGates(void);
+static void enableGates(sGates *_pGates);
+
+static void unenableGates(sGates *_pGates);
+
+static void getConfigurationPositions(eGateConfig _config,
+									  eGatePosition *_pGate1PositionOut,
+									  eGatePosition *_pGate2PositionOut);
 
-static void unenableGates(void);
+static sActuatorToken setGatePosition(sGates *_pGates, eGateNum _gate,
+									  eGatePosition _position);
 
 // Public Functions
 // ----------------------------------------------------------------------------
 
-void Gate_init(void)
+void Gate_init(sGates *_pGates, sActuator *_pActuator)
 {
+	_pGates->pActuator = _pActuator;
+	_pGates->gatesToken = ACTUATOR_TOKEN_COMPLETE;
+
 	// Enable gates
   Timing_nanoSleep(0, 500000000);
-	enableGates();
+	enableGates(_pGates);
   Timing_nanoSleep(0, 500000000);
 	// Set gate 1 to raised position
-	Gate_raisesGate(gate1);
+	Gate_raisesGate(_pGates, gate1);
 	// Set gate 2 to raised position
-	Gate_raisesGate(gate2);
+	Gate_raisesGate(_pGates, gate2);
   Timing_nanoSleep(0, 500000000);
 }
 
-void Gate_cleanup(void)
+void Gate_cleanup(sGates *_pGates)
 {
 	// Set gate 1 to raised position
   Timing_nanoSleep(0, 500000000);
-	Gate_lowersGate(gate1);
+	Gate_lowersGate(_pGates, gate1);
 	// Set gate 2 to raised position
-	Gate_lowersGate(gate2);
+	Gate_lowersGate(_pGates, gate2);
 	// Unenable gates
   Timing_nanoSleep(0, 500000000);
-	unenableGates();
+	unenableGates(_pGates);
 }
 
-void Gate_raisesGate(eGateNum _gateToRaise)
+sActuatorToken Gate_raisesGate(sGates *_pGates, eGateNum _gateToRaise)
+{
+	// Set gate to 2000000
+	sActuatorToken token =
+		Actuator_submit(_pGates->pActuator, _gateToRaise, MIN_MICRO_SERVO,
+						GATE_TRAVEL_TIME_MS);
+	_pGates->gatesToken = Actuator_combineTokens(_pGates->gatesToken, token);
+	return token;
+}
+
+sActuatorToken Gate_lowersGate(sGates *_pGates, eGateNum _gateToLower)
 {
-	// Gets the correct servo
-	Servo servo = Servo_getServo(_gateToRaise);
 	// Set gate to 1000000
-	Servo_changeDutyCycle(servo, MIN_MICRO_SERVO);
+	sActuatorToken token =
+		Actuator_submit(_pGates->pActuator, _gateToLower, MAX_MICRO_SERVO,
+						GATE_TRAVEL_TIME_MS);
+	_pGates->gatesToken = Actuator_combineTokens(_pGates->gatesToken, token);
+	return token;
 }
 
-void Gate_lowersGate(eGateNum _gateToLower)
+sActuatorToken Gate_setConfiguration(sGates *_pGates, eGateConfig _config)
 {
-	// Gets the correct servo
-	Servo servo = Servo_getServo(_gateToLower);
-	// Set gate to 2000000
-	Servo_changeDutyCycle(servo, MAX_MICRO_SERVO);
+	eGatePosition gate1Target;
+	eGatePosition gate2Target;
+	getConfigurationPositions(_config, &gate1Target, &gate2Target);
+
+	return Actuator_combineTokens(setGatePosition(_pGates, gate1, gate1Target),
+								  setGatePosition(_pGates, gate2, gate2Target));
+}
+
+// State functions
+// ----------------------------------------------------------------------------
+
+eGatePosition Gate_getPosition(const sGates *_pGates, eGateNum _gate)
+{
+	if (Actuator_isSubmittedTo(_pGates->pActuator, _gate, MIN_MICRO_SERVO)) {
+		return GATE_RAISED;
+	}
+	else if (Actuator_isSubmittedTo(_pGates->pActuator, _gate,
+									MAX_MICRO_SERVO)) {
+		return GATE_LOWERED;
+	}
+
+	return GATE_UNKNOWN;
+}
+
+bool Gate_getConfiguration(const sGates *_pGates, eGateConfig *_pConfigOut)
+{
+	const eGateConfig configs[] = {GATE_CONFIG_GARBAGE, GATE_CONFIG_COMPOST,
+								   GATE_CONFIG_RECYCLING};
+	for (int i = 0; i < sizeof(configs) / sizeof(configs[0]); i++) {
+		if (Gate_isConfigurationCommanded(_pGates, configs[i])) {
+			*_pConfigOut = configs[i];
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool Gate_isConfigurationReached(const sGates *_pGates, eGateConfig _config)
+{
+	return Gate_isConfigurationCommanded(_pGates, _config) &&
+		   Actuator_isComplete(_pGates->pActuator, _pGates->gatesToken);
+}
+
+bool Gate_isConfigurationCommanded(const sGates *_pGates,
+								   eGateConfig _config)
+{
+	eGatePosition gate1Target;
+	eGatePosition gate2Target;
+	getConfigurationPositions(_config, &gate1Target, &gate2Target);
+
+	return Gate_getPosition(_pGates, gate1) == gate1Target &&
+		   Gate_getPosition(_pGates, gate2) == gate2Target;
+}
+
+int Gate_getNumGatesToMove(eGateConfig _from, eGateConfig _to)
+{
+	eGatePosition fromGate1;
+	eGatePosition fromGate2;
+	getConfigurationPositions(_from, &fromGate1, &fromGate2);
+
+	eGatePosition toGate1;
+	eGatePosition toGate2;
+	getConfigurationPositions(_to, &toGate1, &toGate2);
+
+	return (fromGate1 != toGate1) + (fromGate2 != toGate2);
+}
+
+int64_t Gate_getTravelTimeMs(void)
+{
+	return GATE_TRAVEL_TIME_MS;
+}
+
+int64_t Gate_getTransitionTimeMs(eGateConfig _from, eGateConfig _to)
+{
+	return Gate_getNumGatesToMove(_from, _to) > 0 ? GATE_TRAVEL_TIME_MS : 0;
+}
+
+void Gate_waitUntilSettled(const sGates *_pGates)
+{
+	Actuator_wait(_pGates->pActuator, _pGates->gatesToken);
 }
 
 // Private Functions
 // ----------------------------------------------------------------------------
 
-static void enableGates(void)
+static void enableGates(sGates *_pGates)
 {
+	sServoBank *servoBank = Actuator_getServoBank(_pGates->pActuator);
 	// Enable gate 1
-	Servo servo1 = Servo_getServo(gate1);
+	Servo servo1 = Servo_getServo(servoBank, gate1);
 	Servo_enableSignal(servo1, "1");
 	// Enable gate 2
-	Servo servo2 = Servo_getServo(gate2);
+	Servo servo2 = Servo_getServo(servoBank, gate2);
 	Servo_enableSignal(servo2, "1");
 }
 
-static void unenableGates(void)
+static void unenableGates(sGates *_pGates)
 {
+	sServoBank *servoBank = Actuator_getServoBank(_pGates->pActuator);
 	// Unenable gate 1
-	Servo servo1 = Servo_getServo(gate1);
+	Servo servo1 = Servo_getServo(servoBank, gate1);
 	Servo_enableSignal(servo1, "0");
 	// Unenable gate 2
-	Servo servo2 = Servo_getServo(gate2);
+	Servo servo2 = Servo_getServo(servoBank, gate2);
 	Servo_enableSignal(servo2, "0");
 }
+
+// Sets the positions gates 1 and 2 must be in for the given configuration.
+static void getConfigurationPositions(eGateConfig _config,
+									  eGatePosition *_pGate1PositionOut,
+									  eGatePosition *_pGate2PositionOut)
+{
+	switch (_config) {
+	case GATE_CONFIG_COMPOST:
+		*_pGate1PositionOut = GATE_LOWERED;
+		*_pGate2PositionOut = GATE_RAISED;
+		break;
+	case GATE_CONFIG_RECYCLING:
+		*_pGate1PositionOut = GATE_LOWERED;
+		*_pGate2PositionOut = GATE_LOWERED;
+		break;
+	case GATE_CONFIG_GARBAGE:
+	default:
+		*_pGate1PositionOut = GATE_RAISED;
+		*_pGate2PositionOut = GATE_RAISED;
+		break;
+	}
+}
+
+static sActuatorToken setGatePosition(sGates *_pGates, eGateNum _gate,
+									  eGatePosition _position)
+{
+	if (_position == GATE_RAISED) {
+		return Gate_raisesGate(_pGates, _gate);
+	}
+	else if (_position == GATE_LOWERED) {
+		return Gate_lowersGate(_pGates, _gate);
+	}
+
+	return ACTUATOR_TOKEN_COMPLETE;
+}
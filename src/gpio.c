@@ -0,0 +1,172 @@
+/*
+ * The gpio module fills a single line request with the configuration of all
+ * the lines, and keeps the line request descriptor the kernel returns. Values
+ * and events of the lines are then exchanged through that descriptor only.
+ */
+
+#include "../include/gpio.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/gpio.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#define MAX_EVENTS_PER_READ 16
+
+static uint64_t Gpio_getLineFlags(const sGpioConfig *_pConfig);
+
+// Request functions
+// ----------------------------------------------------------------------------
+bool Gpio_requestLines(const char *_pChipPath, const uint32_t *_pOffsets,
+                       uint32_t _numLines, const sGpioConfig *_pConfig,
+                       const char *_pConsumer, sGpioLines *_pLinesOut)
+{
+  _pLinesOut->fd = -1;
+  _pLinesOut->numLines = 0;
+  if (_numLines == 0 || _numLines > GPIO_MAX_LINES) {
+    fprintf(stderr, "Gpio: Cannot request %u lines.\n", (unsigned)_numLines);
+    return false;
+  }
+
+  struct gpio_v2_line_request request;
+  memset(&request, 0, sizeof(request));
+  memcpy(request.offsets, _pOffsets, _numLines * sizeof(uint32_t));
+  request.num_lines = _numLines;
+  snprintf(request.consumer, sizeof(request.consumer), "%s", _pConsumer);
+
+  uint64_t allLines = _numLines == 64 ? UINT64_MAX : (1ULL << _numLines) - 1;
+  request.config.flags = Gpio_getLineFlags(_pConfig);
+  if (_pConfig->direction == GPIO_DIRECTION_OUTPUT) {
+    struct gpio_v2_line_config_attribute *attribute =
+        &request.config.attrs[request.config.num_attrs++];
+    attribute->attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+    attribute->attr.values = _pConfig->initialValues;
+    attribute->mask = allLines;
+  }
+  else if (_pConfig->debounceUs > 0) {
+    struct gpio_v2_line_config_attribute *attribute =
+        &request.config.attrs[request.config.num_attrs++];
+    attribute->attr.id = GPIO_V2_LINE_ATTR_ID_DEBOUNCE;
+    attribute->attr.debounce_period_us = _pConfig->debounceUs;
+    attribute->mask = allLines;
+  }
+
+  int chipFd = open(_pChipPath, O_RDWR | O_CLOEXEC);
+  if (chipFd < 0) {
+    fprintf(stderr, "Gpio: Unable to open %s: %s\n", _pChipPath,
+            strerror(errno));
+    return false;
+  }
+
+  int result = ioctl(chipFd, GPIO_V2_GET_LINE_IOCTL, &request);
+  int requestErrno = errno;
+  close(chipFd);
+  if (result < 0) {
+    fprintf(stderr, "Gpio: Unable to request lines of %s: %s\n", _pChipPath,
+            strerror(requestErrno));
+    return false;
+  }
+
+  _pLinesOut->fd = request.fd;
+  _pLinesOut->numLines = _numLines;
+  memcpy(_pLinesOut->offsets, _pOffsets, _numLines * sizeof(uint32_t));
+  return true;
+}
+
+void Gpio_releaseLines(sGpioLines *_pLines)
+{
+  if (_pLines->fd >= 0) {
+    close(_pLines->fd);
+  }
+
+  _pLines->fd = -1;
+  _pLines->numLines = 0;
+}
+
+static uint64_t Gpio_getLineFlags(const sGpioConfig *_pConfig)
+{
+  uint64_t flags = _pConfig->isActiveLow ? GPIO_V2_LINE_FLAG_ACTIVE_LOW : 0;
+  if (_pConfig->direction == GPIO_DIRECTION_OUTPUT) {
+    return flags | GPIO_V2_LINE_FLAG_OUTPUT;
+  }
+
+  flags |= GPIO_V2_LINE_FLAG_INPUT;
+  if (_pConfig->edge == GPIO_EDGE_RISING || _pConfig->edge == GPIO_EDGE_BOTH) {
+    flags |= GPIO_V2_LINE_FLAG_EDGE_RISING;
+  }
+  if (_pConfig->edge == GPIO_EDGE_FALLING || _pConfig->edge == GPIO_EDGE_BOTH) {
+    flags |= GPIO_V2_LINE_FLAG_EDGE_FALLING;
+  }
+
+  return flags;
+}
+
+// Value functions
+// ----------------------------------------------------------------------------
+bool Gpio_getValues(const sGpioLines *_pLines, uint64_t _mask,
+                    uint64_t *_pValuesOut)
+{
+  struct gpio_v2_line_values values;
+  memset(&values, 0, sizeof(values));
+  values.mask = _mask;
+  if (ioctl(_pLines->fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0) {
+    perror("Gpio: Unable to get line values");
+    return false;
+  }
+
+  *_pValuesOut = values.bits & _mask;
+  return true;
+}
+
+bool Gpio_setValues(const sGpioLines *_pLines, uint64_t _mask,
+                    uint64_t _values)
+{
+  struct gpio_v2_line_values values;
+  memset(&values, 0, sizeof(values));
+  values.mask = _mask;
+  values.bits = _values;
+  if (ioctl(_pLines->fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &values) < 0) {
+    perror("Gpio: Unable to set line values");
+    return false;
+  }
+
+  return true;
+}
+
+// Event functions
+// ----------------------------------------------------------------------------
+int Gpio_readEvents(const sGpioLines *_pLines, int _timeoutMs,
+                    sGpioEvent *_pEventsOut, int _maxEvents)
+{
+  struct pollfd pollFd = {_pLines->fd, POLLIN, 0};
+  int numReady = poll(&pollFd, 1, _timeoutMs);
+  if (numReady < 0) {
+    return errno == EINTR ? 0 : -1;
+  }
+  if (numReady == 0) {
+    return 0;
+  }
+
+  // The kernel only hands out whole events, as many as fit in the buffer
+  struct gpio_v2_line_event events[MAX_EVENTS_PER_READ];
+  int maxEvents =
+      _maxEvents < MAX_EVENTS_PER_READ ? _maxEvents : MAX_EVENTS_PER_READ;
+  ssize_t numBytes = read(_pLines->fd, events, maxEvents * sizeof(events[0]));
+  if (numBytes < 0) {
+    return errno == EAGAIN || errno == EINTR ? 0 : -1;
+  }
+
+  int numEvents = (int)(numBytes / (ssize_t)sizeof(events[0]));
+  for (int i = 0; i < numEvents; i++) {
+    _pEventsOut[i].offset = events[i].offset;
+    _pEventsOut[i].isRising = events[i].id == GPIO_V2_LINE_EVENT_RISING_EDGE;
+    _pEventsOut[i].timestampNs = (int64_t)events[i].timestamp_ns;
+    _pEventsOut[i].sequence = events[i].seqno;
+  }
+
+  return numEvents;
+}
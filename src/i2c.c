@@ -29,15 +29,20 @@ static void I2c_getP9DataAndClockPinsForI2cBusNum(int32_t _busNum,
                                                   int32_t *_pPinNumsOut);
 static void I2c_getBusNameStringFromBusNum(char *_pBusNameBuffer,
                                            size_t _bufferSize, int32_t _busNum);
-static void I2c_setI2cBusPinToI2cMode(const char *_p9DataPinStr);
-static int I2c_setI2CDeviceToSlaveAddress(const char *_pBusName,
-                                          int32_t _deviceAddress);
 static void I2c_writeRegAddrToI2cBus(int32_t _i2cFileDesc, uint8_t _regAddr);
 static void I2c_readBytesFromRegAddr(int32_t _i2cFileDesc,
                                      uint8_t *_pValueOutput,
                                      size_t _sizeofValueOutput);
 
 int32_t I2c_initI2cDevice(int32_t _busNum, int32_t _deviceAddress)
+{
+  int32_t i2cFileDesc = I2c_openI2cBus(_busNum);
+  I2c_setSlaveAddress(i2cFileDesc, _deviceAddress);
+
+  return i2cFileDesc;
+}
+
+int32_t I2c_openI2cBus(int32_t _busNum)
 {
   I2c_setI2cBusPinsToI2cMode(_busNum);
 
@@ -47,7 +52,11 @@ int32_t I2c_initI2cDevice(int32_t _busNum, int32_t _deviceAddress)
   char busName[BUS_NAME_BUFFER_SIZE];
   I2c_getBusNameStringFromBusNum(busName, BUS_NAME_BUFFER_SIZE, _busNum);
 
-  int32_t i2cFileDesc = I2c_setI2CDeviceToSlaveAddress(busName, _deviceAddress);
+  int32_t i2cFileDesc = open(busName, O_RDWR);
+  if (i2cFileDesc < 0) {
+    perror("I2C: Unable to open I2C bus.");
+    exit(1);
+  }
 
   return i2cFileDesc;
 }
@@ -65,8 +74,13 @@ static void I2c_setI2cBusPinsToI2cMode(int32_t _busNum)
   char p9ClockPinStr[50];
   snprintf(p9ClockPinStr, 50, "P9_%d", dataAndClockPins[1]);
 
-  I2c_setI2cBusPinToI2cMode(p9DataPinStr);
-  I2c_setI2cBusPinToI2cMode(p9ClockPinStr);
+  // Both pins are set at once, and only if they are not in i2c mode already
+  const sShellPinMode pinModes[] = {{p9DataPinStr, "i2c"},
+                                    {p9ClockPinStr, "i2c"}};
+  if (!Shell_setPinModes(pinModes, sizeof(pinModes) / sizeof(pinModes[0]))) {
+    fprintf(stderr, "I2C: Unable to set pins of bus %d to i2c mode.\n",
+            _busNum);
+  }
 }
 
 // Get bus name string from bus number like "/dev/i2c-1"
@@ -76,17 +90,13 @@ static void I2c_getBusNameStringFromBusNum(char *_pBusNameBufferOut,
   snprintf(_pBusNameBufferOut, _bufferSize, I2CDRV_LINUX_BUS_FORMAT, _busNum);
 }
 
-static int32_t I2c_setI2CDeviceToSlaveAddress(const char *_pBusName,
-                                              int32_t _deviceAddress)
+void I2c_setSlaveAddress(int32_t _i2cFileDesc, int32_t _deviceAddress)
 {
-  int32_t i2cFileDesc = open(_pBusName, O_RDWR);
-  int32_t result = ioctl(i2cFileDesc, I2C_SLAVE, _deviceAddress);
+  int32_t result = ioctl(_i2cFileDesc, I2C_SLAVE, _deviceAddress);
   if (result < 0) {
     perror("I2C: Unable to set I2C device to slave address.");
     exit(1);
   }
-
-  return i2cFileDesc;
 }
 
 void I2c_closeI2cDevice(int32_t _i2cFileDesc)
@@ -112,13 +122,6 @@ static void I2c_getP9DataAndClockPinsForI2cBusNum(int32_t _busNum,
   }
 }
 
-static void I2c_setI2cBusPinToI2cMode(const char *_p9DataPinStr)
-{
-  const char *argsData[] = {_p9DataPinStr, "i2c"};
-  Shell_execCommand("/usr/bin/config-pin", argsData,
-                    sizeof(argsData) / sizeof(argsData[0]));
-}
-
 void I2c_writeI2cReg(int32_t _i2cFileDesc, uint8_t _regAddr, uint8_t _value)
 {
   uint8_t buff[2];
@@ -166,3 +169,8 @@ static void I2c_readBytesFromRegAddr(int32_t _i2cFileDesc, uint8_t *_pValueOut,
     exit(1);
   }
 }
+
+void I2c_writeI2cByte(int32_t _i2cFileDesc, uint8_t _value)
+{
+  I2c_writeRegAddrToI2cBus(_i2cFileDesc, _value);
+}
@@ -0,0 +1,366 @@
+/*
+ * The I2C bus module keeps the state of every bus behind its own mutex: the
+ * bus file descriptor, the address and multiplexer channel it last selected,
+ * and the queue of waiting transactions. The mutex is only held to take and
+ * hand over the bus, never while a transaction runs. Waiters queue in arrival
+ * order on their own stack, each with its own condition variable, and the
+ * thread releasing the bus hands it straight to the waiter it chooses.
+ */
+
+#include "../include/i2cBus.h"
+#include "../include/i2c.h"
+#include "../include/timing.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+
+// Bus definitions
+// ----------------------------------------------------------------------------
+typedef struct sI2cBusWaiter {
+  const sI2cBusDevice *pDevice;
+  eI2cBusPriority priority;
+  // Times a waiter that arrived later was granted the bus first
+  int numBypasses;
+  bool isGranted;
+  pthread_cond_t grantedCond;
+  struct sI2cBusWaiter *pNext;
+} sI2cBusWaiter;
+
+typedef struct {
+  pthread_mutex_t mutex;
+  int numOpenDevices;
+  int32_t fileDesc;
+  // Slave address and multiplexer channel last selected, or -1
+  int32_t currentAddress;
+  int32_t selectedMuxAddress;
+  int32_t selectedMuxChannel;
+
+  bool isBusy;
+  // Oldest first
+  sI2cBusWaiter *pWaitersHead;
+  sI2cBusWaiter *pWaitersTail;
+
+  int64_t openedNs;
+  sI2cBusStats stats;
+} sI2cBusState;
+
+#define I2C_BUS_STATE_INITIALIZER                                              \
+  {                                                                            \
+    .mutex = PTHREAD_MUTEX_INITIALIZER, .fileDesc = -1,                        \
+    .currentAddress = -1, .selectedMuxAddress = I2C_BUS_NO_MUX,                \
+    .selectedMuxChannel = -1,                                                  \
+  }
+
+static sI2cBusState m_buses[I2C_NUM_BUSES] = {I2C_BUS_STATE_INITIALIZER,
+                                              I2C_BUS_STATE_INITIALIZER,
+                                              I2C_BUS_STATE_INITIALIZER};
+
+static const char *PRIORITY_NAMES[I2C_BUS_NUM_PRIORITIES] = {
+    "detection", "control", "diagnostics"};
+
+static sI2cBusState *I2cBus_getBus(int32_t _busNum);
+static bool I2cBus_isRouteSelected(const sI2cBusState *_pBus,
+                                   const sI2cBusDevice *_pDevice);
+static void I2cBus_grantNextWaiter(sI2cBusState *_pBus);
+static void I2cBus_switchAddress(sI2cBusState *_pBus, int32_t _address,
+                                 uint64_t *_pNumSwitchesOut);
+static void I2cBus_runTransaction(sI2cBusState *_pBus,
+                                  const sI2cBusDevice *_pDevice,
+                                  const sI2cBusTransaction *_pTransaction,
+                                  uint64_t *_pNumSwitchesOut,
+                                  uint64_t *_pNumMuxSelectionsOut);
+static int64_t I2cBus_getOpenNs(const sI2cBusState *_pBus, int64_t _nowNs);
+
+// Device functions
+// ----------------------------------------------------------------------------
+void I2cBus_openDevice(sI2cBusDevice *_pDeviceOut, int32_t _busNum,
+                       int32_t _address, int32_t _muxAddress,
+                       uint8_t _muxChannel)
+{
+  _pDeviceOut->busNum = _busNum;
+  _pDeviceOut->address = _address;
+  _pDeviceOut->muxAddress = _muxAddress;
+  _pDeviceOut->muxChannel = _muxChannel;
+
+  sI2cBusState *bus = I2cBus_getBus(_busNum);
+  pthread_mutex_lock(&bus->mutex);
+  if (bus->numOpenDevices++ == 0) {
+    bus->fileDesc = I2c_openI2cBus(_busNum);
+    bus->currentAddress = -1;
+    bus->selectedMuxAddress = I2C_BUS_NO_MUX;
+    bus->selectedMuxChannel = -1;
+    bus->openedNs = Timing_getMonotonicTimeNs();
+  }
+  pthread_mutex_unlock(&bus->mutex);
+}
+
+void I2cBus_closeDevice(sI2cBusDevice *_pDevice)
+{
+  sI2cBusState *bus = I2cBus_getBus(_pDevice->busNum);
+  pthread_mutex_lock(&bus->mutex);
+  assert(bus->numOpenDevices > 0);
+  if (--bus->numOpenDevices == 0) {
+    bus->stats.openNs += Timing_getMonotonicTimeNs() - bus->openedNs;
+    I2c_closeI2cDevice(bus->fileDesc);
+    bus->fileDesc = -1;
+  }
+  pthread_mutex_unlock(&bus->mutex);
+}
+
+static sI2cBusState *I2cBus_getBus(int32_t _busNum)
+{
+  assert(_busNum >= 0 && _busNum < I2C_NUM_BUSES);
+  return &m_buses[_busNum];
+}
+
+// Transaction functions
+// ----------------------------------------------------------------------------
+void I2cBus_initTransaction(sI2cBusTransaction *_pTransaction)
+{
+  _pTransaction->numOps = 0;
+}
+
+bool I2cBus_addWriteReg(sI2cBusTransaction *_pTransaction, uint8_t _regAddr,
+                        uint8_t _value)
+{
+  if (_pTransaction->numOps == I2C_BUS_MAX_OPS) {
+    return false;
+  }
+
+  sI2cBusOp *op = &_pTransaction->ops[_pTransaction->numOps++];
+  op->type = I2C_BUS_OP_WRITE_REG;
+  op->regAddr = _regAddr;
+  op->value = _value;
+  op->pBufferOut = NULL;
+  op->numBytes = 0;
+  return true;
+}
+
+bool I2cBus_addReadReg(sI2cBusTransaction *_pTransaction, uint8_t _regAddr,
+                       uint8_t *_pBufferOut, size_t _numBytes)
+{
+  if (_pTransaction->numOps == I2C_BUS_MAX_OPS) {
+    return false;
+  }
+
+  sI2cBusOp *op = &_pTransaction->ops[_pTransaction->numOps++];
+  op->type = I2C_BUS_OP_READ_REG;
+  op->regAddr = _regAddr;
+  op->value = 0;
+  op->pBufferOut = _pBufferOut;
+  op->numBytes = _numBytes;
+  return true;
+}
+
+void I2cBus_execute(const sI2cBusDevice *_pDevice, eI2cBusPriority _priority,
+                    const sI2cBusTransaction *_pTransaction)
+{
+  sI2cBusState *bus = I2cBus_getBus(_pDevice->busNum);
+  int64_t requestNs = Timing_getMonotonicTimeNs();
+
+  pthread_mutex_lock(&bus->mutex);
+  if (bus->isBusy) {
+    sI2cBusWaiter waiter = {.pDevice = _pDevice, .priority = _priority};
+    pthread_cond_init(&waiter.grantedCond, NULL);
+    if (bus->pWaitersTail != NULL) {
+      bus->pWaitersTail->pNext = &waiter;
+    }
+    else {
+      bus->pWaitersHead = &waiter;
+    }
+    bus->pWaitersTail = &waiter;
+
+    while (!waiter.isGranted) {
+      pthread_cond_wait(&waiter.grantedCond, &bus->mutex);
+    }
+    pthread_cond_destroy(&waiter.grantedCond);
+  }
+  bus->isBusy = true;
+  pthread_mutex_unlock(&bus->mutex);
+
+  // The bus is ours alone until it is handed over
+  int64_t startNs = Timing_getMonotonicTimeNs();
+  uint64_t numSwitches = 0;
+  uint64_t numMuxSelections = 0;
+  I2cBus_runTransaction(bus, _pDevice, _pTransaction, &numSwitches,
+                        &numMuxSelections);
+  int64_t endNs = Timing_getMonotonicTimeNs();
+
+  pthread_mutex_lock(&bus->mutex);
+  sI2cBusStats *stats = &bus->stats;
+  int64_t waitNs = startNs - requestNs;
+  stats->numTransactions[_priority]++;
+  stats->totalWaitNs[_priority] += waitNs;
+  if (waitNs > stats->maxWaitNs[_priority]) {
+    stats->maxWaitNs[_priority] = waitNs;
+  }
+  stats->busyNs += endNs - startNs;
+  stats->numAddressSwitches += numSwitches;
+  stats->numMuxSelections += numMuxSelections;
+  I2cBus_grantNextWaiter(bus);
+  pthread_mutex_unlock(&bus->mutex);
+}
+
+// Returns true if accesses to _pDevice need no address switch or multiplexer
+// channel selection
+static bool I2cBus_isRouteSelected(const sI2cBusState *_pBus,
+                                   const sI2cBusDevice *_pDevice)
+{
+  if (_pBus->currentAddress != _pDevice->address) {
+    return false;
+  }
+
+  return _pDevice->muxAddress == I2C_BUS_NO_MUX ||
+         (_pBus->selectedMuxAddress == _pDevice->muxAddress &&
+          _pBus->selectedMuxChannel == _pDevice->muxChannel);
+}
+
+/* Hands the bus to the oldest waiter that was passed over too often, or else
+ * to the waiter of highest priority, preferring one whose device the bus is
+ * addressing already over older ones. Frees the bus if nobody waits. The bus
+ * mutex must be held. */
+static void I2cBus_grantNextWaiter(sI2cBusState *_pBus)
+{
+  sI2cBusWaiter *chosen = NULL;
+  bool isChosenOnRoute = false;
+  for (sI2cBusWaiter *w = _pBus->pWaitersHead; w != NULL; w = w->pNext) {
+    if (w->numBypasses >= I2C_BUS_MAX_BYPASSES) {
+      chosen = w;
+      break;
+    }
+
+    bool isOnRoute = I2cBus_isRouteSelected(_pBus, w->pDevice);
+    if (chosen == NULL || w->priority < chosen->priority ||
+        (w->priority == chosen->priority && isOnRoute && !isChosenOnRoute)) {
+      chosen = w;
+      isChosenOnRoute = isOnRoute;
+    }
+  }
+
+  if (chosen == NULL) {
+    _pBus->isBusy = false;
+    return;
+  }
+
+  // Every waiter ahead of the chosen one was passed over
+  sI2cBusWaiter *previous = NULL;
+  bool isBatched = false;
+  for (sI2cBusWaiter *w = _pBus->pWaitersHead; w != chosen; w = w->pNext) {
+    w->numBypasses++;
+    isBatched = isBatched || w->priority == chosen->priority;
+    previous = w;
+  }
+  if (isBatched) {
+    _pBus->stats.numBatchedGrants++;
+  }
+
+  if (previous != NULL) {
+    previous->pNext = chosen->pNext;
+  }
+  else {
+    _pBus->pWaitersHead = chosen->pNext;
+  }
+  if (_pBus->pWaitersTail == chosen) {
+    _pBus->pWaitersTail = previous;
+  }
+
+  chosen->isGranted = true;
+  pthread_cond_signal(&chosen->grantedCond);
+}
+
+static void I2cBus_switchAddress(sI2cBusState *_pBus, int32_t _address,
+                                 uint64_t *_pNumSwitchesOut)
+{
+  if (_pBus->currentAddress == _address) {
+    return;
+  }
+
+  I2c_setSlaveAddress(_pBus->fileDesc, _address);
+  _pBus->currentAddress = _address;
+  (*_pNumSwitchesOut)++;
+}
+
+// Runs with the bus granted, without the bus mutex
+static void I2cBus_runTransaction(sI2cBusState *_pBus,
+                                  const sI2cBusDevice *_pDevice,
+                                  const sI2cBusTransaction *_pTransaction,
+                                  uint64_t *_pNumSwitchesOut,
+                                  uint64_t *_pNumMuxSelectionsOut)
+{
+  if (_pDevice->muxAddress != I2C_BUS_NO_MUX &&
+      (_pBus->selectedMuxAddress != _pDevice->muxAddress ||
+       _pBus->selectedMuxChannel != _pDevice->muxChannel)) {
+    // Each bit of the control register enables one channel
+    I2cBus_switchAddress(_pBus, _pDevice->muxAddress, _pNumSwitchesOut);
+    I2c_writeI2cByte(_pBus->fileDesc, 1 << _pDevice->muxChannel);
+    _pBus->selectedMuxAddress = _pDevice->muxAddress;
+    _pBus->selectedMuxChannel = _pDevice->muxChannel;
+    (*_pNumMuxSelectionsOut)++;
+  }
+
+  I2cBus_switchAddress(_pBus, _pDevice->address, _pNumSwitchesOut);
+  for (int i = 0; i < _pTransaction->numOps; i++) {
+    const sI2cBusOp *op = &_pTransaction->ops[i];
+    if (op->type == I2C_BUS_OP_WRITE_REG) {
+      I2c_writeI2cReg(_pBus->fileDesc, op->regAddr, op->value);
+    }
+    else {
+      I2c_readI2cReg(_pBus->fileDesc, op->regAddr, op->pBufferOut,
+                     op->numBytes);
+    }
+  }
+}
+
+// Statistics functions
+// ----------------------------------------------------------------------------
+static int64_t I2cBus_getOpenNs(const sI2cBusState *_pBus, int64_t _nowNs)
+{
+  int64_t openNs = _pBus->stats.openNs;
+  if (_pBus->numOpenDevices > 0) {
+    openNs += _nowNs - _pBus->openedNs;
+  }
+
+  return openNs;
+}
+
+sI2cBusStats I2cBus_getStats(int32_t _busNum)
+{
+  sI2cBusState *bus = I2cBus_getBus(_busNum);
+  int64_t nowNs = Timing_getMonotonicTimeNs();
+
+  pthread_mutex_lock(&bus->mutex);
+  sI2cBusStats stats = bus->stats;
+  stats.openNs = I2cBus_getOpenNs(bus, nowNs);
+  pthread_mutex_unlock(&bus->mutex);
+
+  return stats;
+}
+
+void I2cBus_printStats(void)
+{
+  for (int32_t b = 0; b < I2C_NUM_BUSES; b++) {
+    sI2cBusStats stats = I2cBus_getStats(b);
+    if (stats.openNs == 0) {
+      continue;
+    }
+
+    printf("I2C bus %d: %.1f%% utilized, %llu address switches, "
+           "%llu mux selections, %llu batched grants.\n",
+           (int)b, stats.busyNs * 100.0 / stats.openNs,
+           (unsigned long long)stats.numAddressSwitches,
+           (unsigned long long)stats.numMuxSelections,
+           (unsigned long long)stats.numBatchedGrants);
+    for (int p = 0; p < I2C_BUS_NUM_PRIORITIES; p++) {
+      if (stats.numTransactions[p] == 0) {
+        continue;
+      }
+
+      printf("  %-11s %llu transactions, wait avg %lld us, max %lld us\n",
+             PRIORITY_NAMES[p], (unsigned long long)stats.numTransactions[p],
+             (long long)(stats.totalWaitNs[p] /
+                         (int64_t)stats.numTransactions[p] / 1000),
+             (long long)(stats.maxWaitNs[p] / 1000));
+    }
+  }
+}
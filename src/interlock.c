@@ -0,0 +1,77 @@
+/*
+ * The interlock module keeps the time the last item was released from the pipe
+ * and combines it with the commanded positions of the gates and the pipe.
+ */
+
+#include "../include/interlock.h"
+#include "../include/timing.h"
+
+#include <assert.h>
+#include <stdint.h>
+
+// Time an item takes to fall from the pipe past both gates
+static const int64_t ITEM_FALL_TIME_MS = 500;
+
+
+// Initialization/Termination functions
+// ----------------------------------------------------------------------------
+void Interlock_init(sInterlock *_pInterlock, const sGates *_pGates,
+                    const sPipe *_pPipe)
+{
+  _pInterlock->pGates = _pGates;
+  _pInterlock->pPipe = _pPipe;
+  // No item has been released yet, so the gates are free to move
+  _pInterlock->itemReleasedTimeMs =
+      Timing_getMonotonicTimeMs() - ITEM_FALL_TIME_MS;
+}
+
+void Interlock_cleanup(sInterlock *_pInterlock)
+{
+}
+
+// Event functions
+// ----------------------------------------------------------------------------
+void Interlock_recordItemReleased(sInterlock *_pInterlock)
+{
+  _pInterlock->itemReleasedTimeMs = Timing_getMonotonicTimeMs();
+}
+
+// Interlock functions
+// ----------------------------------------------------------------------------
+bool Interlock_canMoveGates(const sInterlock *_pInterlock)
+{
+  return Interlock_getMsUntilGatesMayMove(_pInterlock) == 0;
+}
+
+int64_t Interlock_getMsUntilGatesMayMove(const sInterlock *_pInterlock)
+{
+  int64_t elapsedMs =
+      Timing_getMonotonicTimeMs() - _pInterlock->itemReleasedTimeMs;
+  if (elapsedMs >= ITEM_FALL_TIME_MS) {
+    return 0;
+  }
+
+  return ITEM_FALL_TIME_MS - elapsedMs;
+}
+
+void Interlock_waitUntilGatesMayMove(const sInterlock *_pInterlock)
+{
+  Timing_milliSleep(0, Interlock_getMsUntilGatesMayMove(_pInterlock));
+}
+
+bool Interlock_canDrop(const sInterlock *_pInterlock, eGateConfig _config)
+{
+  return Interlock_canMoveGates(_pInterlock) &&
+         Pipe_isPositionReached(_pInterlock->pPipe, PIPE_AT_REST) &&
+         Gate_isConfigurationReached(_pInterlock->pGates, _config);
+}
+
+void Interlock_waitUntilDropMayBegin(const sInterlock *_pInterlock,
+                                     eGateConfig _config)
+{
+  assert(Gate_isConfigurationCommanded(_pInterlock->pGates, _config));
+
+  Interlock_waitUntilGatesMayMove(_pInterlock);
+  Pipe_waitUntilSettled(_pInterlock->pPipe);
+  Gate_waitUntilSettled(_pInterlock->pGates);
+}
@@ -9,6 +9,10 @@
 
 #define STR_BUFFER_SIZE 1024
 #define BRIGHTNESS_CHARS 4
+#define TRIGGER_LIST_BUFFER_SIZE 4096
+#define DELAY_CHARS 16
+
+#define TIMER_TRIGGER "timer"
 
 // Led configuration definitions
 // ----------------------------------------------------------------------------
@@ -16,6 +20,17 @@ typedef struct {
   char original_trigger[STR_BUFFER_SIZE];
   char original_brightness[STR_BUFFER_SIZE];
   bool isInitialized;
+  // Brightness attribute, kept open while the led is initialized
+  int brightnessFd;
+  // Batch writer slot of the brightness attribute, -1 if not registered
+  int brightnessSlot;
+  // Last brightness written, so that unchanged values are not written again
+  bool isOn;
+  bool hasTimerTrigger;
+  // Delays the timer trigger was last programmed with, while it is active
+  bool isBlinking;
+  uint32_t blinkOnMs;
+  uint32_t blinkOffMs;
 } sLedConfig;
 
 sLedConfig m_ledsConfig[NUMS_OF_LEDS];
@@ -32,6 +47,12 @@ static char *Led_makePath(char *_buffer, size_t _size, eLedNum _ledNum,
 static bool Led_getTrigger(eLedNum _ledNum, char *_outBuffer, size_t _size);
 static bool Led_getBrightness(eLedNum _ledNum, char *_outBuffer, size_t _size);
 
+// Returns true if _trigger is one of the triggers the kernel lists for _ledNum
+static bool Led_isTriggerAvailable(eLedNum _ledNum, const char *_trigger);
+static void Led_stopBlink(eLedNum _ledNum);
+static void Led_writeBrightness(eLedNum _ledNum, bool _value);
+static const char *Led_getBrightnessValue(bool _value);
+
 // String function implementations
 // ----------------------------------------------------------------------------
 static char *Led_makePath(char *_buffer, size_t _size, eLedNum _ledNum,
@@ -93,6 +114,28 @@ static bool Led_getBrightness(eLedNum _ledNum, char *_outBuffer, size_t _size)
   return true;
 }
 
+static bool Led_isTriggerAvailable(eLedNum _ledNum, const char *_trigger)
+{
+  char buffer[TRIGGER_LIST_BUFFER_SIZE] = {0};
+  char filepathBuffer[STR_BUFFER_SIZE];
+
+  Led_makePath(filepathBuffer, STR_BUFFER_SIZE, _ledNum, FILE_LED_TRIGGER);
+  if (!File_readFromFile(filepathBuffer, buffer, TRIGGER_LIST_BUFFER_SIZE)) {
+    return false;
+  }
+
+  // Triggers are separated by spaces, and the active one is within brackets
+  char *savePtr = NULL;
+  for (char *token = strtok_r(buffer, " []\n", &savePtr); token != NULL;
+       token = strtok_r(NULL, " []\n", &savePtr)) {
+    if (strcmp(token, _trigger) == 0) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
 // Initialization/Termination functions
 // ----------------------------------------------------------------------------
 void Led_init(void)
@@ -104,6 +147,8 @@ void Led_init(void)
 
   for (uint8_t i = 0; i < NUMS_OF_LEDS; i++) {
     m_ledsConfig[i].isInitialized = false;
+    m_ledsConfig[i].brightnessFd = -1;
+    m_ledsConfig[i].brightnessSlot = -1;
   }
 }
 
@@ -123,12 +168,24 @@ void Led_initLed(eLedNum _ledNum)
   sLedConfig *ledConfig = m_ledsConfig + _ledNum;
   Led_getTrigger(_ledNum, ledConfig->original_trigger, STR_BUFFER_SIZE);
   Led_getBrightness(_ledNum, ledConfig->original_brightness, STR_BUFFER_SIZE);
+  ledConfig->hasTimerTrigger = Led_isTriggerAvailable(_ledNum, TIMER_TRIGGER);
+  ledConfig->isBlinking = false;
 
   Led_makePath(filepathBuffer, STR_BUFFER_SIZE, _ledNum, FILE_LED_TRIGGER);
   File_writeToFile(filepathBuffer, "none");
+
+  Led_makePath(filepathBuffer, STR_BUFFER_SIZE, _ledNum, FILE_LED_BRIGHTNESS);
+  ledConfig->brightnessFd =
+      File_openAttribute(filepathBuffer, FILE_ATTRIBUTE_WRITE);
+  if (ledConfig->brightnessFd < 0) {
+    fprintf(stderr, "Could not open %s: %s\n", filepathBuffer,
+            strerror(-ledConfig->brightnessFd));
+    exit(EXIT_FAILURE);
+  }
   ledConfig->isInitialized = true;
 
-  Led_setLight(_ledNum, false);
+  Led_writeBrightness(_ledNum, false);
+  ledConfig->brightnessSlot = BatchWriter_registerFd(ledConfig->brightnessFd);
 }
 
 void Led_termLed(eLedNum _ledNum)
@@ -136,6 +193,11 @@ void Led_termLed(eLedNum _ledNum)
   char filepathBuffer[STR_BUFFER_SIZE];
   sLedConfig *ledConfig = m_ledsConfig + _ledNum;
   ledConfig->isInitialized = false;
+  ledConfig->isBlinking = false;
+  BatchWriter_unregisterFd(ledConfig->brightnessSlot);
+  ledConfig->brightnessSlot = -1;
+  File_closeAttribute(ledConfig->brightnessFd);
+  ledConfig->brightnessFd = -1;
 
   Led_makePath(filepathBuffer, STR_BUFFER_SIZE, _ledNum, FILE_LED_BRIGHTNESS);
   if (!File_writeToFile(filepathBuffer, ledConfig->original_brightness)) {
@@ -153,33 +215,126 @@ void Led_termLed(eLedNum _ledNum)
 // Light functions
 // ----------------------------------------------------------------------------
 void Led_setLight(eLedNum _ledNum, bool _value)
+{
+  sBatchWriterBatch batch;
+  BatchWriter_initBatch(&batch);
+  Led_queueLight(_ledNum, _value, &batch);
+  BatchWriter_submit(&batch);
+}
+
+void Led_queueLight(eLedNum _ledNum, bool _value, sBatchWriterBatch *_pBatch)
 {
   if (!Led_isInitialized(_ledNum)) {
     fprintf(stderr, "Trying to write to non initialized led %d\n", _ledNum);
     return;
   }
 
-  char filepathBuffer[STR_BUFFER_SIZE];
-
-  Led_makePath(filepathBuffer, STR_BUFFER_SIZE, _ledNum, FILE_LED_BRIGHTNESS);
-  char *valueToWrite = _value ? m_maxBrightness : "0";
-  if (!File_writeToFile(filepathBuffer, valueToWrite)) {
-    fprintf(stderr, "It was not possible to write to %s.\n", filepathBuffer);
+  Led_stopBlink(_ledNum);
+  sLedConfig *ledConfig = m_ledsConfig + _ledNum;
+  if (ledConfig->isOn == _value) {
     return;
   }
+
+  if (ledConfig->brightnessSlot >= 0 &&
+      BatchWriter_add(_pBatch, ledConfig->brightnessSlot,
+                      Led_getBrightnessValue(_value))) {
+    ledConfig->isOn = _value;
+  }
+  else {
+    Led_writeBrightness(_ledNum, _value);
+  }
 }
 
+// Answers from the last value written rather than from sysfs. While the led
+// blinks, that is the value it had before the blink started.
 bool Led_getLight(eLedNum _ledNum)
 {
-  char buffer[BRIGHTNESS_CHARS];
-  char filepathBuffer[STR_BUFFER_SIZE];
-  Led_makePath(filepathBuffer, STR_BUFFER_SIZE, _ledNum, FILE_LED_BRIGHTNESS);
-  if (!File_readFromFile(filepathBuffer, buffer, BRIGHTNESS_CHARS)) {
-    fprintf(stderr, "It was not possible to read from %s.\n", filepathBuffer);
+  return m_ledsConfig[_ledNum].isOn;
+}
+
+static void Led_writeBrightness(eLedNum _ledNum, bool _value)
+{
+  sLedConfig *ledConfig = m_ledsConfig + _ledNum;
+  int error = File_writeAttribute(ledConfig->brightnessFd,
+                                  Led_getBrightnessValue(_value));
+  if (error < 0) {
+    fprintf(stderr, "It was not possible to write to led %d: %s\n", _ledNum,
+            strerror(-error));
+    return;
+  }
+
+  ledConfig->isOn = _value;
+}
+
+static const char *Led_getBrightnessValue(bool _value)
+{
+  return _value ? m_maxBrightness : "0";
+}
+
+// Blink functions
+// ----------------------------------------------------------------------------
+bool Led_setBlink(eLedNum _ledNum, uint32_t _onMs, uint32_t _offMs)
+{
+  if (!Led_isInitialized(_ledNum)) {
+    fprintf(stderr, "Trying to blink non initialized led %d\n", _ledNum);
+    return false;
+  }
+
+  sLedConfig *ledConfig = m_ledsConfig + _ledNum;
+  if (!ledConfig->hasTimerTrigger) {
     return false;
   }
 
-  return atoi(buffer) == 0 ? false : true;
+  // Reprogramming the delays restarts the blink, so keep a matching one going
+  if (ledConfig->isBlinking && ledConfig->blinkOnMs == _onMs &&
+      ledConfig->blinkOffMs == _offMs) {
+    return true;
+  }
+
+  char filepathBuffer[STR_BUFFER_SIZE];
+  char delayBuffer[DELAY_CHARS];
+
+  // A brightness write landing after the trigger is set would cancel it
+  BatchWriter_waitForSlot(ledConfig->brightnessSlot);
+
+  // The delay attributes only exist while the timer trigger is active
+  if (!ledConfig->isBlinking) {
+    Led_makePath(filepathBuffer, STR_BUFFER_SIZE, _ledNum, FILE_LED_TRIGGER);
+    File_writeToFile(filepathBuffer, TIMER_TRIGGER);
+  }
+
+  Led_makePath(filepathBuffer, STR_BUFFER_SIZE, _ledNum, FILE_LED_DELAY_ON);
+  snprintf(delayBuffer, DELAY_CHARS, "%u", (unsigned)_onMs);
+  File_writeToFile(filepathBuffer, delayBuffer);
+
+  Led_makePath(filepathBuffer, STR_BUFFER_SIZE, _ledNum, FILE_LED_DELAY_OFF);
+  snprintf(delayBuffer, DELAY_CHARS, "%u", (unsigned)_offMs);
+  File_writeToFile(filepathBuffer, delayBuffer);
+
+  ledConfig->isBlinking = true;
+  ledConfig->blinkOnMs = _onMs;
+  ledConfig->blinkOffMs = _offMs;
+  return true;
+}
+
+bool Led_isBlinking(eLedNum _ledNum)
+{
+  return m_ledsConfig[_ledNum].isBlinking;
+}
+
+static void Led_stopBlink(eLedNum _ledNum)
+{
+  sLedConfig *ledConfig = m_ledsConfig + _ledNum;
+  if (!ledConfig->isBlinking) {
+    return;
+  }
+
+  char filepathBuffer[STR_BUFFER_SIZE];
+  // Removing the trigger turns the led off
+  Led_makePath(filepathBuffer, STR_BUFFER_SIZE, _ledNum, FILE_LED_TRIGGER);
+  File_writeToFile(filepathBuffer, "none");
+  ledConfig->isBlinking = false;
+  ledConfig->isOn = false;
 }
 
 bool Led_isInitialized(eLedNum _ledNum)
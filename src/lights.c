@@ -1,196 +1,232 @@
+/*
+ * The lights module runs a single animation thread for the lifetime of the
+ * module. Every stage is a pattern: a table of frames, each one a bitmask of
+ * the LEDs that are on and the time it is shown for. Stage functions post the
+ * pattern to a mailbox and wake the thread, which switches to it at once.
+ * Frames are timed with an absolute-deadline timerfd, so the animation does not
+ * drift, and all LED writes happen within the animation thread.
+ */
+
 #include "../include/lights.h"
 
+#include "../include/batchWriter.h"
 #include "../include/led.h"
+#include "../include/realtime.h"
 #include "../include/timing.h"
 
+#include <poll.h>
 #include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
 
-// Thread definitions
-// ----------------------------------------------------------------------------
-static pthread_t m_lightThread;
-static bool m_threadActive;
-
-void Light_startThread(void *(_func)(void *), void *_args);
-void Light_stopThread(void);
+#define NUM_POLL_FDS 2
 
-typedef enum { NONE_MODE, MOVING_TAIL_MODE, BLINKING_MODE } eModes;
-static eModes m_currentMode = NONE_MODE;
-
-// Moving tail definitions
+// Pattern definitions
 // ----------------------------------------------------------------------------
-typedef enum { LIGHT_RIGHT, LIGHT_LEFT } eLightDirection;
+typedef enum {
+  LIGHT_PATTERN_OFF,
+  LIGHT_PATTERN_IDLE,
+  LIGHT_PATTERN_RECYCLING,
+  LIGHT_PATTERN_RECYCLED,
+  LIGHT_PATTERN_RETURNING,
+  LIGHT_PATTERN_ALARM,
+  LIGHT_NUM_PATTERNS,
+} eLightPattern;
 
 typedef struct {
-  uint8_t headNum;
-  eLightDirection currentDirection;
-  bool tailVisible;
-} sTailConfig;
-
-static void Light_initializeMovingTail(sTailConfig *_tailConfig);
-static void Light_movingTailNextStepNoWrap(sTailConfig *_tailConfig);
-static void Light_movingTailSetLeds(sTailConfig *_tailConfig);
+  // Bit i is set if LED i is on
+  uint8_t ledMask;
+  uint16_t durationMs;
+} sLightFrame;
 
-static void *Light_movingTailThreadFunction(void *_args);
-static void Light_startMovingTail(void);
+typedef struct {
+  const sLightFrame *frames;
+  uint8_t numFrames;
+  // Interval of the kernel timer trigger that shows the same pattern, or 0 if
+  // it cannot. Patterns of a single frame are held until the next switch.
+  uint16_t kernelBlinkIntervalMs;
+} sLightPattern;
 
 #define IDLE_INTERVAL_MS 250
 #define RECYCLING_INTERVAL_MS 125
-static uint64_t m_movingTailInterval;
+#define RECYCLED_BLINK_INTERVAL_MS 500
+#define RETURNING_BLINK_INTERVAL_MS 250
+#define ALARM_BLINK_INTERVAL_MS 100
+
+// A head with a one LED tail that bounces between both ends. The tail is
+// hidden on the step that turns around.
+#define LIGHT_MOVING_TAIL(_intervalMs)                                         \
+  {                                                                            \
+    {0x1, _intervalMs}, {0x3, _intervalMs}, {0x6, _intervalMs},                \
+        {0xC, _intervalMs}, {0x8, _intervalMs}, {0xC, _intervalMs},            \
+        {0x6, _intervalMs}, {0x3, _intervalMs},                                \
+  }
 
-// Blink definitions
-// ----------------------------------------------------------------------------
+#define LIGHT_BLINK(_intervalMs)                                               \
+  {                                                                            \
+    {0x0, _intervalMs}, {0xF, _intervalMs},                                    \
+  }
 
-typedef struct {
-  bool isOn;
-} sBlinkConfig;
+static const sLightFrame OFF_FRAMES[] = {{0x0, 0}};
+static const sLightFrame IDLE_FRAMES[] = LIGHT_MOVING_TAIL(IDLE_INTERVAL_MS);
+static const sLightFrame RECYCLING_FRAMES[] =
+    LIGHT_MOVING_TAIL(RECYCLING_INTERVAL_MS);
+static const sLightFrame RECYCLED_FRAMES[] =
+    LIGHT_BLINK(RECYCLED_BLINK_INTERVAL_MS);
+static const sLightFrame RETURNING_FRAMES[] =
+    LIGHT_BLINK(RETURNING_BLINK_INTERVAL_MS);
+static const sLightFrame ALARM_FRAMES[] = LIGHT_BLINK(ALARM_BLINK_INTERVAL_MS);
+
+#define LIGHT_FRAMES(_frames) _frames, sizeof(_frames) / sizeof(_frames[0])
+
+static const sLightPattern m_patterns[LIGHT_NUM_PATTERNS] = {
+    [LIGHT_PATTERN_OFF] = {LIGHT_FRAMES(OFF_FRAMES), 0},
+    [LIGHT_PATTERN_IDLE] = {LIGHT_FRAMES(IDLE_FRAMES), 0},
+    [LIGHT_PATTERN_RECYCLING] = {LIGHT_FRAMES(RECYCLING_FRAMES), 0},
+    [LIGHT_PATTERN_RECYCLED] = {LIGHT_FRAMES(RECYCLED_FRAMES),
+                                RECYCLED_BLINK_INTERVAL_MS},
+    [LIGHT_PATTERN_RETURNING] = {LIGHT_FRAMES(RETURNING_FRAMES),
+                                 RETURNING_BLINK_INTERVAL_MS},
+    [LIGHT_PATTERN_ALARM] = {LIGHT_FRAMES(ALARM_FRAMES),
+                             ALARM_BLINK_INTERVAL_MS},
+};
 
-static void Light_initializeBlink(sBlinkConfig *_blinkConfig);
-static void Light_blinkNextStep(sBlinkConfig *_blinkConfig);
-static void Light_blinkSetLeds(sBlinkConfig *_blinkConfig);
+// Thread definitions
+// ----------------------------------------------------------------------------
+static pthread_t m_lightThread;
+static bool m_isRunning;
 
-static void *Light_blinkingThreadFunction(void *_args);
-static void Light_startBlinking(void);
+// Pattern posted by the stage functions, read by the animation thread
+static uint32_t m_mailbox;
+static int m_wakeupFd = -1;
+static int m_frameTimerFd = -1;
 
-#define RECYCLED_BLINK_INTERVAL_MS 500
-#define RETURNING_BLINK_INTERVAL_MS 250
-static uint64_t m_blinkInterval;
+static void Light_post(eLightPattern _pattern);
+static void Light_wake(void);
+static void Light_showFrame(const sLightFrame *_pFrame);
+static bool Light_startKernelBlinking(const sLightPattern *_pPattern);
+static void Light_armFrameTimer(int64_t _deadlineNs);
+static void *Light_animationThreadFunction(void *_args);
 
-// Thread implementations
+// Mailbox functions
 // ----------------------------------------------------------------------------
-void Light_startThread(void *(_func)(void *), void *_args)
+static void Light_post(eLightPattern _pattern)
 {
-  if (!m_threadActive) {
-    m_threadActive = true;
-    pthread_create(&m_lightThread, NULL, _func, _args);
+  uint32_t previous =
+      __atomic_exchange_n(&m_mailbox, (uint32_t)_pattern, __ATOMIC_RELEASE);
+  if (previous != (uint32_t)_pattern) {
+    Light_wake();
   }
 }
 
-void Light_stopThread(void)
+static void Light_wake(void)
 {
-  if (m_threadActive) {
-    m_threadActive = false;
-    pthread_join(m_lightThread, NULL);
-  }
+  uint64_t wakeup = 1;
+  write(m_wakeupFd, &wakeup, sizeof(wakeup));
 }
 
-// Moving tail function implementations
+// Animation thread functions
 // ----------------------------------------------------------------------------
-static void Light_initializeMovingTail(sTailConfig *_tailConfig)
+// The leds of a frame change together, in a single batch of writes
+static void Light_showFrame(const sLightFrame *_pFrame)
 {
-  _tailConfig->headNum = 0;
-  _tailConfig->currentDirection = LIGHT_RIGHT;
-  _tailConfig->tailVisible = false;
+  sBatchWriterBatch batch;
+  BatchWriter_initBatch(&batch);
+  for (uint8_t i = 0; i < NUMS_OF_LEDS; i++) {
+    Led_queueLight(i, (_pFrame->ledMask >> i) & 1, &batch);
+  }
+  BatchWriter_submit(&batch);
 }
 
-static void Light_movingTailNextStepNoWrap(sTailConfig *_tailConfig)
+// Hands the pattern over to the kernel timer trigger of every led. Returns
+// false if the pattern cannot be expressed by it or any led lacks it.
+static bool Light_startKernelBlinking(const sLightPattern *_pPattern)
 {
-  // If at rightmost led and moving to right
-  if (_tailConfig->headNum == NUMS_OF_LEDS - 1 &&
-      _tailConfig->currentDirection == LIGHT_RIGHT) {
-    _tailConfig->currentDirection = LIGHT_LEFT;
-    _tailConfig->tailVisible = false;
-  }
-  // If at leftmost led and moving to left
-  else if (_tailConfig->headNum == 0 &&
-           _tailConfig->currentDirection == LIGHT_LEFT) {
-    _tailConfig->currentDirection = LIGHT_RIGHT;
-    _tailConfig->tailVisible = false;
-  }
-  else if (_tailConfig->currentDirection == LIGHT_RIGHT) {
-    _tailConfig->headNum++;
-    _tailConfig->tailVisible = true;
-  }
-  else if (_tailConfig->currentDirection == LIGHT_LEFT) {
-    _tailConfig->headNum--;
-    _tailConfig->tailVisible = true;
+  if (_pPattern->kernelBlinkIntervalMs == 0) {
+    return false;
   }
-}
 
-static void Light_movingTailSetLeds(sTailConfig *_tailConfig)
-{
   for (uint8_t i = 0; i < NUMS_OF_LEDS; i++) {
-    /*  Turns on the led if either LED i corresponds to the head of the "moving
-        tail" or if it corresponds to the tail position and the tail is
-        visible.
-      */
-    if (i == _tailConfig->headNum ||
-        (i == _tailConfig->headNum - 1 &&
-         _tailConfig->currentDirection == LIGHT_RIGHT &&
-         _tailConfig->tailVisible) ||
-        (i == _tailConfig->headNum + 1 &&
-         _tailConfig->currentDirection == LIGHT_LEFT &&
-         _tailConfig->tailVisible)) {
-      Led_setLight(i, true);
+    if (!Led_setBlink(i, _pPattern->kernelBlinkIntervalMs,
+                      _pPattern->kernelBlinkIntervalMs)) {
+      return false;
     }
-    else {
-      Led_setLight(i, false);
-    }
-  }
-}
-
-static void *Light_movingTailThreadFunction(void *_args)
-{
-  sTailConfig tailConfig;
-  Light_initializeMovingTail(&tailConfig);
-
-  while (m_threadActive) {
-    Light_movingTailSetLeds(&tailConfig);
-    Timing_milliSleep(0, m_movingTailInterval);
-    Light_movingTailNextStepNoWrap(&tailConfig);
   }
 
-  return NULL;
+  return true;
 }
 
-static void Light_startMovingTail(void)
-{
-  Light_stopThread();
-  m_currentMode = MOVING_TAIL_MODE;
-  Light_startThread(&Light_movingTailThreadFunction, NULL);
-}
-
-// Blinking funtion implementations
-// ----------------------------------------------------------------------------
-static void Light_initializeBlink(sBlinkConfig *_blinkConfig)
+// Arms the frame timer to expire at _deadlineNs on the monotonic clock, or
+// disarms it if _deadlineNs is negative.
+static void Light_armFrameTimer(int64_t _deadlineNs)
 {
-  _blinkConfig->isOn = false;
+  struct itimerspec spec;
+  memset(&spec, 0, sizeof(spec));
+  if (_deadlineNs >= 0) {
+    spec.it_value.tv_sec = _deadlineNs / 1000000000;
+    spec.it_value.tv_nsec = _deadlineNs % 1000000000;
+  }
+  timerfd_settime(m_frameTimerFd, TFD_TIMER_ABSTIME, &spec, NULL);
 }
 
-static void Light_blinkNextStep(sBlinkConfig *_blinkConfig)
+static void *Light_animationThreadFunction(void *_args)
 {
-  _blinkConfig->isOn ^= 1;
-}
+  struct pollfd pollFds[NUM_POLL_FDS] = {{m_wakeupFd, POLLIN, 0},
+                                         {m_frameTimerFd, POLLIN, 0}};
+  uint32_t currentPattern = LIGHT_NUM_PATTERNS;
+  uint8_t frameIndex = 0;
+  int64_t frameDeadlineNs = -1;
+
+  while (__atomic_load_n(&m_isRunning, __ATOMIC_ACQUIRE)) {
+    uint32_t requestedPattern = __atomic_load_n(&m_mailbox, __ATOMIC_ACQUIRE);
+    if (requestedPattern != currentPattern) {
+      currentPattern = requestedPattern;
+      frameIndex = 0;
+      frameDeadlineNs = -1;
+
+      const sLightPattern *pattern = &m_patterns[currentPattern];
+      if (!Light_startKernelBlinking(pattern)) {
+        Light_showFrame(&pattern->frames[0]);
+        if (pattern->numFrames > 1) {
+          frameDeadlineNs = Timing_getMonotonicTimeNs() +
+                            pattern->frames[0].durationMs * 1000000LL;
+        }
+      }
+      Light_armFrameTimer(frameDeadlineNs);
+    }
 
-static void Light_blinkSetLeds(sBlinkConfig *_blinkConfig)
-{
-  for (uint8_t i = 0; i < NUMS_OF_LEDS; i++) {
-    Led_setLight(i, _blinkConfig->isOn);
-  }
-}
+    if (poll(pollFds, NUM_POLL_FDS, -1) <= 0) {
+      continue;
+    }
 
-static void *Light_blinkingThreadFunction(void *_args)
-{
-  sBlinkConfig blinkConfig;
-  Light_initializeBlink(&blinkConfig);
+    if (pollFds[0].revents & POLLIN) {
+      uint64_t wakeups;
+      read(m_wakeupFd, &wakeups, sizeof(wakeups));
+    }
 
-  while (m_threadActive) {
-    Light_blinkSetLeds(&blinkConfig);
-    Timing_milliSleep(0, m_blinkInterval);
-    Light_blinkNextStep(&blinkConfig);
+    uint64_t expirations;
+    if ((pollFds[1].revents & POLLIN) &&
+        read(m_frameTimerFd, &expirations, sizeof(expirations)) > 0 &&
+        frameDeadlineNs >= 0) {
+      Realtime_recordWakeup(REALTIME_THREAD_LIGHTS, frameDeadlineNs);
+
+      // The next deadline follows from the last one rather than from now
+      const sLightPattern *pattern = &m_patterns[currentPattern];
+      frameIndex = (frameIndex + 1) % pattern->numFrames;
+      Light_showFrame(&pattern->frames[frameIndex]);
+      frameDeadlineNs += pattern->frames[frameIndex].durationMs * 1000000LL;
+      Light_armFrameTimer(frameDeadlineNs);
+    }
   }
 
   return NULL;
 }
 
-static void Light_startBlinking(void)
-{
-  Light_stopThread();
-  m_currentMode = BLINKING_MODE;
-  Light_startThread(&Light_blinkingThreadFunction, NULL);
-}
-
 // Initialization/termination functions
 // ----------------------------------------------------------------------------
 void Lights_init(void)
@@ -200,11 +236,31 @@ void Lights_init(void)
   for (uint8_t i = 0; i < NUMS_OF_LEDS; i++) {
     Led_initLed(i);
   }
+
+  m_wakeupFd = eventfd(0, EFD_NONBLOCK);
+  m_frameTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+  if (m_wakeupFd < 0 || m_frameTimerFd < 0) {
+    perror("Lights: Unable to create animation file descriptors");
+    exit(EXIT_FAILURE);
+  }
+
+  __atomic_store_n(&m_mailbox, LIGHT_PATTERN_OFF, __ATOMIC_RELEASE);
+  __atomic_store_n(&m_isRunning, true, __ATOMIC_RELEASE);
+  pthread_create(&m_lightThread, NULL, &Light_animationThreadFunction, NULL);
+  Realtime_configureThread(m_lightThread, REALTIME_THREAD_LIGHTS);
 }
 
 void Lights_cleanup(void)
 {
-  Light_stopThread();
+  __atomic_store_n(&m_isRunning, false, __ATOMIC_RELEASE);
+  Light_wake();
+  pthread_join(m_lightThread, NULL);
+
+  close(m_wakeupFd);
+  m_wakeupFd = -1;
+  close(m_frameTimerFd);
+  m_frameTimerFd = -1;
+
   Led_cleanup();
 }
 
@@ -212,36 +268,25 @@ void Lights_cleanup(void)
 // ----------------------------------------------------------------------------
 void Lights_setIdle(void)
 {
-  if (m_currentMode != MOVING_TAIL_MODE) {
-    Light_startMovingTail();
-  }
-
-  m_movingTailInterval = IDLE_INTERVAL_MS;
+  Light_post(LIGHT_PATTERN_IDLE);
 }
 
 void Lights_setRecycling(void)
 {
-  if (m_currentMode != MOVING_TAIL_MODE) {
-    Light_startMovingTail();
-  }
-
-  m_movingTailInterval = RECYCLING_INTERVAL_MS;
+  Light_post(LIGHT_PATTERN_RECYCLING);
 }
 
 void Lights_setRecycled(void)
 {
-  if (m_currentMode != BLINKING_MODE) {
-    Light_startBlinking();
-  }
-
-  m_blinkInterval = RECYCLED_BLINK_INTERVAL_MS;
+  Light_post(LIGHT_PATTERN_RECYCLED);
 }
 
 void Lights_setReturning(void)
 {
-  if (m_currentMode != BLINKING_MODE) {
-    Light_startBlinking();
-  }
+  Light_post(LIGHT_PATTERN_RETURNING);
+}
 
-  m_blinkInterval = RETURNING_BLINK_INTERVAL_MS;
+void Lights_setAlarm(void)
+{
+  Light_post(LIGHT_PATTERN_ALARM);
 }
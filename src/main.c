@@ -1,55 +1,59 @@
-#include "../include/classifierModule.h"
-#include "../include/gate.h"
-#include "../include/lights.h"
-#include "../include/pipe.h"
-#include "../include/servo.h"
-#include "../include/timing.h"
+#include "../include/batchWriter.h"
+#include "../include/i2cBus.h"
+#include "../include/realtime.h"
+#include "../include/scheduler.h"
+#include "../include/station.h"
 
 #include <getopt.h>
-#include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <string.h>
 
 void Main_initialize(void);
-void Main_cleanup(int _singal);
-void Main_setupInterrupt(void);
+void Main_cleanup(void);
 void Main_getOpts(int argc, char **argv);
-
-void Main_stageIdle(void);
-void Main_stageCategorizing(void);
-void Main_stageSorting(void);
-void Main_stageDisposing(void);
-void Main_stageReturning(void);
-
-eClassifierModule_RefuseItemType m_itemType;
+void Main_buildConfig(void);
 
 static uint32_t m_colorSensorI2CNumber;
 static bool m_colorSensorOptFlag = false;
 static uint32_t m_objectSensingThreshold;
+static bool m_isSpeculationEnabled = false;
+static uint32_t m_speculationConfidenceThreshold;
+static bool m_isRealtimeEnabled = false;
+static bool m_isRingEnabled = false;
+
+// The time given to the object to come to rest in front of the sensor, and to
+// the object to leave the pipe before it is considered jammed, are learned by
+// the auto tuner and persisted to this profile. Defaults to that of the
+// station.
+static const char *m_delayProfilePath = NULL;
+
+// FIFO the sorter reads control commands from. Defaults to that of the
+// station.
+static const char *m_controlFifoPath = NULL;
+
+// File the stations are described in, see scheduler.h. Without one, a single
+// station is run from the other options.
+static const char *m_stationConfigPath = NULL;
+
+static sSchedulerConfig m_schedulerConfig;
 
 // Main
 // ----------------------------------------------------------------------------
 int main(int argc, char **argv)
 {
   Main_getOpts(argc, argv);
-  if (!m_colorSensorOptFlag) {
-    fprintf(stderr, "i2c bus number for color sensor not provided. Cannot \
-continue execution.\n");
+  Main_buildConfig();
+  if (!Scheduler_validateConfig(&m_schedulerConfig)) {
     exit(EXIT_FAILURE);
   }
 
   Main_initialize();
+  Scheduler_run();
+  Main_cleanup();
 
-  while (true) {
-    Main_stageIdle();
-    Main_stageCategorizing();
-    Main_stageSorting();
-    Main_stageDisposing();
-    Main_stageReturning();
-  }
+  return EXIT_SUCCESS;
 }
 
 // Initialization/Termination functions
@@ -58,40 +62,66 @@ void Main_initialize(void)
 {
   printf("Initializing recycler.\n");
 
-  Main_setupInterrupt();
+  // Must come before any thread is started
+  Realtime_init(m_isRealtimeEnabled);
 
-  Servo_init();
-  Gate_init();
-  Pipe_init();
-  ClassifierModule_init(m_colorSensorI2CNumber, m_objectSensingThreshold);
-  Lights_init();
+  // Servos and lights register their attributes with the batch writer
+  BatchWriter_init(m_isRingEnabled);
+  Scheduler_init(&m_schedulerConfig);
 }
 
-void Main_cleanup(int _signal)
+void Main_cleanup(void)
 {
-  printf("Terminating recycler.");
+  printf("Terminating recycler.\n");
+
+  Scheduler_printStats();
+  I2cBus_printStats();
+  Realtime_printStats();
+  BatchWriter_printStats();
 
-  Gate_cleanup();
-  Pipe_cleanup();
-  Servo_cleanup();
-  ClassifierModule_cleanup();
-  Lights_cleanup();
+  Scheduler_cleanup();
+  BatchWriter_cleanup();
+  Realtime_cleanup();
 }
 
-void Main_setupInterrupt(void)
+void Main_buildConfig(void)
 {
-  struct sigaction action;
-  struct sigaction oldAction;
-  memset(&action, 0, sizeof(action));
-  action.sa_handler = &Main_cleanup;
-  sigaction(SIGINT, &action, &oldAction);
+  if (m_stationConfigPath != NULL) {
+    if (!Scheduler_loadConfig(m_stationConfigPath, &m_schedulerConfig)) {
+      exit(EXIT_FAILURE);
+    }
+    return;
+  }
+
+  if (!m_colorSensorOptFlag) {
+    fprintf(stderr, "i2c bus number for color sensor not provided. Cannot \
+continue execution.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  m_schedulerConfig.numStations = 1;
+  sStationConfig *station = &m_schedulerConfig.stations[0];
+  Station_initConfig(station, "");
+  station->sensorConfig.i2cBusNum = (int32_t)m_colorSensorI2CNumber;
+  station->sensorConfig.objectSensingThreshold = m_objectSensingThreshold;
+  station->isSpeculationEnabled = m_isSpeculationEnabled;
+  station->speculationConfidenceThreshold = m_speculationConfidenceThreshold;
+  station->hasLights = true;
+  if (m_delayProfilePath != NULL) {
+    snprintf(station->delayProfilePath, STATION_PATH_LEN, "%s",
+             m_delayProfilePath);
+  }
+  if (m_controlFifoPath != NULL) {
+    snprintf(station->controlFifoPath, STATION_PATH_LEN, "%s",
+             m_controlFifoPath);
+  }
 }
 
 void Main_getOpts(int argc, char **argv)
 {
   int opt;
 
-  while ((opt = getopt(argc, argv, "t:i:h")) != -1) {
+  while ((opt = getopt(argc, argv, "t:i:s:p:c:f:ruh")) != -1) {
     switch (opt) {
     case 'i':
       m_colorSensorI2CNumber = atoi(optarg);
@@ -100,12 +130,37 @@ void Main_getOpts(int argc, char **argv)
     case 'h':
       printf("Call this program with '-i num', where num is the i2c bus \
       number for the color sensor. Use the '-t num' to set the object sensing \
-			threshold.");
+			threshold. Use the '-s num' to pre-position the gates from early \
+color readings that are at least num percent confident. Use the '-p path' \
+to set the file the learned delays are kept in. Use the '-c path' to set \
+the FIFO control commands are read from. Use '-f path' instead of the options \
+above to run the stations described in a file. Use '-r' to run with real-time \
+priorities and locked memory (needs root). Use '-u' to submit servo and \
+light writes in batches through io_uring.");
       exit(EXIT_SUCCESS);
       break;
 		case 't':
 			m_objectSensingThreshold = atoi(optarg);
 			break;
+    case 's':
+      m_speculationConfidenceThreshold = atoi(optarg);
+      m_isSpeculationEnabled = true;
+      break;
+    case 'p':
+      m_delayProfilePath = optarg;
+      break;
+    case 'c':
+      m_controlFifoPath = optarg;
+      break;
+    case 'f':
+      m_stationConfigPath = optarg;
+      break;
+    case 'r':
+      m_isRealtimeEnabled = true;
+      break;
+    case 'u':
+      m_isRingEnabled = true;
+      break;
     case '?':
       printf("Unknown option %c.\n", optopt);
     case ':':
@@ -113,98 +168,3 @@ void Main_getOpts(int argc, char **argv)
     }
   }
 }
-
-// Stage functions
-// ----------------------------------------------------------------------------
-
-void Main_stageIdle(void)
-{
-  printf("\nEntering idle stage.\n");
-  Lights_setIdle();
-  ClassifierModule_waitUntilRefuseItemAppears();
-  printf("Object detected!\n");
-
-	// Wait until the ball is in place to get a better color reading
-	Timing_milliSleep(0, 700);
-}
-
-void Main_stageCategorizing(void)
-{
-  printf("\nEntering sorting stage.\n");
-  Lights_setRecycling();
-  m_itemType = ClassifierModule_getRefuseItemType();
-
-  char *objectTypeStr;
-  switch (m_itemType) {
-  case CLASSIFIER_MODULE_GARBAGE:
-    objectTypeStr = "garbage";
-    break;
-  case CLASSIFIER_MODULE_COMPOST:
-    objectTypeStr = "compost";
-    break;
-  case CLASSIFIER_MODULE_RECYCLING:
-    objectTypeStr = "recycling";
-    break;
-  default:
-    objectTypeStr = "unknown";
-  }
-
-  printf("Object of type %s detected.\n", objectTypeStr);
-}
-
-void Main_stageSorting()
-{
-  printf("\nEntering sorting stage\n");
-  Lights_setRecycling();
-
-  switch (m_itemType) {
-  case CLASSIFIER_MODULE_COMPOST:
-    printf("Compost, lowering gate %d.\n", gate1);
-    Gate_lowersGate(gate1);
-    break;
-
-  case CLASSIFIER_MODULE_RECYCLING: // Should be lowering both gates
-    printf("Recycling, lowering gate %d and %d.\n", gate1, gate2);
-    Gate_lowersGate(gate1);
-    Gate_lowersGate(gate2);
-    break;
-
-  case CLASSIFIER_MODULE_GARBAGE:
-    printf("Garbage, not lowering any gates.\n");
-    break;
-
-  default:
-    fprintf(stderr, "Uncaught classifier module type %d. Terminating.\n",
-            m_itemType);
-    abort();
-  }
-
-  Timing_milliSleep(3, 0);
-}
-
-void Main_stageDisposing(void)
-{
-  printf("\nEntering disposal stage.\n");
-  Lights_setRecycled();
-
-  printf("Rotating pipe to drop the object.\n");
-  Pipe_rotatePipeToDropBall();
-
-  Timing_milliSleep(2, 0);
-}
-
-void Main_stageReturning(void)
-{
-  printf("\nEntering return stage.\n");
-  Lights_setReturning();
-
-  printf("Rotating the pipe to original position.\n");
-  Pipe_resetPipePosition();
-
-	// Wait for pipe to return before fully
-	Timing_milliSleep(1, 500);
-
-	printf("Rising gates to their original positions.\n");
-	Gate_raisesGate(gate1);
-	Gate_raisesGate(gate2);
-}
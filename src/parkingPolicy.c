@@ -0,0 +1,132 @@
+/*
+ * The parking policy module keeps the configurations of the last items in a
+ * ring buffer along with a count of each configuration in the ring.
+ */
+
+#include "../include/parkingPolicy.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+
+static const eGateConfig GATE_CONFIGS[PARKING_POLICY_NUM_GATE_CONFIGS] = {
+    GATE_CONFIG_GARBAGE, GATE_CONFIG_COMPOST, GATE_CONFIG_RECYCLING};
+
+// Configuration the gates return to when not parked by the policy
+static const eGateConfig DEFAULT_PARKING_CONFIG = GATE_CONFIG_GARBAGE;
+
+static uint32_t
+ParkingPolicy_getExpectedTransitions(const sParkingPolicy *_pPolicy,
+                                     eGateConfig _parkingConfig);
+static int64_t ParkingPolicy_getActuationMs(eGateConfig _from,
+                                            eGateConfig _parked,
+                                            eGateConfig _to);
+
+// Initialization/Termination functions
+// ----------------------------------------------------------------------------
+void ParkingPolicy_init(sParkingPolicy *_pPolicy)
+{
+  _pPolicy->historyLength = 0;
+  _pPolicy->historyNext = 0;
+  for (int i = 0; i < PARKING_POLICY_NUM_GATE_CONFIGS; i++) {
+    _pPolicy->configCounts[i] = 0;
+  }
+
+  _pPolicy->hasPreviousItem = false;
+  _pPolicy->parkingConfig = DEFAULT_PARKING_CONFIG;
+  _pPolicy->savedActuationMs = 0;
+}
+
+void ParkingPolicy_cleanup(sParkingPolicy *_pPolicy)
+{
+}
+
+// Policy functions
+// ----------------------------------------------------------------------------
+void ParkingPolicy_recordItem(sParkingPolicy *_pPolicy,
+                              eGateConfig _itemConfig)
+{
+  // The default policy moves the gates from the previous item to raised, then
+  // from raised to this item. This policy moves them from the previous item to
+  // the parking configuration, then to this item.
+  if (_pPolicy->hasPreviousItem) {
+    _pPolicy->savedActuationMs +=
+        ParkingPolicy_getActuationMs(_pPolicy->previousItemConfig,
+                                     DEFAULT_PARKING_CONFIG, _itemConfig) -
+        ParkingPolicy_getActuationMs(_pPolicy->previousItemConfig,
+                                     _pPolicy->parkingConfig, _itemConfig);
+  }
+
+  _pPolicy->hasPreviousItem = true;
+  _pPolicy->previousItemConfig = _itemConfig;
+
+  if (_pPolicy->historyLength == PARKING_POLICY_HISTORY_SIZE) {
+    _pPolicy->configCounts[_pPolicy->history[_pPolicy->historyNext]]--;
+  }
+  else {
+    _pPolicy->historyLength++;
+  }
+
+  _pPolicy->history[_pPolicy->historyNext] = _itemConfig;
+  _pPolicy->configCounts[_itemConfig]++;
+  _pPolicy->historyNext =
+      (_pPolicy->historyNext + 1) % PARKING_POLICY_HISTORY_SIZE;
+}
+
+eGateConfig ParkingPolicy_getParkingConfig(sParkingPolicy *_pPolicy,
+                                           eGateConfig _currentConfig)
+{
+  if (_pPolicy->historyLength == 0) {
+    _pPolicy->parkingConfig = DEFAULT_PARKING_CONFIG;
+    return _pPolicy->parkingConfig;
+  }
+
+  eGateConfig bestConfig = _currentConfig;
+  uint32_t bestExpectedTransitions =
+      ParkingPolicy_getExpectedTransitions(_pPolicy, _currentConfig);
+  for (int i = 0; i < PARKING_POLICY_NUM_GATE_CONFIGS; i++) {
+    uint32_t expectedTransitions =
+        ParkingPolicy_getExpectedTransitions(_pPolicy, GATE_CONFIGS[i]);
+    if (expectedTransitions < bestExpectedTransitions) {
+      bestConfig = GATE_CONFIGS[i];
+      bestExpectedTransitions = expectedTransitions;
+    }
+  }
+
+  _pPolicy->parkingConfig = bestConfig;
+  return _pPolicy->parkingConfig;
+}
+
+int64_t ParkingPolicy_getSavedActuationMs(const sParkingPolicy *_pPolicy)
+{
+  return _pPolicy->savedActuationMs;
+}
+
+void ParkingPolicy_printStats(const sParkingPolicy *_pPolicy)
+{
+  printf("Gate parking saved %lld ms of gate actuation. Last %u items: "
+         "garbage %u, compost %u, recycling %u.\n",
+         (long long)_pPolicy->savedActuationMs, _pPolicy->historyLength,
+         _pPolicy->configCounts[GATE_CONFIG_GARBAGE],
+         _pPolicy->configCounts[GATE_CONFIG_COMPOST],
+         _pPolicy->configCounts[GATE_CONFIG_RECYCLING]);
+}
+
+// Returns the gate actuation time of going from _from to _parked, then from
+// _parked to _to
+static int64_t ParkingPolicy_getActuationMs(eGateConfig _from,
+                                            eGateConfig _parked,
+                                            eGateConfig _to)
+{
+  return Gate_getTransitionTimeMs(_from, _parked) +
+         Gate_getTransitionTimeMs(_parked, _to);
+}
+
+// Returns the number of items in the history that would have needed a gate
+// transition from _parkingConfig, however many gates it moved. Proportional to
+// the expected transitions for the next item.
+static uint32_t
+ParkingPolicy_getExpectedTransitions(const sParkingPolicy *_pPolicy,
+                                     eGateConfig _parkingConfig)
+{
+  return _pPolicy->historyLength - _pPolicy->configCounts[_parkingConfig];
+}
@@ -1,6 +1,8 @@
 #include "../include/pipe.h"
+#include "../include/actuator.h"
 #include "../include/servo.h"
 #include "../include/timing.h"
+#include <stdint.h>
 #include <stdlib.h>
 
 // Servo max and min duty cycles
@@ -12,65 +14,106 @@ static const char *MAX_PIPE_SERVO = "2300000";		// counterclockwise
 //-----------------------------------------------------------------------------
 static const int PIPE_SERVO_INDEX = 0;
 
+// Time given to the pipe to travel to each position
+// ----------------------------------------------------------------------------
+static const int64_t PIPE_DROP_TRAVEL_TIME_MS = 2000;
+static const int64_t PIPE_RESET_TRAVEL_TIME_MS = 1500;
+
 // Function prototype declarations
 // ----------------------------------------------------------------------------
 
-static void enablePipe(void);
+static void enablePipe(sPipe *_pPipe);
 
-static void unenablePipe(void);
+static void unenablePipe(sPipe *_pPipe);
 
 // Public Functions
 // ----------------------------------------------------------------------------
 
-void Pipe_init(void)
+void Pipe_init(sPipe *_pPipe, sActuator *_pActuator)
 {
+	_pPipe->pActuator = _pActuator;
+	_pPipe->pipeToken = ACTUATOR_TOKEN_COMPLETE;
+
 	// Enable gates
   Timing_nanoSleep(0, 500000000);
-	enablePipe();
+	enablePipe(_pPipe);
   Timing_nanoSleep(0, 500000000);
 	// Ensure pipe is in initial position
-	Pipe_resetPipePosition();
+	Pipe_resetPipePosition(_pPipe);
   Timing_nanoSleep(0, 500000000);
 }
 
-void Pipe_cleanup(void)
+void Pipe_cleanup(sPipe *_pPipe)
 {
   Timing_nanoSleep(0, 500000000);
 	// Ensure pipe goes back to initial position
-	Pipe_resetPipePosition();
+	Pipe_resetPipePosition(_pPipe);
   Timing_nanoSleep(0, 500000000);
-	unenablePipe();
+	unenablePipe(_pPipe);
+}
+
+sActuatorToken Pipe_resetPipePosition(sPipe *_pPipe)
+{
+	// Set pipe to 500000
+	_pPipe->pipeToken = Actuator_submit(_pPipe->pActuator, PIPE_SERVO_INDEX,
+										MIN_PIPE_SERVO,
+										PIPE_RESET_TRAVEL_TIME_MS);
+	return _pPipe->pipeToken;
+}
+
+sActuatorToken Pipe_rotatePipeToDropBall(sPipe *_pPipe)
+{
+	// Set pipe to 2300000
+	_pPipe->pipeToken = Actuator_submit(_pPipe->pActuator, PIPE_SERVO_INDEX,
+										MAX_PIPE_SERVO,
+										PIPE_DROP_TRAVEL_TIME_MS);
+	return _pPipe->pipeToken;
+}
+
+// State functions
+// ----------------------------------------------------------------------------
+
+ePipePosition Pipe_getPosition(const sPipe *_pPipe)
+{
+	if (Actuator_isSubmittedTo(_pPipe->pActuator, PIPE_SERVO_INDEX,
+							   MIN_PIPE_SERVO)) {
+		return PIPE_AT_REST;
+	}
+	else if (Actuator_isSubmittedTo(_pPipe->pActuator, PIPE_SERVO_INDEX,
+									MAX_PIPE_SERVO)) {
+		return PIPE_DROPPING;
+	}
+
+	return PIPE_UNKNOWN;
 }
 
-void Pipe_resetPipePosition(void)
+bool Pipe_isPositionReached(const sPipe *_pPipe, ePipePosition _position)
 {
-	// Gets the correct servo
-	Servo servo = Servo_getServo(PIPE_SERVO_INDEX);
-	// Set gate to 470000
-	Servo_changeDutyCycle(servo, MIN_PIPE_SERVO);
+	return Pipe_getPosition(_pPipe) == _position &&
+		   Actuator_isComplete(_pPipe->pActuator, _pPipe->pipeToken);
 }
 
-void Pipe_rotatePipeToDropBall(void)
+void Pipe_waitUntilSettled(const sPipe *_pPipe)
 {
-  // Gets the correct servo
-	Servo servo = Servo_getServo(PIPE_SERVO_INDEX);
-	// Set gate to 2300000
-	Servo_changeDutyCycle(servo, MAX_PIPE_SERVO);
+	Actuator_wait(_pPipe->pActuator, _pPipe->pipeToken);
 }
 
 // Private Functions
 // ----------------------------------------------------------------------------
 
-static void enablePipe(void)
+static void enablePipe(sPipe *_pPipe)
 {
+	sServoBank *servoBank = Actuator_getServoBank(_pPipe->pActuator);
 	// Enable pipe
-	Servo servo1 = Servo_getServo(PIPE_SERVO_INDEX);
+	Servo servo1 = Servo_getServo(servoBank, PIPE_SERVO_INDEX);
 	Servo_enableSignal(servo1, "1");
 }
 
-static void unenablePipe(void)
+static void unenablePipe(sPipe *_pPipe)
 {
+	sServoBank *servoBank = Actuator_getServoBank(_pPipe->pActuator);
 	// Unenable pipe
-	Servo servo1 = Servo_getServo(PIPE_SERVO_INDEX);
+	Servo servo1 = Servo_getServo(servoBank, PIPE_SERVO_INDEX);
 	Servo_enableSignal(servo1, "0");
 }
+
@@ -0,0 +1,212 @@
+/*
+ * The realtime module keeps a table with the priority, CPU and latency budget
+ * of every thread role. Several threads may share a role, as every station
+ * thread records as the sorter, so statistics are updated with atomics (the
+ * maximum with a compare-and-swap loop) and read with relaxed atomics when
+ * printed.
+ */
+
+// CPU affinity and malloc tuning are GNU extensions
+#define _GNU_SOURCE
+
+#include "../include/realtime.h"
+#include "../include/timing.h"
+
+#include <malloc.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Stack prefaulted for the calling thread. Other threads get their stacks
+// locked and populated by mlockall(MCL_FUTURE) when they are created.
+#define STACK_PREFAULT_BYTES (256 * 1024)
+#define PAGE_SIZE_BYTES 4096
+
+// Role definitions
+// ----------------------------------------------------------------------------
+typedef struct {
+  const char *name;
+  int priority;
+  int cpu;
+  // Wakeups later than this are counted as deadline misses
+  int64_t latencyBudgetNs;
+} sRealtimeRole;
+
+// The actuator times servo travel, so it preempts the sorter, and both
+// preempt the lights. The BeagleBone has a single CPU; on more, the control
+// threads share one CPU and the lights get another.
+static const sRealtimeRole m_roles[REALTIME_NUM_THREADS] = {
+    [REALTIME_THREAD_SORTER] = {"sorter", 70, 0, 5000000},
+    [REALTIME_THREAD_ACTUATOR] = {"actuator", 80, 0, 2000000},
+    [REALTIME_THREAD_LIGHTS] = {"lights", 20, 1, 20000000},
+};
+
+// Upper bounds of every latency bucket but the last, which is unbounded
+static const int64_t BUCKET_BOUNDS_NS[REALTIME_NUM_LATENCY_BUCKETS - 1] = {
+    50000, 100000, 500000, 1000000, 5000000, 10000000, 50000000};
+
+static bool m_isEnabled;
+static sRealtimeLatencyStats m_stats[REALTIME_NUM_THREADS];
+
+static void Realtime_prefaultStack(void);
+
+// Initialization/Termination functions
+// ----------------------------------------------------------------------------
+void Realtime_init(bool _isEnabled)
+{
+  m_isEnabled = _isEnabled;
+  memset(m_stats, 0, sizeof(m_stats));
+  if (!m_isEnabled) {
+    return;
+  }
+
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+    perror("Realtime: Unable to lock memory");
+  }
+
+  // Keep freed heap memory mapped, so that it does not fault again when it is
+  // reused
+  mallopt(M_TRIM_THRESHOLD, -1);
+  mallopt(M_MMAP_MAX, 0);
+
+  Realtime_prefaultStack();
+  Realtime_configureThread(pthread_self(), REALTIME_THREAD_SORTER);
+}
+
+void Realtime_cleanup(void)
+{
+  if (m_isEnabled) {
+    munlockall();
+  }
+}
+
+// Profile functions
+// ----------------------------------------------------------------------------
+void Realtime_configureThread(pthread_t _thread, eRealtimeThread _role)
+{
+  Realtime_configureThreadOnCpu(_thread, _role, 0);
+}
+
+void Realtime_configureThreadOnCpu(pthread_t _thread, eRealtimeThread _role,
+                                   int _cpuOffset)
+{
+  if (!m_isEnabled) {
+    return;
+  }
+
+  const sRealtimeRole *role = &m_roles[_role];
+  struct sched_param param;
+  memset(&param, 0, sizeof(param));
+  param.sched_priority = role->priority;
+  int error = pthread_setschedparam(_thread, SCHED_FIFO, &param);
+  if (error != 0) {
+    fprintf(stderr, "Realtime: Unable to schedule %s thread: %s\n", role->name,
+            strerror(error));
+  }
+
+  long numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int cpu = (role->cpu + _cpuOffset) % (int)numCpus;
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  error = pthread_setaffinity_np(_thread, sizeof(cpus), &cpus);
+  if (error != 0) {
+    fprintf(stderr, "Realtime: Unable to pin %s thread: %s\n", role->name,
+            strerror(error));
+  }
+}
+
+// Statistics functions
+// ----------------------------------------------------------------------------
+void Realtime_recordWakeup(eRealtimeThread _role, int64_t _expectedTimeNs)
+{
+  int64_t latencyNs = Timing_getMonotonicTimeNs() - _expectedTimeNs;
+  if (latencyNs < 0) {
+    latencyNs = 0;
+  }
+
+  sRealtimeLatencyStats *stats = &m_stats[_role];
+  __atomic_add_fetch(&stats->numWakeups, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&stats->totalLatencyNs, latencyNs, __ATOMIC_RELAXED);
+  int64_t maxLatencyNs =
+      __atomic_load_n(&stats->maxLatencyNs, __ATOMIC_RELAXED);
+  while (latencyNs > maxLatencyNs &&
+         !__atomic_compare_exchange_n(&stats->maxLatencyNs, &maxLatencyNs,
+                                      latencyNs, true, __ATOMIC_RELAXED,
+                                      __ATOMIC_RELAXED)) {
+  }
+  if (latencyNs > m_roles[_role].latencyBudgetNs) {
+    __atomic_add_fetch(&stats->numDeadlineMisses, 1, __ATOMIC_RELAXED);
+  }
+
+  int bucket = 0;
+  while (bucket < REALTIME_NUM_LATENCY_BUCKETS - 1 &&
+         latencyNs >= BUCKET_BOUNDS_NS[bucket]) {
+    bucket++;
+  }
+  __atomic_add_fetch(&stats->buckets[bucket], 1, __ATOMIC_RELAXED);
+}
+
+sRealtimeLatencyStats Realtime_getStats(eRealtimeThread _role)
+{
+  sRealtimeLatencyStats stats;
+  sRealtimeLatencyStats *source = &m_stats[_role];
+  stats.numWakeups = __atomic_load_n(&source->numWakeups, __ATOMIC_RELAXED);
+  stats.numDeadlineMisses =
+      __atomic_load_n(&source->numDeadlineMisses, __ATOMIC_RELAXED);
+  stats.totalLatencyNs =
+      __atomic_load_n(&source->totalLatencyNs, __ATOMIC_RELAXED);
+  stats.maxLatencyNs =
+      __atomic_load_n(&source->maxLatencyNs, __ATOMIC_RELAXED);
+  for (int i = 0; i < REALTIME_NUM_LATENCY_BUCKETS; i++) {
+    stats.buckets[i] = __atomic_load_n(&source->buckets[i], __ATOMIC_RELAXED);
+  }
+
+  return stats;
+}
+
+void Realtime_printStats(void)
+{
+  printf("Wakeup latency (%s scheduling profile):\n",
+         m_isEnabled ? "real-time" : "default");
+  for (int i = 0; i < REALTIME_NUM_THREADS; i++) {
+    sRealtimeLatencyStats stats = Realtime_getStats(i);
+    if (stats.numWakeups == 0) {
+      continue;
+    }
+
+    int64_t meanLatencyNs = stats.totalLatencyNs / (int64_t)stats.numWakeups;
+    printf("  %s: %llu wakeups, mean %lld us, max %lld us, %llu over %lld us "
+           "budget\n    ",
+           m_roles[i].name, (unsigned long long)stats.numWakeups,
+           (long long)(meanLatencyNs / 1000),
+           (long long)(stats.maxLatencyNs / 1000),
+           (unsigned long long)stats.numDeadlineMisses,
+           (long long)(m_roles[i].latencyBudgetNs / 1000));
+    for (int j = 0; j < REALTIME_NUM_LATENCY_BUCKETS; j++) {
+      if (j < REALTIME_NUM_LATENCY_BUCKETS - 1) {
+        printf("<%lldus:%llu ", (long long)(BUCKET_BOUNDS_NS[j] / 1000),
+               (unsigned long long)stats.buckets[j]);
+      }
+      else {
+        printf(">=%lldus:%llu\n", (long long)(BUCKET_BOUNDS_NS[j - 1] / 1000),
+               (unsigned long long)stats.buckets[j]);
+      }
+    }
+  }
+}
+
+// Helper functions
+// ----------------------------------------------------------------------------
+static void Realtime_prefaultStack(void)
+{
+  volatile unsigned char stack[STACK_PREFAULT_BYTES];
+  for (size_t i = 0; i < STACK_PREFAULT_BYTES; i += PAGE_SIZE_BYTES) {
+    stack[i] = 0;
+  }
+
+  // Read back, so the writes are not optimized away
+  (void)stack[0];
+}
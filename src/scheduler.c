@@ -0,0 +1,402 @@
+/*
+ * The scheduler module owns the stations and the signals. SIGINT and SIGTERM
+ * are blocked in every thread and read from a signalfd by the thread that
+ * runs the scheduler, which stops every station in turn. Stations report that
+ * their sorter stopped through a shared eventfd, so the scheduler also
+ * returns once the stations were all quit through their FIFOs.
+ */
+
+#include "../include/scheduler.h"
+#include "../include/lights.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
+
+#define LINE_LEN 256
+#define MAX_MUX_CHANNEL 7
+#define NUM_POLL_FDS 2
+
+static sStation m_stations[SCHEDULER_MAX_STATIONS];
+static int m_numStations = 0;
+static bool m_hasLights = false;
+
+static int m_signalFd = -1;
+static int m_stoppedFd = -1;
+
+static bool Scheduler_parseInt(const char *_pValue, int32_t *_pValueOut);
+static bool Scheduler_setKey(sStationConfig *_pConfig, const char *_pKey,
+                             const char *_pValue);
+static bool Scheduler_areSensorsCompatible(const sColorSensorConfig *_pA,
+                                           const sColorSensorConfig *_pB);
+static void Scheduler_stopAll(void);
+
+// Configuration functions
+// ----------------------------------------------------------------------------
+bool Scheduler_loadConfig(const char *_pPath, sSchedulerConfig *_pConfigOut)
+{
+  memset(_pConfigOut, 0, sizeof(*_pConfigOut));
+
+  FILE *pFile = fopen(_pPath, "r");
+  if (pFile == NULL) {
+    fprintf(stderr, "Scheduler: Unable to open %s: %s\n", _pPath,
+            strerror(errno));
+    return false;
+  }
+
+  char line[LINE_LEN];
+  char key[LINE_LEN];
+  char value[LINE_LEN];
+  int lineNum = 0;
+  bool isValid = true;
+  while (isValid && fgets(line, LINE_LEN, pFile) != NULL) {
+    lineNum++;
+    char *comment = strchr(line, '#');
+    if (comment != NULL) {
+      *comment = '\0';
+    }
+
+    char extra[2];
+    int numFields = sscanf(line, "%255s %255s %1s", key, value, extra);
+    if (numFields <= 0) {
+      continue;
+    }
+
+    if (numFields != 2) {
+      fprintf(stderr, "%s:%d: Expected a key and a value.\n", _pPath,
+              lineNum);
+      isValid = false;
+    }
+    else if (strcmp(key, "station") == 0) {
+      if (_pConfigOut->numStations == SCHEDULER_MAX_STATIONS) {
+        fprintf(stderr, "%s:%d: No more than %d stations are supported.\n",
+                _pPath, lineNum, SCHEDULER_MAX_STATIONS);
+        isValid = false;
+      }
+      else if (strlen(value) >= STATION_NAME_LEN) {
+        fprintf(stderr, "%s:%d: Station name too long.\n", _pPath, lineNum);
+        isValid = false;
+      }
+      else {
+        Station_initConfig(
+            &_pConfigOut->stations[_pConfigOut->numStations++], value);
+      }
+    }
+    else if (_pConfigOut->numStations == 0) {
+      fprintf(stderr, "%s:%d: '%s' comes before any station.\n", _pPath,
+              lineNum, key);
+      isValid = false;
+    }
+    else if (!Scheduler_setKey(
+                 &_pConfigOut->stations[_pConfigOut->numStations - 1], key,
+                 value)) {
+      fprintf(stderr, "%s:%d: Invalid '%s %s'.\n", _pPath, lineNum, key,
+              value);
+      isValid = false;
+    }
+  }
+
+  fclose(pFile);
+  return isValid;
+}
+
+bool Scheduler_validateConfig(const sSchedulerConfig *_pConfig)
+{
+  if (_pConfig->numStations <= 0) {
+    fprintf(stderr, "Scheduler: No station configured.\n");
+    return false;
+  }
+
+  bool isValid = true;
+  int numStationsWithLights = 0;
+  for (int i = 0; i < _pConfig->numStations; i++) {
+    const sStationConfig *station = &_pConfig->stations[i];
+    const sColorSensorConfig *sensor = &station->sensorConfig;
+    if (sensor->i2cBusNum < 0) {
+      fprintf(stderr, "Scheduler: Station '%s' has no sensor bus.\n",
+              station->name);
+      isValid = false;
+    }
+    if (sensor->muxChannel > MAX_MUX_CHANNEL) {
+      fprintf(stderr, "Scheduler: Station '%s' has no mux channel %u.\n",
+              station->name, (unsigned)sensor->muxChannel);
+      isValid = false;
+    }
+    for (int s = 0; s < SERVO_NUM_SERVOS; s++) {
+      if (!Servo_isPwmPin(station->servoPins[s])) {
+        fprintf(stderr, "Scheduler: Station '%s': %s is not a PWM pin.\n",
+                station->name, station->servoPins[s]);
+        isValid = false;
+      }
+    }
+    if (station->hasLights) {
+      numStationsWithLights++;
+    }
+
+    for (int j = 0; j < i; j++) {
+      const sStationConfig *other = &_pConfig->stations[j];
+      if (strcmp(station->name, other->name) == 0) {
+        fprintf(stderr, "Scheduler: Two stations are named '%s'.\n",
+                station->name);
+        isValid = false;
+      }
+      if (!Scheduler_areSensorsCompatible(sensor, &other->sensorConfig)) {
+        fprintf(stderr,
+                "Scheduler: Stations '%s' and '%s' cannot both reach their "
+                "sensors on bus %d.\n",
+                other->name, station->name, (int)sensor->i2cBusNum);
+        isValid = false;
+      }
+      for (int s = 0; s < SERVO_NUM_SERVOS; s++) {
+        for (int t = 0; t < SERVO_NUM_SERVOS; t++) {
+          if (strcmp(station->servoPins[s], other->servoPins[t]) == 0) {
+            fprintf(stderr,
+                    "Scheduler: Stations '%s' and '%s' share pin %s.\n",
+                    other->name, station->name, station->servoPins[s]);
+            isValid = false;
+          }
+        }
+      }
+      if (strcmp(station->delayProfilePath, other->delayProfilePath) == 0) {
+        fprintf(stderr,
+                "Scheduler: Stations '%s' and '%s' share delay profile %s.\n",
+                other->name, station->name, station->delayProfilePath);
+        isValid = false;
+      }
+      if (strcmp(station->calibrationProfilePath,
+                 other->calibrationProfilePath) == 0) {
+        fprintf(stderr,
+                "Scheduler: Stations '%s' and '%s' share calibration profile "
+                "%s.\n",
+                other->name, station->name, station->calibrationProfilePath);
+        isValid = false;
+      }
+      if (strcmp(station->controlFifoPath, other->controlFifoPath) == 0) {
+        fprintf(stderr,
+                "Scheduler: Stations '%s' and '%s' share control FIFO %s.\n",
+                other->name, station->name, station->controlFifoPath);
+        isValid = false;
+      }
+    }
+  }
+
+  if (numStationsWithLights > 1) {
+    fprintf(stderr, "Scheduler: Only one station may have the lights.\n");
+    isValid = false;
+  }
+
+  return isValid;
+}
+
+static bool Scheduler_parseInt(const char *_pValue, int32_t *_pValueOut)
+{
+  char *end;
+  errno = 0;
+  long value = strtol(_pValue, &end, 0);
+  if (errno != 0 || end == _pValue || *end != '\0' || value < INT32_MIN ||
+      value > INT32_MAX) {
+    return false;
+  }
+
+  *_pValueOut = (int32_t)value;
+  return true;
+}
+
+// Returns false if the key is unknown or its value invalid
+static bool Scheduler_setKey(sStationConfig *_pConfig, const char *_pKey,
+                             const char *_pValue)
+{
+  sColorSensorConfig *sensor = &_pConfig->sensorConfig;
+  int32_t number;
+
+  if (strcmp(_pKey, "sensorBus") == 0) {
+    if (!Scheduler_parseInt(_pValue, &number) || number < 0) {
+      return false;
+    }
+    sensor->i2cBusNum = number;
+  }
+  else if (strcmp(_pKey, "muxAddress") == 0) {
+    if (!Scheduler_parseInt(_pValue, &number) || number < 0) {
+      return false;
+    }
+    sensor->muxAddress = number;
+  }
+  else if (strcmp(_pKey, "muxChannel") == 0) {
+    if (!Scheduler_parseInt(_pValue, &number) || number < 0 ||
+        number > MAX_MUX_CHANNEL) {
+      return false;
+    }
+    sensor->muxChannel = (uint8_t)number;
+  }
+  else if (strcmp(_pKey, "threshold") == 0) {
+    if (!Scheduler_parseInt(_pValue, &number) || number < 0) {
+      return false;
+    }
+    sensor->objectSensingThreshold = (uint32_t)number;
+  }
+  else if (strcmp(_pKey, "pipeServo") == 0 ||
+           strcmp(_pKey, "gate1Servo") == 0 ||
+           strcmp(_pKey, "gate2Servo") == 0) {
+    int index = _pKey[0] == 'p' ? 0 : _pKey[4] - '0';
+    if (strlen(_pValue) >= STATION_PIN_LEN) {
+      return false;
+    }
+    snprintf(_pConfig->servoPins[index], STATION_PIN_LEN, "%s", _pValue);
+  }
+  else if (strcmp(_pKey, "delayProfile") == 0 ||
+           strcmp(_pKey, "calibrationProfile") == 0 ||
+           strcmp(_pKey, "controlFifo") == 0) {
+    if (strlen(_pValue) >= STATION_PATH_LEN) {
+      return false;
+    }
+    char *path = _pConfig->controlFifoPath;
+    if (_pKey[0] == 'd') {
+      path = _pConfig->delayProfilePath;
+    }
+    else if (strcmp(_pKey, "calibrationProfile") == 0) {
+      path = _pConfig->calibrationProfilePath;
+    }
+    snprintf(path, STATION_PATH_LEN, "%s", _pValue);
+  }
+  else if (strcmp(_pKey, "lights") == 0) {
+    if (strcmp(_pValue, "on") != 0 && strcmp(_pValue, "off") != 0) {
+      return false;
+    }
+    _pConfig->hasLights = strcmp(_pValue, "on") == 0;
+  }
+  else if (strcmp(_pKey, "speculation") == 0) {
+    if (!Scheduler_parseInt(_pValue, &number) || number < 0 ||
+        number > 100) {
+      return false;
+    }
+    _pConfig->speculationConfidenceThreshold = (uint32_t)number;
+    _pConfig->isSpeculationEnabled = true;
+  }
+  else {
+    return false;
+  }
+
+  return true;
+}
+
+/* The sensors have a fixed address, so two on the same bus are only told
+ * apart by the channel of the multiplexer they are behind. Every multiplexer
+ * also keeps its channels selected until told otherwise, so both must be
+ * behind the same one. */
+static bool Scheduler_areSensorsCompatible(const sColorSensorConfig *_pA,
+                                           const sColorSensorConfig *_pB)
+{
+  if (_pA->i2cBusNum != _pB->i2cBusNum) {
+    return true;
+  }
+
+  return _pA->muxAddress != COLOR_SENSOR_NO_MUX &&
+         _pA->muxAddress == _pB->muxAddress &&
+         _pA->muxChannel != _pB->muxChannel;
+}
+
+// Initialization/Termination functions
+// ----------------------------------------------------------------------------
+void Scheduler_init(const sSchedulerConfig *_pConfig)
+{
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  if (pthread_sigmask(SIG_BLOCK, &signals, NULL) != 0) {
+    fprintf(stderr, "Scheduler: Unable to block termination signals.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  m_signalFd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+  m_stoppedFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (m_signalFd < 0 || m_stoppedFd < 0) {
+    perror("Scheduler: Unable to create file descriptors");
+    exit(EXIT_FAILURE);
+  }
+
+  m_hasLights = false;
+  for (int i = 0; i < _pConfig->numStations; i++) {
+    m_hasLights = m_hasLights || _pConfig->stations[i].hasLights;
+  }
+  if (m_hasLights) {
+    Lights_init();
+  }
+
+  // Spreading the stations over the CPUs keeps their sorters from contending
+  m_numStations = _pConfig->numStations;
+  for (int i = 0; i < m_numStations; i++) {
+    Station_init(&m_stations[i], &_pConfig->stations[i], i);
+  }
+}
+
+void Scheduler_cleanup(void)
+{
+  for (int i = 0; i < m_numStations; i++) {
+    Station_cleanup(&m_stations[i]);
+  }
+  m_numStations = 0;
+
+  if (m_hasLights) {
+    Lights_cleanup();
+    m_hasLights = false;
+  }
+
+  close(m_signalFd);
+  m_signalFd = -1;
+  close(m_stoppedFd);
+  m_stoppedFd = -1;
+}
+
+// Behaviour functions
+// ----------------------------------------------------------------------------
+void Scheduler_run(void)
+{
+  for (int i = 0; i < m_numStations; i++) {
+    Station_start(&m_stations[i], m_stoppedFd);
+  }
+
+  struct pollfd pollFds[NUM_POLL_FDS] = {{m_signalFd, POLLIN, 0},
+                                         {m_stoppedFd, POLLIN, 0}};
+  int numStopped = 0;
+  while (numStopped < m_numStations) {
+    if (poll(pollFds, NUM_POLL_FDS, -1) <= 0) {
+      continue;
+    }
+
+    struct signalfd_siginfo info;
+    if ((pollFds[0].revents & POLLIN) &&
+        read(m_signalFd, &info, sizeof(info)) == sizeof(info)) {
+      printf("Received signal %u.\n", info.ssi_signo);
+      Scheduler_stopAll();
+    }
+
+    uint64_t stopped;
+    if ((pollFds[1].revents & POLLIN) &&
+        read(m_stoppedFd, &stopped, sizeof(stopped)) == sizeof(stopped)) {
+      numStopped += (int)stopped;
+    }
+  }
+}
+
+void Scheduler_printStats(void)
+{
+  for (int i = 0; i < m_numStations; i++) {
+    Station_printStats(&m_stations[i]);
+  }
+}
+
+static void Scheduler_stopAll(void)
+{
+  for (int i = 0; i < m_numStations; i++) {
+    Station_stop(&m_stations[i]);
+  }
+}
@@ -2,6 +2,7 @@
 #include "../include/file.h"
 #include "../include/timing.h"
 
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -16,31 +17,54 @@ static const char *PERIOD_FILE = "/period";
 static const char *DUTY_CYCLE_FILE = "/duty_cycle";
 static const char *ENABLE_FILE = "/enable";
 
-// EHRPWM pin export
+// EHRPWM pins
 // ----------------------------------------------------------------------------
-static const char P9_PIN_21 = '1';		// EHRPWM0B, 1 for B
-static const char P9_PIN_14 = '0';		// EHRPWM1A, 0 for A
-static const char P8_PIN_13 = '1';		// EHRPWM2B, 1 for B
+// Every EHRPWM module drives two pins, exported as channel 0 for A and 1 for B
+typedef struct {
+	const char *name;
+	int pin;
+	char pinExportChar;
+	char *header;
+	char *pwmPath;
+} sServoPwmPin;
+
+#define EHRPWM_PATH(_epwmss, _pwm) \
+	"/sys/devices/platform/ocp/" _epwmss ".epwmss/" _pwm ".pwm/pwm/"
+#define EHRPWM0_PATH EHRPWM_PATH("48300000", "48300200")
+#define EHRPWM1_PATH EHRPWM_PATH("48302000", "48302200")
+#define EHRPWM2_PATH EHRPWM_PATH("48304000", "48304200")
+
+static const sServoPwmPin PWM_PINS[] = {
+	{"P9_22", 22, '0', "p9", EHRPWM0_PATH},		// EHRPWM0A
+	{"P9_21", 21, '1', "p9", EHRPWM0_PATH},		// EHRPWM0B
+	{"P9_14", 14, '0', "p9", EHRPWM1_PATH},		// EHRPWM1A
+	{"P9_16", 16, '1', "p9", EHRPWM1_PATH},		// EHRPWM1B
+	{"P8_19", 19, '0', "p8", EHRPWM2_PATH},		// EHRPWM2A
+	{"P8_13", 13, '1', "p8", EHRPWM2_PATH},		// EHRPWM2B
+};
+
+static const int NUM_PWM_PINS = sizeof(PWM_PINS) / sizeof(PWM_PINS[0]);
+
+const char *const SERVO_DEFAULT_PINS[SERVO_NUM_SERVOS] = {"P8_13", "P9_21",
+														  "P9_14"};
 
 // Servo period
 // ----------------------------------------------------------------------------
 static const char *SERVO_PERIOD = "20000000"; // 20ms as specified by servo docs
 
-// List of servos and list length
+// Servos in a bank
 // ----------------------------------------------------------------------------
-static struct Servo servos[] = {
-	{13, P8_PIN_13, "p8", "pwmchipN",	// p8_13
-	"/sys/devices/platform/ocp/48304000.epwmss/48304200.pwm/pwm/", "tower"},
-	{21, P9_PIN_21, "p9", "pwmchipN",	// p9_21
-	"/sys/devices/platform/ocp/48300000.epwmss/48300200.pwm/pwm/", "micro"},
-	{14, P9_PIN_14, "p9", "pwmchipN",	// p9_14
-	"/sys/devices/platform/ocp/48302000.epwmss/48302200.pwm/pwm/", "micro"},
-};
+static const int SERVOS_LISTED = SERVO_NUM_SERVOS;
 
-static const int SERVOS_LISTED = 3;
+// The pipe servo comes first in a bank
+static const int TOWER_SERVO_INDEX = 0;
 
 // Function prototype declarations
 // ----------------------------------------------------------------------------
+static const sServoPwmPin *findPwmPin(const char *_pPin);
+
+static void setServoPin(Servo *_pServo, const char *_pPin, char *_type);
+
 static void exportPWMChip(Servo _servo);
 
 static void setPWMChip(Servo _servo);
@@ -52,6 +76,13 @@ static void unexportPWMChip(Servo _servo);
 static void writeToServo(Servo _servo, const char *_fileToWrite,
 						 const char *_pvalue);
 
+static void getServoFilePath(Servo _servo, const char *_file,
+							 char *_pFilePathOut);
+
+static void openDutyCycleAttribute(sServoBank *_pBank, int _servoIndex);
+
+static void checkServoIndex(int _servoIndex);
+
 // Constant pwmchip length for pwmchip buffers
 // ----------------------------------------------------------------------------
 static const int PWMCHIP_LENGTH = strlen("pwmchipN")+1;
@@ -59,40 +90,137 @@ static const int PWMCHIP_LENGTH = strlen("pwmchipN")+1;
 // Public Functions
 // ----------------------------------------------------------------------------
 
-void Servo_init(void)
+void Servo_init(sServoBank *_pBank, const char *const _pPins[SERVO_NUM_SERVOS])
 {
+	pthread_mutex_init(&_pBank->statesMutex, NULL);
 	for(int i = 0; i < SERVOS_LISTED ; i++){
+		Servo *servo = &_pBank->servos[i];
+		setServoPin(servo, _pPins[i],
+					i == TOWER_SERVO_INDEX ? "tower" : "micro");
 		// Set the correct pwmchip according to pin path
 		char *pinPwmChip = malloc(sizeof(char)*PWMCHIP_LENGTH);
-		servos[i].pwmchip = pinPwmChip;
-		setPWMChip(servos[i]);
+		servo->pwmchip = pinPwmChip;
+		setPWMChip(*servo);
+		servo->dutyCycleFd = -1;
+		_pBank->dutyCycleSlots[i] = -1;
 		// Export EHRPWM pin
-		exportPWMChip(servos[i]);
+		exportPWMChip(*servo);
 		Timing_nanoSleep(0, 500000000);
 		// Set servo period
-		setServoPeriod(servos[i], SERVO_PERIOD);
+		setServoPeriod(*servo, SERVO_PERIOD);
+		// Keep the duty cycle open, as it is written on every command
+		openDutyCycleAttribute(_pBank, i);
+		// Position is unknown until the first command
+		pthread_mutex_lock(&_pBank->statesMutex);
+		_pBank->states[i].isCommanded = false;
+		pthread_mutex_unlock(&_pBank->statesMutex);
 	}
 }
 
-void Servo_cleanup(void)
+void Servo_cleanup(sServoBank *_pBank)
 {
 	for(int i = 0; i < SERVOS_LISTED ; i++){
+		Servo *servo = &_pBank->servos[i];
+		// Let batched duty cycle writes land first
+		BatchWriter_unregisterFd(_pBank->dutyCycleSlots[i]);
+		_pBank->dutyCycleSlots[i] = -1;
 		// Unenable pin
-		Servo_enableSignal(servos[i], "0");
+		Servo_enableSignal(*servo, "0");
 		// Set duty cycle to 0
-		Servo_changeDutyCycle(servos[i], "0");
+		Servo_changeDutyCycle(*servo, "0");
+		File_closeAttribute(servo->dutyCycleFd);
+		servo->dutyCycleFd = -1;
 		// Set period to 0
-		setServoPeriod(servos[i], 0);
+		setServoPeriod(*servo, 0);
 		// Unexport EHRPWM pin
-		unexportPWMChip(servos[i]);
+		unexportPWMChip(*servo);
 		// Free pwmchip
-		free(servos[i].pwmchip);
+		free(servo->pwmchip);
+		// Forget the commanded position
+		pthread_mutex_lock(&_pBank->statesMutex);
+		_pBank->states[i].isCommanded = false;
+		pthread_mutex_unlock(&_pBank->statesMutex);
 	}
+	pthread_mutex_destroy(&_pBank->statesMutex);
+}
+
+bool Servo_isPwmPin(const char *_pPin)
+{
+	return findPwmPin(_pPin) != NULL;
 }
 
 void Servo_changeDutyCycle(Servo _servo, const char *_newDutyCycle)
 {
-	writeToServo(_servo, DUTY_CYCLE_FILE, _newDutyCycle);
+	if (_servo.dutyCycleFd < 0) {
+		writeToServo(_servo, DUTY_CYCLE_FILE, _newDutyCycle);
+		return;
+	}
+
+	int error = File_writeAttribute(_servo.dutyCycleFd, _newDutyCycle);
+	if (error < 0) {
+		printf("Error: Could not write duty cycle %s: %s\n", _newDutyCycle,
+			   strerror(-error));
+	}
+}
+
+bool Servo_commandDutyCycle(sServoBank *_pBank, int _servoIndex,
+							const char *_newDutyCycle)
+{
+	sBatchWriterBatch batch;
+	BatchWriter_initBatch(&batch);
+	bool isWritten =
+		Servo_queueDutyCycle(_pBank, _servoIndex, _newDutyCycle, &batch);
+	BatchWriter_submit(&batch);
+	return isWritten;
+}
+
+bool Servo_queueDutyCycle(sServoBank *_pBank, int _servoIndex,
+						  const char *_newDutyCycle,
+						  sBatchWriterBatch *_pBatch)
+{
+	if (Servo_isCommandedTo(_pBank, _servoIndex, _newDutyCycle)) {
+		return false;
+	}
+
+	int slot = _pBank->dutyCycleSlots[_servoIndex];
+	if (slot < 0 || !BatchWriter_add(_pBatch, slot, _newDutyCycle)) {
+		Servo_changeDutyCycle(_pBank->servos[_servoIndex], _newDutyCycle);
+	}
+
+	pthread_mutex_lock(&_pBank->statesMutex);
+	sServoState *state = &_pBank->states[_servoIndex];
+	snprintf(state->dutyCycle, SERVO_DUTY_CYCLE_LEN, "%s", _newDutyCycle);
+	state->isCommanded = true;
+	state->lastCommandTimeMs = Timing_getMonotonicTimeMs();
+	pthread_mutex_unlock(&_pBank->statesMutex);
+	return true;
+}
+
+bool Servo_isCommandedTo(sServoBank *_pBank, int _servoIndex,
+						 const char *_dutyCycle)
+{
+	checkServoIndex(_servoIndex);
+
+	pthread_mutex_lock(&_pBank->statesMutex);
+	sServoState *state = &_pBank->states[_servoIndex];
+	bool isCommanded =
+		state->isCommanded && strcmp(state->dutyCycle, _dutyCycle) == 0;
+	pthread_mutex_unlock(&_pBank->statesMutex);
+	return isCommanded;
+}
+
+int64_t Servo_getMsSinceLastCommand(sServoBank *_pBank, int _servoIndex)
+{
+	checkServoIndex(_servoIndex);
+
+	pthread_mutex_lock(&_pBank->statesMutex);
+	sServoState *state = &_pBank->states[_servoIndex];
+	int64_t elapsedMs = INT64_MAX;
+	if (state->isCommanded) {
+		elapsedMs = Timing_getMonotonicTimeMs() - state->lastCommandTimeMs;
+	}
+	pthread_mutex_unlock(&_pBank->statesMutex);
+	return elapsedMs;
 }
 
 // Enables/disables the signal of the servo
@@ -101,19 +229,52 @@ void Servo_enableSignal(Servo _servo, char *_newSignal)
 	writeToServo(_servo, ENABLE_FILE, _newSignal);
 }
 
-Servo Servo_getServo(int _servoIndex)
+Servo Servo_getServo(const sServoBank *_pBank, int _servoIndex)
 {
-	if (_servoIndex < SERVOS_LISTED && _servoIndex >= 0){
-		return servos[_servoIndex];
+	checkServoIndex(_servoIndex);
+	return _pBank->servos[_servoIndex];
+}
+
+// Private Functions
+// ----------------------------------------------------------------------------
+
+// Returns the EHRPWM pin named _pPin, or NULL if there is none.
+static const sServoPwmPin *findPwmPin(const char *_pPin)
+{
+	for (int i = 0; i < NUM_PWM_PINS; i++) {
+		if (strcmp(PWM_PINS[i].name, _pPin) == 0) {
+			return &PWM_PINS[i];
+		}
 	}
-	else {
-		printf("Error: Must select servo index of 0-2.\n");
+
+	return NULL;
+}
+
+// Sets the pin fields of the servo to those of the EHRPWM pin named _pPin.
+// Terminates the program if it is not an EHRPWM pin.
+static void setServoPin(Servo *_pServo, const char *_pPin, char *_type)
+{
+	const sServoPwmPin *pwmPin = findPwmPin(_pPin);
+	if (pwmPin == NULL) {
+		printf("Error: %s is not a PWM pin.\n", _pPin);
 		exit(EXIT_FAILURE);
 	}
+
+	_pServo->pin = pwmPin->pin;
+	_pServo->pinExportChar = pwmPin->pinExportChar;
+	_pServo->header = pwmPin->header;
+	_pServo->pwmPath = pwmPin->pwmPath;
+	_pServo->type = _type;
 }
 
-// Private Functions
-// ----------------------------------------------------------------------------
+// Terminates the program if the servo index is not in the servo list.
+static void checkServoIndex(int _servoIndex)
+{
+	if (_servoIndex >= SERVOS_LISTED || _servoIndex < 0) {
+		printf("Error: Must select servo index of 0-2.\n");
+		exit(EXIT_FAILURE);
+	}
+}
 
 // Exports the EHRPWM pin to either a 1 or a 0 dependednt on pin export char.
 static void exportPWMChip(Servo _servo)
@@ -179,37 +340,58 @@ static void setServoPeriod(Servo _servo, const char* _period)
 	writeToServo(_servo, PERIOD_FILE, _period);
 }
 
+// Opens the duty cycle attribute of the servo and registers it for batched
+// writes. If it cannot be opened, duty cycles are written through its path
+// instead.
+static void openDutyCycleAttribute(sServoBank *_pBank, int _servoIndex)
+{
+	Servo *servo = &_pBank->servos[_servoIndex];
+	char dutyCyclePath[MAX_BUFFER_LEN];
+	getServoFilePath(*servo, DUTY_CYCLE_FILE, dutyCyclePath);
+	servo->dutyCycleFd =
+		File_openAttribute(dutyCyclePath, FILE_ATTRIBUTE_WRITE);
+	_pBank->dutyCycleSlots[_servoIndex] = -1;
+	if (servo->dutyCycleFd < 0) {
+		printf("Error: Could not open %s: %s\n", dutyCyclePath,
+			   strerror(-servo->dutyCycleFd));
+		return;
+	}
+
+	_pBank->dutyCycleSlots[_servoIndex] =
+		BatchWriter_registerFd(servo->dutyCycleFd);
+}
+
 // Writes a char * value to a servo file.
 static void writeToServo(Servo _servo, const char *_fileToWrite,
 						 const char *_pvalue)
+{
+	char servoFilePath[MAX_BUFFER_LEN];
+	getServoFilePath(_servo, _fileToWrite, servoFilePath);
+
+	// Write to servo file
+	File_writeToFile(servoFilePath, _pvalue);
+}
+
+// Builds the path of a servo file into _pFilePathOut, of MAX_BUFFER_LEN.
+static void getServoFilePath(Servo _servo, const char *_file,
+							 char *_pFilePathOut)
 {
  	// Get pwmchip path
-	char *pwmchipPath = malloc(sizeof(char)*MAX_BUFFER_LEN);
+	char pwmchipPath[MAX_BUFFER_LEN];
 	File_concatFilePath(_servo.pwmPath, _servo.pwmchip, pwmchipPath,
 	 MAX_BUFFER_LEN);
 
-	// Get servo file path
-	char *servoFilePath = malloc(sizeof(char)*MAX_BUFFER_LEN);
-
 	// Handles pwm export file being in different directory
-	if (strcmp(_fileToWrite, FILE_EXPORT_FILE)){	// Not exporting a file
+	if (strcmp(_file, FILE_EXPORT_FILE)){	// Not exporting a file
 		// Get pwm 0 or 1
-		char *pwm = malloc(sizeof(char)*MAX_BUFFER_LEN);
+		char pwm[MAX_BUFFER_LEN];
 		snprintf(pwm, MAX_BUFFER_LEN,"/pwm%c", _servo.pinExportChar);
 
 		// Get final pwm path
-		char *pwmPath = malloc(sizeof(char)*MAX_BUFFER_LEN);
+		char pwmPath[MAX_BUFFER_LEN];
 		File_concatFilePath(pwmchipPath, pwm, pwmPath, MAX_BUFFER_LEN);
-		File_concatFilePath(pwmPath, _fileToWrite, servoFilePath, MAX_BUFFER_LEN);
-		free(pwm);
-		free(pwmPath);
+		File_concatFilePath(pwmPath, _file, _pFilePathOut, MAX_BUFFER_LEN);
 	} else {	// Exporting a file
-		File_concatFilePath(pwmchipPath, _fileToWrite, servoFilePath,
-												MAX_BUFFER_LEN);
+		File_concatFilePath(pwmchipPath, _file, _pFilePathOut, MAX_BUFFER_LEN);
 	}
-
-	// Write to servo file
-	File_writeToFile(servoFilePath, _pvalue);
-	free(pwmchipPath);
-	free(servoFilePath);
 }
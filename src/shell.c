@@ -1,38 +1,223 @@
 /*
- * This shell module contains the functionality to fork the process and
- * carry out shell commands.
+ * This shell module contains the functionality to spawn processes and carry
+ * out shell commands. Commands are started with posix_spawn, so that the
+ * child never runs any code of this program, and their exit is polled for
+ * until their timeout.
  */
 
 #include "../include/shell.h"
+#include "../include/file.h"
+#include "../include/timing.h"
 #include <errno.h>
+#include <signal.h>
+#include <spawn.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#define CONFIG_PIN_PATH "/usr/bin/config-pin"
+#define CONFIG_PIN_TIMEOUT_MS 10000
+#define EXIT_POLL_INTERVAL_MS 5
+#define PATH_BUFFER_SIZE 256
+#define MODE_BUFFER_SIZE 64
+
+extern char **environ;
+
+static int Shell_initSpawnAttributes(posix_spawnattr_t *_pAttributes);
+static int Shell_waitForExit(pid_t _childPid, int64_t _timeoutMs);
+static bool Shell_setPinModeThroughPinmux(const sShellPinMode *_pPinMode,
+                                          bool *_pIsSetOut);
+static bool Shell_setPinModesThroughConfigPin(const sShellPinMode *_pPinModes,
+                                              const bool *_pIsSet,
+                                              size_t _numPins);
+
 // returns NULL if successful, a string pointer with an error message if not.
 const char *Shell_execCommand(const char *_pCommandNameIn,
                               const char *_pArgsIn[], size_t _numArgs)
+{
+  int status = Shell_runCommand(_pCommandNameIn, _pArgsIn, _numArgs, -1);
+  switch (status) {
+  case 0:
+    return NULL;
+  case SHELL_ERROR_SPAWN:
+    return "Command could not be started";
+  case SHELL_ERROR_SIGNAL:
+    return "Command was terminated by a signal";
+  default:
+    return "Command exited with an error";
+  }
+}
+
+int Shell_runCommand(const char *_pCommandPath, const char *_pArgsIn[],
+                     size_t _numArgs, int64_t _timeoutMs)
 {
   // Generate null-terminated array from args with command name
   const char *argsTerminated[_numArgs + 2];
   memcpy(&argsTerminated[1], _pArgsIn, _numArgs * sizeof(_pArgsIn[0]));
-  argsTerminated[0] = _pCommandNameIn;
+  argsTerminated[0] = _pCommandPath;
   argsTerminated[_numArgs + 1] = (const char *)0;
 
-  // Execute command-line program
-  pid_t childPid = fork();
-  const char *error = NULL;
-  if (childPid == 0) {
-    int32_t e = execv(_pCommandNameIn, (char *const *)argsTerminated);
-    if (e == -1) {
-      error = strerror(errno);
-    }
+  posix_spawnattr_t attributes;
+  int error = Shell_initSpawnAttributes(&attributes);
+  if (error != 0) {
+    fprintf(stderr, "Shell: Unable to set up %s: %s\n", _pCommandPath,
+            strerror(error));
+    return SHELL_ERROR_SPAWN;
+  }
+
+  pid_t childPid;
+  error = posix_spawn(&childPid, _pCommandPath, NULL, &attributes,
+                      (char *const *)argsTerminated, environ);
+  posix_spawnattr_destroy(&attributes);
+  if (error != 0) {
+    fprintf(stderr, "Shell: Unable to run %s: %s\n", _pCommandPath,
+            strerror(error));
+    return SHELL_ERROR_SPAWN;
+  }
+
+  return Shell_waitForExit(childPid, _timeoutMs);
+}
+
+// The child starts with no signals blocked and the default action for the
+// stop signals, whatever the calling thread has blocked or ignored, so that a
+// hung command can still be interrupted.
+static int Shell_initSpawnAttributes(posix_spawnattr_t *_pAttributes)
+{
+  int error = posix_spawnattr_init(_pAttributes);
+  if (error != 0) {
+    return error;
   }
 
-  // Wait for command to finish
-  wait(&childPid);
+  sigset_t emptyMask;
+  sigset_t defaultSignals;
+  sigemptyset(&emptyMask);
+  sigemptyset(&defaultSignals);
+  sigaddset(&defaultSignals, SIGINT);
+  sigaddset(&defaultSignals, SIGTERM);
+
+  error = posix_spawnattr_setsigmask(_pAttributes, &emptyMask);
+  if (error == 0) {
+    error = posix_spawnattr_setsigdefault(_pAttributes, &defaultSignals);
+  }
+  if (error == 0) {
+    error = posix_spawnattr_setflags(
+        _pAttributes, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+  }
+  if (error != 0) {
+    posix_spawnattr_destroy(_pAttributes);
+  }
 
   return error;
 }
+
+static int Shell_waitForExit(pid_t _childPid, int64_t _timeoutMs)
+{
+  int64_t deadlineMs = Timing_getMonotonicTimeMs() + _timeoutMs;
+  int status;
+  while (true) {
+    pid_t pid = waitpid(_childPid, &status, _timeoutMs < 0 ? 0 : WNOHANG);
+    if (pid == _childPid) {
+      break;
+    }
+    if (pid < 0 && errno != EINTR) {
+      perror("Shell: Unable to wait for command");
+      return SHELL_ERROR_SPAWN;
+    }
+
+    if (pid == 0 && Timing_getMonotonicTimeMs() >= deadlineMs) {
+      kill(_childPid, SIGKILL);
+      waitpid(_childPid, &status, 0);
+      return SHELL_ERROR_TIMEOUT;
+    }
+    if (pid == 0) {
+      Timing_milliSleep(0, EXIT_POLL_INTERVAL_MS);
+    }
+  }
+
+  if (WIFEXITED(status)) {
+    return WEXITSTATUS(status);
+  }
+
+  return SHELL_ERROR_SIGNAL;
+}
+
+// Pin mode functions
+// ----------------------------------------------------------------------------
+bool Shell_setPinModes(const sShellPinMode *_pPinModes, size_t _numPins)
+{
+  bool isSet[_numPins];
+  bool needsConfigPin = false;
+  for (size_t i = 0; i < _numPins; i++) {
+    if (!Shell_setPinModeThroughPinmux(&_pPinModes[i], &isSet[i])) {
+      needsConfigPin = true;
+    }
+  }
+
+  if (!needsConfigPin) {
+    return true;
+  }
+
+  return Shell_setPinModesThroughConfigPin(_pPinModes, isSet, _numPins);
+}
+
+// Returns false, leaving the pin to config-pin, if the pin has no pinmux
+// state that can be written.
+static bool Shell_setPinModeThroughPinmux(const sShellPinMode *_pPinMode,
+                                          bool *_pIsSetOut)
+{
+  *_pIsSetOut = false;
+
+  char statePath[PATH_BUFFER_SIZE];
+  snprintf(statePath, PATH_BUFFER_SIZE, FILE_PINMUX_PATH "%s" FILE_PINMUX_STATE,
+           _pPinMode->pPin);
+  if (access(statePath, R_OK | W_OK) != 0) {
+    return false;
+  }
+
+  char currentMode[MODE_BUFFER_SIZE] = {0};
+  File_readFromFile(statePath, currentMode, MODE_BUFFER_SIZE);
+  currentMode[strcspn(currentMode, "\n")] = '\0';
+  if (strcmp(currentMode, _pPinMode->pMode) != 0) {
+    File_writeToFile(statePath, _pPinMode->pMode);
+  }
+
+  *_pIsSetOut = true;
+  return true;
+}
+
+// Sets the pins not set yet with a single config-pin invocation, through a
+// temporary file that lists one pin and mode per line.
+static bool Shell_setPinModesThroughConfigPin(const sShellPinMode *_pPinModes,
+                                              const bool *_pIsSet,
+                                              size_t _numPins)
+{
+  char configPath[] = "/tmp/recyclerPinsXXXXXX";
+  int configFd = mkstemp(configPath);
+  if (configFd < 0) {
+    perror("Shell: Unable to create pin configuration file");
+    return false;
+  }
+
+  for (size_t i = 0; i < _numPins; i++) {
+    if (!_pIsSet[i]) {
+      dprintf(configFd, "%s %s\n", _pPinModes[i].pPin, _pPinModes[i].pMode);
+    }
+  }
+  close(configFd);
+
+  const char *args[] = {"-f", configPath};
+  int status = Shell_runCommand(CONFIG_PIN_PATH, args,
+                                sizeof(args) / sizeof(args[0]),
+                                CONFIG_PIN_TIMEOUT_MS);
+  unlink(configPath);
+  if (status != 0) {
+    fprintf(stderr, "Shell: config-pin failed with status %d\n", status);
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,947 @@
+/*
+ * The sorter module keeps a table with, for every state, the lights and sensor
+ * frame mode it runs with, its handlers, and its deadline. Handlers request
+ * transitions, which the event loop carries out once the handler returns.
+ * Timers of the state being left are disarmed on every transition.
+ */
+
+#include "../include/sorter.h"
+#include "../include/lights.h"
+#include "../include/realtime.h"
+#include "../include/timing.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#define MAX_EPOLL_EVENTS 8
+#define CONTROL_BUFFER_LEN 128
+
+// Time given to the early color reading before speculation is given up on
+static const int64_t SPECULATION_TIMEOUT_MS = 500;
+
+// State definitions
+// ----------------------------------------------------------------------------
+typedef struct {
+  const char *name;
+  void (*setLights)(void);
+  eClassifierModule_FrameMode frameMode;
+  // Called on entering the state
+  void (*onEnter)(sSorter *_pSorter);
+  // Called when the timer set with Sorter_wakeAfterMs() expires. May be NULL.
+  void (*onWake)(sSorter *_pSorter);
+  // Called whenever an actuator command completes. May be NULL.
+  void (*onActuatorCompletion)(sSorter *_pSorter);
+  // Returns the time the state may last from entry. NULL if unlimited.
+  int64_t (*getDeadlineMs)(sSorter *_pSorter);
+  // Called when the deadline expires, before moving to timeoutState. May be
+  // NULL.
+  void (*onTimeout)(sSorter *_pSorter);
+  eSorterState timeoutState;
+} sSorterState;
+
+// State handler declarations
+// ----------------------------------------------------------------------------
+static void Sorter_enterDetecting(sSorter *_pSorter);
+static void Sorter_wakeDetecting(sSorter *_pSorter);
+
+static void Sorter_enterSpeculating(sSorter *_pSorter);
+static void Sorter_wakeSpeculating(sSorter *_pSorter);
+static int64_t Sorter_getSpeculationDeadlineMs(sSorter *_pSorter);
+
+static void Sorter_enterSettling(sSorter *_pSorter);
+static void Sorter_wakeSettling(sSorter *_pSorter);
+static int64_t Sorter_getSettleDeadlineMs(sSorter *_pSorter);
+static void Sorter_timeOutSettling(sSorter *_pSorter);
+
+static void Sorter_enterCategorizing(sSorter *_pSorter);
+static void Sorter_wakeCategorizing(sSorter *_pSorter);
+
+static void Sorter_enterSorting(sSorter *_pSorter);
+static void Sorter_wakeSorting(sSorter *_pSorter);
+
+static void Sorter_enterDisposing(sSorter *_pSorter);
+static void Sorter_wakeDisposing(sSorter *_pSorter);
+
+static void Sorter_enterDeparting(sSorter *_pSorter);
+static void Sorter_wakeDeparting(sSorter *_pSorter);
+static int64_t Sorter_getDepartureDeadlineMs(sSorter *_pSorter);
+static void Sorter_timeOutDeparting(sSorter *_pSorter);
+
+static void Sorter_enterJammed(sSorter *_pSorter);
+static void Sorter_wakeJammed(sSorter *_pSorter);
+
+static void Sorter_enterReturning(sSorter *_pSorter);
+static void Sorter_wakeReturning(sSorter *_pSorter);
+
+// State table
+// ----------------------------------------------------------------------------
+static const sSorterState m_states[SORTER_NUM_STATES] = {
+    [SORTER_STATE_DETECTING] = {"detecting", &Lights_setIdle,
+                                CLASSIFIER_MODULE_FRAMES_FULL,
+                                &Sorter_enterDetecting, &Sorter_wakeDetecting,
+                                NULL, NULL, NULL, SORTER_STATE_DETECTING},
+    [SORTER_STATE_SPECULATING] =
+        {"speculating", &Lights_setIdle, CLASSIFIER_MODULE_FRAMES_SHORT,
+         &Sorter_enterSpeculating, &Sorter_wakeSpeculating,
+         &Sorter_wakeSpeculating, &Sorter_getSpeculationDeadlineMs, NULL,
+         SORTER_STATE_SETTLING},
+    [SORTER_STATE_SETTLING] =
+        {"settling", &Lights_setIdle, CLASSIFIER_MODULE_FRAMES_SHORT,
+         &Sorter_enterSettling, &Sorter_wakeSettling, NULL,
+         &Sorter_getSettleDeadlineMs, &Sorter_timeOutSettling,
+         SORTER_STATE_CATEGORIZING},
+    [SORTER_STATE_CATEGORIZING] =
+        {"categorizing", &Lights_setRecycling, CLASSIFIER_MODULE_FRAMES_FULL,
+         &Sorter_enterCategorizing, &Sorter_wakeCategorizing, NULL, NULL,
+         NULL, SORTER_STATE_CATEGORIZING},
+    [SORTER_STATE_SORTING] = {"sorting", &Lights_setRecycling,
+                              CLASSIFIER_MODULE_FRAMES_FULL,
+                              &Sorter_enterSorting, &Sorter_wakeSorting,
+                              &Sorter_wakeSorting, NULL, NULL,
+                              SORTER_STATE_SORTING},
+    [SORTER_STATE_DISPOSING] = {"disposing", &Lights_setRecycled,
+                                CLASSIFIER_MODULE_FRAMES_SHORT,
+                                &Sorter_enterDisposing, &Sorter_wakeDisposing,
+                                &Sorter_wakeDisposing, NULL, NULL,
+                                SORTER_STATE_DISPOSING},
+    [SORTER_STATE_DEPARTING] =
+        {"departing", &Lights_setRecycled, CLASSIFIER_MODULE_FRAMES_SHORT,
+         &Sorter_enterDeparting, &Sorter_wakeDeparting, NULL,
+         &Sorter_getDepartureDeadlineMs, &Sorter_timeOutDeparting,
+         SORTER_STATE_JAMMED},
+    [SORTER_STATE_JAMMED] = {"jammed", &Lights_setAlarm,
+                             CLASSIFIER_MODULE_FRAMES_SHORT,
+                             &Sorter_enterJammed, &Sorter_wakeJammed, NULL,
+                             NULL, NULL, SORTER_STATE_JAMMED},
+    [SORTER_STATE_RETURNING] = {"returning", &Lights_setReturning,
+                                CLASSIFIER_MODULE_FRAMES_SHORT,
+                                &Sorter_enterReturning, &Sorter_wakeReturning,
+                                &Sorter_wakeReturning, NULL, NULL,
+                                SORTER_STATE_RETURNING},
+};
+
+// Function prototype declarations
+// ----------------------------------------------------------------------------
+static void Sorter_addToEpoll(sSorter *_pSorter, int _fd);
+static void Sorter_armTimer(int _timerFd, int64_t _delayMs,
+                            int64_t *_pExpiryTimeNsOut);
+static void Sorter_disarmTimer(int _timerFd);
+static bool Sorter_readTimer(int _timerFd);
+static void Sorter_wakeAfterMs(sSorter *_pSorter, int64_t _delayMs);
+static void Sorter_wakeOnNextFrame(sSorter *_pSorter);
+static void Sorter_setFrameMode(sSorter *_pSorter,
+                                eClassifierModule_FrameMode _frameMode);
+static uint32_t Sorter_getNumAmbientRecalibrations(const sSorter *_pSorter);
+
+static void Sorter_transition(sSorter *_pSorter, eSorterState _nextState);
+static void Sorter_performTransitions(sSorter *_pSorter);
+static void Sorter_handleEvent(sSorter *_pSorter, int _fd);
+static void Sorter_handleStop(sSorter *_pSorter);
+static void Sorter_handleControl(sSorter *_pSorter);
+static void Sorter_handleCommand(sSorter *_pSorter, const char *_pCommand);
+
+static eGateConfig
+Sorter_getGateConfigForItemType(eClassifierModule_RefuseItemType _itemType);
+static void Sorter_releaseItem(sSorter *_pSorter);
+static void Sorter_printf(const sSorter *_pSorter, const char *_pFormat, ...);
+static void Sorter_printError(const sSorter *_pSorter, const char *_pFormat,
+                              ...);
+static void Sorter_vprintf(const sSorter *_pSorter, FILE *_pStream,
+                           const char *_pFormat, va_list _args);
+
+// Initialization/Termination functions
+// ----------------------------------------------------------------------------
+void Sorter_init(sSorter *_pSorter, const sSorterConfig *_pConfig)
+{
+  snprintf(_pSorter->name, SORTER_NAME_LEN, "%s",
+           _pConfig->pName != NULL ? _pConfig->pName : "");
+  _pSorter->pClassifier = _pConfig->modules.pClassifier;
+  _pSorter->pActuator = _pConfig->modules.pActuator;
+  _pSorter->pGates = _pConfig->modules.pGates;
+  _pSorter->pPipe = _pConfig->modules.pPipe;
+  _pSorter->pInterlock = _pConfig->modules.pInterlock;
+  _pSorter->pSpeculator = _pConfig->modules.pSpeculator;
+  _pSorter->pParkingPolicy = _pConfig->modules.pParkingPolicy;
+  _pSorter->pAutoTuner = _pConfig->modules.pAutoTuner;
+  _pSorter->isSpeculationEnabled = _pConfig->isSpeculationEnabled;
+  _pSorter->hasLights = _pConfig->hasLights;
+  _pSorter->isRecalibrationRequested = false;
+  _pSorter->numItemsSorted = 0;
+  _pSorter->numJams = 0;
+  _pSorter->numDetectionReads = 0;
+  _pSorter->detectingMs = 0;
+  _pSorter->numDetectionBursts = 0;
+  _pSorter->numQuietBursts = 0;
+  _pSorter->burstToArrivalMs = 0;
+
+  _pSorter->stopFd = eventfd(0, EFD_NONBLOCK);
+  _pSorter->wakeTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+  _pSorter->deadlineTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+  if (_pSorter->stopFd < 0 || _pSorter->wakeTimerFd < 0 ||
+      _pSorter->deadlineTimerFd < 0) {
+    perror("Sorter: Unable to create event file descriptors");
+    exit(EXIT_FAILURE);
+  }
+
+  // Opening the FIFO for writing too keeps it from reporting end-of-file
+  // whenever a writer closes it
+  snprintf(_pSorter->controlFifoPath, SORTER_PATH_LEN, "%s",
+           _pConfig->pControlFifoPath);
+  if (mkfifo(_pSorter->controlFifoPath, 0660) != 0 && errno != EEXIST) {
+    perror("Sorter: Unable to create control FIFO");
+    exit(EXIT_FAILURE);
+  }
+  _pSorter->controlFd = open(_pSorter->controlFifoPath, O_RDWR | O_NONBLOCK);
+  if (_pSorter->controlFd < 0) {
+    perror("Sorter: Unable to open control FIFO");
+    exit(EXIT_FAILURE);
+  }
+
+  _pSorter->epollFd = epoll_create1(0);
+  if (_pSorter->epollFd < 0) {
+    perror("Sorter: Unable to create epoll instance");
+    exit(EXIT_FAILURE);
+  }
+  Sorter_addToEpoll(_pSorter, _pSorter->stopFd);
+  Sorter_addToEpoll(_pSorter, _pSorter->wakeTimerFd);
+  Sorter_addToEpoll(_pSorter, _pSorter->deadlineTimerFd);
+  Sorter_addToEpoll(_pSorter, _pSorter->controlFd);
+  Sorter_addToEpoll(_pSorter,
+                    Actuator_getCompletionFd(_pSorter->pActuator));
+}
+
+void Sorter_cleanup(sSorter *_pSorter)
+{
+  close(_pSorter->epollFd);
+  close(_pSorter->controlFd);
+  close(_pSorter->deadlineTimerFd);
+  close(_pSorter->wakeTimerFd);
+  close(_pSorter->stopFd);
+  unlink(_pSorter->controlFifoPath);
+}
+
+// Behaviour functions
+// ----------------------------------------------------------------------------
+void Sorter_run(sSorter *_pSorter)
+{
+  _pSorter->isRunning = true;
+  _pSorter->frameMode = CLASSIFIER_MODULE_FRAMES_FULL;
+  _pSorter->pSetLights = NULL;
+  Sorter_transition(_pSorter, SORTER_STATE_DETECTING);
+  Sorter_performTransitions(_pSorter);
+
+  while (_pSorter->isRunning) {
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    int numEvents =
+        epoll_wait(_pSorter->epollFd, events, MAX_EPOLL_EVENTS, -1);
+    if (numEvents < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("Sorter: Unable to wait for events");
+      exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < numEvents && _pSorter->isRunning; i++) {
+      Sorter_handleEvent(_pSorter, events[i].data.fd);
+      Sorter_performTransitions(_pSorter);
+    }
+  }
+}
+
+void Sorter_stop(sSorter *_pSorter)
+{
+  uint64_t stop = 1;
+  write(_pSorter->stopFd, &stop, sizeof(stop));
+}
+
+void Sorter_printStats(const sSorter *_pSorter)
+{
+  Sorter_printf(_pSorter, "%u items sorted, %u jams detected.\n",
+                _pSorter->numItemsSorted, _pSorter->numJams);
+
+  int64_t detectingMs = _pSorter->detectingMs;
+  if (_pSorter->state == SORTER_STATE_DETECTING) {
+    detectingMs +=
+        Timing_getMonotonicTimeMs() - _pSorter->detectingStartTimeMs;
+  }
+  uint32_t numArrivals =
+      _pSorter->numDetectionBursts - _pSorter->numQuietBursts;
+  Sorter_printf(_pSorter,
+                "%llu detection frames read in %lld s idle, %u bursts (%u "
+                "without an item), %lld ms from burst to arrival on "
+                "average.\n",
+                (unsigned long long)_pSorter->numDetectionReads,
+                (long long)(detectingMs / 1000), _pSorter->numDetectionBursts,
+                _pSorter->numQuietBursts,
+                (long long)(numArrivals > 0
+                                ? _pSorter->burstToArrivalMs / numArrivals
+                                : 0));
+}
+
+// Event loop functions
+// ----------------------------------------------------------------------------
+static void Sorter_addToEpoll(sSorter *_pSorter, int _fd)
+{
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.fd = _fd;
+  if (epoll_ctl(_pSorter->epollFd, EPOLL_CTL_ADD, _fd, &event) != 0) {
+    perror("Sorter: Unable to add file descriptor to epoll instance");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void Sorter_armTimer(int _timerFd, int64_t _delayMs,
+                            int64_t *_pExpiryTimeNsOut)
+{
+  // An all-zero expiry would disarm the timer instead
+  struct itimerspec spec;
+  memset(&spec, 0, sizeof(spec));
+  if (_delayMs > 0) {
+    spec.it_value.tv_sec = _delayMs / 1000;
+    spec.it_value.tv_nsec = (_delayMs % 1000) * 1000000;
+  }
+  else {
+    spec.it_value.tv_nsec = 1;
+  }
+  *_pExpiryTimeNsOut = Timing_getMonotonicTimeNs() +
+                       spec.it_value.tv_sec * 1000000000LL +
+                       spec.it_value.tv_nsec;
+  timerfd_settime(_timerFd, 0, &spec, NULL);
+}
+
+static void Sorter_disarmTimer(int _timerFd)
+{
+  struct itimerspec spec;
+  memset(&spec, 0, sizeof(spec));
+  timerfd_settime(_timerFd, 0, &spec, NULL);
+}
+
+// Returns false if the timer was disarmed after it became readable
+static bool Sorter_readTimer(int _timerFd)
+{
+  uint64_t expirations;
+  return read(_timerFd, &expirations, sizeof(expirations)) ==
+         sizeof(expirations);
+}
+
+static void Sorter_wakeAfterMs(sSorter *_pSorter, int64_t _delayMs)
+{
+  Sorter_armTimer(_pSorter->wakeTimerFd, _delayMs,
+                  &_pSorter->wakeExpiryTimeNs);
+}
+
+static void Sorter_wakeOnNextFrame(sSorter *_pSorter)
+{
+  Sorter_wakeAfterMs(
+      _pSorter, ClassifierModule_getMsUntilNextFrame(_pSorter->pClassifier));
+}
+
+// Restarts integration unless the sensor already runs with _frameMode
+static void Sorter_setFrameMode(sSorter *_pSorter,
+                                eClassifierModule_FrameMode _frameMode)
+{
+  if (_frameMode != _pSorter->frameMode) {
+    _pSorter->frameMode = _frameMode;
+    ClassifierModule_setFrameMode(_pSorter->pClassifier, _frameMode);
+  }
+}
+
+static uint32_t Sorter_getNumAmbientRecalibrations(const sSorter *_pSorter)
+{
+  sAmbientMonitorStats stats =
+      ClassifierModule_getAmbientStats(_pSorter->pClassifier);
+  return stats.numShiftRecalibrations + stats.numBurstRecalibrations;
+}
+
+static void Sorter_transition(sSorter *_pSorter, eSorterState _nextState)
+{
+  _pSorter->nextState = _nextState;
+  _pSorter->isTransitionPending = true;
+}
+
+static void Sorter_performTransitions(sSorter *_pSorter)
+{
+  while (_pSorter->isTransitionPending && _pSorter->isRunning) {
+    _pSorter->isTransitionPending = false;
+    _pSorter->state = _pSorter->nextState;
+    const sSorterState *state = &m_states[_pSorter->state];
+
+    Sorter_disarmTimer(_pSorter->wakeTimerFd);
+    if (state->getDeadlineMs != NULL) {
+      Sorter_armTimer(_pSorter->deadlineTimerFd,
+                      state->getDeadlineMs(_pSorter),
+                      &_pSorter->deadlineExpiryTimeNs);
+    }
+    else {
+      Sorter_disarmTimer(_pSorter->deadlineTimerFd);
+    }
+
+    Sorter_setFrameMode(_pSorter, state->frameMode);
+    if (_pSorter->hasLights && state->setLights != _pSorter->pSetLights) {
+      _pSorter->pSetLights = state->setLights;
+      _pSorter->pSetLights();
+    }
+
+    state->onEnter(_pSorter);
+  }
+}
+
+static void Sorter_handleEvent(sSorter *_pSorter, int _fd)
+{
+  const sSorterState *state = &m_states[_pSorter->state];
+
+  if (_fd == _pSorter->wakeTimerFd) {
+    if (Sorter_readTimer(_pSorter->wakeTimerFd)) {
+      Realtime_recordWakeup(REALTIME_THREAD_SORTER,
+                            _pSorter->wakeExpiryTimeNs);
+      if (state->onWake != NULL) {
+        state->onWake(_pSorter);
+      }
+    }
+  }
+  else if (_fd == _pSorter->deadlineTimerFd) {
+    if (Sorter_readTimer(_pSorter->deadlineTimerFd)) {
+      Realtime_recordWakeup(REALTIME_THREAD_SORTER,
+                            _pSorter->deadlineExpiryTimeNs);
+      if (state->onTimeout != NULL) {
+        state->onTimeout(_pSorter);
+      }
+      Sorter_transition(_pSorter, state->timeoutState);
+    }
+  }
+  else if (_fd == Actuator_getCompletionFd(_pSorter->pActuator)) {
+    uint64_t completions;
+    read(_fd, &completions, sizeof(completions));
+    if (state->onActuatorCompletion != NULL) {
+      state->onActuatorCompletion(_pSorter);
+    }
+  }
+  else if (_fd == _pSorter->stopFd) {
+    Sorter_handleStop(_pSorter);
+  }
+  else if (_fd == _pSorter->controlFd) {
+    Sorter_handleControl(_pSorter);
+  }
+}
+
+static void Sorter_handleStop(sSorter *_pSorter)
+{
+  uint64_t stops;
+  if (read(_pSorter->stopFd, &stops, sizeof(stops)) == sizeof(stops)) {
+    _pSorter->isRunning = false;
+  }
+}
+
+// Commands are expected to be written whole, one per line, as echo does
+static void Sorter_handleControl(sSorter *_pSorter)
+{
+  char buffer[CONTROL_BUFFER_LEN];
+  ssize_t numRead =
+      read(_pSorter->controlFd, buffer, CONTROL_BUFFER_LEN - 1);
+  if (numRead <= 0) {
+    return;
+  }
+  buffer[numRead] = '\0';
+
+  char *savePtr;
+  char *command = strtok_r(buffer, "\r\n", &savePtr);
+  while (command != NULL) {
+    Sorter_handleCommand(_pSorter, command);
+    command = strtok_r(NULL, "\r\n", &savePtr);
+  }
+}
+
+static void Sorter_handleCommand(sSorter *_pSorter, const char *_pCommand)
+{
+  if (strcmp(_pCommand, "quit") == 0) {
+    _pSorter->isRunning = false;
+  }
+  else if (strcmp(_pCommand, "recalibrate") == 0) {
+    // Only an empty ramp can be calibrated against
+    if (_pSorter->state == SORTER_STATE_DETECTING) {
+      Sorter_printf(_pSorter, "Recalibrating.\n");
+      ClassifierModule_recalibrate(_pSorter->pClassifier);
+    }
+    else {
+      Sorter_printf(_pSorter, "Recalibrating once the ramp is idle.\n");
+      _pSorter->isRecalibrationRequested = true;
+    }
+  }
+  else if (strcmp(_pCommand, "whitebalance") == 0) {
+    // The white reference would be sorted as an item by a busy sorter
+    if (_pSorter->state != SORTER_STATE_DETECTING) {
+      Sorter_printf(_pSorter, "White balance needs an idle sorter.\n");
+    }
+    else if (ClassifierModule_calibrateWhiteBalance(_pSorter->pClassifier)) {
+      Sorter_printf(_pSorter, "White balance calibrated.\n");
+    }
+    else {
+      Sorter_printf(_pSorter, "White reference too dark to calibrate.\n");
+    }
+  }
+  else if (strcmp(_pCommand, "clear") == 0) {
+    if (_pSorter->state == SORTER_STATE_JAMMED) {
+      Sorter_printf(_pSorter, "Jam cleared by hand.\n");
+      Sorter_releaseItem(_pSorter);
+      Sorter_transition(_pSorter, SORTER_STATE_RETURNING);
+    }
+    else {
+      Sorter_printf(_pSorter, "Nothing is jammed.\n");
+    }
+  }
+  else if (strcmp(_pCommand, "status") == 0) {
+    Sorter_printf(_pSorter, "Sorter is %s.\n",
+                  m_states[_pSorter->state].name);
+    Sorter_printStats(_pSorter);
+  }
+  else {
+    Sorter_printf(_pSorter, "Unknown control command '%s'.\n", _pCommand);
+  }
+}
+
+// Detecting state
+// ----------------------------------------------------------------------------
+// Full-integration frames are read one at a time while the ramp is quiet. Once
+// the luminance moves toward the threshold, short frames are read as fast as
+// they are integrated, until the arrival is confirmed or the ramp is quiet
+// again. The first read takes the frame left from the previous state.
+static void Sorter_enterDetecting(sSorter *_pSorter)
+{
+  Sorter_printf(_pSorter, "\nEntering idle stage.\n");
+
+  if (_pSorter->isRecalibrationRequested) {
+    _pSorter->isRecalibrationRequested = false;
+    Sorter_printf(_pSorter, "Recalibrating.\n");
+    ClassifierModule_recalibrate(_pSorter->pClassifier);
+  }
+
+  _pSorter->arrivalTracker = (sClassifierModule_ArrivalTracker){0};
+  _pSorter->detectingStartTimeMs = Timing_getMonotonicTimeMs();
+  Sorter_wakeAfterMs(_pSorter, 0);
+}
+
+static void Sorter_wakeDetecting(sSorter *_pSorter)
+{
+  _pSorter->numDetectionReads++;
+  uint32_t numRecalibrations = Sorter_getNumAmbientRecalibrations(_pSorter);
+  eClassifierModule_RampActivity activity = ClassifierModule_trackArrival(
+      _pSorter->pClassifier, &_pSorter->arrivalTracker);
+  if (Sorter_getNumAmbientRecalibrations(_pSorter) != numRecalibrations) {
+    Sorter_printf(_pSorter,
+                  "Ambient light changed, recalibrated object detection.\n");
+  }
+  if (activity != CLASSIFIER_MODULE_RAMP_ARRIVED) {
+    eClassifierModule_FrameMode frameMode =
+        activity == CLASSIFIER_MODULE_RAMP_ACTIVE
+            ? CLASSIFIER_MODULE_FRAMES_SHORT
+            : CLASSIFIER_MODULE_FRAMES_FULL;
+    if (frameMode != _pSorter->frameMode) {
+      if (frameMode == CLASSIFIER_MODULE_FRAMES_SHORT) {
+        _pSorter->numDetectionBursts++;
+        _pSorter->burstStartTimeMs = Timing_getMonotonicTimeMs();
+      }
+      else {
+        _pSorter->numQuietBursts++;
+      }
+      Sorter_setFrameMode(_pSorter, frameMode);
+    }
+
+    Sorter_wakeOnNextFrame(_pSorter);
+    return;
+  }
+
+  Sorter_printf(_pSorter, "Object detected!\n");
+  _pSorter->detectedTimeMs = Timing_getMonotonicTimeMs();
+  _pSorter->detectingMs +=
+      _pSorter->detectedTimeMs - _pSorter->detectingStartTimeMs;
+  _pSorter->burstToArrivalMs +=
+      _pSorter->detectedTimeMs - _pSorter->burstStartTimeMs;
+  Sorter_transition(_pSorter, _pSorter->isSpeculationEnabled
+                                  ? SORTER_STATE_SPECULATING
+                                  : SORTER_STATE_SETTLING);
+}
+
+// Speculating state
+// ----------------------------------------------------------------------------
+// Pre-positions the gates from a short-integration reading while the object
+// settles and the full-integration frame is integrated.
+static void Sorter_enterSpeculating(sSorter *_pSorter)
+{
+  _pSorter->hasPreliminaryReading = false;
+  Sorter_wakeAfterMs(_pSorter,
+                     ClassifierModule_getMsUntilFrame(_pSorter->pClassifier));
+}
+
+static void Sorter_wakeSpeculating(sSorter *_pSorter)
+{
+  if (!_pSorter->hasPreliminaryReading) {
+    if (ClassifierModule_getMsUntilFrame(_pSorter->pClassifier) > 0) {
+      return;
+    }
+
+    eClassifierModule_RefuseItemType preliminaryType =
+        ClassifierModule_getCurrentRefuseItemType(
+            _pSorter->pClassifier, &_pSorter->preliminaryConfidencePercent);
+    _pSorter->preliminaryConfig =
+        Sorter_getGateConfigForItemType(preliminaryType);
+    _pSorter->hasPreliminaryReading = true;
+  }
+
+  // The previous item may still be falling past the gates
+  if (!Gate_isConfigurationCommanded(_pSorter->pGates,
+                                     _pSorter->preliminaryConfig) &&
+      !Interlock_canMoveGates(_pSorter->pInterlock)) {
+    Sorter_wakeAfterMs(_pSorter,
+                       Interlock_getMsUntilGatesMayMove(_pSorter->pInterlock));
+    return;
+  }
+
+  if (Speculator_speculate(_pSorter->pSpeculator, _pSorter->preliminaryConfig,
+                           _pSorter->preliminaryConfidencePercent)) {
+    Sorter_printf(_pSorter,
+                  "Pre-positioning gates for configuration %d (%u%% "
+                  "confident).\n",
+                  _pSorter->preliminaryConfig,
+                  _pSorter->preliminaryConfidencePercent);
+  }
+  Sorter_transition(_pSorter, SORTER_STATE_SETTLING);
+}
+
+static int64_t Sorter_getSpeculationDeadlineMs(sSorter *_pSorter)
+{
+  return SPECULATION_TIMEOUT_MS;
+}
+
+// Settling state
+// ----------------------------------------------------------------------------
+// Waits until the ball is in place to get a better color reading, watching how
+// long it actually takes to come to rest. Leaving the state restarts full
+// integration, so the classifying frame is integrated entirely at rest.
+static void Sorter_enterSettling(sSorter *_pSorter)
+{
+  _pSorter->restTracker = (sClassifierModule_RestTracker){0};
+  _pSorter->settledAfterMs = -1;
+  Sorter_wakeOnNextFrame(_pSorter);
+}
+
+static void Sorter_wakeSettling(sSorter *_pSorter)
+{
+  // Only the last time the item came to rest counts, in case it bounced
+  if (!ClassifierModule_isRefuseItemAtRest(_pSorter->pClassifier,
+                                           &_pSorter->restTracker)) {
+    _pSorter->settledAfterMs = -1;
+  }
+  else if (_pSorter->settledAfterMs < 0) {
+    _pSorter->settledAfterMs =
+        Timing_getMonotonicTimeMs() - _pSorter->detectedTimeMs;
+  }
+
+  Sorter_wakeOnNextFrame(_pSorter);
+}
+
+static int64_t Sorter_getSettleDeadlineMs(sSorter *_pSorter)
+{
+  return AutoTuner_getDelayMs(_pSorter->pAutoTuner,
+                              AUTO_TUNER_ARRIVAL_SETTLE) -
+         (Timing_getMonotonicTimeMs() - _pSorter->detectedTimeMs);
+}
+
+static void Sorter_timeOutSettling(sSorter *_pSorter)
+{
+  if (_pSorter->settledAfterMs >= 0) {
+    AutoTuner_recordObservation(_pSorter->pAutoTuner,
+                                AUTO_TUNER_ARRIVAL_SETTLE,
+                                _pSorter->settledAfterMs);
+  }
+  else {
+    Sorter_printf(_pSorter, "Object still moving after %lld ms.\n",
+                  (long long)AutoTuner_getDelayMs(_pSorter->pAutoTuner,
+                                                  AUTO_TUNER_ARRIVAL_SETTLE));
+    AutoTuner_recordFailure(_pSorter->pAutoTuner, AUTO_TUNER_ARRIVAL_SETTLE);
+  }
+}
+
+// Categorizing state
+// ----------------------------------------------------------------------------
+static void Sorter_enterCategorizing(sSorter *_pSorter)
+{
+  Sorter_printf(_pSorter, "\nEntering sorting stage.\n");
+  Sorter_wakeAfterMs(_pSorter,
+                     ClassifierModule_getMsUntilFrame(_pSorter->pClassifier));
+}
+
+static void Sorter_wakeCategorizing(sSorter *_pSorter)
+{
+  _pSorter->itemType =
+      ClassifierModule_getRefuseItemType(_pSorter->pClassifier);
+
+  char *objectTypeStr;
+  switch (_pSorter->itemType) {
+  case CLASSIFIER_MODULE_GARBAGE:
+    objectTypeStr = "garbage";
+    break;
+  case CLASSIFIER_MODULE_COMPOST:
+    objectTypeStr = "compost";
+    break;
+  case CLASSIFIER_MODULE_RECYCLING:
+    objectTypeStr = "recycling";
+    break;
+  default:
+    objectTypeStr = "unknown";
+  }
+
+  Sorter_printf(_pSorter, "Object of type %s detected.\n", objectTypeStr);
+  Sorter_transition(_pSorter, SORTER_STATE_SORTING);
+}
+
+// Sorting state
+// ----------------------------------------------------------------------------
+static void Sorter_enterSorting(sSorter *_pSorter)
+{
+  Sorter_printf(_pSorter, "\nEntering sorting stage\n");
+
+  _pSorter->gateConfig = Sorter_getGateConfigForItemType(_pSorter->itemType);
+  switch (_pSorter->gateConfig) {
+  case GATE_CONFIG_COMPOST:
+    Sorter_printf(_pSorter, "Compost, lowering gate %d and raising gate %d.\n",
+                  gate1, gate2);
+    break;
+  case GATE_CONFIG_RECYCLING:
+    Sorter_printf(_pSorter, "Recycling, lowering gate %d and %d.\n", gate1,
+                  gate2);
+    break;
+  case GATE_CONFIG_GARBAGE:
+    Sorter_printf(_pSorter, "Garbage, raising gate %d and %d.\n", gate1,
+                  gate2);
+    break;
+  }
+
+  // Confirm or correct the gates pre-positioned from the early reading
+  Speculator_resolve(_pSorter->pSpeculator, _pSorter->gateConfig);
+  ParkingPolicy_recordItem(_pSorter->pParkingPolicy, _pSorter->gateConfig);
+
+  // Gates are left in place between items, so a run of items going to the
+  // same bin does not move the gates at all
+  if (Gate_isConfigurationCommanded(_pSorter->pGates, _pSorter->gateConfig)) {
+    Sorter_printf(_pSorter, "Gates already in place.\n");
+  }
+
+  Sorter_wakeSorting(_pSorter);
+}
+
+static void Sorter_wakeSorting(sSorter *_pSorter)
+{
+  // The previous item may still be falling past the gates
+  if (!Gate_isConfigurationCommanded(_pSorter->pGates,
+                                     _pSorter->gateConfig) &&
+      !Interlock_canMoveGates(_pSorter->pInterlock)) {
+    Sorter_wakeAfterMs(_pSorter,
+                       Interlock_getMsUntilGatesMayMove(_pSorter->pInterlock));
+    return;
+  }
+
+  // Both gates travel in parallel, and the disposing state waits for them
+  Gate_setConfiguration(_pSorter->pGates, _pSorter->gateConfig);
+  Sorter_transition(_pSorter, SORTER_STATE_DISPOSING);
+}
+
+// Disposing state
+// ----------------------------------------------------------------------------
+static void Sorter_enterDisposing(sSorter *_pSorter)
+{
+  Sorter_printf(_pSorter, "\nEntering disposal stage.\n");
+  Sorter_wakeDisposing(_pSorter);
+}
+
+// The pipe must be back at rest and the gates in place before dropping. Their
+// travel completing wakes this state through the actuator.
+static void Sorter_wakeDisposing(sSorter *_pSorter)
+{
+  if (!Interlock_canDrop(_pSorter->pInterlock, _pSorter->gateConfig)) {
+    if (!Interlock_canMoveGates(_pSorter->pInterlock)) {
+      Sorter_wakeAfterMs(_pSorter,
+                       Interlock_getMsUntilGatesMayMove(_pSorter->pInterlock));
+    }
+    return;
+  }
+
+  Sorter_printf(_pSorter, "Rotating pipe to drop the object.\n");
+  Pipe_rotatePipeToDropBall(_pSorter->pPipe);
+  _pSorter->dropTimeMs = Timing_getMonotonicTimeMs();
+  Sorter_transition(_pSorter, SORTER_STATE_DEPARTING);
+}
+
+// Departing state
+// ----------------------------------------------------------------------------
+// Watches the sensor until the object is verifiably gone, rather than assuming
+// it left after a fixed time.
+static void Sorter_enterDeparting(sSorter *_pSorter)
+{
+  _pSorter->departureTracker = (sClassifierModule_DepartureTracker){0};
+  Sorter_wakeOnNextFrame(_pSorter);
+}
+
+static void Sorter_wakeDeparting(sSorter *_pSorter)
+{
+  if (ClassifierModule_hasRefuseItemLeft(_pSorter->pClassifier,
+                                         &_pSorter->departureTracker)) {
+    AutoTuner_recordObservation(
+        _pSorter->pAutoTuner, AUTO_TUNER_DEPARTURE_TIMEOUT,
+        Timing_getMonotonicTimeMs() - _pSorter->dropTimeMs);
+    Sorter_releaseItem(_pSorter);
+    Sorter_transition(_pSorter, SORTER_STATE_RETURNING);
+    return;
+  }
+
+  Sorter_wakeOnNextFrame(_pSorter);
+}
+
+static int64_t Sorter_getDepartureDeadlineMs(sSorter *_pSorter)
+{
+  return AutoTuner_getDelayMs(_pSorter->pAutoTuner,
+                              AUTO_TUNER_DEPARTURE_TIMEOUT);
+}
+
+static void Sorter_timeOutDeparting(sSorter *_pSorter)
+{
+  _pSorter->numJams++;
+  Sorter_printError(_pSorter, "Object jammed in the pipe! Waiting for it to "
+                              "be cleared.\n");
+
+  // The timeout may have been too tight
+  AutoTuner_recordFailure(_pSorter->pAutoTuner, AUTO_TUNER_DEPARTURE_TIMEOUT);
+}
+
+// Jammed state
+// ----------------------------------------------------------------------------
+static void Sorter_enterJammed(sSorter *_pSorter)
+{
+  _pSorter->departureTracker = (sClassifierModule_DepartureTracker){0};
+  Sorter_wakeOnNextFrame(_pSorter);
+}
+
+static void Sorter_wakeJammed(sSorter *_pSorter)
+{
+  if (ClassifierModule_hasRefuseItemLeft(_pSorter->pClassifier,
+                                         &_pSorter->departureTracker)) {
+    Sorter_printf(_pSorter, "Jam cleared.\n");
+    Sorter_releaseItem(_pSorter);
+    Sorter_transition(_pSorter, SORTER_STATE_RETURNING);
+    return;
+  }
+
+  Sorter_wakeOnNextFrame(_pSorter);
+}
+
+// Returning state
+// ----------------------------------------------------------------------------
+// The pipe keeps returning while the next item is detected and classified.
+// Meanwhile, the gates wait in the configuration the next item is most likely
+// to need.
+static void Sorter_enterReturning(sSorter *_pSorter)
+{
+  Sorter_printf(_pSorter, "\nEntering return stage.\n");
+
+  Sorter_printf(_pSorter, "Rotating the pipe to original position.\n");
+  Pipe_resetPipePosition(_pSorter->pPipe);
+
+  _pSorter->parkingConfig = ParkingPolicy_getParkingConfig(
+      _pSorter->pParkingPolicy, _pSorter->gateConfig);
+  if (!Gate_isConfigurationCommanded(_pSorter->pGates,
+                                     _pSorter->parkingConfig)) {
+    Sorter_printf(_pSorter, "Parking gates for the next item.\n");
+  }
+
+  Sorter_wakeReturning(_pSorter);
+}
+
+static void Sorter_wakeReturning(sSorter *_pSorter)
+{
+  if (!Gate_isConfigurationCommanded(_pSorter->pGates,
+                                     _pSorter->parkingConfig)) {
+    if (!Interlock_canMoveGates(_pSorter->pInterlock)) {
+      Sorter_wakeAfterMs(_pSorter,
+                       Interlock_getMsUntilGatesMayMove(_pSorter->pInterlock));
+      return;
+    }
+
+    Gate_setConfiguration(_pSorter->pGates, _pSorter->parkingConfig);
+  }
+
+  Sorter_transition(_pSorter, SORTER_STATE_DETECTING);
+}
+
+// Helper functions
+// ----------------------------------------------------------------------------
+static eGateConfig
+Sorter_getGateConfigForItemType(eClassifierModule_RefuseItemType _itemType)
+{
+  switch (_itemType) {
+  case CLASSIFIER_MODULE_COMPOST:
+    return GATE_CONFIG_COMPOST;
+  case CLASSIFIER_MODULE_RECYCLING:
+    return GATE_CONFIG_RECYCLING;
+  case CLASSIFIER_MODULE_GARBAGE:
+    return GATE_CONFIG_GARBAGE;
+  default:
+    fprintf(stderr, "Uncaught classifier module type %d. Terminating.\n",
+            _itemType);
+    abort();
+  }
+}
+
+static void Sorter_releaseItem(sSorter *_pSorter)
+{
+  Sorter_printf(_pSorter, "Object has left the pipe.\n");
+  Interlock_recordItemReleased(_pSorter->pInterlock);
+  _pSorter->numItemsSorted++;
+}
+
+// Prints a message of the sorter, prefixed with its name if it has one. Line
+// breaks leading the message stay ahead of the prefix.
+static void Sorter_printf(const sSorter *_pSorter, const char *_pFormat, ...)
+{
+  va_list args;
+  va_start(args, _pFormat);
+  Sorter_vprintf(_pSorter, stdout, _pFormat, args);
+  va_end(args);
+}
+
+static void Sorter_printError(const sSorter *_pSorter, const char *_pFormat,
+                              ...)
+{
+  va_list args;
+  va_start(args, _pFormat);
+  Sorter_vprintf(_pSorter, stderr, _pFormat, args);
+  va_end(args);
+}
+
+// The stream is locked so that the messages of concurrent sorters do not
+// interleave
+static void Sorter_vprintf(const sSorter *_pSorter, FILE *_pStream,
+                           const char *_pFormat, va_list _args)
+{
+  flockfile(_pStream);
+  while (*_pFormat == '\n') {
+    putc_unlocked('\n', _pStream);
+    _pFormat++;
+  }
+  if (_pSorter->name[0] != '\0') {
+    fprintf(_pStream, "[%s] ", _pSorter->name);
+  }
+  vfprintf(_pStream, _pFormat, _args);
+  funlockfile(_pStream);
+}
@@ -0,0 +1,101 @@
+/*
+ * The speculator module keeps the configuration the gates were in before a
+ * speculation, so that a miss can be charged for the gate moves it wasted.
+ */
+
+#include "../include/speculator.h"
+
+#include <stdio.h>
+
+// Initialization/Termination functions
+// ----------------------------------------------------------------------------
+void Speculator_init(sSpeculator *_pSpeculator, sGates *_pGates,
+                     const sInterlock *_pInterlock,
+                     uint32_t _confidenceThresholdPercent)
+{
+  _pSpeculator->pGates = _pGates;
+  _pSpeculator->pInterlock = _pInterlock;
+  _pSpeculator->confidenceThresholdPercent = _confidenceThresholdPercent;
+  _pSpeculator->stats = (sSpeculatorStats){0};
+  _pSpeculator->isSpeculating = false;
+}
+
+void Speculator_cleanup(sSpeculator *_pSpeculator)
+{
+  _pSpeculator->isSpeculating = false;
+}
+
+// Speculation functions
+// ----------------------------------------------------------------------------
+bool Speculator_speculate(sSpeculator *_pSpeculator, eGateConfig _config,
+                          uint32_t _confidencePercent)
+{
+  if (_confidencePercent < _pSpeculator->confidenceThresholdPercent) {
+    _pSpeculator->stats.numSkipped++;
+    return false;
+  }
+
+  // Never waits for the interlock, as speculation runs in the event loop
+  bool mustMove = !Gate_isConfigurationCommanded(_pSpeculator->pGates, _config);
+  if (mustMove && !Interlock_canMoveGates(_pSpeculator->pInterlock)) {
+    return false;
+  }
+
+  _pSpeculator->wasConfigKnown = Gate_getConfiguration(
+      _pSpeculator->pGates, &_pSpeculator->configBeforeSpeculation);
+  if (mustMove) {
+    Gate_setConfiguration(_pSpeculator->pGates, _config);
+  }
+
+  _pSpeculator->isSpeculating = true;
+  _pSpeculator->speculatedConfig = _config;
+  return true;
+}
+
+void Speculator_resolve(sSpeculator *_pSpeculator, eGateConfig _finalConfig)
+{
+  if (!_pSpeculator->isSpeculating) {
+    return;
+  }
+  _pSpeculator->isSpeculating = false;
+
+  sSpeculatorStats *stats = &_pSpeculator->stats;
+  eGateConfig speculatedConfig = _pSpeculator->speculatedConfig;
+  if (_finalConfig == speculatedConfig) {
+    stats->numHits++;
+    return;
+  }
+
+  stats->numMisses++;
+
+  // Moves made to the speculated configuration and back, minus the moves the
+  // final configuration needed anyway. Gates in an unknown configuration would
+  // have had to move regardless. The gates move in parallel, so the time is
+  // counted per transition rather than per gate.
+  int wastedMoves = Gate_getNumGatesToMove(speculatedConfig, _finalConfig);
+  int64_t wastedMs = Gate_getTransitionTimeMs(speculatedConfig, _finalConfig);
+  if (_pSpeculator->wasConfigKnown) {
+    eGateConfig configBefore = _pSpeculator->configBeforeSpeculation;
+    wastedMoves += Gate_getNumGatesToMove(configBefore, speculatedConfig) -
+                   Gate_getNumGatesToMove(configBefore, _finalConfig);
+    wastedMs += Gate_getTransitionTimeMs(configBefore, speculatedConfig) -
+                Gate_getTransitionTimeMs(configBefore, _finalConfig);
+  }
+
+  stats->numRollbackMoves += wastedMoves;
+  stats->rollbackCostMs += wastedMs;
+}
+
+sSpeculatorStats Speculator_getStats(const sSpeculator *_pSpeculator)
+{
+  return _pSpeculator->stats;
+}
+
+void Speculator_printStats(const sSpeculator *_pSpeculator)
+{
+  const sSpeculatorStats *stats = &_pSpeculator->stats;
+  printf("Speculation: %u hits, %u misses, %u skipped, %u rollback gate moves "
+         "(%lld ms).\n",
+         stats->numHits, stats->numMisses, stats->numSkipped,
+         stats->numRollbackMoves, (long long)stats->rollbackCostMs);
+}
@@ -0,0 +1,172 @@
+/*
+ * The station module initializes the modules of a station bottom-up, from the
+ * servo bank to the sorter, and cleans them up in reverse. The station thread
+ * only runs the sorter event loop; the actuator of the station has its own
+ * service thread.
+ */
+
+#include "../include/station.h"
+#include "../include/realtime.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Paths of the single-station recycler, which other stations suffix with
+// their name
+static const char *DEFAULT_DELAY_PROFILE_PATH = "recyclerDelays";
+static const char *DEFAULT_CALIBRATION_PROFILE_PATH = "recyclerCalibration";
+static const char *DEFAULT_PROFILE_EXTENSION = ".txt";
+static const char *DEFAULT_CONTROL_FIFO_PATH = "/tmp/recyclerControl";
+
+static void *Station_threadFunction(void *_args);
+
+// Configuration functions
+// ----------------------------------------------------------------------------
+void Station_initConfig(sStationConfig *_pConfigOut, const char *_pName)
+{
+  memset(_pConfigOut, 0, sizeof(*_pConfigOut));
+  snprintf(_pConfigOut->name, STATION_NAME_LEN, "%s", _pName);
+
+  _pConfigOut->sensorConfig.i2cBusNum = -1;
+  _pConfigOut->sensorConfig.muxAddress = COLOR_SENSOR_NO_MUX;
+  for (int i = 0; i < SERVO_NUM_SERVOS; i++) {
+    snprintf(_pConfigOut->servoPins[i], STATION_PIN_LEN, "%s",
+             SERVO_DEFAULT_PINS[i]);
+  }
+
+  const char *separator = _pName[0] != '\0' ? "." : "";
+  snprintf(_pConfigOut->delayProfilePath, STATION_PATH_LEN, "%s%s%s%s",
+           DEFAULT_DELAY_PROFILE_PATH, separator, _pName,
+           DEFAULT_PROFILE_EXTENSION);
+  snprintf(_pConfigOut->calibrationProfilePath, STATION_PATH_LEN, "%s%s%s%s",
+           DEFAULT_CALIBRATION_PROFILE_PATH, separator, _pName,
+           DEFAULT_PROFILE_EXTENSION);
+  snprintf(_pConfigOut->controlFifoPath, STATION_PATH_LEN, "%s%s%s",
+           DEFAULT_CONTROL_FIFO_PATH, separator, _pName);
+}
+
+// Initialization/Termination functions
+// ----------------------------------------------------------------------------
+void Station_init(sStation *_pStation, const sStationConfig *_pConfig,
+                  int _cpuOffset)
+{
+  memset(_pStation, 0, sizeof(*_pStation));
+  _pStation->config = *_pConfig;
+  _pStation->cpuOffset = _cpuOffset;
+  _pStation->stoppedFd = -1;
+  const sStationConfig *config = &_pStation->config;
+
+  AutoTuner_init(&_pStation->autoTuner, config->delayProfilePath);
+
+  const char *servoPins[SERVO_NUM_SERVOS];
+  for (int i = 0; i < SERVO_NUM_SERVOS; i++) {
+    servoPins[i] = config->servoPins[i];
+  }
+  Servo_init(&_pStation->servoBank, servoPins);
+  Actuator_init(&_pStation->actuator, &_pStation->servoBank, _cpuOffset);
+  Gate_init(&_pStation->gates, &_pStation->actuator);
+  Pipe_init(&_pStation->pipe, &_pStation->actuator);
+  Interlock_init(&_pStation->interlock, &_pStation->gates, &_pStation->pipe);
+  Speculator_init(&_pStation->speculator, &_pStation->gates,
+                  &_pStation->interlock,
+                  config->speculationConfidenceThreshold);
+  ParkingPolicy_init(&_pStation->parkingPolicy);
+  sColorSensorConfig sensorConfig = config->sensorConfig;
+  sensorConfig.pCalibrationProfilePath = config->calibrationProfilePath;
+  ClassifierModule_init(&_pStation->classifier, &sensorConfig);
+
+  const sSorterConfig sorterConfig = {
+      .pName = config->name,
+      .modules =
+          {
+              .pClassifier = &_pStation->classifier,
+              .pActuator = &_pStation->actuator,
+              .pGates = &_pStation->gates,
+              .pPipe = &_pStation->pipe,
+              .pInterlock = &_pStation->interlock,
+              .pSpeculator = &_pStation->speculator,
+              .pParkingPolicy = &_pStation->parkingPolicy,
+              .pAutoTuner = &_pStation->autoTuner,
+          },
+      .pControlFifoPath = config->controlFifoPath,
+      .isSpeculationEnabled = config->isSpeculationEnabled,
+      .hasLights = config->hasLights,
+  };
+  Sorter_init(&_pStation->sorter, &sorterConfig);
+}
+
+void Station_cleanup(sStation *_pStation)
+{
+  if (_pStation->isStarted) {
+    pthread_join(_pStation->thread, NULL);
+    _pStation->isStarted = false;
+  }
+
+  Sorter_cleanup(&_pStation->sorter);
+  ParkingPolicy_cleanup(&_pStation->parkingPolicy);
+  Speculator_cleanup(&_pStation->speculator);
+  Interlock_cleanup(&_pStation->interlock);
+  Gate_cleanup(&_pStation->gates);
+  Pipe_cleanup(&_pStation->pipe);
+  Actuator_cleanup(&_pStation->actuator);
+  Servo_cleanup(&_pStation->servoBank);
+  ClassifierModule_cleanup(&_pStation->classifier);
+  AutoTuner_cleanup(&_pStation->autoTuner);
+}
+
+// Behaviour functions
+// ----------------------------------------------------------------------------
+void Station_start(sStation *_pStation, int _stoppedFd)
+{
+  _pStation->stoppedFd = _stoppedFd;
+  if (pthread_create(&_pStation->thread, NULL, &Station_threadFunction,
+                     _pStation) != 0) {
+    perror("Station: Unable to start station thread");
+    exit(EXIT_FAILURE);
+  }
+  _pStation->isStarted = true;
+  Realtime_configureThreadOnCpu(_pStation->thread, REALTIME_THREAD_SORTER,
+                                _pStation->cpuOffset);
+}
+
+void Station_stop(sStation *_pStation)
+{
+  Sorter_stop(&_pStation->sorter);
+}
+
+const char *Station_getName(const sStation *_pStation)
+{
+  return _pStation->config.name;
+}
+
+void Station_printStats(const sStation *_pStation)
+{
+  if (_pStation->config.name[0] != '\0') {
+    printf("Station %s:\n", _pStation->config.name);
+  }
+
+  if (_pStation->config.isSpeculationEnabled) {
+    Speculator_printStats(&_pStation->speculator);
+  }
+  ParkingPolicy_printStats(&_pStation->parkingPolicy);
+  Sorter_printStats(&_pStation->sorter);
+  ClassifierModule_printStats(&_pStation->classifier);
+  AutoTuner_printStats(&_pStation->autoTuner);
+}
+
+// Thread functions
+// ----------------------------------------------------------------------------
+static void *Station_threadFunction(void *_args)
+{
+  sStation *station = _args;
+  Sorter_run(&station->sorter);
+
+  if (station->stoppedFd >= 0) {
+    uint64_t stopped = 1;
+    write(station->stoppedFd, &stopped, sizeof(stopped));
+  }
+
+  return NULL;
+}
@@ -3,6 +3,7 @@
  */
 
 #include "../include/timing.h"
+#include <errno.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -11,7 +12,9 @@
 
 void Timing_nanoSleep(int64_t _seconds, int64_t _nanoseconds)
 {
-  struct timespec delay = {_seconds, _nanoseconds};
+  // nanosleep rejects nanosecond fields of a second or more
+  struct timespec delay = {_seconds + _nanoseconds / 1000000000,
+                           _nanoseconds % 1000000000};
   nanosleep(&delay, (struct timespec *)NULL);
 }
 
@@ -19,3 +22,26 @@ void Timing_milliSleep(int64_t _seconds, int64_t _milliseconds)
 {
   Timing_nanoSleep(_seconds, _milliseconds * 1000000);
 }
+
+void Timing_sleepUntilNs(int64_t _deadlineNs)
+{
+  struct timespec deadline = {_deadlineNs / 1000000000,
+                              _deadlineNs % 1000000000};
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) ==
+         EINTR) {
+  }
+}
+
+int64_t Timing_getMonotonicTimeMs(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+int64_t Timing_getMonotonicTimeNs(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
@@ -1,9 +1,15 @@
+#include "../include/ambientMonitor.h"
+#include "../include/autoTuner.h"
 #include "../include/classifierModule.h"
 #include "../include/colorSensor.h"
+#include "../include/gpio.h"
 #include "../include/led.h"
 #include "../include/lights.h"
+#include "../include/parkingPolicy.h"
+#include "../include/scheduler.h"
 #include "../include/timing.h"
 #include <assert.h>
+#include <linux/gpio.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -24,15 +30,54 @@ static void Test_testExample(void);
 #define TEST_COLOR_SENSOR "testColorSensor"
 static void Test_testColorSensor(void);
 
+#define TEST_COLOR_FEATURES "testColorFeatures"
+static void Test_testColorFeatures(void);
+
+#define TEST_FRAME_CONVERSION "testFrameConversion"
+static void Test_testFrameConversion(void);
+
+#define TEST_WHITE_BALANCE "testWhiteBalance"
+static void Test_testWhiteBalance(void);
+static void Test_simulateFrame(const int32_t *_pReflectancePercents,
+                               const int32_t *_pIlluminant,
+                               sColorSensorFeatures *_pFeaturesOut);
+
 #define TEST_CLASSIFIER_MODULE "testClassifierModule"
 static void Test_testClassifierModule(void);
 
+#define TEST_ARRIVAL_TRACKER "testArrivalTracker"
+static void Test_testArrivalTracker(void);
+
+#define TEST_AMBIENT_MONITOR "testAmbientMonitor"
+static void Test_testAmbientMonitor(void);
+
 #define TEST_LED "testLed"
 static void Test_testLed(void);
 
 #define TEST_LIGHTS "testLights"
 static void Test_testLights(void);
 
+#define TEST_PARKING_POLICY "testParkingPolicy"
+static void Test_testParkingPolicy(void);
+
+#define TEST_AUTO_TUNER "testAutoTuner"
+static void Test_testAutoTuner(void);
+
+#define TEST_GPIO "testGpio"
+static void Test_testGpio(void);
+
+#define TEST_SCHEDULER "testScheduler"
+static void Test_testScheduler(void);
+static bool Test_loadSchedulerConfig(const char *_pContents,
+                                     sSchedulerConfig *_pConfigOut);
+
+// Object sensing threshold used by tests that initialize the color sensor
+#define TEST_OBJECT_SENSING_THRESHOLD 100
+
+// Frames converted in bulk by the frame conversion test, more than two full
+// vectors of the NEON kernel
+#define NUM_CONVERSION_TEST_FRAMES 19
+
 // Do not modify this one. This will help the program determine that the end
 // of tests has been reached.
 #define END_OF_TESTS_STR "0_END_OF_TESTS"
@@ -58,9 +103,18 @@ int main(int argc, char *argv[])
    */
   test_t tests[] = {{TEST_EXAMPLE, &Test_testExample},
                     {TEST_COLOR_SENSOR, &Test_testColorSensor},
+                    {TEST_COLOR_FEATURES, &Test_testColorFeatures},
+                    {TEST_FRAME_CONVERSION, &Test_testFrameConversion},
+                    {TEST_WHITE_BALANCE, &Test_testWhiteBalance},
                     {TEST_CLASSIFIER_MODULE, &Test_testClassifierModule},
+                    {TEST_ARRIVAL_TRACKER, &Test_testArrivalTracker},
+                    {TEST_AMBIENT_MONITOR, &Test_testAmbientMonitor},
                     {TEST_LED, &Test_testLed},
                     {TEST_LIGHTS, &Test_testLights},
+                    {TEST_PARKING_POLICY, &Test_testParkingPolicy},
+                    {TEST_AUTO_TUNER, &Test_testAutoTuner},
+                    {TEST_GPIO, &Test_testGpio},
+                    {TEST_SCHEDULER, &Test_testScheduler},
                     end_of_tests};
 
   printf("Tests have started\n");
@@ -105,21 +159,32 @@ static void Test_testColorSensor(void)
   static const int64_t COLOR_READ_TIME_INTERVAL_NS = 750000000;
 
   printf("\nInitializing color sensor...\n");
-  ColorSensor_init(2);
+  const sColorSensorConfig config = {
+      .i2cBusNum = 2,
+      .muxAddress = COLOR_SENSOR_NO_MUX,
+      .objectSensingThreshold = TEST_OBJECT_SENSING_THRESHOLD,
+  };
+  sColorSensor sensor;
+  ColorSensor_init(&sensor, &config);
   for (int32_t i = 0; i < NUM_COLOR_SENSOR_TEST_READS; ++i) {
     int luminanceValues[5];
-    ColorSensor_getLuminanceValuesInLux(luminanceValues);
+    ColorSensor_getLuminanceValuesInLux(&sensor, luminanceValues);
     printf("Red luminance: %d lux\n", luminanceValues[0]);
-    printf("Blue luminance: %d lux\n", luminanceValues[1]);
-    printf("Green luminance: %d lux\n", luminanceValues[2]);
-    printf("IR luminance: %d lux\n", luminanceValues[3]);
+    printf("Green luminance: %d lux\n", luminanceValues[1]);
+    printf("Blue luminance: %d lux\n", luminanceValues[2]);
+    printf("Clear luminance: %d lux\n", luminanceValues[3]);
     printf("Ambient light luminance: %d lux\n", luminanceValues[4]);
 
+    sColorSensorFeatures features;
+    ColorSensor_getFeatures(&sensor, &features);
+    printf("Infrared: %d, CCT: %d K, illuminance: %d mlux\n",
+           features.infrared, features.cctKelvin, features.milliLux);
+
     int rgbValues[3];
-    ColorSensor_getRgbValues(rgbValues);
+    ColorSensor_getRgbValues(&sensor, rgbValues);
     printf("RGB: %d, %d, %d\n", rgbValues[0], rgbValues[1], rgbValues[2]);
 
-    eColorSensorColor detectedColor = ColorSensor_getColor();
+    eColorSensorColor detectedColor = ColorSensor_getColor(&sensor);
     if (detectedColor == COLOR_SENSOR_RED) {
       printf("Color: Red\n");
     }
@@ -130,7 +195,8 @@ static void Test_testColorSensor(void)
       printf("Color: Blue\n");
     }
 
-    bool isObjectInFrontOfColorSensor = ColorSensor_isObjectInFrontOfSensor();
+    bool isObjectInFrontOfColorSensor =
+        ColorSensor_isObjectInFrontOfSensor(&sensor);
     printf("Is an object in front of the color sensor: %s\n",
            isObjectInFrontOfColorSensor ? "True" : "False");
 
@@ -138,19 +204,238 @@ static void Test_testColorSensor(void)
     Timing_nanoSleep(0, COLOR_READ_TIME_INTERVAL_NS);
   }
 
-  ColorSensor_cleanup();
+  ColorSensor_cleanup(&sensor);
+}
+
+static void Test_testColorFeatures(void)
+{
+  printf("\nTesting color features...\n");
+  sColorSensorFeatures features;
+
+  // R + G + B exceeds C by twice the infrared the color channels share
+  ColorSensor_computeFeatures(3000, 2000, 1000, 5000, &features);
+  assert(features.infrared == 500);
+  assert(features.irFreeRed == 2500 && features.irFreeGreen == 1500 &&
+         features.irFreeBlue == 500);
+  assert(features.redChromaticity == 3000 * COLOR_SENSOR_Q16_ONE / 5000);
+  assert(features.blueChromaticity == 1000 * COLOR_SENSOR_Q16_ONE / 5000);
+
+  // CCT = 3810 * B' / R' + 1391
+  assert(features.cctKelvin == 3810 * 500 / 2500 + 1391);
+
+  // lux = (0.136 R' + G' - 0.444 B') * 310 / 614.4 ms, within the rounding
+  // of the Q12 coefficients
+  double lux = (0.136 * 2500 + 1500 - 0.444 * 500) * 310 / 614.4;
+  printf("Illuminance: %d mlux, expected %.0f mlux\n", features.milliLux,
+         lux * 1000);
+  assert(features.milliLux > (int32_t)(lux * 1000) - 100 &&
+         features.milliLux < (int32_t)(lux * 1000) + 100);
+
+  // Similar hues: the infrared every channel sees hides how far apart they
+  // are, which its removal restores
+  uint32_t confidencePercent;
+  ColorSensor_computeFeatures(2400, 2200, 2000, 4600, &features);
+  assert(ColorSensor_getFeaturesColor(&features, &confidencePercent) ==
+         COLOR_SENSOR_RED);
+  printf("Confidence of similar hues: %u%%\n", confidencePercent);
+  assert(confidencePercent > (2400 - 2200) * 100 / 2400);
+
+  // No light at all
+  ColorSensor_computeFeatures(0, 0, 0, 0, &features);
+  assert(features.cctKelvin == 0 && features.milliLux == 0);
+  assert(features.redChromaticity == 0);
+
+  printf("Color features test passed.\n");
+}
+
+// Bulk-converted frames must agree with the scalar reference, and with the
+// features of the same counts, including past the last full vector of frames
+static void Test_testFrameConversion(void)
+{
+  printf("\nTesting bulk frame conversion...\n");
+
+  // Clear, red, green and blue counts
+  uint16_t counts[NUM_CONVERSION_TEST_FRAMES][4];
+  for (int i = 0; i < NUM_CONVERSION_TEST_FRAMES; i++) {
+    counts[i][0] = 5000 + i * 3001;
+    counts[i][1] = 3000 + i * 1709;
+    counts[i][2] = 2000 + i * 997;
+    counts[i][3] = 1000 + i * 2503;
+  }
+  // No light, a saturated frame, and a channel above the clear channel
+  memset(counts[0], 0, sizeof(counts[0]));
+  for (int j = 0; j < 4; j++) {
+    counts[1][j] = UINT16_MAX;
+  }
+  counts[2][0] = 100;
+  counts[2][1] = 4000;
+  // The frame of the color features test
+  counts[3][0] = 5000;
+  counts[3][1] = 3000;
+  counts[3][2] = 2000;
+  counts[3][3] = 1000;
+
+  uint8_t frames[NUM_CONVERSION_TEST_FRAMES * COLOR_SENSOR_FRAME_NUM_BYTES];
+  for (int i = 0; i < NUM_CONVERSION_TEST_FRAMES; i++) {
+    for (int j = 0; j < 4; j++) {
+      frames[i * COLOR_SENSOR_FRAME_NUM_BYTES + j * 2] = counts[i][j] & 0xFF;
+      frames[i * COLOR_SENSOR_FRAME_NUM_BYTES + j * 2 + 1] = counts[i][j] >> 8;
+    }
+  }
+
+  uint16_t channels[2][4][NUM_CONVERSION_TEST_FRAMES];
+  int32_t milliLux[2][NUM_CONVERSION_TEST_FRAMES];
+  uint32_t chromaticities[2][3][NUM_CONVERSION_TEST_FRAMES];
+  sColorSensorFrameArrays arrays[2];
+  for (int k = 0; k < 2; k++) {
+    arrays[k] = (sColorSensorFrameArrays){
+        channels[k][1],       channels[k][2],       channels[k][3],
+        channels[k][0],       milliLux[k],          chromaticities[k][0],
+        chromaticities[k][1], chromaticities[k][2],
+    };
+  }
+  ColorSensor_convertFrames(frames, NUM_CONVERSION_TEST_FRAMES,
+                            COLOR_SENSOR_INTEGRATION_FULL, &arrays[0]);
+  ColorSensor_convertFramesScalar(frames, NUM_CONVERSION_TEST_FRAMES,
+                                  COLOR_SENSOR_INTEGRATION_FULL, &arrays[1]);
+  assert(memcmp(channels[0], channels[1], sizeof(channels[0])) == 0);
+  assert(memcmp(milliLux[0], milliLux[1], sizeof(milliLux[0])) == 0);
+  assert(memcmp(chromaticities[0], chromaticities[1],
+                sizeof(chromaticities[0])) == 0);
+
+  for (int i = 0; i < NUM_CONVERSION_TEST_FRAMES; i++) {
+    sColorSensorFeatures features;
+    ColorSensor_computeFeatures(counts[i][1], counts[i][2], counts[i][3],
+                                counts[i][0], &features);
+    assert(channels[0][0][i] == counts[i][0]);
+    assert(channels[0][1][i] == counts[i][1]);
+    assert(milliLux[0][i] == features.milliLux);
+    assert(chromaticities[0][0][i] == features.redChromaticity);
+    assert(chromaticities[0][1][i] == features.greenChromaticity);
+    assert(chromaticities[0][2][i] == features.blueChromaticity);
+  }
+  assert(chromaticities[0][0][2] == COLOR_SENSOR_Q16_ONE);
+  assert(milliLux[0][0] == 0 && chromaticities[0][0][0] == 0);
+
+  // Short frames read the same light with fewer counts
+  ColorSensor_convertFrames(frames, NUM_CONVERSION_TEST_FRAMES,
+                            COLOR_SENSOR_INTEGRATION_SHORT, &arrays[1]);
+  printf("Illuminance of frame 3: %d mlux full, %d mlux short\n",
+         milliLux[0][3], milliLux[1][3]);
+  assert(milliLux[0][3] > 0 && milliLux[1][3] > milliLux[0][3] * 5);
+
+  printf("Frame conversion test passed.\n");
+}
+
+// Every item is classified under daylight, tungsten and cool LED lighting,
+// after a white balance calibration against a white reference under the same
+// lighting, and must classify the same under all of them.
+static void Test_testWhiteBalance(void)
+{
+  printf("\nTesting white balance across illuminants...\n");
+
+  // Red, green and blue counts a perfect white reflector reads, then infrared
+  static const int32_t ILLUMINANTS[][4] = {
+      {4000, 4000, 4000, 300},  // Daylight
+      {6000, 4000, 2000, 1500}, // Tungsten
+      {3000, 4000, 5500, 200},  // Cool LED
+  };
+  static const char *ILLUMINANT_NAMES[] = {"daylight", "tungsten",
+                                           "cool LED"};
+  static const int32_t WHITE[] = {90, 90, 90};
+
+  // Red, green and blue reflectance percentages of similar-hue items
+  static const struct {
+    int32_t reflectancePercents[3];
+    eColorSensorColor color;
+  } ITEMS[] = {
+      {{60, 35, 30}, COLOR_SENSOR_RED},
+      {{35, 45, 30}, COLOR_SENSOR_GREEN},
+      {{30, 35, 50}, COLOR_SENSOR_BLUE},
+      {{40, 47, 38}, COLOR_SENSOR_GREEN},
+  };
+  const int NUM_ILLUMINANTS = sizeof(ILLUMINANTS) / sizeof(ILLUMINANTS[0]);
+  const int NUM_ITEMS = sizeof(ITEMS) / sizeof(ITEMS[0]);
+
+  int numUncorrectedErrors = 0;
+  for (int i = 0; i < NUM_ILLUMINANTS; i++) {
+    sColorSensorFeatures white;
+    Test_simulateFrame(WHITE, ILLUMINANTS[i], &white);
+    uint32_t gains[COLOR_SENSOR_NUM_COLORS];
+    assert(ColorSensor_computeWhiteBalanceGains(&white, gains));
+
+    // The reference itself comes out white
+    ColorSensor_applyWhiteBalance(gains, &white);
+    assert(abs(white.balancedRed - white.balancedGreen) <= 1);
+    assert(abs(white.balancedBlue - white.balancedGreen) <= 1);
+
+    for (int j = 0; j < NUM_ITEMS; j++) {
+      sColorSensorFeatures features;
+      uint32_t confidencePercent;
+      Test_simulateFrame(ITEMS[j].reflectancePercents, ILLUMINANTS[i],
+                         &features);
+      if (ColorSensor_getFeaturesColor(&features, &confidencePercent) !=
+          ITEMS[j].color) {
+        numUncorrectedErrors++;
+      }
+
+      ColorSensor_applyWhiteBalance(gains, &features);
+      eColorSensorColor color =
+          ColorSensor_getFeaturesColor(&features, &confidencePercent);
+      printf("Item %d under %s: color %d, %u%% confident\n", j,
+             ILLUMINANT_NAMES[i], color, confidencePercent);
+      assert(color == ITEMS[j].color);
+    }
+  }
+
+  // Without the correction, the tinted illuminants pull items off their hue
+  printf("Misclassified without white balance: %d\n", numUncorrectedErrors);
+  assert(numUncorrectedErrors > 0);
+
+  // A reference too dark to tell the channels apart is refused
+  static const int32_t DARK_ILLUMINANT[] = {50, 50, 50, 0};
+  sColorSensorFeatures dark;
+  uint32_t gains[COLOR_SENSOR_NUM_COLORS];
+  Test_simulateFrame(WHITE, DARK_ILLUMINANT, &dark);
+  assert(!ColorSensor_computeWhiteBalanceGains(&dark, gains));
+
+  printf("White balance test passed.\n");
+}
+
+// The color channels read the reflected light plus the infrared of the
+// illuminant, and the clear channel reads the reflected light alone.
+static void Test_simulateFrame(const int32_t *_pReflectancePercents,
+                               const int32_t *_pIlluminant,
+                               sColorSensorFeatures *_pFeaturesOut)
+{
+  int32_t reflected[3];
+  for (int i = 0; i < 3; i++) {
+    reflected[i] = _pIlluminant[i] * _pReflectancePercents[i] / 100;
+  }
+  int32_t infrared = _pIlluminant[3];
+
+  ColorSensor_computeFeatures(
+      reflected[0] + infrared, reflected[1] + infrared,
+      reflected[2] + infrared,
+      reflected[0] + reflected[1] + reflected[2] + infrared, _pFeaturesOut);
 }
 
 static void Test_testClassifierModule(void)
 {
   printf("\nInitializing classifier module...\n");
-  ClassifierModule_init(2);
+  const sColorSensorConfig config = {
+      .i2cBusNum = 2,
+      .muxAddress = COLOR_SENSOR_NO_MUX,
+      .objectSensingThreshold = TEST_OBJECT_SENSING_THRESHOLD,
+  };
+  sClassifierModule classifier;
+  ClassifierModule_init(&classifier, &config);
 
   printf("\nWaiting for refuse item to appear...\n");
-  ClassifierModule_waitUntilRefuseItemAppears();
+  ClassifierModule_waitUntilRefuseItemAppears(&classifier);
 
   eClassifierModule_RefuseItemType refuseType =
-      ClassifierModule_getRefuseItemType();
+      ClassifierModule_getRefuseItemType(&classifier);
   printf("A refuse item has appeared! it is: ");
   if (refuseType == CLASSIFIER_MODULE_GARBAGE) {
     printf("Garbage :(\n");
@@ -162,7 +447,111 @@ static void Test_testClassifierModule(void)
     printf("Recycling :)\n");
   }
 
-  ClassifierModule_cleanup();
+  ClassifierModule_cleanup(&classifier);
+}
+
+static void Test_testArrivalTracker(void)
+{
+  printf("\nTesting arrival tracker...\n");
+  sClassifierModule_ArrivalTracker tracker = {0};
+
+  // Noise around the baseline keeps the ramp quiet
+  assert(ClassifierModule_recordArrivalLevel(&tracker, 0) ==
+         CLASSIFIER_MODULE_RAMP_QUIET);
+  assert(ClassifierModule_recordArrivalLevel(&tracker, 10) ==
+         CLASSIFIER_MODULE_RAMP_QUIET);
+
+  // An item rolling in moves the luminance toward the threshold, then has to
+  // stay past it for a second frame
+  assert(ClassifierModule_recordArrivalLevel(&tracker, 40) ==
+         CLASSIFIER_MODULE_RAMP_ACTIVE);
+  assert(ClassifierModule_recordArrivalLevel(&tracker, 120) ==
+         CLASSIFIER_MODULE_RAMP_ACTIVE);
+  assert(ClassifierModule_recordArrivalLevel(&tracker, 150) ==
+         CLASSIFIER_MODULE_RAMP_ARRIVED);
+
+  // A single frame past the threshold is not an arrival, and the ramp is
+  // quiet again after a few frames back at the baseline
+  tracker = (sClassifierModule_ArrivalTracker){0};
+  assert(ClassifierModule_recordArrivalLevel(&tracker, 200) ==
+         CLASSIFIER_MODULE_RAMP_ACTIVE);
+  assert(ClassifierModule_recordArrivalLevel(&tracker, 5) ==
+         CLASSIFIER_MODULE_RAMP_ACTIVE);
+  assert(ClassifierModule_recordArrivalLevel(&tracker, 150) ==
+         CLASSIFIER_MODULE_RAMP_ACTIVE);
+  assert(ClassifierModule_recordArrivalLevel(&tracker, 5) ==
+         CLASSIFIER_MODULE_RAMP_ACTIVE);
+  assert(ClassifierModule_recordArrivalLevel(&tracker, 5) ==
+         CLASSIFIER_MODULE_RAMP_ACTIVE);
+  assert(ClassifierModule_recordArrivalLevel(&tracker, 5) ==
+         CLASSIFIER_MODULE_RAMP_QUIET);
+  assert(tracker.numFalseTriggers == 1);
+
+  // Activity that never crosses the threshold is not a false trigger
+  assert(ClassifierModule_recordArrivalLevel(&tracker, 60) ==
+         CLASSIFIER_MODULE_RAMP_ACTIVE);
+  for (int i = 0; i < 3; i++) {
+    ClassifierModule_recordArrivalLevel(&tracker, 5);
+  }
+  assert(!tracker.isActive);
+  assert(tracker.numFalseTriggers == 1);
+
+  printf("Arrival tracker test passed.\n");
+}
+
+static void Test_testAmbientMonitor(void)
+{
+  printf("\nTesting ambient monitor...\n");
+  sAmbientMonitor monitor;
+  AmbientMonitor_init(&monitor, 1000, 25);
+
+  // Noise and an item rolling past do not shift the ambient light
+  int64_t timeMs = 0;
+  for (int i = 0; i < 100; i++, timeMs += 700) {
+    assert(!AmbientMonitor_recordEmptyFrame(&monitor, 1000 + i % 20 - 10,
+                                            timeMs));
+  }
+  for (int i = 0; i < 4; i++, timeMs += 700) {
+    assert(!AmbientMonitor_recordEmptyFrame(&monitor, 1060, timeMs));
+  }
+  AmbientMonitor_recordItem(&monitor);
+  assert(AmbientMonitor_getAmbientLuminance(&monitor) == 1000);
+
+  // Neither do short frames of an item approaching, read more often
+  for (int i = 0; i < 40; i++, timeMs += 24) {
+    assert(!AmbientMonitor_recordEmptyFrame(&monitor, 1080, timeMs));
+  }
+  AmbientMonitor_recordItem(&monitor);
+
+  // The lights dimming are a shift once it has lasted a few seconds
+  bool hasShifted = false;
+  int64_t shiftTimeMs = timeMs;
+  while (!hasShifted) {
+    assert(timeMs - shiftTimeMs < 10000);
+    hasShifted = AmbientMonitor_recordEmptyFrame(&monitor, 900, timeMs);
+    timeMs += 700;
+  }
+  assert(timeMs - shiftTimeMs >= 5000);
+  int32_t ambientLuminance = AmbientMonitor_getAmbientLuminance(&monitor);
+  assert(ambientLuminance <= 975 && ambientLuminance > 900);
+
+  AmbientMonitor_setBaseline(&monitor, 900);
+  assert(!AmbientMonitor_recordEmptyFrame(&monitor, 900, timeMs));
+
+  // False triggers that are far apart are not a burst
+  assert(!AmbientMonitor_recordFalseTrigger(&monitor, 0));
+  assert(!AmbientMonitor_recordFalseTrigger(&monitor, 50000));
+  assert(!AmbientMonitor_recordFalseTrigger(&monitor, 100000));
+  assert(AmbientMonitor_recordFalseTrigger(&monitor, 110000));
+
+  sAmbientMonitorStats stats = AmbientMonitor_getStats(&monitor);
+  assert(stats.numFalseTriggers == 4);
+  assert(stats.numShiftRecalibrations == 1);
+  assert(stats.numBurstRecalibrations == 1);
+  AmbientMonitor_printStats(&monitor);
+
+  AmbientMonitor_cleanup(&monitor);
+  printf("Ambient monitor test passed.\n");
 }
 
 void Test_handleInterruptTestLed(int _signal)
@@ -260,3 +649,242 @@ static void Test_testLights(void)
   printf("Finishing lights testing.\n");
   Lights_cleanup();
 }
+
+static void Test_testParkingPolicy(void)
+{
+  printf("\nTesting parking policy...\n");
+  sParkingPolicy policy;
+  ParkingPolicy_init(&policy);
+
+  // No history: gates park raised, as they always used to
+  assert(ParkingPolicy_getParkingConfig(&policy, GATE_CONFIG_RECYCLING) ==
+         GATE_CONFIG_GARBAGE);
+
+  // A stream skewed towards recycling parks the gates lowered
+  for (int i = 0; i < 8; i++) {
+    ParkingPolicy_recordItem(&policy, GATE_CONFIG_RECYCLING);
+    ParkingPolicy_getParkingConfig(&policy, GATE_CONFIG_RECYCLING);
+  }
+  ParkingPolicy_recordItem(&policy, GATE_CONFIG_GARBAGE);
+  assert(ParkingPolicy_getParkingConfig(&policy, GATE_CONFIG_GARBAGE) ==
+         GATE_CONFIG_RECYCLING);
+
+  // Each recycling item after the first saved a round trip of the gates, which
+  // move together
+  printf("Saved actuation: %lld ms\n",
+         (long long)ParkingPolicy_getSavedActuationMs(&policy));
+  assert(ParkingPolicy_getSavedActuationMs(&policy) ==
+         7 * 2 * Gate_getTravelTimeMs());
+
+  // Ties keep the gates where they are
+  ParkingPolicy_init(&policy);
+  ParkingPolicy_recordItem(&policy, GATE_CONFIG_GARBAGE);
+  ParkingPolicy_recordItem(&policy, GATE_CONFIG_RECYCLING);
+  assert(ParkingPolicy_getParkingConfig(&policy, GATE_CONFIG_RECYCLING) ==
+         GATE_CONFIG_RECYCLING);
+
+  // A mixed stream (13 garbage, 8 compost, 11 recycling out of 32) needs the
+  // fewest transitions parked raised, although compost needs the fewest
+  // individual gate moves. Parking never costs more than the default.
+  const eGateConfig mixedStream[] = {
+      GATE_CONFIG_GARBAGE,   GATE_CONFIG_RECYCLING, GATE_CONFIG_COMPOST,
+      GATE_CONFIG_GARBAGE,   GATE_CONFIG_RECYCLING, GATE_CONFIG_GARBAGE,
+      GATE_CONFIG_COMPOST,   GATE_CONFIG_RECYCLING, GATE_CONFIG_GARBAGE,
+      GATE_CONFIG_RECYCLING, GATE_CONFIG_GARBAGE,   GATE_CONFIG_COMPOST,
+      GATE_CONFIG_GARBAGE,   GATE_CONFIG_RECYCLING, GATE_CONFIG_COMPOST,
+      GATE_CONFIG_GARBAGE,   GATE_CONFIG_RECYCLING, GATE_CONFIG_GARBAGE,
+      GATE_CONFIG_COMPOST,   GATE_CONFIG_RECYCLING, GATE_CONFIG_GARBAGE,
+      GATE_CONFIG_RECYCLING, GATE_CONFIG_GARBAGE,   GATE_CONFIG_COMPOST,
+      GATE_CONFIG_GARBAGE,   GATE_CONFIG_RECYCLING, GATE_CONFIG_COMPOST,
+      GATE_CONFIG_GARBAGE,   GATE_CONFIG_RECYCLING, GATE_CONFIG_GARBAGE,
+      GATE_CONFIG_RECYCLING, GATE_CONFIG_COMPOST};
+  const int numMixedItems = sizeof(mixedStream) / sizeof(mixedStream[0]);
+  assert(numMixedItems == PARKING_POLICY_HISTORY_SIZE);
+  ParkingPolicy_init(&policy);
+  eGateConfig parkingConfig = GATE_CONFIG_GARBAGE;
+  for (int i = 0; i < 3 * numMixedItems; i++) {
+    ParkingPolicy_recordItem(&policy, mixedStream[i % numMixedItems]);
+    parkingConfig = ParkingPolicy_getParkingConfig(
+        &policy, mixedStream[i % numMixedItems]);
+    assert(ParkingPolicy_getSavedActuationMs(&policy) >= 0);
+  }
+  assert(parkingConfig == GATE_CONFIG_GARBAGE);
+
+  ParkingPolicy_cleanup(&policy);
+  printf("Parking policy test passed.\n");
+}
+
+static void Test_testAutoTuner(void)
+{
+  printf("\nTesting auto tuner...\n");
+  const char *profilePath = "/tmp/testAutoTunerDelays.txt";
+  remove(profilePath);
+  sAutoTuner tuner;
+  AutoTuner_init(&tuner, profilePath);
+
+  // Too few observations leave the default alone
+  int64_t defaultMs = AutoTuner_getDelayMs(&tuner, AUTO_TUNER_ARRIVAL_SETTLE);
+  AutoTuner_recordObservation(&tuner, AUTO_TUNER_ARRIVAL_SETTLE, 300);
+  assert(AutoTuner_getDelayMs(&tuner, AUTO_TUNER_ARRIVAL_SETTLE) == defaultMs);
+
+  // Consistently fast arrivals shrink the delay, but not below p95 + margin
+  for (int i = 0; i < 64; i++) {
+    AutoTuner_recordObservation(&tuner, AUTO_TUNER_ARRIVAL_SETTLE, 300);
+  }
+  int64_t tunedMs = AutoTuner_getDelayMs(&tuner, AUTO_TUNER_ARRIVAL_SETTLE);
+  printf("Tuned arrival settle: %lld ms\n", (long long)tunedMs);
+  assert(tunedMs < defaultMs && tunedMs >= 300 + 50);
+
+  // A slow outlier grows the delay straight away
+  for (int i = 0; i < 4; i++) {
+    AutoTuner_recordObservation(&tuner, AUTO_TUNER_ARRIVAL_SETTLE, 600);
+  }
+  assert(AutoTuner_getDelayMs(&tuner, AUTO_TUNER_ARRIVAL_SETTLE) > tunedMs);
+
+  // The delay never shrinks below its floor
+  for (int i = 0; i < 256; i++) {
+    AutoTuner_recordObservation(&tuner, AUTO_TUNER_DEPARTURE_TIMEOUT, 10);
+  }
+  int64_t floorMs =
+      AutoTuner_getDelayMs(&tuner, AUTO_TUNER_DEPARTURE_TIMEOUT);
+  assert(floorMs > 10 + 50);
+
+  // A failure backs the delay off, up to its default
+  AutoTuner_recordFailure(&tuner, AUTO_TUNER_DEPARTURE_TIMEOUT);
+  int64_t backedOffMs =
+      AutoTuner_getDelayMs(&tuner, AUTO_TUNER_DEPARTURE_TIMEOUT);
+  assert(backedOffMs > floorMs);
+
+  // Learned delays survive a restart
+  int64_t settleMs = AutoTuner_getDelayMs(&tuner, AUTO_TUNER_ARRIVAL_SETTLE);
+  AutoTuner_cleanup(&tuner);
+  AutoTuner_init(&tuner, profilePath);
+  assert(AutoTuner_getDelayMs(&tuner, AUTO_TUNER_ARRIVAL_SETTLE) == settleMs);
+  assert(AutoTuner_getDelayMs(&tuner, AUTO_TUNER_DEPARTURE_TIMEOUT) ==
+         backedOffMs);
+
+  AutoTuner_cleanup(&tuner);
+  remove(profilePath);
+  printf("Auto tuner test passed.\n");
+}
+
+// Feeds edge events through a pipe in place of a line request descriptor, as
+// the kernel would report them.
+static void Test_testGpio(void)
+{
+  printf("\nTesting gpio events...\n");
+  int pipeFds[2];
+  assert(pipe(pipeFds) == 0);
+
+  sGpioLines lines;
+  lines.fd = pipeFds[0];
+  lines.numLines = 1;
+  lines.offsets[0] = 17;
+
+  sGpioEvent events[4];
+  assert(Gpio_readEvents(&lines, 0, events, 4) == 0);
+
+  struct gpio_v2_line_event kernelEvents[3];
+  memset(kernelEvents, 0, sizeof(kernelEvents));
+  for (int i = 0; i < 3; i++) {
+    kernelEvents[i].timestamp_ns = 1000000 * (i + 1);
+    kernelEvents[i].id = i % 2 == 0 ? GPIO_V2_LINE_EVENT_RISING_EDGE
+                                    : GPIO_V2_LINE_EVENT_FALLING_EDGE;
+    kernelEvents[i].offset = 17;
+    kernelEvents[i].seqno = i + 1;
+  }
+  assert(write(pipeFds[1], kernelEvents, sizeof(kernelEvents)) ==
+         sizeof(kernelEvents));
+
+  // Only as many events as asked for are read; the rest stay pending
+  assert(Gpio_readEvents(&lines, 100, events, 2) == 2);
+  assert(events[0].offset == 17 && events[0].isRising);
+  assert(!events[1].isRising && events[1].timestampNs == 2000000);
+  assert(Gpio_readEvents(&lines, 100, events, 4) == 1);
+  assert(events[0].isRising && events[0].sequence == 3);
+
+  close(pipeFds[1]);
+  Gpio_releaseLines(&lines);
+  assert(lines.fd == -1);
+  printf("Gpio test passed.\n");
+}
+
+static void Test_testScheduler(void)
+{
+  printf("\nTesting scheduler configuration...\n");
+  sSchedulerConfig config;
+
+  // Two stations behind one multiplexer, with lights on the first
+  assert(Test_loadSchedulerConfig("# Two stations\n"
+                                  "station left\n"
+                                  "sensorBus 2\n"
+                                  "muxAddress 0x70\n"
+                                  "muxChannel 0\n"
+                                  "lights on\n"
+                                  "\n"
+                                  "station right\n"
+                                  "sensorBus 2 # same bus\n"
+                                  "muxAddress 0x70\n"
+                                  "muxChannel 1\n"
+                                  "threshold 80\n"
+                                  "pipeServo P9_22\n"
+                                  "gate1Servo P9_16\n"
+                                  "gate2Servo P8_19\n"
+                                  "speculation 70\n",
+                                  &config));
+  assert(config.numStations == 2);
+  assert(Scheduler_validateConfig(&config));
+  const sStationConfig *right = &config.stations[1];
+  assert(strcmp(right->name, "right") == 0);
+  assert(right->sensorConfig.muxAddress == 0x70);
+  assert(right->sensorConfig.muxChannel == 1);
+  assert(right->sensorConfig.objectSensingThreshold == 80);
+  assert(strcmp(right->servoPins[2], "P8_19") == 0);
+  assert(right->isSpeculationEnabled && !right->hasLights);
+  assert(right->speculationConfidenceThreshold == 70);
+  assert(strcmp(right->controlFifoPath, "/tmp/recyclerControl.right") == 0);
+  assert(strcmp(right->delayProfilePath, "recyclerDelays.right.txt") == 0);
+
+  // Unknown keys and keys before any station are rejected
+  assert(!Test_loadSchedulerConfig("station a\ncolor red\n", &config));
+  assert(!Test_loadSchedulerConfig("sensorBus 2\n", &config));
+
+  // Sensors sharing a bus without a multiplexer cannot be told apart
+  assert(Test_loadSchedulerConfig("station a\nsensorBus 2\n"
+                                  "station b\nsensorBus 2\n"
+                                  "pipeServo P9_22\ngate1Servo P9_16\n"
+                                  "gate2Servo P8_19\n",
+                                  &config));
+  assert(!Scheduler_validateConfig(&config));
+
+  // Stations on separate buses must still not share a servo
+  assert(Test_loadSchedulerConfig("station a\nsensorBus 1\n"
+                                  "station b\nsensorBus 2\n",
+                                  &config));
+  assert(!Scheduler_validateConfig(&config));
+
+  // A station needs a sensor bus, and a pin that can drive a servo
+  assert(Test_loadSchedulerConfig("station a\n", &config));
+  assert(!Scheduler_validateConfig(&config));
+  assert(Test_loadSchedulerConfig("station a\nsensorBus 1\n"
+                                  "pipeServo P9_12\n",
+                                  &config));
+  assert(!Scheduler_validateConfig(&config));
+
+  printf("Scheduler test passed.\n");
+}
+
+// Writes _pContents to a temporary configuration file and loads it
+static bool Test_loadSchedulerConfig(const char *_pContents,
+                                     sSchedulerConfig *_pConfigOut)
+{
+  const char *path = "/tmp/testSchedulerStations.conf";
+  FILE *pFile = fopen(path, "w");
+  assert(pFile != NULL);
+  fputs(_pContents, pFile);
+  fclose(pFile);
+
+  bool isLoaded = Scheduler_loadConfig(path, _pConfigOut);
+  remove(path);
+  return isLoaded;
+}